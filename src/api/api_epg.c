@@ -419,6 +419,8 @@ api_epg_grid
   /* Pagination settings */
   start = htsmsg_get_u32_or_default(args, "start", 0);
   limit = htsmsg_get_u32_or_default(args, "limit", 50);
+  if (start + limit >= start)
+    eq.limit = start + limit;
 
   /* Query the EPG */
   pthread_mutex_lock(&global_lock); 
@@ -26,6 +26,7 @@
 #include "api.h"
 #include "tcp.h"
 #include "input.h"
+#include "mempool.h"
 
 static int
 api_status_inputs
@@ -90,6 +91,23 @@ api_status_connections
   return 0;
 }
 
+static int
+api_status_mempool
+  ( access_t *perm, void *opaque, const char *op, htsmsg_t *args, htsmsg_t **resp )
+{
+  int c = 0;
+  htsmsg_t *l = mempool_stats();
+  htsmsg_field_t *f;
+
+  HTSMSG_FOREACH(f, l)
+    c++;
+
+  *resp = htsmsg_create_map();
+  htsmsg_add_msg(*resp, "entries", l);
+  htsmsg_add_u32(*resp, "totalCount", c);
+  return 0;
+}
+
 static int
 api_connections_cancel
   ( access_t *perm, void *opaque, const char *op, htsmsg_t *args, htsmsg_t **resp )
@@ -126,6 +144,7 @@ void api_status_init ( void )
     { "status/connections",   ACCESS_ADMIN, api_status_connections, NULL },
     { "status/subscriptions", ACCESS_ADMIN, api_status_subscriptions, NULL },
     { "status/inputs",        ACCESS_ADMIN, api_status_inputs, NULL },
+    { "status/mempool",       ACCESS_ADMIN, api_status_mempool, NULL },
     { "connections/cancel",   ACCESS_ADMIN, api_connections_cancel, NULL },
     { NULL },
   };
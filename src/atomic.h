@@ -65,3 +65,19 @@ atomic_pre_add_u64(volatile uint64_t *ptr, uint64_t incr)
   return ret;
 #endif
 }
+
+static inline int
+atomic_cas_u64(volatile uint64_t *ptr, uint64_t old, uint64_t new)
+{
+#if ENABLE_ATOMIC64
+  return __sync_bool_compare_and_swap(ptr, old, new);
+#else
+  int ret;
+  pthread_mutex_lock(&atomic_lock);
+  ret = *ptr == old;
+  if (ret)
+    *ptr = new;
+  pthread_mutex_unlock(&atomic_lock);
+  return ret;
+#endif
+}
@@ -16,97 +16,124 @@
  *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include "avg.h"
 #include <stdlib.h>
+#include <string.h>
+
+#include "tvheadend.h"
+#include "atomic.h"
+#include "avg.h"
+
+#define AVGSTAT_CLOCK(v) ((uint32_t)((v) >> 32))
+#define AVGSTAT_COUNT(v) ((uint32_t)(v))
+
+static inline uint64_t
+avgstat_slot_get(avgstat_t *as, uint32_t clk)
+{
+  return as->as_slot[clk & (AVGSTAT_SLOTS - 1)];
+}
 
 void
 avgstat_init(avgstat_t *as, int depth)
 {
-  TAILQ_INIT(&as->as_queue);
-  pthread_mutex_init(&as->as_mutex, NULL);
-  as->as_depth = depth;
+  memset((void *)as->as_slot, 0, sizeof(as->as_slot));
+  if (depth < 1)
+    depth = 1;
+  as->as_depth = depth < AVGSTAT_SLOTS ? depth : AVGSTAT_SLOTS - 1;
 }
 
 
 void
 avgstat_flush(avgstat_t *as)
 {
-  avgstat_entry_t *ase;
-
-  while((ase = TAILQ_FIRST(&as->as_queue)) != NULL) {
-    TAILQ_REMOVE(&as->as_queue, ase, ase_link);
-    free(ase);
-  }
+  memset((void *)as->as_slot, 0, sizeof(as->as_slot));
 }
 
 
-static void
-avgstat_expire(avgstat_t *as, int now)
+void
+avgstat_add(avgstat_t *as, int count, time_t now)
 {
-  avgstat_entry_t *ase;
-
-  while(1) {
-    ase = TAILQ_LAST(&as->as_queue, avgstat_entry_queue);
-    if(ase == NULL || ase->ase_clock > now - as->as_depth) 
-      break;
-    TAILQ_REMOVE(&as->as_queue, ase, ase_link);
-    free(ase);
-  }
+  volatile uint64_t *slot = &as->as_slot[now & (AVGSTAT_SLOTS - 1)];
+  uint64_t o, n;
+
+  /* A slot still holding an older second is restarted */
+  do {
+    o = *slot;
+    if (AVGSTAT_CLOCK(o) == (uint32_t)now)
+      n = o + (uint32_t)count;
+    else
+      n = ((uint64_t)(uint32_t)now << 32) | (uint32_t)count;
+  } while (!atomic_cas_u64(slot, o, n));
 }
 
 
-void
-avgstat_add(avgstat_t *as, int count, time_t now)
+/*
+ * Sum of the seconds [now - depth, now], stale slots (still holding an
+ * older second) are simply skipped, so there is nothing to expire
+ */
+unsigned int
+avgstat_read(avgstat_t *as, int depth, time_t now)
 {
-  avgstat_entry_t *ase;
-
-  pthread_mutex_lock(&as->as_mutex);
-  ase = TAILQ_FIRST(&as->as_queue);
-  if(ase != NULL && ase->ase_clock == now) {
-    ase->ase_count += count;
-  } else {
-    ase = malloc(sizeof(avgstat_entry_t));
-    TAILQ_INSERT_HEAD(&as->as_queue, ase, ase_link);
-    ase->ase_clock = now;
-    ase->ase_count = count;
+  uint32_t clk = now, i;
+  uint64_t v;
+  unsigned int r = 0;
+
+  if (depth >= AVGSTAT_SLOTS)
+    depth = AVGSTAT_SLOTS - 1;
+  for (i = 0; i <= (uint32_t)depth; i++, clk--) {
+    v = avgstat_slot_get(as, clk);
+    if (AVGSTAT_CLOCK(v) == clk)
+      r += AVGSTAT_COUNT(v);
   }
-
-  avgstat_expire(as, now);
-  pthread_mutex_unlock(&as->as_mutex);
+  return r;
 }
 
-
 unsigned int
 avgstat_read_and_expire(avgstat_t *as, time_t now)
 {
-  avgstat_entry_t *ase;
-  int r = 0;
-
-  pthread_mutex_lock(&as->as_mutex);
-
-  avgstat_expire(as, now);
+  return avgstat_read(as, as->as_depth - 1, now);
+}
 
-  TAILQ_FOREACH(ase, &as->as_queue, ase_link)
-    r += ase->ase_count;
+int
+avgstat_history(avgstat_t *as, unsigned int *hist, int depth, time_t now)
+{
+  uint32_t clk = now - 1;
+  uint64_t v;
+  int i;
+
+  if (depth >= AVGSTAT_SLOTS)
+    depth = AVGSTAT_SLOTS - 1;
+  for (i = 0; i < depth; i++, clk--) {
+    v = avgstat_slot_get(as, clk);
+    hist[i] = AVGSTAT_CLOCK(v) == clk ? AVGSTAT_COUNT(v) : 0;
+  }
+  return depth;
+}
 
-  pthread_mutex_unlock(&as->as_mutex);
-  return r;
+static int
+avgstat_cmp(const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *)a, y = *(const unsigned int *)b;
+  return x < y ? -1 : (x > y);
 }
 
+/*
+ * Nearest-rank percentile of the per-second counts over the last
+ * complete seconds
+ */
 unsigned int
-avgstat_read(avgstat_t *as, int depth, time_t now)
+avgstat_percentile(avgstat_t *as, int depth, int pct, time_t now)
 {
-  avgstat_entry_t *ase;
-  int r = 0;
-
-  pthread_mutex_lock(&as->as_mutex);
-
-  TAILQ_FOREACH(ase, &as->as_queue, ase_link) {
-    if(ase->ase_clock < now - depth)
-      break;
-    r += ase->ase_count;
-  }
-  pthread_mutex_unlock(&as->as_mutex);
-  return r;
+  unsigned int hist[AVGSTAT_SLOTS];
+  int n, k;
+
+  n = avgstat_history(as, hist, depth, now);
+  if (n <= 0)
+    return 0;
+  qsort(hist, n, sizeof(hist[0]), avgstat_cmp);
+  k = (pct * n + 99) / 100;
+  if (k < 1)
+    k = 1;
+  if (k > n)
+    k = n;
+  return hist[k - 1];
 }
-
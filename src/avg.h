@@ -19,31 +19,35 @@
 #ifndef AVG_H
 #define AVG_H
 
-#include <pthread.h>
-#include "queue.h"
+#include <stdint.h>
+#include <time.h>
 
 /*
- * avg stat queue
+ * avg stat ring
+ *
+ * One slot per second, each slot packs the second it belongs to (upper
+ * 32 bits) with the count (lower 32 bits) so that it can be updated with
+ * a single compare-and-swap, no lock and no allocation on the hot path.
  */
 
-TAILQ_HEAD(avgstat_entry_queue, avgstat_entry);
+#define AVGSTAT_SLOTS 64   /* power of two, bounds the usable depth */
 
 typedef struct avgstat {
-  pthread_mutex_t as_mutex;
-  struct avgstat_entry_queue as_queue;
+  volatile uint64_t as_slot[AVGSTAT_SLOTS];
   int as_depth;  /* in seconds */
 } avgstat_t;
 
-typedef struct avgstat_entry {
-  TAILQ_ENTRY(avgstat_entry) ase_link;
-  int ase_clock;
-  int ase_count;
-} avgstat_entry_t;
-
 void avgstat_init(avgstat_t *as, int maxdepth);
 void avgstat_add(avgstat_t *as, int count, time_t now);
 void avgstat_flush(avgstat_t *as);
 unsigned int avgstat_read_and_expire(avgstat_t *as, time_t now);
 unsigned int avgstat_read(avgstat_t *as, int depth, time_t now);
 
+/*
+ * History of the last complete seconds (newest first), returns the
+ * number of entries written
+ */
+int avgstat_history(avgstat_t *as, unsigned int *hist, int depth, time_t now);
+unsigned int avgstat_percentile(avgstat_t *as, int depth, int pct, time_t now);
+
 #endif /* AVG_H */
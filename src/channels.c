@@ -758,10 +758,12 @@ channel_create0
     free(ch);
     return NULL;
   }
+  tvh_domain_wrlock(LOCK_CHANNEL);
   if (RB_INSERT_SORTED(&channels, ch, ch_link, ch_id_cmp)) {
     tvherror("channel", "id collision!");
     abort();
   }
+  tvh_domain_unlock(LOCK_CHANNEL);
 
   /* Defaults */
   ch->ch_enabled = 1;
@@ -834,11 +836,13 @@ channel_delete ( channel_t *ch, int delconf )
     hts_settings_remove("channel/config/%s", idnode_uuid_as_str(&ch->ch_id));
 
   /* Free memory */
+  tvh_domain_wrlock(LOCK_CHANNEL);
   RB_REMOVE(&channels, ch, ch_link);
   idnode_unlink(&ch->ch_id);
   free(ch->ch_name);
   free(ch->ch_icon);
   free(ch);
+  tvh_domain_unlock(LOCK_CHANNEL);
 }
 
 /*
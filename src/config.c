@@ -1503,3 +1503,45 @@ int config_set_picon_path ( const char *str )
 {
   return _config_set_str("piconpath", str);
 }
+
+/* HTSP bytes written per writer wakeup (kB) */
+int config_get_htsp_write_budget ( void )
+{
+  int64_t s64;
+  if (htsmsg_get_s64(config, "htsp_write_budget", &s64) || s64 <= 0)
+    return 64;
+  return MIN(s64, 4096);
+}
+
+int config_set_htsp_write_budget ( const char *str )
+{
+  return _config_set_str("htsp_write_budget", str);
+}
+
+/* Descrambling threads (0 = descramble in the input thread) */
+int config_get_csa_threads ( void )
+{
+  int64_t s64;
+  if (htsmsg_get_s64(config, "csa_threads", &s64) || s64 <= 0)
+    return 0;
+  return MIN(s64, 64);
+}
+
+int config_set_csa_threads ( const char *str )
+{
+  return _config_set_str("csa_threads", str);
+}
+
+/* Packets per descrambling job (0 = library default) */
+int config_get_csa_batch ( void )
+{
+  int64_t s64;
+  if (htsmsg_get_s64(config, "csa_batch", &s64) || s64 <= 0)
+    return 0;
+  return MIN(s64, 4096);
+}
+
+int config_set_csa_batch ( const char *str )
+{
+  return _config_set_str("csa_batch", str);
+}
@@ -49,4 +49,16 @@ const char *config_get_picon_path  ( void );
 int         config_set_picon_path  ( const char *str )
   __attribute__((warn_unused_result));
 
+int         config_get_htsp_write_budget ( void );
+int         config_set_htsp_write_budget ( const char *str )
+  __attribute__((warn_unused_result));
+
+int         config_get_csa_threads ( void );
+int         config_set_csa_threads ( const char *str )
+  __attribute__((warn_unused_result));
+
+int         config_get_csa_batch ( void );
+int         config_set_csa_batch ( const char *str )
+  __attribute__((warn_unused_result));
+
 #endif /* __TVH_CONFIG__H__ */
@@ -19,6 +19,10 @@
 #include "tvheadend.h"
 #include "settings.h"
 #include "caclient.h"
+#include "config.h"
+#if ENABLE_TVHCSA
+#include "tvhcsa.h"
+#endif
 
 const idclass_t *caclient_classes[] = {
 #if ENABLE_CWC
@@ -37,7 +41,7 @@ const idclass_t *caclient_classes[] = {
 struct caclient_entry_queue caclients;
 static pthread_mutex_t caclients_mutex;
 
-static void caclient_class_save ( idnode_t *in );
+static void caclient_save ( caclient_t *cac );
 
 static const idclass_t *
 caclient_class_find(const char *name)
@@ -68,7 +72,7 @@ caclient_reindex(void)
   TAILQ_FOREACH(cac, &caclients, cac_link)
     if (cac->cac_save) {
       cac->cac_save = 0;
-      caclient_class_save((idnode_t *)cac);
+      caclient_save(cac);
     }
 }
 
@@ -78,6 +82,17 @@ cac_cmp(caclient_t *a, caclient_t *b)
   return a->cac_index - b->cac_index;
 }
 
+/*
+ * The descrambling threads are shared by all services (global config)
+ */
+void
+caclient_csa_update(void)
+{
+#if ENABLE_TVHCSA
+  tvhcsa_workers_set(config_get_csa_threads(), config_get_csa_batch());
+#endif
+}
+
 caclient_t *
 caclient_create
   (const char *uuid, htsmsg_t *conf, int save)
@@ -129,7 +144,7 @@ caclient_create
   }
   pthread_mutex_unlock(&caclients_mutex);
   if (save)
-    caclient_class_save((idnode_t *)cac);
+    caclient_save(cac);
   cac->cac_conf_changed(cac);
   return cac;
 }
@@ -153,16 +168,21 @@ caclient_delete(caclient_t *cac, int delconf)
 }
 
 static void
-caclient_class_save ( idnode_t *in )
+caclient_save ( caclient_t *cac )
 {
-  caclient_t *cac = (caclient_t *)in;
   htsmsg_t *c = htsmsg_create_map();
-  idnode_save(in, c);
-  hts_settings_save(c, "caclient/%s", idnode_uuid_as_str(in));
+  idnode_save(&cac->cac_id, c);
+  hts_settings_save(c, "caclient/%s", idnode_uuid_as_str(&cac->cac_id));
   htsmsg_destroy(c);
   cac->cac_conf_changed(cac);
 }
 
+static void
+caclient_class_save ( idnode_t *in )
+{
+  caclient_save((caclient_t *)in);
+}
+
 static const char *
 caclient_class_get_title ( idnode_t *in )
 {
@@ -350,6 +370,7 @@ caclient_init(void)
 #if ENABLE_TSDEBUG
   tsdebugcw_init();
 #endif
+  caclient_csa_update();
 
   if (!(c = hts_settings_load("caclient")))
     return;
@@ -370,4 +391,7 @@ caclient_done(void)
   while ((cac = TAILQ_FIRST(&caclients)) != NULL)
     caclient_delete(cac, 0);
   pthread_mutex_unlock(&global_lock);
+#if ENABLE_TVHCSA
+  tvhcsa_workers_done();
+#endif
 }
@@ -72,6 +72,8 @@ void caclient_caid_update(struct mpegts_mux *mux,
 void caclient_set_status(caclient_t *cac, caclient_status_t status);
 const char *caclient_get_status(caclient_t *cac);
 
+void caclient_csa_update(void);
+
 void caclient_init(void);
 void caclient_done(void);
 
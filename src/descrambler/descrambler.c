@@ -260,7 +260,7 @@ fin:
     mpegts_mux_t *mm = ((mpegts_service_t *)td->td_service)->s_dvb_mux;
     if (!mm->mm_active)
       return;
-    pthread_mutex_lock(&mm->mm_active->mmi_input->mi_output_lock);
+    pthread_mutex_lock(&mm->mm_output_lock);
     tp->pos = mm->mm_tsdebug_pos;
     memset(tp->pkt, 0xff, sizeof(tp->pkt));
     tp->pkt[pos++] = 0x47; /* sync byte */
@@ -282,7 +282,7 @@ fin:
     tp->pkt[pos++] = (crc >> 8) & 0xff;
     tp->pkt[pos++] = crc & 0xff;
     TAILQ_INSERT_HEAD(&mm->mm_tsdebug_packets, tp, link);
-    pthread_mutex_unlock(&mm->mm_active->mmi_input->mi_output_lock);
+    pthread_mutex_unlock(&mm->mm_output_lock);
   }
 #endif
 }
@@ -51,6 +51,8 @@
 #define PARALLEL_128_2MMX    1284
 #define PARALLEL_128_SSE     1285
 #define PARALLEL_128_SSE2    1286
+#define PARALLEL_256_AVX2    2560
+#define PARALLEL_512_AVX512  5120
 
 #include "parallel_generic.h"
 //// conditionals
@@ -87,6 +89,12 @@
 #elif PARALLEL_MODE==PARALLEL_128_SSE2
 #include "parallel_128_sse2.h"
 #define FUNC(x) (x ## _128sse2)
+#elif PARALLEL_MODE==PARALLEL_256_AVX2
+#include "parallel_256_avx2.h"
+#define FUNC(x) (x ## _256avx2)
+#elif PARALLEL_MODE==PARALLEL_512_AVX512
+#include "parallel_512_avx512.h"
+#define FUNC(x) (x ## _512avx512)
 #else
 #error "unknown/undefined parallel mode"
 #endif
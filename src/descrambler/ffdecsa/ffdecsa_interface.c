@@ -67,6 +67,14 @@ MAKEFUNCS(64mmx);
 MAKEFUNCS(128sse2);
 #endif
 
+#ifdef CONFIG_AVX2
+MAKEFUNCS(256avx2);
+#endif
+
+#ifdef CONFIG_AVX512F
+MAKEFUNCS(512avx512);
+#endif
+
 static csafuncs_t current;
 
 
@@ -126,6 +134,22 @@ typedef int x86_reg;
            "=c" (ecx), "=d" (edx)\
          : "0" (index));
 
+#define cpuid_count(index,count,eax,ebx,ecx,edx)\
+    __asm__ volatile\
+        ("mov %%"REG_b", %%"REG_S"\n\t"\
+         "cpuid\n\t"\
+         "xchg %%"REG_b", %%"REG_S\
+         : "=a" (eax), "=S" (ebx),\
+           "=c" (ecx), "=d" (edx)\
+         : "0" (index), "2" (count));
+
+/* register state enabled by the OS (XCR0) */
+#define xgetbv(index,eax,edx)\
+    __asm__ volatile\
+        (".byte 0x0f, 0x01, 0xd0"\
+         : "=a" (eax), "=d" (edx)\
+         : "c" (index));
+
 
 
 void
@@ -137,7 +161,7 @@ ffdecsa_init(void)
 #if defined(__i386__) || defined(__x86_64__)
 
   int eax, ebx, ecx, edx;
-  int max_std_level, std_caps=0;
+  int max_std_level, std_caps=0, ext_caps=0, xcr0=0;
   
 #if defined(__i386__)
 
@@ -170,6 +194,31 @@ ffdecsa_init(void)
     if(max_std_level >= 1){
       cpuid(1, eax, ebx, ecx, std_caps);
 
+      /* OSXSAVE and AVX */
+      if ((ecx & (1<<27)) && (ecx & (1<<28))) {
+        xgetbv(0, xcr0, edx);
+        if (max_std_level >= 7)
+          cpuid_count(7, 0, eax, ext_caps, ecx, edx);
+      }
+
+#ifdef CONFIG_AVX512F
+      /* AVX512F, ZMM/YMM/XMM and opmask state */
+      if ((ext_caps & (1<<16)) && (xcr0 & 0xe6) == 0xe6) {
+	current = funcs_512avx512;
+	tvhlog(LOG_INFO, "CSA", "Using AVX-512 512bit parallel descrambling");
+	return;
+      }
+#endif
+
+#ifdef CONFIG_AVX2
+      /* AVX2, YMM/XMM state */
+      if ((ext_caps & (1<<5)) && (xcr0 & 0x06) == 0x06) {
+	current = funcs_256avx2;
+	tvhlog(LOG_INFO, "CSA", "Using AVX2 256bit parallel descrambling");
+	return;
+      }
+#endif
+
 #ifdef CONFIG_SSE2
       if (std_caps & (1<<26)) {
 	current = funcs_128sse2;
@@ -432,6 +432,117 @@ static inline void trasp64_128_88cw(unsigned char *data){
   }
 #undef halfrow
 }
+
+//64-256,64-512---------------------------------------------------
+static inline void trasp64_wide_88ccw(unsigned char *data, int cols){
+/* 64 rows of cols*64 bits transposition (bytes transp. - 8x8 rotate counterclockwise)*/
+/* same as trasp64_64_88ccw on every 64 bit column */
+#define qrow(x) (((unsigned long long int *)data)[cols*(x)+c])
+  int i,j,c;
+  for(c=0;c<cols;c++){
+    unsigned long long int t,b;
+    for(i=0;i<32;i++){
+      t=qrow(i);
+      b=qrow(32+i);
+      qrow(i)   = (t&0x00000000ffffffffULL)      | ((b                      )<<32);
+      qrow(32+i)=((t                      )>>32) |  (b&0xffffffff00000000ULL) ;
+    }
+    for(j=0;j<64;j+=32){
+      for(i=0;i<16;i++){
+        t=qrow(j+i);
+        b=qrow(j+16+i);
+        qrow(j+i)   = (t&0x0000ffff0000ffffULL)      | ((b&0x0000ffff0000ffffULL)<<16);
+        qrow(j+16+i)=((t&0xffff0000ffff0000ULL)>>16) |  (b&0xffff0000ffff0000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=16){
+      for(i=0;i<8;i++){
+        t=qrow(j+i);
+        b=qrow(j+8+i);
+        qrow(j+i)   = (t&0x00ff00ff00ff00ffULL)     | ((b&0x00ff00ff00ff00ffULL)<<8);
+        qrow(j+8+i) =((t&0xff00ff00ff00ff00ULL)>>8) |  (b&0xff00ff00ff00ff00ULL);
+      }
+    }
+    for(j=0;j<64;j+=8){
+      for(i=0;i<4;i++){
+        t=qrow(j+i);
+        b=qrow(j+4+i);
+        qrow(j+i)   =((t&0x0f0f0f0f0f0f0f0fULL)<<4) |  (b&0x0f0f0f0f0f0f0f0fULL);
+        qrow(j+4+i) = (t&0xf0f0f0f0f0f0f0f0ULL)     | ((b&0xf0f0f0f0f0f0f0f0ULL)>>4);
+      }
+    }
+    for(j=0;j<64;j+=4){
+      for(i=0;i<2;i++){
+        t=qrow(j+i);
+        b=qrow(j+2+i);
+        qrow(j+i)   =((t&0x3333333333333333ULL)<<2) |  (b&0x3333333333333333ULL);
+        qrow(j+2+i) = (t&0xccccccccccccccccULL)     | ((b&0xccccccccccccccccULL)>>2);
+      }
+    }
+    for(j=0;j<64;j+=2){
+      t=qrow(j);
+      b=qrow(j+1);
+      qrow(j)   =((t&0x5555555555555555ULL)<<1) |  (b&0x5555555555555555ULL);
+      qrow(j+1) = (t&0xaaaaaaaaaaaaaaaaULL)     | ((b&0xaaaaaaaaaaaaaaaaULL)>>1);
+    }
+  }
+#undef qrow
+}
+
+static inline void trasp64_wide_88cw(unsigned char *data, int cols){
+/* 64 rows of cols*64 bits transposition (bytes transp. - 8x8 rotate clockwise)*/
+/* same as trasp64_64_88cw on every 64 bit column */
+#define qrow(x) (((unsigned long long int *)data)[cols*(x)+c])
+  int i,j,c;
+  for(c=0;c<cols;c++){
+    unsigned long long int t,b;
+    for(i=0;i<32;i++){
+      t=qrow(i);
+      b=qrow(32+i);
+      qrow(i)   = (t&0x00000000ffffffffULL)      | ((b                      )<<32);
+      qrow(32+i)=((t                      )>>32) |  (b&0xffffffff00000000ULL) ;
+    }
+    for(j=0;j<64;j+=32){
+      for(i=0;i<16;i++){
+        t=qrow(j+i);
+        b=qrow(j+16+i);
+        qrow(j+i)   = (t&0x0000ffff0000ffffULL)      | ((b&0x0000ffff0000ffffULL)<<16);
+        qrow(j+16+i)=((t&0xffff0000ffff0000ULL)>>16) |  (b&0xffff0000ffff0000ULL) ;
+      }
+    }
+    for(j=0;j<64;j+=16){
+      for(i=0;i<8;i++){
+        t=qrow(j+i);
+        b=qrow(j+8+i);
+        qrow(j+i)   = (t&0x00ff00ff00ff00ffULL)     | ((b&0x00ff00ff00ff00ffULL)<<8);
+        qrow(j+8+i) =((t&0xff00ff00ff00ff00ULL)>>8) |  (b&0xff00ff00ff00ff00ULL);
+      }
+    }
+    for(j=0;j<64;j+=8){
+      for(i=0;i<4;i++){
+        t=qrow(j+i);
+        b=qrow(j+4+i);
+        qrow(j+i)   =((t&0xf0f0f0f0f0f0f0f0ULL)>>4) |   (b&0xf0f0f0f0f0f0f0f0ULL);
+        qrow(j+4+i) = (t&0x0f0f0f0f0f0f0f0fULL)     |  ((b&0x0f0f0f0f0f0f0f0fULL)<<4);
+      }
+    }
+    for(j=0;j<64;j+=4){
+      for(i=0;i<2;i++){
+        t=qrow(j+i);
+        b=qrow(j+2+i);
+        qrow(j+i)   =((t&0xccccccccccccccccULL)>>2) |  (b&0xccccccccccccccccULL);
+        qrow(j+2+i) = (t&0x3333333333333333ULL)     | ((b&0x3333333333333333ULL)<<2);
+      }
+    }
+    for(j=0;j<64;j+=2){
+      t=qrow(j);
+      b=qrow(j+1);
+      qrow(j)   =((t&0xaaaaaaaaaaaaaaaaULL)>>1) |  (b&0xaaaaaaaaaaaaaaaaULL);
+      qrow(j+1) = (t&0x5555555555555555ULL)     | ((b&0x5555555555555555ULL)<<1);
+    }
+  }
+#undef qrow
+}
 #endif
 
 
@@ -489,6 +600,9 @@ trasp64_64_88ccw(sb);
 #if GROUP_PARALLELISM==128
 trasp64_128_88ccw(sb);
 #endif
+#if GROUP_PARALLELISM>=256
+trasp64_wide_88ccw(sb,GROUP_PARALLELISM/64);
+#endif
 DBG(dump_mem("stream_postrot",sb,GROUP_PARALLELISM*8,BYPG));
 
 for(j=0;j<64;j++){
@@ -888,6 +1002,9 @@ trasp64_64_88cw(cb);
 #if GROUP_PARALLELISM==128
 trasp64_128_88cw(cb);
 #endif
+#if GROUP_PARALLELISM>=256
+trasp64_wide_88cw(cb,GROUP_PARALLELISM/64);
+#endif
 
 for(j=0;j<64;j++){
   DBG(fprintf(stderr,"postcall postrot cb[%2i]=",j));
@@ -23,6 +23,344 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <assert.h>
+#include "atomic.h"
+
+/*
+ * Asynchronous descrambling
+ */
+
+#define TVHCSA_JOBS_MAX 32 /* max. outstanding clusters per service */
+
+typedef struct tvhcsa_job {
+  TAILQ_ENTRY(tvhcsa_job) cj_link;     /* worker queue */
+  TAILQ_ENTRY(tvhcsa_job) cj_csa_link; /* csa_jobs or csa_jobs_free */
+  tvhcsa_t     *cj_csa;
+  uint8_t      *cj_data;
+  int           cj_fill;
+  int           cj_queued;
+  volatile int  cj_done;
+  uint32_t      cj_key_gen;
+  uint8_t       cj_key_even[8];
+  uint8_t       cj_key_odd[8];
+} tvhcsa_job_t;
+
+typedef struct tvhcsa_worker {
+  pthread_t     cw_tid;
+  uint32_t      cw_key_gen;
+#if ENABLE_DVBCSA
+  struct dvbcsa_bs_batch_s *cw_batch;
+  struct dvbcsa_bs_key_s   *cw_key_even;
+  struct dvbcsa_bs_key_s   *cw_key_odd;
+#else
+  void         *cw_keys;
+#endif
+} tvhcsa_worker_t;
+
+static pthread_mutex_t          tvhcsa_lock      = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t           tvhcsa_cond      = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t           tvhcsa_done_cond = PTHREAD_COND_INITIALIZER;
+static TAILQ_HEAD(, tvhcsa_job) tvhcsa_queue     =
+                                  TAILQ_HEAD_INITIALIZER(tvhcsa_queue);
+static tvhcsa_worker_t         *tvhcsa_workers;
+static int                      tvhcsa_nworkers;
+static int                      tvhcsa_running;
+static int                      tvhcsa_batch;
+static volatile int             tvhcsa_key_gen;
+
+static void
+tvhcsa_worker_init ( tvhcsa_worker_t *cw )
+{
+  cw->cw_key_gen  = 0;
+#if ENABLE_DVBCSA
+  cw->cw_batch    = malloc((dvbcsa_bs_batch_size() + 1) *
+                           sizeof(struct dvbcsa_bs_batch_s));
+  cw->cw_key_even = dvbcsa_bs_key_alloc();
+  cw->cw_key_odd  = dvbcsa_bs_key_alloc();
+#else
+  cw->cw_keys     = get_key_struct();
+#endif
+}
+
+static void
+tvhcsa_worker_free ( tvhcsa_worker_t *cw )
+{
+#if ENABLE_DVBCSA
+  dvbcsa_bs_key_free(cw->cw_key_odd);
+  dvbcsa_bs_key_free(cw->cw_key_even);
+  free(cw->cw_batch);
+#else
+  free_key_struct(cw->cw_keys);
+#endif
+}
+
+#if ENABLE_DVBCSA
+static void
+tvhcsa_des_batch
+  ( struct dvbcsa_bs_batch_s *b, struct dvbcsa_bs_key_s *key,
+    uint8_t *data, int fill, int odd )
+{
+  const int size = dvbcsa_bs_batch_size();
+  const uint8_t xc0 = odd ? 0xc0 : 0x80;
+  int i, n = 0, len, offset;
+  uint8_t *pkt;
+
+  for (i = 0, pkt = data; i < fill; i++, pkt += 188) {
+    if ((pkt[3] & 0xc0) != xc0)
+      continue;
+    pkt[3] &= 0x3f;  // consider it decrypted now
+    if (pkt[3] & 0x20) { // incomplete packet
+      offset = 4 + pkt[4] + 1;
+      len = 188 - offset;
+      if (len < 8) // decrypted==encrypted!
+        continue;
+    } else {
+      offset = 4;
+      len = 184;
+    }
+    b[n].data = pkt + offset;
+    b[n].len  = len;
+    if (++n == size) {
+      b[n].data = NULL;
+      dvbcsa_bs_decrypt(key, b, 184);
+      n = 0;
+    }
+  }
+  if (n) {
+    b[n].data = NULL;
+    dvbcsa_bs_decrypt(key, b, 184);
+  }
+}
+
+static void
+tvhcsa_des_cluster
+  ( struct dvbcsa_bs_batch_s *b, struct dvbcsa_bs_key_s *key_even,
+    struct dvbcsa_bs_key_s *key_odd, uint8_t *data, int fill )
+{
+  tvhcsa_des_batch(b, key_even, data, fill, 0);
+  tvhcsa_des_batch(b, key_odd, data, fill, 1);
+}
+#else
+static void
+tvhcsa_des_cluster ( void *keys, uint8_t *data, int fill )
+{
+  unsigned char *vec[3];
+
+  vec[0] = data;
+  vec[1] = data + fill * 188;
+  vec[2] = NULL;
+  while (vec[0])
+    if (decrypt_packets(keys, vec) <= 0)
+      break;
+}
+#endif
+
+static void
+tvhcsa_job_run ( tvhcsa_worker_t *cw, tvhcsa_job_t *job )
+{
+  if (cw->cw_key_gen != job->cj_key_gen) {
+#if ENABLE_DVBCSA
+    dvbcsa_bs_key_set(job->cj_key_even, cw->cw_key_even);
+    dvbcsa_bs_key_set(job->cj_key_odd, cw->cw_key_odd);
+#else
+    set_even_control_word(cw->cw_keys, job->cj_key_even);
+    set_odd_control_word(cw->cw_keys, job->cj_key_odd);
+#endif
+    cw->cw_key_gen = job->cj_key_gen;
+  }
+
+#if ENABLE_DVBCSA
+  tvhcsa_des_cluster(cw->cw_batch, cw->cw_key_even, cw->cw_key_odd,
+                     job->cj_data, job->cj_fill);
+#else
+  tvhcsa_des_cluster(cw->cw_keys, job->cj_data, job->cj_fill);
+#endif
+}
+
+static void tvhcsa_job_deliver
+  ( tvhcsa_t *csa, struct mpegts_service *s, int wait );
+
+/*
+ * Pass the finished clusters on right away, the input thread would
+ * deliver them only with its next packet otherwise
+ */
+static void
+tvhcsa_worker_deliver ( tvhcsa_t *csa )
+{
+  struct mpegts_service *s = csa->csa_service;
+  pthread_mutex_t *mutex = &((service_t *)s)->s_stream_mutex;
+  struct timespec ts;
+  int cancel;
+
+  while (1) {
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10000000;
+    if (ts.tv_nsec >= 1000000000) {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+    if (pthread_mutex_timedlock(mutex, &ts) == 0) {
+      tvhcsa_job_deliver(csa, s, 0);
+      pthread_mutex_unlock(mutex);
+      break;
+    }
+    /* tvhcsa_job_cancel() waits for us with the stream lock held */
+    pthread_mutex_lock(&tvhcsa_lock);
+    cancel = csa->csa_cancel;
+    pthread_mutex_unlock(&tvhcsa_lock);
+    if (cancel)
+      break;
+  }
+}
+
+static void *
+tvhcsa_worker_thread ( void *aux )
+{
+  tvhcsa_worker_t *cw = aux;
+  tvhcsa_job_t *job;
+  tvhcsa_t *csa;
+
+  pthread_mutex_lock(&tvhcsa_lock);
+  while (1) {
+    if ((job = TAILQ_FIRST(&tvhcsa_queue)) == NULL) {
+      if (!tvhcsa_running)
+        break;
+      pthread_cond_wait(&tvhcsa_cond, &tvhcsa_lock);
+      continue;
+    }
+    TAILQ_REMOVE(&tvhcsa_queue, job, cj_link);
+    job->cj_queued = 0;
+    csa = job->cj_csa;
+    csa->csa_running++;
+    pthread_mutex_unlock(&tvhcsa_lock);
+
+    tvhcsa_job_run(cw, job);
+
+    /* the job may be recycled by the input thread from now on */
+    pthread_mutex_lock(&tvhcsa_lock);
+    job->cj_done = 1;
+    pthread_cond_broadcast(&tvhcsa_done_cond);
+    pthread_mutex_unlock(&tvhcsa_lock);
+
+    tvhcsa_worker_deliver(csa);
+
+    pthread_mutex_lock(&tvhcsa_lock);
+    csa->csa_running--;
+    pthread_cond_broadcast(&tvhcsa_done_cond);
+  }
+  pthread_mutex_unlock(&tvhcsa_lock);
+  return NULL;
+}
+
+/*
+ * Hand over the current cluster to the workers
+ */
+static void
+tvhcsa_job_submit ( tvhcsa_t *csa, struct mpegts_service *s )
+{
+  tvhcsa_job_t *job;
+  uint8_t *data;
+
+  if ((job = TAILQ_FIRST(&csa->csa_jobs_free)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs_free, job, cj_csa_link);
+  } else {
+    job = calloc(1, sizeof(*job));
+    job->cj_csa  = csa;
+    job->cj_data = malloc(csa->csa_cluster_size * 188);
+  }
+  data = job->cj_data;
+  job->cj_data    = csa->csa_tsbcluster;
+  job->cj_fill    = csa->csa_fill;
+  job->cj_done    = 0;
+  job->cj_key_gen = csa->csa_key_gen;
+  memcpy(job->cj_key_even, csa->csa_cw_even, 8);
+  memcpy(job->cj_key_odd, csa->csa_cw_odd, 8);
+  csa->csa_tsbcluster = data;
+  csa->csa_fill = 0;
+  csa->csa_service = s;
+  TAILQ_INSERT_TAIL(&csa->csa_jobs, job, cj_csa_link);
+  csa->csa_njobs++;
+
+  pthread_mutex_lock(&tvhcsa_lock);
+  if (tvhcsa_nworkers > 0) {
+    job->cj_queued = 1;
+    TAILQ_INSERT_TAIL(&tvhcsa_queue, job, cj_link);
+    pthread_cond_signal(&tvhcsa_cond);
+    pthread_mutex_unlock(&tvhcsa_lock);
+    return;
+  }
+  pthread_mutex_unlock(&tvhcsa_lock);
+
+  /* Workers were stopped meanwhile, the keys in csa are current */
+#if ENABLE_DVBCSA
+  tvhcsa_des_cluster(csa->csa_tsbbatch_even, csa->csa_key_even,
+                     csa->csa_key_odd, job->cj_data, job->cj_fill);
+#else
+  tvhcsa_des_cluster(csa->csa_keys, job->cj_data, job->cj_fill);
+#endif
+  job->cj_done = 1;
+}
+
+/*
+ * Pass the decrypted clusters in order, the input thread waits for
+ * the workers only when too much data is outstanding
+ */
+static void
+tvhcsa_job_deliver ( tvhcsa_t *csa, struct mpegts_service *s, int wait )
+{
+  tvhcsa_job_t *job;
+  const uint8_t *t0;
+  int i;
+
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    if (!job->cj_done) {
+      if (!wait || csa->csa_njobs <= TVHCSA_JOBS_MAX)
+        break;
+      pthread_mutex_lock(&tvhcsa_lock);
+      while (!job->cj_done)
+        pthread_cond_wait(&tvhcsa_done_cond, &tvhcsa_lock);
+      pthread_mutex_unlock(&tvhcsa_lock);
+    }
+    __sync_synchronize();
+    TAILQ_REMOVE(&csa->csa_jobs, job, cj_csa_link);
+    csa->csa_njobs--;
+    for (i = 0, t0 = job->cj_data; i < job->cj_fill; i++, t0 += 188)
+      ts_recv_packet2(s, t0);
+    TAILQ_INSERT_HEAD(&csa->csa_jobs_free, job, cj_csa_link);
+  }
+}
+
+static void
+tvhcsa_job_cancel ( tvhcsa_t *csa )
+{
+  tvhcsa_job_t *job;
+
+  pthread_mutex_lock(&tvhcsa_lock);
+  csa->csa_cancel = 1;
+  TAILQ_FOREACH(job, &csa->csa_jobs, cj_csa_link)
+    if (job->cj_queued) {
+      TAILQ_REMOVE(&tvhcsa_queue, job, cj_link);
+      job->cj_queued = 0;
+    }
+  while (csa->csa_running > 0)
+    pthread_cond_wait(&tvhcsa_done_cond, &tvhcsa_lock);
+  pthread_mutex_unlock(&tvhcsa_lock);
+
+  while ((job = TAILQ_FIRST(&csa->csa_jobs)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs, job, cj_csa_link);
+    free(job->cj_data);
+    free(job);
+  }
+  while ((job = TAILQ_FIRST(&csa->csa_jobs_free)) != NULL) {
+    TAILQ_REMOVE(&csa->csa_jobs_free, job, cj_csa_link);
+    free(job->cj_data);
+    free(job);
+  }
+  csa->csa_njobs = 0;
+}
+
+/*
+ * CSA
+ */
 
 static void
 tvhcsa_aes_flush
@@ -43,6 +381,13 @@ static void
 tvhcsa_des_flush
   ( tvhcsa_t *csa, struct mpegts_service *s )
 {
+  if (csa->csa_async) {
+    if (csa->csa_fill)
+      tvhcsa_job_submit(csa, s);
+    tvhcsa_job_deliver(csa, s, 1);
+    return;
+  }
+
 #if ENABLE_DVBCSA
 
   int i;
@@ -107,6 +452,15 @@ static void
 tvhcsa_des_descramble
   ( tvhcsa_t *csa, struct mpegts_service *s, const uint8_t *tsb )
 {
+  if (csa->csa_async) {
+    memcpy(csa->csa_tsbcluster + csa->csa_fill * 188, tsb, 188);
+    if (++csa->csa_fill == csa->csa_cluster_size)
+      tvhcsa_job_submit(csa, s);
+    if (TAILQ_FIRST(&csa->csa_jobs))
+      tvhcsa_job_deliver(csa, s, 1);
+    return;
+  }
+
 #if ENABLE_DVBCSA
   uint8_t *pkt;
   int xc0;
@@ -209,6 +563,8 @@ void tvhcsa_set_key_even( tvhcsa_t *csa, const uint8_t *even )
 #else
     set_even_control_word((csa)->csa_keys, even);
 #endif
+    memcpy(csa->csa_cw_even, even, 8);
+    csa->csa_key_gen = atomic_add(&tvhcsa_key_gen, 1) + 1;
     break;
   case DESCRAMBLER_AES:
     aes_set_even_control_word(csa->csa_aes_keys, even);
@@ -228,6 +584,8 @@ void tvhcsa_set_key_odd( tvhcsa_t *csa, const uint8_t *odd )
 #else
     set_odd_control_word((csa)->csa_keys, odd);
 #endif
+    memcpy(csa->csa_cw_odd, odd, 8);
+    csa->csa_key_gen = atomic_add(&tvhcsa_key_gen, 1) + 1;
     break;
   case DESCRAMBLER_AES:
     aes_set_odd_control_word(csa->csa_aes_keys, odd);
@@ -247,6 +605,19 @@ tvhcsa_init ( tvhcsa_t *csa )
 #else
   csa->csa_cluster_size  = get_suggested_cluster_size();
 #endif
+  TAILQ_INIT(&csa->csa_jobs);
+  TAILQ_INIT(&csa->csa_jobs_free);
+  csa->csa_njobs         = 0;
+  csa->csa_running       = 0;
+  csa->csa_cancel        = 0;
+  csa->csa_service       = NULL;
+  csa->csa_key_gen       = atomic_add(&tvhcsa_key_gen, 1) + 1;
+  pthread_mutex_lock(&tvhcsa_lock);
+  csa->csa_async         = tvhcsa_nworkers > 0;
+  /* smaller batches would leave the bitslice lanes unused */
+  if (csa->csa_async && tvhcsa_batch > csa->csa_cluster_size)
+    csa->csa_cluster_size = tvhcsa_batch;
+  pthread_mutex_unlock(&tvhcsa_lock);
   csa->csa_tsbcluster    = malloc(csa->csa_cluster_size * 188);
 #if ENABLE_DVBCSA
   csa->csa_tsbbatch_even = malloc((csa->csa_cluster_size + 1) *
@@ -264,6 +635,7 @@ tvhcsa_init ( tvhcsa_t *csa )
 void
 tvhcsa_destroy ( tvhcsa_t *csa )
 {
+  tvhcsa_job_cancel(csa);
 #if ENABLE_DVBCSA
   dvbcsa_bs_key_free(csa->csa_key_odd);
   dvbcsa_bs_key_free(csa->csa_key_even);
@@ -275,3 +647,61 @@ tvhcsa_destroy ( tvhcsa_t *csa )
   aes_free_key_struct(csa->csa_aes_keys);
   free(csa->csa_tsbcluster);
 }
+
+/*
+ * Descrambling threads
+ */
+void
+tvhcsa_workers_set ( int threads, int batch )
+{
+  int i;
+
+  threads = MAX(0, MIN(threads, TVHCSA_THREADS_MAX));
+  batch   = MAX(0, MIN(batch, TVHCSA_BATCH_MAX));
+
+  pthread_mutex_lock(&tvhcsa_lock);
+  tvhcsa_batch = batch;
+  pthread_mutex_unlock(&tvhcsa_lock);
+
+  if (threads == tvhcsa_nworkers)
+    return;
+
+  tvhcsa_workers_done();
+  if (threads == 0)
+    return;
+
+  tvhinfo("csa", "using %d descrambling threads", threads);
+  tvhcsa_workers = calloc(threads, sizeof(tvhcsa_worker_t));
+  pthread_mutex_lock(&tvhcsa_lock);
+  tvhcsa_running  = 1;
+  tvhcsa_nworkers = threads;
+  pthread_mutex_unlock(&tvhcsa_lock);
+  for (i = 0; i < threads; i++) {
+    tvhcsa_worker_init(&tvhcsa_workers[i]);
+    tvhthread_create(&tvhcsa_workers[i].cw_tid, NULL,
+                     tvhcsa_worker_thread, &tvhcsa_workers[i]);
+  }
+}
+
+void
+tvhcsa_workers_done ( void )
+{
+  int i, n = tvhcsa_nworkers;
+
+  if (tvhcsa_workers == NULL)
+    return;
+
+  /* the queued clusters are finished before the threads exit */
+  pthread_mutex_lock(&tvhcsa_lock);
+  tvhcsa_running  = 0;
+  tvhcsa_nworkers = 0;
+  pthread_cond_broadcast(&tvhcsa_cond);
+  pthread_mutex_unlock(&tvhcsa_lock);
+
+  for (i = 0; i < n; i++) {
+    pthread_join(tvhcsa_workers[i].cw_tid, NULL);
+    tvhcsa_worker_free(&tvhcsa_workers[i]);
+  }
+  free(tvhcsa_workers);
+  tvhcsa_workers = NULL;
+}
@@ -24,6 +24,7 @@ struct elementary_stream;
 
 #include <stdint.h>
 #include "build.h"
+#include "queue.h"
 #if ENABLE_DVBCSA
 #include <dvbcsa/dvbcsa.h>
 #else
@@ -32,6 +33,11 @@ struct elementary_stream;
 
 #include "libaesdec/libaesdec.h"
 
+#define TVHCSA_THREADS_MAX 64
+#define TVHCSA_BATCH_MAX   4096
+
+struct tvhcsa_job;
+
 typedef struct tvhcsa
 {
 
@@ -61,6 +67,22 @@ typedef struct tvhcsa
   void *csa_keys;
 #endif
   void *csa_aes_keys;
+
+  /**
+   * Asynchronous descrambling (DES only), the full clusters are
+   * decrypted in the worker threads and delivered in order with
+   * the stream lock held (from the input or the worker thread)
+   */
+  int      csa_async;
+  int      csa_njobs;
+  int      csa_running;   /*< protected by the worker lock */
+  int      csa_cancel;    /*< protected by the worker lock */
+  struct mpegts_service *csa_service;
+  TAILQ_HEAD(, tvhcsa_job) csa_jobs;      /*< in stream order */
+  TAILQ_HEAD(, tvhcsa_job) csa_jobs_free;
+  uint8_t  csa_cw_even[8];
+  uint8_t  csa_cw_odd[8];
+  uint32_t csa_key_gen;
   
 } tvhcsa_t;
 
@@ -72,4 +94,7 @@ void tvhcsa_set_key_odd ( tvhcsa_t *csa, const uint8_t *odd );
 void tvhcsa_init    ( tvhcsa_t *csa );
 void tvhcsa_destroy ( tvhcsa_t *csa );
 
+void tvhcsa_workers_set ( int threads, int batch );
+void tvhcsa_workers_done ( void );
+
 #endif /* __TVH_CSA_H__ */
@@ -230,6 +230,19 @@ typedef struct dvr_entry {
   LIST_ENTRY(dvr_entry) de_inotify_link;
 #endif
 
+  /**
+   * Lookup indexes (see dvr_db.c), only while linked in dvrentries
+   */
+  int de_indexed;
+  LIST_ENTRY(dvr_entry) de_id_link;
+  LIST_ENTRY(dvr_entry) de_bcast_link;
+  int de_bcast_linked;
+  LIST_ENTRY(dvr_entry) de_dup_link;
+  int de_dup_linked;
+  RB_ENTRY(dvr_entry) de_sched_link;
+  int de_sched_linked;
+  time_t de_sched_start;
+
 } dvr_entry_t;
 
 #define DVR_CH_NAME(e) ((e)->de_channel == NULL ? (e)->de_channel_name : channel_get_name((e)->de_channel))
@@ -254,6 +267,7 @@ typedef struct dvr_autorec_entry {
 
   char *dae_title;
   regex_t dae_title_preg;
+  char *dae_title_lit;  /* Literal every title match contains (lower case) */
   
   uint32_t dae_content_type;
 
@@ -283,6 +297,15 @@ typedef struct dvr_autorec_entry {
 
   time_t dae_start_extra;
   time_t dae_stop_extra;
+
+  /**
+   * Rule index (see dvr_autorec.c), protected by global_lock
+   */
+  int dae_index_type;
+  uintptr_t dae_index_key;
+  LIST_ENTRY(dvr_autorec_entry) dae_index_link;
+  uint32_t dae_index_gen;
+  uint32_t dae_index_seq;
 } dvr_autorec_entry_t;
 
 TAILQ_HEAD(dvr_autorec_entry_queue, dvr_autorec_entry);
@@ -445,6 +468,8 @@ void dvr_event_replaced(epg_broadcast_t *e, epg_broadcast_t *new_e);
 
 void dvr_event_updated(epg_broadcast_t *e);
 
+void dvr_episode_updated(epg_episode_t *ee);
+
 dvr_entry_t *dvr_entry_find_by_id(int id);
 
 static inline dvr_entry_t *dvr_entry_find_by_uuid(const char *uuid)
@@ -536,6 +561,8 @@ void dvr_autorec_done(void);
 
 void dvr_autorec_update(void);
 
+void dvr_autorec_config_changed(dvr_config_t *cfg);
+
 /**
  *
  */
@@ -57,12 +57,152 @@ dvr_autorec_purge_spawns(dvr_autorec_entry_t *dae, int del)
   }
 }
 
+/**
+ * Rule index
+ *
+ * Every rule is filed under one condition that any broadcast it matches
+ * must satisfy (serieslink/season/brand pointer, channel, a trigram of the
+ * title regex literal, channel tag or content group). For a broadcast only
+ * the buckets for its own keys are walked and autorec_cmp() stays the final
+ * word, so the index only ever saves work.
+ */
+typedef enum {
+  DAE_INDEX_NONE = 0,   /* cannot match anything */
+  DAE_INDEX_ALL,        /* nothing usable, always evaluated */
+  DAE_INDEX_SERIESLINK,
+  DAE_INDEX_SEASON,
+  DAE_INDEX_BRAND,
+  DAE_INDEX_CHANNEL,
+  DAE_INDEX_TRIGRAM,
+  DAE_INDEX_TAG,
+  DAE_INDEX_GENRE,
+} dae_index_type_t;
+
+#define DVR_AUTOREC_INDEX_BITS 9
+#define DVR_AUTOREC_INDEX_SIZE (1 << DVR_AUTOREC_INDEX_BITS)
+
+static struct dvr_autorec_entry_list autorec_index[DVR_AUTOREC_INDEX_SIZE];
+static struct dvr_autorec_entry_list autorec_index_all;
+static uint32_t autorec_index_gen;
+static uint32_t autorec_index_seq;
+
+static inline uint32_t
+autorec_index_hash(int type, uintptr_t key)
+{
+  uint32_t h = (uint32_t)(key ^ (key >> 16) ^ ((uint64_t)key >> 32)) + type;
+  return (h * 2654435761U) >> (32 - DVR_AUTOREC_INDEX_BITS);
+}
+
+static inline int
+autorec_lower(int c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static inline uint32_t
+autorec_trigram(const char *s)
+{
+  return ((uint32_t)autorec_lower((uint8_t)s[0]) << 16) |
+         ((uint32_t)autorec_lower((uint8_t)s[1]) << 8) |
+          (uint32_t)autorec_lower((uint8_t)s[2]);
+}
+
+static void
+autorec_index_remove(dvr_autorec_entry_t *dae)
+{
+  if (dae->dae_index_type != DAE_INDEX_NONE)
+    LIST_REMOVE(dae, dae_index_link);
+  dae->dae_index_type = DAE_INDEX_NONE;
+}
+
+/*
+ * (Re)file a rule, after any change to it or its config
+ */
+static void
+autorec_index_add(dvr_autorec_entry_t *dae)
+{
+  const char *s;
+  int type;
+  uintptr_t key = 0;
+
+  autorec_index_remove(dae);
+
+  if (dae->dae_enabled == 0 || dae->dae_weekdays == 0)
+    return;
+
+  if (dae->dae_serieslink) {
+    type = DAE_INDEX_SERIESLINK;
+    key  = (uintptr_t)dae->dae_serieslink;
+  } else if (dae->dae_season) {
+    type = DAE_INDEX_SEASON;
+    key  = (uintptr_t)dae->dae_season;
+  } else if (dae->dae_brand) {
+    type = DAE_INDEX_BRAND;
+    key  = (uintptr_t)dae->dae_brand;
+  } else if (dae->dae_channel && dae->dae_config &&
+             dae->dae_config->dvr_sl_quality_lock) {
+    type = DAE_INDEX_CHANNEL;
+    key  = (uintptr_t)dae->dae_channel;
+  } else if (dae->dae_title && dae->dae_title[0] && dae->dae_title_lit) {
+    /* prefer a trigram without blanks or punctuation */
+    type = DAE_INDEX_TRIGRAM;
+    for (s = dae->dae_title_lit; s[2]; s++)
+      if (isalnum((uint8_t)s[0]) && isalnum((uint8_t)s[1]) &&
+          isalnum((uint8_t)s[2]))
+        break;
+    if (s[2] == '\0')
+      s = dae->dae_title_lit;
+    key  = autorec_trigram(s);
+  } else if (dae->dae_channel_tag) {
+    type = DAE_INDEX_TAG;
+    key  = (uintptr_t)dae->dae_channel_tag;
+  } else if (dae->dae_content_type) {
+    type = DAE_INDEX_GENRE;
+    key  = dae->dae_content_type & 0xF0;
+  } else if (dae->dae_channel == NULL &&
+             (dae->dae_title == NULL || dae->dae_title[0] == '\0') &&
+             dae->dae_minduration <= 0 &&
+             (dae->dae_maxduration <= 0 || dae->dae_maxduration > 24 * 3600)) {
+    return; /* super wildcard, see autorec_cmp() */
+  } else {
+    type = DAE_INDEX_ALL;
+  }
+
+  dae->dae_index_type = type;
+  dae->dae_index_key  = key;
+  if (type == DAE_INDEX_ALL)
+    LIST_INSERT_HEAD(&autorec_index_all, dae, dae_index_link);
+  else
+    LIST_INSERT_HEAD(&autorec_index[autorec_index_hash(type, key)],
+                     dae, dae_index_link);
+}
+
+/**
+ * Broadcast being matched, local start time is filled on demand
+ */
+typedef struct autorec_event {
+  epg_broadcast_t *e;
+  int              tm_valid;
+  struct tm        tm;
+} autorec_event_t;
+
+static inline const struct tm *
+autorec_event_tm(autorec_event_t *ev)
+{
+  if (!ev->tm_valid) {
+    localtime_r(&ev->e->start, &ev->tm);
+    ev->tm_valid = 1;
+  }
+  return &ev->tm;
+}
+
 /**
  * return 1 if the event 'e' is matched by the autorec rule 'dae'
  */
 static int
-autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
+autorec_cmp(dvr_autorec_entry_t *dae, autorec_event_t *ev)
 {
+  epg_broadcast_t *e = ev->e;
   channel_tag_mapping_t *ctm;
   dvr_config_t *cfg;
   double duration;
@@ -97,8 +237,12 @@ autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
   if(dae->dae_title != NULL && dae->dae_title[0] != '\0') {
     lang_str_ele_t *ls;
     if(!e->episode->title) return 0;
-    RB_FOREACH(ls, e->episode->title, link)
+    RB_FOREACH(ls, e->episode->title, link) {
+      if (dae->dae_title_lit &&
+          !regexp_literal_match(ls->str, dae->dae_title_lit))
+        continue;
       if (!regexec(&dae->dae_title_preg, ls->str, 0, NULL, 0)) break;
+    }
     if (!ls) return 0;
   }
 
@@ -128,14 +272,11 @@ autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
 
   if(dae->dae_start >= 0 && dae->dae_start_window >= 0 &&
      dae->dae_start < 24*60 && dae->dae_start_window < 24*60) {
-    struct tm a_time, ev_time;
+    const struct tm *tm = autorec_event_tm(ev);
     time_t ta, te, tad;
-    localtime_r(&e->start, &a_time);
-    ev_time = a_time;
-    a_time.tm_min = dae->dae_start % 60;
-    a_time.tm_hour = dae->dae_start / 60;
-    ta = mktime(&a_time);
-    te = mktime(&ev_time);
+    /* same wall clock day and DST offset as the event, no mktime() needed */
+    te = e->start;
+    ta = te - (tm->tm_hour * 60 + tm->tm_min - dae->dae_start) * 60;
     if(dae->dae_start > dae->dae_start_window) {
       ta -= 24 * 3600; /* 24 hours */
       tad = ((24 * 60) - dae->dae_start + dae->dae_start_window) * 60;
@@ -162,9 +303,8 @@ autorec_cmp(dvr_autorec_entry_t *dae, epg_broadcast_t *e)
   }
 
   if(dae->dae_weekdays != 0x7f) {
-    struct tm tm;
-    localtime_r(&e->start, &tm);
-    if(!((1 << ((tm.tm_wday ?: 7) - 1)) & dae->dae_weekdays))
+    const struct tm *tm = autorec_event_tm(ev);
+    if(!((1 << ((tm->tm_wday ?: 7) - 1)) & dae->dae_weekdays))
       return 0;
   }
   return 1;
@@ -195,8 +335,10 @@ dvr_autorec_create(const char *uuid, htsmsg_t *conf)
   LIST_INSERT_HEAD(&dae->dae_config->dvr_autorec_entries, dae, dae_config_link);
 
   TAILQ_INSERT_TAIL(&autorec_entries, dae, dae_link);
+  dae->dae_index_seq = ++autorec_index_seq;
 
   idnode_load(&dae->dae_id, conf);
+  autorec_index_add(dae);
 
   htsp_autorec_entry_add(dae);
 
@@ -304,6 +446,7 @@ autorec_entry_destroy(dvr_autorec_entry_t *dae, int delconf)
   htsp_autorec_entry_delete(dae);
 
   TAILQ_REMOVE(&autorec_entries, dae, dae_link);
+  autorec_index_remove(dae);
   idnode_unlink(&dae->dae_id);
 
   if(dae->dae_config)
@@ -319,6 +462,7 @@ autorec_entry_destroy(dvr_autorec_entry_t *dae, int delconf)
     free(dae->dae_title);
     regfree(&dae->dae_title_preg);
   }
+  free(dae->dae_title_lit);
 
   if(dae->dae_channel != NULL)
     LIST_REMOVE(dae, dae_channel_link);
@@ -435,10 +579,14 @@ dvr_autorec_entry_class_title_set(void *o, const void *v)
        free(dae->dae_title);
        dae->dae_title = NULL;
     }
+    free(dae->dae_title_lit);
+    dae->dae_title_lit = NULL;
     if (title[0] != '\0' &&
         !regcomp(&dae->dae_title_preg, title,
-                 REG_ICASE | REG_EXTENDED | REG_NOSUB))
+                 REG_ICASE | REG_EXTENDED | REG_NOSUB)) {
       dae->dae_title = strdup(title);
+      dae->dae_title_lit = regexp_literal(title);
+    }
     return 1;
   }
   return 0;
@@ -1062,6 +1210,55 @@ dvr_autorec_update(void)
   }
 }
 
+/**
+ * Rules matching one broadcast, applied in autorec_entries order
+ */
+typedef struct autorec_match {
+  autorec_event_t       ev;
+  dvr_autorec_entry_t **v;
+  int                   count, size;
+  dvr_autorec_entry_t  *stack[16];
+} autorec_match_t;
+
+static void
+autorec_match_try(autorec_match_t *m, dvr_autorec_entry_t *dae)
+{
+  if (dae->dae_index_gen == autorec_index_gen)
+    return;
+  dae->dae_index_gen = autorec_index_gen;
+  if (!autorec_cmp(dae, &m->ev))
+    return;
+  if (m->count == m->size) {
+    m->size *= 2;
+    if (m->v == m->stack) {
+      m->v = malloc(m->size * sizeof(*m->v));
+      memcpy(m->v, m->stack, sizeof(m->stack));
+    } else {
+      m->v = realloc(m->v, m->size * sizeof(*m->v));
+    }
+  }
+  m->v[m->count++] = dae;
+}
+
+static void
+autorec_match_bucket(autorec_match_t *m, int type, uintptr_t key)
+{
+  dvr_autorec_entry_t *dae;
+
+  LIST_FOREACH(dae, &autorec_index[autorec_index_hash(type, key)],
+               dae_index_link)
+    if (dae->dae_index_type == type && dae->dae_index_key == key)
+      autorec_match_try(m, dae);
+}
+
+static int
+autorec_match_seq_cmp(const void *a, const void *b)
+{
+  uint32_t sa = (*(dvr_autorec_entry_t **)a)->dae_index_seq;
+  uint32_t sb = (*(dvr_autorec_entry_t **)b)->dae_index_seq;
+  return sa < sb ? -1 : (sa > sb);
+}
+
 /**
  *
  */
@@ -1069,10 +1266,56 @@ void
 dvr_autorec_check_event(epg_broadcast_t *e)
 {
   dvr_autorec_entry_t *dae;
+  channel_tag_mapping_t *ctm;
+  epg_episode_t *ep = e->episode;
+  epg_genre_t *g;
+  lang_str_ele_t *ls;
+  autorec_match_t m;
+  const char *s;
+  int i;
 
-  TAILQ_FOREACH(dae, &autorec_entries, dae_link)
-    if(autorec_cmp(dae, e))
-      dvr_entry_create_by_autorec(e, dae);
+  if (!e->channel || !ep)
+    return;
+
+  memset(&m, 0, sizeof(m));
+  m.ev.e = e;
+  m.v    = m.stack;
+  m.size = ARRAY_SIZE(m.stack);
+  if (++autorec_index_gen == 0)
+    autorec_index_gen = 1;
+
+  LIST_FOREACH(dae, &autorec_index_all, dae_index_link)
+    autorec_match_try(&m, dae);
+  if (e->serieslink)
+    autorec_match_bucket(&m, DAE_INDEX_SERIESLINK, (uintptr_t)e->serieslink);
+  if (ep->season)
+    autorec_match_bucket(&m, DAE_INDEX_SEASON, (uintptr_t)ep->season);
+  if (ep->brand)
+    autorec_match_bucket(&m, DAE_INDEX_BRAND, (uintptr_t)ep->brand);
+  autorec_match_bucket(&m, DAE_INDEX_CHANNEL, (uintptr_t)e->channel);
+  if (ep->title) {
+    RB_FOREACH(ls, ep->title, link) {
+      if (!regexp_icase_ascii(ls->str)) {
+        TAILQ_FOREACH(dae, &autorec_entries, dae_link)
+          if (dae->dae_index_type == DAE_INDEX_TRIGRAM)
+            autorec_match_try(&m, dae);
+        continue;
+      }
+      for (s = ls->str; s[0] && s[1] && s[2]; s++)
+        autorec_match_bucket(&m, DAE_INDEX_TRIGRAM, autorec_trigram(s));
+    }
+  }
+  LIST_FOREACH(ctm, &e->channel->ch_ctms, ctm_channel_link)
+    autorec_match_bucket(&m, DAE_INDEX_TAG, (uintptr_t)ctm->ctm_tag);
+  LIST_FOREACH(g, &ep->genre, link)
+    autorec_match_bucket(&m, DAE_INDEX_GENRE, g->code & 0xF0);
+
+  if (m.count > 1)
+    qsort(m.v, m.count, sizeof(*m.v), autorec_match_seq_cmp);
+  for (i = 0; i < m.count; i++)
+    dvr_entry_create_by_autorec(e, m.v[i]);
+  if (m.v != m.stack)
+    free(m.v);
   // Note: no longer updating event here as it will be done from EPG
   //       anyway
 }
@@ -1102,15 +1345,29 @@ void
 dvr_autorec_changed(dvr_autorec_entry_t *dae, int purge)
 {
   channel_t *ch;
+  channel_tag_mapping_t *ctm;
   epg_broadcast_t *e;
+  autorec_event_t ev;
 
   if (purge)
     dvr_autorec_purge_spawns(dae, 1);
 
+  autorec_index_add(dae);
+
   CHANNEL_FOREACH(ch) {
+    if (dae->dae_index_type == DAE_INDEX_NONE) break;
     if (!ch->ch_enabled) continue;
+    if (dae->dae_index_type == DAE_INDEX_CHANNEL &&
+        ch != dae->dae_channel) continue;
+    if (dae->dae_index_type == DAE_INDEX_TAG) {
+      LIST_FOREACH(ctm, &ch->ch_ctms, ctm_channel_link)
+        if (ctm->ctm_tag == dae->dae_channel_tag) break;
+      if (ctm == NULL) continue;
+    }
     RB_FOREACH(e, &ch->ch_epg_schedule, sched_link) {
-      if(autorec_cmp(dae, e))
+      ev.e = e;
+      ev.tm_valid = 0;
+      if(autorec_cmp(dae, &ev))
         dvr_entry_create_by_autorec(e, dae);
     }
   }
@@ -1142,6 +1399,7 @@ autorec_destroy_by_channel_tag(channel_tag_t *ct, int delconf)
   while((dae = LIST_FIRST(&ct->ct_autorecs)) != NULL) {
     LIST_REMOVE(dae, dae_channel_tag_link);
     dae->dae_channel_tag = NULL;
+    autorec_index_add(dae);
     idnode_notify_simple(&dae->dae_id);
     if (delconf)
       dvr_autorec_save(dae);
@@ -1177,7 +1435,20 @@ autorec_destroy_by_config(dvr_config_t *kcfg, int delconf)
     if (cfg)
       LIST_INSERT_HEAD(&cfg->dvr_autorec_entries, dae, dae_config_link);
     dae->dae_config = cfg;
+    autorec_index_add(dae);
     if (delconf)
       dvr_autorec_save(dae);
   }
 }
+
+/**
+ * The channel test depends on the quality lock of the rule's config
+ */
+void
+dvr_autorec_config_changed(dvr_config_t *cfg)
+{
+  dvr_autorec_entry_t *dae;
+
+  LIST_FOREACH(dae, &cfg->dvr_autorec_entries, dae_config_link)
+    autorec_index_add(dae);
+}
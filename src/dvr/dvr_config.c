@@ -299,6 +299,7 @@ dvr_config_class_save(idnode_t *self)
     cfg->dvr_enabled = 1;
   cfg->dvr_valid = 1;
   dvr_config_save(cfg);
+  dvr_autorec_config_changed(cfg);
 }
 
 static void
@@ -25,6 +25,7 @@
 #include "settings.h"
 
 #include "tvheadend.h"
+#include "config.h"
 #include "dvr.h"
 #include "htsp_server.h"
 #include "streaming.h"
@@ -35,6 +36,20 @@
 
 struct dvr_entry_list dvrentries;
 
+/*
+ * Lookup indexes over dvrentries: short id, broadcast, (title, episode
+ * number) of the broadcast for duplicate detection and start time of
+ * scheduled entries
+ */
+#define DVR_ENTRY_HASH_BITS 12
+#define DVR_ENTRY_HASH_SIZE (1 << DVR_ENTRY_HASH_BITS)
+
+static struct dvr_entry_list dvr_entries_by_id[DVR_ENTRY_HASH_SIZE];
+static struct dvr_entry_list dvr_entries_by_bcast[DVR_ENTRY_HASH_SIZE];
+static struct dvr_entry_list dvr_entries_by_dup[DVR_ENTRY_HASH_SIZE];
+static RB_HEAD(, dvr_entry) dvr_entries_by_start;
+static char *dvr_entries_dup_lang;
+
 #if ENABLE_DBUS_1
 static gtimer_t dvr_dbus_timer;
 #endif
@@ -45,6 +60,120 @@ static void dvr_timer_start_recording(void *aux);
 static void dvr_timer_stop_recording(void *aux);
 static int dvr_entry_class_disp_title_set(void *o, const void *v);
 
+/*
+ * Index maintenance
+ */
+static inline unsigned int
+dvr_entry_ptr_hash(const void *p)
+{
+  return ((uint32_t)((uintptr_t)p >> 4) * 2654435761U) >>
+         (32 - DVR_ENTRY_HASH_BITS);
+}
+
+/* -1 if the episode can't be an episode duplicate (see below) */
+static int
+dvr_entry_dup_hash(epg_episode_t *ee)
+{
+  const char *title;
+  unsigned int h;
+
+  if (ee == NULL || (title = lang_str_get(ee->title, NULL)) == NULL)
+    return -1;
+  if (!ee->epnum.s_num && !ee->epnum.e_num && !ee->epnum.p_num)
+    return -1;
+  h = tvh_strhash(title, UINT_MAX);
+  h = ((h * 31 + ee->epnum.s_num) * 31 + ee->epnum.e_num) * 31 +
+      ee->epnum.p_num;
+  return h & (DVR_ENTRY_HASH_SIZE - 1);
+}
+
+static void
+dvr_entry_index_bcast(dvr_entry_t *de)
+{
+  epg_broadcast_t *e = de->de_bcast;
+  int h;
+
+  if (de->de_bcast_linked) {
+    LIST_REMOVE(de, de_bcast_link);
+    de->de_bcast_linked = 0;
+  }
+  if (de->de_dup_linked) {
+    LIST_REMOVE(de, de_dup_link);
+    de->de_dup_linked = 0;
+  }
+  if (!de->de_indexed || e == NULL)
+    return;
+  LIST_INSERT_HEAD(&dvr_entries_by_bcast[dvr_entry_ptr_hash(e)],
+                   de, de_bcast_link);
+  de->de_bcast_linked = 1;
+  if ((h = dvr_entry_dup_hash(e->episode)) >= 0) {
+    LIST_INSERT_HEAD(&dvr_entries_by_dup[h], de, de_dup_link);
+    de->de_dup_linked = 1;
+  }
+}
+
+/* the title key follows the configured language preference */
+static void
+dvr_entry_index_dup_lang(void)
+{
+  const char *lang = config_get_language() ?: "";
+  dvr_entry_t *de;
+
+  if (dvr_entries_dup_lang && !strcmp(dvr_entries_dup_lang, lang))
+    return;
+  free(dvr_entries_dup_lang);
+  dvr_entries_dup_lang = strdup(lang);
+  LIST_FOREACH(de, &dvrentries, de_global_link)
+    dvr_entry_index_bcast(de);
+}
+
+static int
+dvr_entry_sched_cmp(const dvr_entry_t *a, const dvr_entry_t *b)
+{
+  if (a->de_sched_start != b->de_sched_start)
+    return a->de_sched_start < b->de_sched_start ? -1 : 1;
+  return a < b ? -1 : (a > b);
+}
+
+/* keyed by the start the timer was armed for, see dvr_entry_set_timer() */
+static void
+dvr_entry_index_sched(dvr_entry_t *de)
+{
+  if (de->de_sched_linked) {
+    RB_REMOVE(&dvr_entries_by_start, de, de_sched_link);
+    de->de_sched_linked = 0;
+  }
+  if (!de->de_indexed || de->de_sched_state != DVR_SCHEDULED)
+    return;
+  de->de_sched_start = dvr_entry_get_start_time(de);
+  RB_INSERT_SORTED(&dvr_entries_by_start, de, de_sched_link,
+                   dvr_entry_sched_cmp);
+  de->de_sched_linked = 1;
+}
+
+static void
+dvr_entry_index_add(dvr_entry_t *de)
+{
+  uint32_t id = idnode_get_short_uuid(&de->de_id);
+
+  de->de_indexed = 1;
+  LIST_INSERT_HEAD(&dvr_entries_by_id[id & (DVR_ENTRY_HASH_SIZE - 1)],
+                   de, de_id_link);
+  dvr_entry_index_bcast(de);
+  dvr_entry_index_sched(de);
+}
+
+static void
+dvr_entry_index_remove(dvr_entry_t *de)
+{
+  if (!de->de_indexed)
+    return;
+  LIST_REMOVE(de, de_id_link);
+  de->de_indexed = 0;
+  dvr_entry_index_bcast(de);
+  dvr_entry_index_sched(de);
+}
+
 /*
  * Start / stop time calculators
  */
@@ -122,28 +251,17 @@ static void
 dvr_dbus_timer_cb( void *aux )
 {
   dvr_entry_t *de;
-  time_t result, start, max = 0;
+  time_t result = 0;
   static time_t last_result = 0;
 
   lock_assert(&global_lock);
 
-  /* find the maximum value */
-  LIST_FOREACH(de, &dvrentries, de_global_link) {
-    if (de->de_sched_state != DVR_SCHEDULED)
-      continue;
-    start = dvr_entry_get_start_time(de);
-    if (dispatch_clock < start && start > max)
-      max = start;
-  }
-  /* lower the maximum value */
-  result = max;
-  LIST_FOREACH(de, &dvrentries, de_global_link) {
-    if (de->de_sched_state != DVR_SCHEDULED)
-      continue;
-    start = dvr_entry_get_start_time(de);
-    if (dispatch_clock < start && start < result)
-      result = start;
-  }
+  /* first scheduled start in the future */
+  RB_FOREACH(de, &dvr_entries_by_start, de_sched_link)
+    if (dispatch_clock < de->de_sched_start) {
+      result = de->de_sched_start;
+      break;
+    }
   /* different? send it.... */
   if (result && result != last_result) {
     dbus_emit_signal_s64("/dvr", "next", result);
@@ -159,6 +277,7 @@ static void
 _dvr_entry_completed(dvr_entry_t *de)
 {
   de->de_sched_state = DVR_COMPLETED;
+  dvr_entry_index_sched(de);
 #if ENABLE_INOTIFY
   dvr_inotify_add(de);
 #endif
@@ -328,6 +447,7 @@ dvr_entry_set_timer(dvr_entry_t *de)
     de->de_sched_state = DVR_NOSTATE;
 
   }
+  dvr_entry_index_sched(de);
 }
 
 
@@ -432,6 +552,7 @@ dvr_entry_create(const char *uuid, htsmsg_t *conf)
   de->de_refcnt = 1;
 
   LIST_INSERT_HEAD(&dvrentries, de, de_global_link);
+  dvr_entry_index_add(de);
 
   if (de->de_channel) {
     LIST_FOREACH(de2, &de->de_channel->ch_dvrs, de_channel_link)
@@ -601,31 +722,37 @@ dvr_entry_create_by_event(const char *config_uuid,
 static int _dvr_duplicate_event ( epg_broadcast_t *e )
 {
   dvr_entry_t *de;
+  epg_broadcast_t *ebc;
   epg_episode_num_t empty_epnum;
-  int has_epnum = 1;
+  const char *e_title;
+  int h;
+
+  /* any entry linked to a broadcast of this episode */
+  LIST_FOREACH(ebc, &e->episode->broadcasts, ep_link)
+    LIST_FOREACH(de, &dvr_entries_by_bcast[dvr_entry_ptr_hash(ebc)],
+                 de_bcast_link)
+      if (de->de_bcast == ebc) return 1;
 
   /* skip episode duplicate check below if no episode number */
   memset(&empty_epnum, 0, sizeof(empty_epnum));
   if (epg_episode_number_cmp(&empty_epnum, &e->episode->epnum) == 0)
-    has_epnum = 0;
+    return 0;
 
-  LIST_FOREACH(de, &dvrentries, de_global_link) {
-    if (de->de_bcast) {
-      if (de->de_bcast->episode == e->episode) return 1;
+  dvr_entry_index_dup_lang();
+  if ((h = dvr_entry_dup_hash(e->episode)) < 0)
+    return 0;
+  e_title = lang_str_get(e->episode->title, NULL);
 
-      if (has_epnum) {
-        int ep_dup_det = de->de_config->dvr_episode_duplicate;
+  LIST_FOREACH(de, &dvr_entries_by_dup[h], de_dup_link) {
+    int ep_dup_det = de->de_config->dvr_episode_duplicate;
 
-        if (ep_dup_det) {
-          const char* de_title = lang_str_get(de->de_bcast->episode->title, NULL);
-          const char* e_title = lang_str_get(e->episode->title, NULL);
+    if (ep_dup_det) {
+      const char* de_title = lang_str_get(de->de_bcast->episode->title, NULL);
 
-          /* duplicate if title and episode match */
-          if (de_title && e_title && strcmp(de_title, e_title) == 0
-              && epg_episode_number_cmp(&de->de_bcast->episode->epnum, &e->episode->epnum) == 0) {
-            return 1;
-          }
-        }
+      /* duplicate if title and episode match */
+      if (de_title && e_title && strcmp(de_title, e_title) == 0
+          && epg_episode_number_cmp(&de->de_bcast->episode->epnum, &e->episode->epnum) == 0) {
+        return 1;
       }
     }
   }
@@ -715,6 +842,7 @@ dvr_entry_destroy(dvr_entry_t *de, int delconf)
   if (de->de_channel)
     LIST_REMOVE(de, de_channel_link);
   LIST_REMOVE(de, de_global_link);
+  dvr_entry_index_remove(de);
   de->de_channel = NULL;
 
   dvr_entry_dec_ref(de);
@@ -843,6 +971,7 @@ static dvr_entry_t *_dvr_entry_update
       de->de_bcast->putref(de->de_bcast);
     de->de_bcast = e;
     e->getref(e);
+    dvr_entry_index_bcast(de);
     save = 1;
 
   }
@@ -913,6 +1042,7 @@ dvr_event_replaced(epg_broadcast_t *e, epg_broadcast_t *new_e)
     /* Unlink the broadcast */
     e->putref(e);
     de->de_bcast = NULL;
+    dvr_entry_index_bcast(de);
 
     /* If this was created by autorec - just remove it, it'll get recreated */
     if (de->de_autorec) {
@@ -930,6 +1060,7 @@ dvr_event_replaced(epg_broadcast_t *e, epg_broadcast_t *new_e)
                    e->start, e->stop);
           e->getref(e);
           de->de_bcast = e;
+          dvr_entry_index_bcast(de);
           _dvr_entry_update(de, e, NULL, NULL, NULL, 0, 0, 0, 0, DVR_PRIO_NOTSET, 0);
           break;
         }
@@ -944,11 +1075,10 @@ void dvr_event_updated ( epg_broadcast_t *e )
   de = dvr_entry_find_by_event(e);
   if (de)
     _dvr_entry_update(de, e, NULL, NULL, NULL, 0, 0, 0, 0, DVR_PRIO_NOTSET, 0);
-  else {
-    LIST_FOREACH(de, &dvrentries, de_global_link) {
+  else if (e->channel) {
+    LIST_FOREACH(de, &e->channel->ch_dvrs, de_channel_link) {
       if (de->de_sched_state != DVR_SCHEDULED) continue;
       if (de->de_bcast) continue;
-      if (de->de_channel != e->channel) continue;
       if (dvr_entry_fuzzy_match(de, e)) {
         tvhtrace("dvr",
                  "dvr entry %s link to event %s on %s @ %"PRItime_t
@@ -959,6 +1089,7 @@ void dvr_event_updated ( epg_broadcast_t *e )
                  e->start, e->stop);
         e->getref(e);
         de->de_bcast = e;
+        dvr_entry_index_bcast(de);
         _dvr_entry_update(de, e, NULL, NULL, NULL, 0, 0, 0, 0, DVR_PRIO_NOTSET, 0);
         break;
       }
@@ -966,6 +1097,22 @@ void dvr_event_updated ( epg_broadcast_t *e )
   }
 }
 
+/**
+ * Title or episode number changes (or a broadcast moving to another
+ * episode) move entries in the duplicate index, see epg_updated()
+ */
+void dvr_episode_updated ( epg_episode_t *ee )
+{
+  dvr_entry_t *de;
+  epg_broadcast_t *ebc;
+
+  LIST_FOREACH(ebc, &ee->broadcasts, ep_link)
+    LIST_FOREACH(de, &dvr_entries_by_bcast[dvr_entry_ptr_hash(ebc)],
+                 de_bcast_link)
+      if (de->de_bcast == ebc)
+        dvr_entry_index_bcast(de);
+}
+
 /**
  *
  */
@@ -978,6 +1125,7 @@ dvr_stop_recording(dvr_entry_t *de, int stopcode, int saveconf)
     de->de_sched_state = DVR_MISSED_TIME;
   else
     _dvr_entry_completed(de);
+  dvr_entry_index_sched(de);
 
   dvr_rec_unsubscribe(de, stopcode);
 
@@ -1017,6 +1165,7 @@ dvr_timer_start_recording(void *aux)
 
   de->de_sched_state = DVR_RECORDING;
   de->de_rec_state = DVR_RS_PENDING;
+  dvr_entry_index_sched(de);
 
   tvhlog(LOG_INFO, "dvr", "\"%s\" on \"%s\" recorder starting",
 	 lang_str_get(de->de_title, NULL), DVR_CH_NAME(de));
@@ -1037,7 +1186,8 @@ dvr_entry_t *
 dvr_entry_find_by_id(int id)
 {
   dvr_entry_t *de;
-  LIST_FOREACH(de, &dvrentries, de_global_link)
+  LIST_FOREACH(de, &dvr_entries_by_id[(uint32_t)id & (DVR_ENTRY_HASH_SIZE - 1)],
+               de_id_link)
     if(idnode_get_short_uuid(&de->de_id) == id)
       break;
   return de;  
@@ -1054,8 +1204,8 @@ dvr_entry_find_by_event(epg_broadcast_t *e)
 
   if(!e->channel) return NULL;
 
-  LIST_FOREACH(de, &e->channel->ch_dvrs, de_channel_link)
-    if(de->de_bcast == e) return de;
+  LIST_FOREACH(de, &dvr_entries_by_bcast[dvr_entry_ptr_hash(e)], de_bcast_link)
+    if(de->de_bcast == e && de->de_channel == e->channel) return de;
   return NULL;
 }
 
@@ -1464,6 +1614,7 @@ dvr_entry_class_broadcast_set(void *o, const void *v)
     if (de->de_bcast) {
       de->de_bcast->putref((epg_object_t*)de->de_bcast);
       de->de_bcast = NULL;
+      dvr_entry_index_bcast(de);
       return 1;
     }
   } else if (de->de_bcast != bcast) {
@@ -1471,6 +1622,7 @@ dvr_entry_class_broadcast_set(void *o, const void *v)
       de->de_bcast->putref((epg_object_t*)de->de_bcast);
     de->de_bcast = bcast;
     de->de_bcast->getref((epg_object_t*)bcast);
+    dvr_entry_index_bcast(de);
     return 1;
   }
   return 0;
@@ -2165,4 +2317,6 @@ dvr_entry_done(void)
   lock_assert(&global_lock);
   while ((de = LIST_FIRST(&dvrentries)) != NULL)
       dvr_entry_destroy(de, 0);
+  free(dvr_entries_dup_lang);
+  dvr_entries_dup_lang = NULL;
 }
@@ -498,7 +498,7 @@ dvr_thread(void *aux)
         atomic_add(&de->de_s->ths_bytes_out, pktbuf_len(pb));
     }
 
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
 
     pthread_mutex_unlock(&sq->sq_mutex);
 
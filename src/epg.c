@@ -34,6 +34,7 @@
 #include "htsp_server.h"
 #include "epggrab.h"
 #include "imagecache.h"
+#include "lang_codes.h"
 
 /* Broadcast hashing */
 #define EPG_HASH_WIDTH 1024
@@ -51,10 +52,14 @@ epg_object_tree_t epg_serieslinks;
 /* Other special case lists */
 epg_object_list_t epg_object_unref;
 epg_object_list_t epg_object_updated;
+epg_object_list_t epg_object_journal;
 
 /* Global counter */
 static uint32_t _epg_object_idx    = 0;
 
+/* Channel teardown (delete or shutdown) is not journalled as deletions */
+static int      _epg_journal_unlink = 0;
+
 /*
  *
  */
@@ -114,6 +119,8 @@ void epg_updated ( void )
 {
   epg_object_t *eo;
 
+  tvh_domain_wrlock(LOCK_EPG);
+
   /* Remove unref'd */
   while ((eo = LIST_FIRST(&epg_object_unref))) {
     tvhtrace("epg",
@@ -125,6 +132,15 @@ void epg_updated ( void )
   //       to be useful to DVR since they will relate to episode/seasons/brands
   //       with no valid broadcasts etc..
 
+  /* DVR duplicate detection is keyed on episode title/number, re-key
+     before any of the updated broadcasts is matched */
+  LIST_FOREACH(eo, &epg_object_updated, up_link) {
+    if (eo->type == EPG_EPISODE)
+      dvr_episode_updated((epg_episode_t*)eo);
+    else if (eo->type == EPG_BROADCAST && ((epg_broadcast_t*)eo)->episode)
+      dvr_episode_updated(((epg_broadcast_t*)eo)->episode);
+  }
+
   /* Update updated */
   while ((eo = LIST_FIRST(&epg_object_updated))) {
     eo->update(eo);
@@ -132,10 +148,19 @@ void epg_updated ( void )
     eo->_updated = 0;
     eo->created  = dispatch_clock;
   }
+
+  /* Append changes to the database journal */
+  if (epg_journal_active)
+    epg_journal_flush();
+
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 /* **************************************************************************
  * Object (Generic routines)
+ *
+ * All changes are made with the EPG domain write lock held (nested from
+ * the setters below), so epg_save() can walk the trees with the read lock.
  * *************************************************************************/
 
 static void _epg_object_destroy 
@@ -147,6 +172,7 @@ static void _epg_object_destroy
   if (eo->uri) free(eo->uri);
   if (tree) RB_REMOVE(tree, eo, uri_link);
   if (eo->_updated) LIST_REMOVE(eo, up_link);
+  if (eo->_journal) LIST_REMOVE(eo, jn_link);
   RB_REMOVE(epg_id_tree(eo), eo, id_link);
 }
 
@@ -155,8 +181,10 @@ static void _epg_object_getref ( void *o )
   epg_object_t *eo = o;
   tvhtrace("epg", "eo [%p, %u, %d, %s] getref %d",
            eo, eo->id, eo->type, eo->uri, eo->refcount+1);
+  tvh_domain_wrlock(LOCK_EPG);
   if (eo->refcount == 0) LIST_REMOVE(eo, un_link);
   eo->refcount++;
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 static void _epg_object_putref ( void *o )
@@ -165,8 +193,10 @@ static void _epg_object_putref ( void *o )
   tvhtrace("epg", "eo [%p, %u, %d, %s] putref %d",
            eo, eo->id, eo->type, eo->uri, eo->refcount-1);
   assert(eo->refcount>0);
+  tvh_domain_wrlock(LOCK_EPG);
   eo->refcount--;
   if (!eo->refcount) eo->destroy(eo);
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 static void _epg_object_set_updated ( void *o )
@@ -175,9 +205,17 @@ static void _epg_object_set_updated ( void *o )
   if (!eo->_updated) {
     tvhtrace("epg", "eo [%p, %u, %d, %s] updated",
              eo, eo->id, eo->type, eo->uri);
+    tvh_domain_wrlock(LOCK_EPG);
     eo->_updated = 1;
     eo->updated  = dispatch_clock;
     LIST_INSERT_HEAD(&epg_object_updated, eo, up_link);
+    tvh_domain_unlock(LOCK_EPG);
+  }
+  if (epg_journal_active && !eo->_journal) {
+    tvh_domain_wrlock(LOCK_EPG);
+    eo->_journal = 1;
+    LIST_INSERT_HEAD(&epg_object_journal, eo, jn_link);
+    tvh_domain_unlock(LOCK_EPG);
   }
 }
 
@@ -185,6 +223,7 @@ static void _epg_object_create ( void *o )
 {
   epg_object_t *eo = o;
   uint32_t id = eo->id;
+  tvh_domain_wrlock(LOCK_EPG);
   if (!id) eo->id = ++_epg_object_idx;
   if (!eo->id) eo->id = ++_epg_object_idx;
   if (!eo->getref) eo->getref = _epg_object_getref;
@@ -203,6 +242,7 @@ static void _epg_object_create ( void *o )
     eo->id = ++_epg_object_idx;
     if (!eo->id) eo->id = ++_epg_object_idx;
   }
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 static epg_object_t *_epg_object_find_by_uri 
@@ -222,6 +262,7 @@ static epg_object_t *_epg_object_find_by_uri
   
   /* Find/create */
   } else {
+    tvh_domain_wrlock(LOCK_EPG);
     eo = RB_INSERT_SORTED(tree, *skel, uri_link, _uri_cmp);
     if ( !eo ) {
       *save        = 1;
@@ -230,6 +271,7 @@ static epg_object_t *_epg_object_find_by_uri
       eo->uri      = strdup(uri);
       _epg_object_create(eo);
     }
+    tvh_domain_unlock(LOCK_EPG);
   }
   return eo;
 }
@@ -288,7 +330,9 @@ static int _epg_object_set_grabber ( void *o, epggrab_module_t *grab  )
   if ( !grab ) return 1; // grab=NULL is override
   if ( !eo->grabber ||
        ((eo->grabber != grab) && (grab->priority > eo->grabber->priority)) ) {
+    tvh_domain_wrlock(LOCK_EPG);
     eo->grabber = grab;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return grab == eo->grabber;
 }
@@ -301,9 +345,11 @@ static int _epg_object_set_str
   if ( !eo || !new ) return 0;
   if ( !_epg_object_set_grabber(eo, src) && *old ) return 0;
   if ( !*old || strcmp(*old, new) ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( *old ) free(*old);
     *old = strdup(new);
     _epg_object_set_updated(eo);
+    tvh_domain_unlock(LOCK_EPG);
     save = 1;
   }
   return save;
@@ -317,10 +363,12 @@ static int _epg_object_set_lang_str
   epg_object_t *eo = o;
   if ( !eo || !newstr ) return 0;
   update = _epg_object_set_grabber(eo, src);
+  tvh_domain_wrlock(LOCK_EPG);
   if (!*old) *old = lang_str_create();
   save = lang_str_add(*old, newstr, newlang, update);
   if (save)
     _epg_object_set_updated(eo);
+  tvh_domain_unlock(LOCK_EPG);
   return save;
 }
 
@@ -341,8 +389,10 @@ static int _epg_object_set_u8
   int save = 0;
   if ( !_epg_object_set_grabber(o, src) && *old ) return 0;
   if ( *old != new ) {
+    tvh_domain_wrlock(LOCK_EPG);
     *old = new;
     _epg_object_set_updated(o);
+    tvh_domain_unlock(LOCK_EPG);
     save = 1;
   }
   return save;
@@ -354,8 +404,10 @@ static int _epg_object_set_u16
   int save = 0;
   if ( !_epg_object_set_grabber(o, src) && *old ) return 0;
   if ( *old != new ) {
+    tvh_domain_wrlock(LOCK_EPG);
     *old = new;
     _epg_object_set_updated(o);
+    tvh_domain_unlock(LOCK_EPG);
     save = 1;
   }
   return save;
@@ -680,11 +732,13 @@ int epg_season_set_brand
   if ( !season || !brand ) return 0;
   if ( !_epg_object_set_grabber(season, src) && season->brand ) return 0;
   if ( season->brand != brand ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( season->brand ) _epg_brand_rem_season(season->brand, season);
     season->brand = brand;
     _epg_brand_add_season(brand, season);
     _epg_object_set_updated(season);
     save = 1;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return save;
 }
@@ -823,6 +877,7 @@ static void _epg_episode_destroy ( void *eo )
     tvhlog(LOG_CRIT, "epg", "attempt to destroy episode with broadcasts");
     assert(0);
   }
+  if (epg_journal_active && !_epg_journal_unlink) epg_journal_deleted(eo);
   if (ee->brand)       _epg_brand_rem_episode(ee->brand, ee);
   if (ee->season)      _epg_season_rem_episode(ee->season, ee);
   if (ee->title)       lang_str_destroy(ee->title);
@@ -983,11 +1038,13 @@ int epg_episode_set_brand
   if ( !episode || !brand ) return 0;
   if ( !_epg_object_set_grabber(episode, src) && episode->brand ) return 0;
   if ( episode->brand != brand ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( episode->brand ) _epg_brand_rem_episode(episode->brand, episode);
     episode->brand = brand;
     _epg_brand_add_episode(brand, episode);
     _epg_object_set_updated(episode);
     save = 1;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return save;
 }
@@ -999,6 +1056,7 @@ int epg_episode_set_season
   if ( !episode || !season ) return 0;
   if ( !_epg_object_set_grabber(episode, src) && episode->season ) return 0;
   if ( episode->season != season ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( episode->season ) _epg_season_rem_episode(episode->season, episode);
     episode->season = season;
     _epg_season_add_episode(season, episode);
@@ -1006,6 +1064,7 @@ int epg_episode_set_season
       save |= epg_episode_set_brand(episode, season->brand, src);
     _epg_object_set_updated(episode);
     save = 1;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return save;
 }
@@ -1019,6 +1078,8 @@ int epg_episode_set_genre
   g1 = LIST_FIRST(&ee->genre);
   if (!_epg_object_set_grabber(ee, src) && g1) return 0;
 
+  tvh_domain_wrlock(LOCK_EPG);
+
   /* Remove old */
   while (g1) {
     g2 = LIST_NEXT(g1, link);
@@ -1035,6 +1096,7 @@ int epg_episode_set_genre
     save |= epg_genre_list_add(&ee->genre, g1);
   }
 
+  tvh_domain_unlock(LOCK_EPG);
   return save;
 }
 
@@ -1275,6 +1337,33 @@ epg_episode_t *epg_episode_deserialize ( htsmsg_t *m, int create, int *save )
   return ee;
 }
 
+/* Deletion record (database journal) */
+htsmsg_t *epg_episode_serialize_deleted ( epg_episode_t *episode )
+{
+  htsmsg_t *m;
+  if (!episode || !episode->uri) return NULL;
+  m = htsmsg_create_map();
+  htsmsg_add_str(m, "uri", episode->uri);
+  return m;
+}
+
+int epg_episode_deserialize_deleted ( htsmsg_t *m )
+{
+  epg_object_t *eo;
+  const char *str;
+
+  if ( !(str = htsmsg_get_str(m, "uri")) ) return 0;
+  eo = (epg_object_t*)epg_episode_find_by_uri(str, 0, NULL);
+  if ( !eo || eo->refcount ) return 0;
+
+  /* Unreferenced, still on the unref list */
+  tvh_domain_wrlock(LOCK_EPG);
+  LIST_REMOVE(eo, un_link);
+  eo->destroy(eo);
+  tvh_domain_unlock(LOCK_EPG);
+  return 1;
+}
+
 const char *epg_episode_get_title 
   ( const epg_episode_t *e, const char *lang )
 {
@@ -1394,10 +1483,12 @@ static void _epg_channel_rem_broadcast
   ( channel_t *ch, epg_broadcast_t *ebc, epg_broadcast_t *new )
 {
   if (new) dvr_event_replaced(ebc, new);
+  tvh_domain_wrlock(LOCK_EPG);
   RB_REMOVE(&ch->ch_epg_schedule, ebc, sched_link);
   if (ch->ch_epg_now  == ebc) ch->ch_epg_now  = NULL;
   if (ch->ch_epg_next == ebc) ch->ch_epg_next = NULL;
   _epg_object_putref(ebc);
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 static void _epg_channel_timer_callback ( void *p )
@@ -1406,6 +1497,8 @@ static void _epg_channel_timer_callback ( void *p )
   epg_broadcast_t *ebc, *cur, *nxt;
   channel_t *ch = (channel_t*)p;
 
+  tvh_domain_wrlock(LOCK_EPG);
+
   /* Clear now/next */
   if ((cur = ch->ch_epg_now))
     cur->getref(cur);
@@ -1459,6 +1552,8 @@ static void _epg_channel_timer_callback ( void *p )
   /* Remove refs */
   if (cur) cur->putref(cur);
   if (nxt) nxt->putref(nxt);
+
+  tvh_domain_unlock(LOCK_EPG);
 }
 
 static epg_broadcast_t *_epg_channel_add_broadcast 
@@ -1476,6 +1571,7 @@ static epg_broadcast_t *_epg_channel_add_broadcast
 
   /* Find/Create */
   } else {
+    tvh_domain_wrlock(LOCK_EPG);
     ret = RB_INSERT_SORTED(&ch->ch_epg_schedule, *bcast, sched_link, _ebc_start_cmp);
 
     /* New */
@@ -1496,6 +1592,7 @@ static epg_broadcast_t *_epg_channel_add_broadcast
 
       /* No time change */
       if ( ret->stop == (*bcast)->stop ) {
+        tvh_domain_unlock(LOCK_EPG);
         return ret;
 
       /* Extend in time */
@@ -1540,15 +1637,20 @@ static epg_broadcast_t *_epg_channel_add_broadcast
 
   /* Reset timer */
   if (timer) _epg_channel_timer_callback(ch);
+  tvh_domain_unlock(LOCK_EPG);
   return ret;
 }
 
 void epg_channel_unlink ( channel_t *ch )
 {
   epg_broadcast_t *ebc;
+  tvh_domain_wrlock(LOCK_EPG);
+  _epg_journal_unlink = 1;
   while ( (ebc = RB_FIRST(&ch->ch_epg_schedule)) ) {
     _epg_channel_rem_broadcast(ch, ebc, NULL);
   }
+  _epg_journal_unlink = 0;
+  tvh_domain_unlock(LOCK_EPG);
   gtimer_disarm(&ch->ch_epg_timer);
 }
 
@@ -1559,6 +1661,7 @@ void epg_channel_unlink ( channel_t *ch )
 static void _epg_broadcast_destroy ( void *eo )
 {
   epg_broadcast_t *ebc = eo;
+  if (epg_journal_active && !_epg_journal_unlink) epg_journal_deleted(eo);
   if (ebc->created)     htsp_event_delete(ebc);
   if (ebc->episode)     _epg_episode_rem_broadcast(ebc->episode, ebc);
   if (ebc->serieslink)  _epg_serieslink_rem_broadcast(ebc->serieslink, ebc);
@@ -1630,12 +1733,14 @@ int epg_broadcast_set_episode
   if ( !_epg_object_set_grabber(broadcast, src) && broadcast->episode )
     return 0;
   if ( broadcast->episode != episode ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( broadcast->episode )
       _epg_episode_rem_broadcast(broadcast->episode, broadcast);
     broadcast->episode = episode;
     _epg_episode_add_broadcast(episode, broadcast);
     _epg_object_set_updated(broadcast);
     save = 1;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return save;
 }
@@ -1647,10 +1752,12 @@ int epg_broadcast_set_serieslink
   if ( !ebc || !esl ) return 0;
   if ( !_epg_object_set_grabber(ebc, src) && ebc->serieslink ) return 0;
   if ( ebc->serieslink != esl ) {
+    tvh_domain_wrlock(LOCK_EPG);
     if ( ebc->serieslink ) _epg_serieslink_rem_broadcast(ebc->serieslink, ebc);
     ebc->serieslink = esl;
     _epg_serieslink_add_broadcast(esl, ebc);
     save = 1;
+    tvh_domain_unlock(LOCK_EPG);
   }
   return save;
 }
@@ -1914,6 +2021,35 @@ epg_broadcast_t *epg_broadcast_deserialize
   return ebc;
 }
 
+/* Deletion record (database journal) */
+htsmsg_t *epg_broadcast_serialize_deleted ( epg_broadcast_t *broadcast )
+{
+  htsmsg_t *m;
+  if (!broadcast || !broadcast->channel) return NULL;
+  m = htsmsg_create_map();
+  htsmsg_add_str(m, "channel", channel_get_uuid(broadcast->channel));
+  htsmsg_add_s64(m, "start", broadcast->start);
+  return m;
+}
+
+int epg_broadcast_deserialize_deleted ( htsmsg_t *m )
+{
+  channel_t *ch;
+  epg_broadcast_t *ebc, skel;
+  const char *str;
+  int64_t start;
+
+  if ( !(str = htsmsg_get_str(m, "channel")) ) return 0;
+  if ( htsmsg_get_s64(m, "start", &start) ) return 0;
+  if ( !(ch = channel_find(str)) ) return 0;
+
+  skel.start = start;
+  ebc = RB_FIND(&ch->ch_epg_schedule, &skel, sched_link, _ebc_start_cmp);
+  if (!ebc) return 0;
+  _epg_channel_rem_broadcast(ch, ebc, NULL);
+  return 1;
+}
+
 /* **************************************************************************
  * Genre
  * *************************************************************************/
@@ -2233,6 +2369,34 @@ htsmsg_t *epg_genres_list_all ( int major_only, int major_prefix )
  * Querying
  * *************************************************************************/
 
+/*
+ * Matches are collected together with their sort key, resolved once per
+ * match rather than on every compare. With a limit, only the best 'limit'
+ * rows are kept (a heap with the worst row at the root), eq->entries still
+ * counts all matches.
+ */
+typedef struct epg_query_row {
+  epg_broadcast_t *e;
+  const char      *s;       ///< String sort key
+  int64_t          n;       ///< Numeric sort key
+} epg_query_row_t;
+
+typedef struct epg_query_run {
+  epg_query_t      *eq;
+  const char      **langs;  ///< Split eq->lang
+  int               str;    ///< Sort key is a string
+  epg_query_row_t  *rows;
+  uint32_t          count;
+  uint32_t          allocated;
+} epg_query_run_t;
+
+static inline const char *
+_eq_lang_str ( epg_query_run_t *qr, lang_str_t *ls )
+{
+  lang_str_ele_t *e = lang_str_get3(ls, qr->langs);
+  return e ? e->str : NULL;
+}
+
 static inline int
 _eq_comp_num ( epg_filter_num_t *f, int64_t val )
 {
@@ -2253,15 +2417,138 @@ _eq_comp_str ( epg_filter_str_t *f, const char *str )
     case EC_LT: return strcmp(str, f->str) > 0;
     case EC_GT: return strcmp(str, f->str) < 0;
     case EC_IN: return strstr(str, f->str) != NULL;
-    case EC_RE: return regexec(&f->re, str, 0, NULL, 0) != 0;
+    case EC_RE:
+      if (f->lit && !regexp_literal_match(str, f->lit)) return 1;
+      return regexec(&f->re, str, 0, NULL, 0) != 0;
     default: return 0;
   }
 }
 
+static int
+_eq_row_cmp ( const void *a, const void *b, void *aux )
+{
+  const epg_query_row_t *r1 = a, *r2 = b;
+  epg_query_run_t *qr = aux;
+  int r;
+
+  if (qr->str) {
+    if (r1->s == NULL || r2->s == NULL)
+      r = (r1->s == NULL) - (r2->s == NULL);
+    else
+      r = strcmp(r1->s, r2->s);
+  } else {
+    r = (r1->n > r2->n) - (r1->n < r2->n);
+  }
+  if (qr->eq->sort_dir == ES_DSC)
+    r = -r;
+  /* Keep the order (and so the pages) stable */
+  if (r == 0)
+    r = (r1->e->id > r2->e->id) - (r1->e->id < r2->e->id);
+  return r;
+}
+
+static int64_t
+_eq_genre_key ( epg_episode_t *ep )
+{
+  int64_t k = 0;
+  epg_genre_t *g;
+  int i = 0;
+
+  LIST_FOREACH(g, &ep->genre, link) {
+    if (i == 7) break;
+    k = (k << 8) | g->code;
+    i++;
+  }
+  return k << (8 * (7 - i));
+}
+
+static void
+_eq_row_key ( epg_query_run_t *qr, epg_query_row_t *r )
+{
+  epg_broadcast_t *e = r->e;
+  epg_episode_t *ep = e->episode;
+
+  switch (qr->eq->sort_key) {
+  case ESK_START:       r->n = e->start; break;
+  case ESK_STOP:        r->n = e->stop; break;
+  case ESK_DURATION:    r->n = (int64_t)e->stop - (int64_t)e->start; break;
+  case ESK_TITLE:       r->s = _eq_lang_str(qr, ep->title); break;
+  case ESK_SUBTITLE:    r->s = _eq_lang_str(qr, ep->subtitle); break;
+  case ESK_SUMMARY:     r->s = _eq_lang_str(qr, e->summary); break;
+  case ESK_DESCRIPTION: r->s = _eq_lang_str(qr, e->description); break;
+  case ESK_CHANNEL:     r->s = channel_get_name(e->channel); break;
+  case ESK_CHANNEL_NUM: r->n = channel_get_number(e->channel); break;
+  case ESK_STARS:       r->n = ep->star_rating; break;
+  case ESK_AGE:         r->n = ep->age_rating; break;
+  case ESK_GENRE:       r->n = _eq_genre_key(ep); break;
+  }
+}
+
 static void
-_eq_add ( epg_query_t *eq, epg_broadcast_t *e )
+_eq_heap_up ( epg_query_run_t *qr, uint32_t i )
 {
-  const char *s, *lang = eq->lang;
+  epg_query_row_t t, *rows = qr->rows;
+  uint32_t p;
+
+  while (i > 0) {
+    p = (i - 1) / 2;
+    if (_eq_row_cmp(&rows[i], &rows[p], qr) <= 0) break;
+    t = rows[i]; rows[i] = rows[p]; rows[p] = t;
+    i = p;
+  }
+}
+
+static void
+_eq_heap_down ( epg_query_run_t *qr, uint32_t i )
+{
+  epg_query_row_t t, *rows = qr->rows;
+  uint32_t c;
+
+  while ((c = 2 * i + 1) < qr->count) {
+    if (c + 1 < qr->count && _eq_row_cmp(&rows[c + 1], &rows[c], qr) > 0)
+      c++;
+    if (_eq_row_cmp(&rows[c], &rows[i], qr) <= 0) break;
+    t = rows[i]; rows[i] = rows[c]; rows[c] = t;
+    i = c;
+  }
+}
+
+static void
+_eq_store ( epg_query_run_t *qr, epg_broadcast_t *e )
+{
+  epg_query_t *eq = qr->eq;
+  epg_query_row_t row = { .e = e };
+
+  eq->entries++;
+  _eq_row_key(qr, &row);
+
+  if (eq->limit && qr->count == eq->limit) {
+    if (_eq_row_cmp(&row, &qr->rows[0], qr) < 0) {
+      qr->rows[0] = row;
+      _eq_heap_down(qr, 0);
+    }
+    return;
+  }
+
+  /* More space */
+  if (qr->count == qr->allocated) {
+    qr->allocated = MAX(100, qr->allocated * 2);
+    if (eq->limit)
+      qr->allocated = MIN(qr->allocated, eq->limit);
+    qr->rows = realloc(qr->rows, qr->allocated * sizeof(epg_query_row_t));
+  }
+
+  /* Store */
+  qr->rows[qr->count++] = row;
+  if (eq->limit)
+    _eq_heap_up(qr, qr->count - 1);
+}
+
+static void
+_eq_add ( epg_query_run_t *qr, epg_broadcast_t *e )
+{
+  epg_query_t *eq = qr->eq;
+  const char *s;
   epg_episode_t *ep;
 
   /* Filtering */
@@ -2293,49 +2580,78 @@ _eq_add ( epg_query_t *eq, epg_broadcast_t *e )
     if (!r) return;
   }
   if (eq->title.comp != EC_NO || eq->stitle) {
-    if ((s = epg_episode_get_title(ep, lang)) == NULL) return;
-    if (eq->stitle)
+    if ((s = _eq_lang_str(qr, ep->title)) == NULL) return;
+    if (eq->stitle) {
+      if (eq->stitle_lit && !regexp_literal_match(s, eq->stitle_lit)) return;
       if (regexec(&eq->stitle_re, s, 0, NULL, 0)) return;
+    }
     if (_eq_comp_str(&eq->title, s)) return;
   }
   if (eq->subtitle.comp != EC_NO) {
-    if ((s = epg_episode_get_subtitle(ep, lang)) == NULL) return;
+    if ((s = _eq_lang_str(qr, ep->subtitle)) == NULL) return;
     if (_eq_comp_str(&eq->subtitle, s)) return;
   }
   if (eq->summary.comp != EC_NO) {
-    if ((s = epg_episode_get_summary(ep, lang)) == NULL) return;
+    if ((s = _eq_lang_str(qr, ep->summary)) == NULL) return;
     if (_eq_comp_str(&eq->summary, s)) return;
   }
   if (eq->description.comp != EC_NO) {
-    if ((s = epg_episode_get_description(ep, lang)) == NULL) return;
+    if ((s = _eq_lang_str(qr, ep->description)) == NULL) return;
     if (_eq_comp_str(&eq->description, s)) return;
   }
 
-  /* More space */
-  if (eq->entries == eq->allocated) {
-    eq->allocated = MAX(100, eq->allocated + 100);
-    eq->result    = realloc(eq->result, eq->allocated * sizeof(epg_broadcast_t *));
-  }
+  _eq_store(qr, e);
+}
 
-  /* Store */
-  eq->result[eq->entries++] = e;
+static int
+_eq_start_cmp ( const void *a, const void *b )
+{
+  time_t t1 = ((epg_broadcast_t*)a)->start, t2 = ((epg_broadcast_t*)b)->start;
+  return (t1 > t2) - (t1 < t2);
 }
 
 static void
-_eq_add_channel ( epg_query_t *eq, channel_t *ch )
-{
-  epg_broadcast_t *ebc;
-  RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
+_eq_add_channel ( epg_query_run_t *qr, channel_t *ch )
+{
+  epg_query_t *eq = qr->eq;
+  epg_broadcast_t *ebc, skel;
+  int64_t hi = INT64_MAX;
+
+  /* The schedule is ordered by start, walk only the requested range */
+  switch (eq->start.comp) {
+    case EC_EQ:
+    case EC_GT:
+    case EC_RG:
+      skel.start = eq->start.val1;
+      ebc = RB_FIND_GE(&ch->ch_epg_schedule, &skel, sched_link, _eq_start_cmp);
+      break;
+    default:
+      ebc = RB_FIRST(&ch->ch_epg_schedule);
+      break;
+  }
+  switch (eq->start.comp) {
+    case EC_EQ:
+    case EC_LT: hi = eq->start.val1; break;
+    case EC_RG: hi = eq->start.val2; break;
+    default: break;
+  }
+
+  for ( ; ebc; ebc = RB_NEXT(ebc, sched_link)) {
+    if (ebc->start > hi) break;
     if (ebc->episode)
-      _eq_add(eq, ebc);
+      _eq_add(qr, ebc);
   }
 }
 
 static int
 _eq_init_str( epg_filter_str_t *f )
 {
+  f->lit = NULL;
   if (f->comp != EC_RE) return 0;
-  return regcomp(&f->re, f->str, REG_ICASE | REG_EXTENDED | REG_NOSUB);
+  if (regcomp(&f->re, f->str, REG_ICASE | REG_EXTENDED | REG_NOSUB))
+    return 1;
+  f->lit = regexp_literal(f->str);
+  return 0;
 }
 
 static void
@@ -2345,175 +2661,8 @@ _eq_done_str( epg_filter_str_t *f )
     regfree(&f->re);
   free(f->str);
   f->str = NULL;
-}
-
-static int _epg_sort_start_ascending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)a)->start - (*(epg_broadcast_t**)b)->start;
-}
-
-static int _epg_sort_start_descending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)b)->start - (*(epg_broadcast_t**)a)->start;
-}
-
-static int _epg_sort_stop_ascending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)a)->stop - (*(epg_broadcast_t**)b)->stop;
-}
-
-static int _epg_sort_stop_descending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)b)->stop - (*(epg_broadcast_t**)a)->stop;
-}
-
-static inline int64_t _epg_sort_duration( const epg_broadcast_t *b )
-{
-  return b->stop - b->start;
-}
-
-static int _epg_sort_duration_ascending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_duration(*(epg_broadcast_t**)a) - _epg_sort_duration(*(epg_broadcast_t**)b);
-}
-
-static int _epg_sort_duration_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_duration(*(epg_broadcast_t**)b) - _epg_sort_duration(*(epg_broadcast_t**)a);
-}
-
-static int _epg_sort_title_ascending ( const void *a, const void *b, void *eq )
-{
-  const char *s1 = epg_broadcast_get_title(*(epg_broadcast_t**)a, ((epg_query_t *)eq)->lang);
-  const char *s2 = epg_broadcast_get_title(*(epg_broadcast_t**)b, ((epg_query_t *)eq)->lang);
-  if (s1 == NULL && s2 == NULL) return 0;
-  if (s1 == NULL && s2) return 1;
-  if (s1 && s2 == NULL) return -1;
-  return strcmp(s1, s2);
-}
-
-static int _epg_sort_title_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_title_ascending(a, b, eq) * -1;
-}
-
-static int _epg_sort_subtitle_ascending ( const void *a, const void *b, void *eq )
-{
-  const char *s1 = epg_broadcast_get_subtitle(*(epg_broadcast_t**)a, ((epg_query_t *)eq)->lang);
-  const char *s2 = epg_broadcast_get_subtitle(*(epg_broadcast_t**)b, ((epg_query_t *)eq)->lang);
-  if (s1 == NULL && s2 == NULL) return 0;
-  if (s1 == NULL && s2) return 1;
-  if (s1 && s2 == NULL) return -1;
-  return strcmp(s1, s2);
-}
-
-static int _epg_sort_subtitle_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_subtitle_ascending(a, b, eq) * -1;
-}
-
-static int _epg_sort_summary_ascending ( const void *a, const void *b, void *eq )
-{
-  const char *s1 = epg_broadcast_get_summary(*(epg_broadcast_t**)a, ((epg_query_t *)eq)->lang);
-  const char *s2 = epg_broadcast_get_summary(*(epg_broadcast_t**)b, ((epg_query_t *)eq)->lang);
-  if (s1 == NULL && s2 == NULL) return 0;
-  if (s1 == NULL && s2) return 1;
-  if (s1 && s2 == NULL) return -1;
-  return strcmp(s1, s2);
-}
-
-static int _epg_sort_summary_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_summary_ascending(a, b, eq) * -1;
-}
-
-static int _epg_sort_description_ascending ( const void *a, const void *b, void *eq )
-{
-  const char *s1 = epg_broadcast_get_description(*(epg_broadcast_t**)a, ((epg_query_t *)eq)->lang);
-  const char *s2 = epg_broadcast_get_description(*(epg_broadcast_t**)b, ((epg_query_t *)eq)->lang);
-  if (s1 == NULL && s2 == NULL) return 0;
-  if (s1 == NULL && s2) return 1;
-  if (s1 && s2 == NULL) return -1;
-  return strcmp(s1, s2);
-}
-
-static int _epg_sort_description_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_description_ascending(a, b, eq) * -1;
-}
-
-static int _epg_sort_channel_ascending ( const void *a, const void *b, void *eq )
-{
-  char *s1 = strdup(channel_get_name((*(epg_broadcast_t**)a)->channel));
-  char *s2 = strdup(channel_get_name((*(epg_broadcast_t**)b)->channel));
-  int r = strcmp(s1, s2);
-  free(s2);
-  free(s1);
-  return r;
-}
-
-static int _epg_sort_channel_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_description_ascending(a, b, eq) * -1;
-}
-
-static int _epg_sort_channel_num_ascending ( const void *a, const void *b, void *eq )
-{
-  int64_t v1 = channel_get_number((*(epg_broadcast_t**)a)->channel);
-  int64_t v2 = channel_get_number((*(epg_broadcast_t**)b)->channel);
-  return v1 - v2;
-}
-
-static int _epg_sort_channel_num_descending ( const void *a, const void *b, void *eq )
-{
-  int64_t v1 = channel_get_number((*(epg_broadcast_t**)a)->channel);
-  int64_t v2 = channel_get_number((*(epg_broadcast_t**)b)->channel);
-  return v2 - v1;
-}
-
-static int _epg_sort_stars_ascending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)a)->episode->star_rating - (*(epg_broadcast_t**)b)->episode->star_rating;
-}
-
-static int _epg_sort_stars_descending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)b)->episode->star_rating - (*(epg_broadcast_t**)a)->episode->star_rating;
-}
-
-static int _epg_sort_age_ascending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)a)->episode->age_rating - (*(epg_broadcast_t**)b)->episode->age_rating;
-}
-
-static int _epg_sort_age_descending ( const void *a, const void *b, void *eq )
-{
-  return (*(epg_broadcast_t**)b)->episode->age_rating - (*(epg_broadcast_t**)a)->episode->age_rating;
-}
-
-static uint64_t _epg_sort_genre_hash( epg_episode_t *ep )
-{
-  uint64_t h = 0, t;
-  epg_genre_t *g;
-
-  LIST_FOREACH(g, &ep->genre, link) {
-    t = h >> 28;
-    h <<= 8;
-    h += (uint64_t)g->code + t;
-  }
-  return h;
-}
-
-static int _epg_sort_genre_ascending ( const void *a, const void *b, void *eq )
-{
-  uint64_t v1 = _epg_sort_genre_hash((*(epg_broadcast_t**)a)->episode);
-  uint64_t v2 = _epg_sort_genre_hash((*(epg_broadcast_t**)b)->episode);
-  return v1 - v2;
-}
-
-static int _epg_sort_genre_descending ( const void *a, const void *b, void *eq )
-{
-  return _epg_sort_genre_ascending(a, b, eq) * -1;
+  free(f->lit);
+  f->lit = NULL;
 }
 
 epg_broadcast_t **
@@ -2521,7 +2670,12 @@ epg_query ( epg_query_t *eq, access_t *perm )
 {
   channel_t *channel;
   channel_tag_t *tag;
-  int (*fcn)(const void *, const void *, void *) = NULL;
+  epg_query_run_t qr;
+  uint32_t i;
+
+  memset(&qr, 0, sizeof(qr));
+  qr.eq = eq;
+  eq->stitle_lit = NULL;
 
   /* Setup exp */
   if (_eq_init_str(&eq->title)) goto fin;
@@ -2530,9 +2684,16 @@ epg_query ( epg_query_t *eq, access_t *perm )
   if (_eq_init_str(&eq->description)) goto fin;
   if (_eq_init_str(&eq->channel_name)) goto fin;
 
-  if (eq->stitle)
+  if (eq->stitle) {
     if (regcomp(&eq->stitle_re, eq->stitle, REG_ICASE | REG_EXTENDED | REG_NOSUB))
       goto fin;
+    eq->stitle_lit = regexp_literal(eq->stitle);
+  }
+
+  qr.langs = lang_code_split(eq->lang);
+  qr.str   = eq->sort_key == ESK_TITLE || eq->sort_key == ESK_SUBTITLE ||
+             eq->sort_key == ESK_SUMMARY || eq->sort_key == ESK_DESCRIPTION ||
+             eq->sort_key == ESK_CHANNEL;
 
   channel = channel_find_by_uuid(eq->channel) ?:
             channel_find_by_name(eq->channel);
@@ -2543,7 +2704,7 @@ epg_query ( epg_query_t *eq, access_t *perm )
   /* Single channel */
   if (channel && tag == NULL) {
     if (channel_access(channel, perm, 0))
-      _eq_add_channel(eq, channel);
+      _eq_add_channel(&qr, channel);
   
   /* Tag based */
   } else if (tag) {
@@ -2553,54 +2714,30 @@ epg_query ( epg_query_t *eq, access_t *perm )
       ch2 = ctm->ctm_channel;
       if(ch2 == channel || channel == NULL)
         if (channel_access(ch2, perm, 0))
-          _eq_add_channel(eq, ch2);
+          _eq_add_channel(&qr, ch2);
     }
 
   /* All channels */
   } else {
     CHANNEL_FOREACH(channel)
       if (channel_access(channel, perm, 0))
-        _eq_add_channel(eq, channel);
-  }
-
-  switch (eq->sort_dir) {
-  case ES_ASC:
-    switch (eq->sort_key) {
-    case ESK_START:       fcn = _epg_sort_start_ascending;        break;
-    case ESK_STOP:        fcn = _epg_sort_stop_ascending;         break;
-    case ESK_DURATION:    fcn = _epg_sort_duration_ascending;     break;
-    case ESK_TITLE:       fcn = _epg_sort_title_ascending;        break;
-    case ESK_SUBTITLE:    fcn = _epg_sort_subtitle_ascending;     break;
-    case ESK_SUMMARY:     fcn = _epg_sort_summary_ascending;      break;
-    case ESK_DESCRIPTION: fcn = _epg_sort_description_ascending;  break;
-    case ESK_CHANNEL:     fcn = _epg_sort_channel_ascending;      break;
-    case ESK_CHANNEL_NUM: fcn = _epg_sort_channel_num_ascending;  break;
-    case ESK_STARS:       fcn = _epg_sort_stars_ascending;        break;
-    case ESK_AGE:         fcn = _epg_sort_age_ascending;          break;
-    case ESK_GENRE:       fcn = _epg_sort_genre_ascending;        break;
-    }
-    break;
-  case ES_DSC:
-    switch (eq->sort_key) {
-    case ESK_START:       fcn = _epg_sort_start_descending;       break;
-    case ESK_STOP:        fcn = _epg_sort_stop_descending;        break;
-    case ESK_DURATION:    fcn = _epg_sort_duration_descending;    break;
-    case ESK_TITLE:       fcn = _epg_sort_title_descending;       break;
-    case ESK_SUBTITLE:    fcn = _epg_sort_subtitle_descending;    break;
-    case ESK_SUMMARY:     fcn = _epg_sort_summary_descending;     break;
-    case ESK_DESCRIPTION: fcn = _epg_sort_description_descending; break;
-    case ESK_CHANNEL:     fcn = _epg_sort_channel_descending;     break;
-    case ESK_CHANNEL_NUM: fcn = _epg_sort_channel_num_descending; break;
-    case ESK_STARS:       fcn = _epg_sort_stars_descending;       break;
-    case ESK_AGE:         fcn = _epg_sort_age_descending;         break;
-    case ESK_GENRE:       fcn = _epg_sort_genre_descending;       break;
-    }
-    break;
+        _eq_add_channel(&qr, channel);
   }
 
-  tvh_qsort_r(eq->result, eq->entries, sizeof(epg_broadcast_t *), fcn, eq);
+  /* Sort (the kept rows only) */
+  tvh_qsort_r(qr.rows, qr.count, sizeof(epg_query_row_t), _eq_row_cmp, &qr);
+
+  if (qr.count) {
+    eq->result    = malloc(qr.count * sizeof(epg_broadcast_t *));
+    eq->allocated = qr.count;
+    for (i = 0; i < qr.count; i++)
+      eq->result[i] = qr.rows[i].e;
+  }
 
 fin:
+  free(qr.rows);
+  free(qr.langs);
+
   _eq_done_str(&eq->title);
   _eq_done_str(&eq->subtitle);
   _eq_done_str(&eq->summary);
@@ -2609,6 +2746,7 @@ fin:
 
   if (eq->stitle)
     regfree(&eq->stitle_re);
+  free(eq->stitle_lit); eq->stitle_lit = NULL;
 
   free(eq->lang); eq->lang = NULL;
   free(eq->channel); eq->channel = NULL;
@@ -108,6 +108,7 @@ struct epg_object
   RB_ENTRY(epg_object)    id_link;    ///< Global (ID) link
   LIST_ENTRY(epg_object)  un_link;    ///< Global unref'd link
   LIST_ENTRY(epg_object)  up_link;    ///< Global updated link
+  LIST_ENTRY(epg_object)  jn_link;    ///< Global journal link
  
   epg_object_type_t       type;       ///< Specific object type
   uint32_t                id;         ///< Internal ID
@@ -116,6 +117,7 @@ struct epg_object
   time_t                  updated;    ///< Last time object was changed
 
   int                     _updated;   ///< Flag to indicate updated
+  int                     _journal;   ///< Flag to indicate journal pending
   int                     refcount;   ///< Reference counting
   // Note: could use LIST_ENTRY field to determine this!
 
@@ -382,6 +384,8 @@ int epg_episode_fuzzy_match
 /* Serialization */
 htsmsg_t      *epg_episode_serialize   ( epg_episode_t *b );
 epg_episode_t *epg_episode_deserialize ( htsmsg_t *m, int create, int *save );
+htsmsg_t      *epg_episode_serialize_deleted   ( epg_episode_t *b );
+int            epg_episode_deserialize_deleted ( htsmsg_t *m );
 
 /* ************************************************************************
  * Series Link - broadcast level linkage
@@ -520,6 +524,8 @@ const char *epg_broadcast_get_description
 htsmsg_t        *epg_broadcast_serialize   ( epg_broadcast_t *b );
 epg_broadcast_t *epg_broadcast_deserialize 
   ( htsmsg_t *m, int create, int *save );
+htsmsg_t        *epg_broadcast_serialize_deleted   ( epg_broadcast_t *b );
+int              epg_broadcast_deserialize_deleted ( htsmsg_t *m );
 
 /* ************************************************************************
  * Channel - provides mapping from EPG channels to real channels
@@ -551,6 +557,7 @@ typedef enum {
 typedef struct epg_filter_str {
   char      *str;
   regex_t    re;
+  char      *lit;   ///< Literal the regexp requires (internal)
   epg_comp_t comp;
 } epg_filter_str_t;
 
@@ -579,6 +586,7 @@ typedef struct epg_query {
   epg_filter_num_t  channel_num;
   char             *stitle;
   regex_t           stitle_re;
+  char             *stitle_lit;
   char             *channel;
   char             *channel_tag;
   uint32_t          genre_count;
@@ -604,6 +612,10 @@ typedef struct epg_query {
     ES_DSC
   } sort_dir;
 
+  /* Pagination, only the first 'limit' sorted results are returned
+   * (0 = all), entries still counts all matches */
+  uint32_t          limit;
+
   /* Result */
   epg_broadcast_t **result;
   uint32_t          entries;
@@ -624,4 +636,10 @@ void epg_save    (void);
 void epg_save_callback (void *p);
 void epg_updated (void);
 
+/* Journalled database (epgdb.c) */
+extern int epg_journal_active;
+void epg_journal       (int on);
+void epg_journal_flush (void);
+void epg_journal_deleted (epg_object_t *eo);
+
 #endif /* EPG_H */
@@ -17,10 +17,12 @@
  */
 
 #include <string.h>
+#include <fcntl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
 
 #include "tvheadend.h"
 #include "queue.h"
@@ -29,13 +31,23 @@
 #include "channels.h"
 #include "epg.h"
 #include "epggrab.h"
+#include "atomic.h"
 
 #define EPG_DB_VERSION 2
 
+/* Journal size that triggers compaction (at least the snapshot size) */
+#define EPG_DB_JOURNAL_MINCOMPACT (4 * 1024 * 1024)
+/* seconds before an automatic compaction is retried after a failure */
+#define EPG_DB_JOURNAL_RETRY      300
+
 extern epg_object_tree_t epg_brands;
 extern epg_object_tree_t epg_seasons;
 extern epg_object_tree_t epg_episodes;
 extern epg_object_tree_t epg_serieslinks;
+extern epg_object_list_t epg_object_journal;
+
+static void _epgdb_journal_start ( void );
+static void _epgdb_journal_stop  ( void );
 
 /* **************************************************************************
  * Load
@@ -131,6 +143,12 @@ _epgdb_v2_process( char **sect, htsmsg_t *m, epggrab_stats_t *stats )
   } else if ( !strcmp(*sect, "broadcasts") ) {
     if (epg_broadcast_deserialize(m, 1, &save)) stats->broadcasts.total++;
 
+  /* Deletions (journal only) */
+  } else if ( !strcmp(*sect, "deleted_broadcasts") ) {
+    if (epg_broadcast_deserialize_deleted(m)) stats->broadcasts.total--;
+  } else if ( !strcmp(*sect, "deleted_episodes") ) {
+    if (epg_episode_deserialize_deleted(m)) stats->episodes.total--;
+
   /* Global config */
   } else if ( !strcmp(*sect, "config") ) {
     if (epg_config_deserialize(m)) stats->config.total++;
@@ -143,107 +161,398 @@ _epgdb_v2_process( char **sect, htsmsg_t *m, epggrab_stats_t *stats )
 }
 
 /*
- * Load data
+ * Parse a database file (snapshot or journal)
+ *
+ * cb is called for each record with the message and its raw (serialized)
+ * data, it returns non-zero when it took ownership of the message.
  */
-void epg_init ( void )
+typedef int (*epgdb_record_cb_t)
+  ( void *aux, char **sect, htsmsg_t *m, const uint8_t *raw, size_t rawlen );
+
+static uint8_t *_epgdb_map ( int fd, size_t *size )
 {
-  int fd = -1;
   struct stat st;
-  size_t remain;
-  uint8_t *mem, *rp;
-  epggrab_stats_t stats;
-  int ver = EPG_DB_VERSION;
-  char *sect = NULL;
+  uint8_t *mem;
 
-  /* Find the right file (and version) */
-  while (fd < 0 && ver > 0) {
-    fd = hts_settings_open_file(0, "epgdb.v%d", ver);
-    if (fd > 0) break;
-    ver--;
-  }
-  if ( fd < 0 )
-    fd = hts_settings_open_file(0, "epgdb");
-  if ( fd < 0 ) {
-    tvhlog(LOG_DEBUG, "epgdb", "database does not exist");
-    return;
-  }
-  
   /* Map file to memory */
   if ( fstat(fd, &st) != 0 ) {
     tvhlog(LOG_ERR, "epgdb", "failed to detect database size");
-    return;
+    return NULL;
   }
   if ( !st.st_size ) {
     tvhlog(LOG_DEBUG, "epgdb", "database is empty");
-    return;
+    return NULL;
   }
-  remain   = st.st_size;
-  rp = mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  mem = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
   if ( mem == MAP_FAILED ) {
     tvhlog(LOG_ERR, "epgdb", "failed to mmap database");
-    return;
+    return NULL;
   }
+  *size = st.st_size;
+  return mem;
+}
 
-  /* Process */
-  memset(&stats, 0, sizeof(stats));
-  while ( remain > 4 ) {
+/*
+ * Records are decoded in parallel: the file is indexed in windows of
+ * records, decoder threads deserialize a window while the calling
+ * thread applies (links) the previous one in file order. The EPG itself
+ * is only ever modified by the calling thread.
+ */
+#define EPGDB_DECODE_WINDOW  8192
+#define EPGDB_DECODE_BATCH   64
+#define EPGDB_DECODE_THREADS 8
+#define EPGDB_PARSE_SECTS    8
+
+typedef struct epgdb_window
+{
+  int                 count;
+  volatile int        next;         ///< Next record to decode
+  volatile int        done;         ///< Decoded records
+  const uint8_t      *rec[EPGDB_DECODE_WINDOW];
+  uint32_t            len[EPGDB_DECODE_WINDOW];
+  htsmsg_t           *msg[EPGDB_DECODE_WINDOW];
+} epgdb_window_t;
+
+typedef struct epgdb_decoder
+{
+  pthread_mutex_t     lock;
+  pthread_cond_t      cond;
+  epgdb_window_t     *win;
+  int                 run;
+  int                 threads;
+  pthread_t           tid[EPGDB_DECODE_THREADS];
+} epgdb_decoder_t;
+
+/* Load time statistics */
+typedef struct epgdb_parse_stats
+{
+  int                 threads;
+  int64_t             decode;       ///< Time spent waiting for decoders
+  int                 count;
+  struct {
+    char             *name;
+    int               records;
+    int64_t           time;
+  } sect[EPGDB_PARSE_SECTS];
+} epgdb_parse_stats_t;
+
+static inline int64_t _epgdb_clock ( void )
+{
+  struct timespec tp;
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+  return tp.tv_sec * 1000000LL + (tp.tv_nsec / 1000);
+}
+
+static void _epgdb_decode ( epgdb_decoder_t *dec, epgdb_window_t *w )
+{
+  int i, j, n;
+
+  while ((i = atomic_add(&w->next, EPGDB_DECODE_BATCH)) < w->count) {
+    n = MIN(i + EPGDB_DECODE_BATCH, w->count);
+    for (j = i; j < n; j++)
+      w->msg[j] = htsmsg_binary_deserialize(w->rec[j], w->len[j], NULL);
+    if (atomic_add(&w->done, n - i) + (n - i) == w->count) {
+      pthread_mutex_lock(&dec->lock);
+      pthread_cond_broadcast(&dec->cond);
+      pthread_mutex_unlock(&dec->lock);
+    }
+  }
+}
+
+static void *_epgdb_decode_thread ( void *aux )
+{
+  epgdb_decoder_t *dec = aux;
+  epgdb_window_t *w;
+
+  pthread_mutex_lock(&dec->lock);
+  while (dec->run) {
+    w = dec->win;
+    if (w == NULL || w->next >= w->count) {
+      pthread_cond_wait(&dec->cond, &dec->lock);
+      continue;
+    }
+    pthread_mutex_unlock(&dec->lock);
+    _epgdb_decode(dec, w);
+    pthread_mutex_lock(&dec->lock);
+  }
+  pthread_mutex_unlock(&dec->lock);
+  return NULL;
+}
+
+/* Index the next window of records, hand it to the decoders */
+static void _epgdb_window_fill
+  ( epgdb_decoder_t *dec, epgdb_window_t *w,
+    const uint8_t **rpp, size_t *remainp )
+{
+  const uint8_t *rp = *rpp;
+  size_t remain = *remainp;
+  uint32_t msglen;
+  int n = 0;
+
+  while ( remain > 4 && n < EPGDB_DECODE_WINDOW ) {
 
     /* Get message length */
-    uint32_t msglen = (rp[0] << 24) | (rp[1] << 16) | (rp[2] << 8) | rp[3];
-    remain    -= 4;
-    rp        += 4;
+    msglen  = (rp[0] << 24) | (rp[1] << 16) | (rp[2] << 8) | rp[3];
+    remain -= 4;
+    rp     += 4;
 
     /* Safety check */
     if ((int64_t)msglen > remain) {
       tvhlog(LOG_ERR, "epgdb", "corruption detected, some/all data lost");
+      remain = 0;
       break;
     }
-    
-    /* Extract message */
-    htsmsg_t *m = htsmsg_binary_deserialize(rp, msglen, NULL);
+
+    w->rec[n] = rp;
+    w->len[n] = msglen;
+    w->msg[n] = NULL;
+    n++;
 
     /* Next */
     rp     += msglen;
     remain -= msglen;
+  }
+  *rpp     = rp;
+  *remainp = remain;
+
+  /* next stays beyond count until the window is published */
+  pthread_mutex_lock(&dec->lock);
+  w->count = n;
+  w->done  = 0;
+  __sync_synchronize();
+  w->next  = 0;
+  dec->win = w;
+  pthread_cond_broadcast(&dec->cond);
+  pthread_mutex_unlock(&dec->lock);
+}
 
-    /* Skip */
-    if (!m) continue;
+static void _epgdb_parse_time
+  ( epgdb_parse_stats_t *st, int *idx, const char *sect, int64_t *since )
+{
+  int64_t now = _epgdb_clock();
+  int i;
 
-    /* Process */
-    switch (ver) {
-      case 2:
-        _epgdb_v2_process(&sect, m, &stats);
-        break;
-      default:
-        break;
+  if (*idx >= 0)
+    st->sect[*idx].time += now - *since;
+  *since = now;
+  if (!sect)
+    return;
+  for (i = 0; i < st->count; i++)
+    if (!strcmp(st->sect[i].name, sect))
+      break;
+  if (i == st->count) {
+    if (i == EPGDB_PARSE_SECTS) {
+      *idx = -1;
+      return;
     }
+    st->sect[i].name = strdup(sect);
+    st->count++;
+  }
+  *idx = i;
+}
 
-    /* Cleanup */
-    htsmsg_destroy(m);
+static void _epgdb_parse
+  ( const uint8_t *rp, size_t remain, epgdb_record_cb_t cb, void *aux,
+    epgdb_parse_stats_t *st )
+{
+  epgdb_decoder_t dec;
+  epgdb_window_t *w[2], *win;
+  epgdb_parse_stats_t tmp;
+  char *sect = NULL;
+  int64_t since, mono;
+  int i, cur = 0, idx = -1, marker;
+  long cpus;
+  htsmsg_t *m;
+
+  if (!st) {
+    memset(&tmp, 0, sizeof(tmp));
+    st = &tmp;
+  }
+
+  /* Decoders (the calling thread helps too) */
+  memset(&dec, 0, sizeof(dec));
+  pthread_mutex_init(&dec.lock, NULL);
+  pthread_cond_init(&dec.cond, NULL);
+  cpus = sysconf(_SC_NPROCESSORS_ONLN);
+  dec.threads = MAX(0, MIN(cpus - 1, EPGDB_DECODE_THREADS));
+  if (remain < EPGDB_DECODE_WINDOW * 16)
+    dec.threads = 0;
+  dec.run = 1;
+  for (i = 0; i < dec.threads; i++)
+    tvhthread_create(&dec.tid[i], NULL, _epgdb_decode_thread, &dec);
+  st->threads = MAX(st->threads, dec.threads);
+
+  w[0] = calloc(1, sizeof(epgdb_window_t));
+  w[1] = calloc(1, sizeof(epgdb_window_t));
+  since = _epgdb_clock();
+  _epgdb_window_fill(&dec, w[0], &rp, &remain);
+
+  while ((win = w[cur])->count > 0) {
+
+    /* Wait for the window */
+    mono = _epgdb_clock();
+    _epgdb_decode(&dec, win);
+    pthread_mutex_lock(&dec.lock);
+    while (win->done < win->count)
+      pthread_cond_wait(&dec.cond, &dec.lock);
+    pthread_mutex_unlock(&dec.lock);
+    st->decode += _epgdb_clock() - mono;
+
+    /* Decode ahead */
+    cur ^= 1;
+    _epgdb_window_fill(&dec, w[cur], &rp, &remain);
+
+    /* Link */
+    for (i = 0; i < win->count; i++) {
+      if (!(m = win->msg[i])) continue;
+      win->msg[i] = NULL;
+      marker = htsmsg_get_str(m, "__section__") != NULL;
+      if (!cb(aux, &sect, m, win->rec[i] - 4, win->len[i] + 4))
+        htsmsg_destroy(m);
+      if (marker)
+        _epgdb_parse_time(st, &idx, sect, &since);
+      else if (idx >= 0)
+        st->sect[idx].records++;
+    }
   }
+  _epgdb_parse_time(st, &idx, NULL, &since);
 
+  /* Stop decoders */
+  pthread_mutex_lock(&dec.lock);
+  dec.run = 0;
+  pthread_cond_broadcast(&dec.cond);
+  pthread_mutex_unlock(&dec.lock);
+  for (i = 0; i < dec.threads; i++)
+    pthread_join(dec.tid[i], NULL);
+  pthread_cond_destroy(&dec.cond);
+  pthread_mutex_destroy(&dec.lock);
+
+  free(w[0]);
+  free(w[1]);
   free(sect);
+  if (st == &tmp)
+    for (i = 0; i < tmp.count; i++)
+      free(tmp.sect[i].name);
+}
+
+static int _epgdb_read
+  ( int fd, epgdb_record_cb_t cb, void *aux, epgdb_parse_stats_t *st )
+{
+  uint8_t *mem;
+  size_t size;
+
+  if (!(mem = _epgdb_map(fd, &size)))
+    return -1;
+  _epgdb_parse(mem, size, cb, aux, st);
+  munmap(mem, size);
+  return 0;
+}
+
+typedef struct epgdb_load {
+  int                 ver;
+  int                 records;
+  epggrab_stats_t     stats;
+  epgdb_parse_stats_t time;
+} epgdb_load_t;
 
-  if (!stats.config.total) {
-    htsmsg_t *m = htsmsg_create_map();
-    /* it's not correct, but at least something */
-    htsmsg_add_u32(m, "last_id", 64 * 1024 * 1024);
-    if (!epg_config_deserialize(m))
-      assert(0);
+static int _epgdb_load_record
+  ( void *aux, char **sect, htsmsg_t *m, const uint8_t *raw, size_t rawlen )
+{
+  epgdb_load_t *ld = aux;
+  ld->records++;
+  switch (ld->ver) {
+    case 2:
+      _epgdb_v2_process(sect, m, &ld->stats);
+      break;
+    default:
+      break;
   }
+  return 0;
+}
 
-  /* Stats */
-  tvhlog(LOG_INFO, "epgdb", "loaded v%d", ver);
-  tvhlog(LOG_INFO, "epgdb", "  config     %d", stats.config.total);
-  tvhlog(LOG_INFO, "epgdb", "  channels   %d", stats.channels.total);
-  tvhlog(LOG_INFO, "epgdb", "  brands     %d", stats.brands.total);
-  tvhlog(LOG_INFO, "epgdb", "  seasons    %d", stats.seasons.total);
-  tvhlog(LOG_INFO, "epgdb", "  episodes   %d", stats.episodes.total);
-  tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", stats.broadcasts.total);
+static int _epgdb_journal_replay ( epgdb_load_t *ld, const char *name )
+{
+  int fd;
 
-  /* Close file */
-  munmap(mem, st.st_size);
+  if ((fd = hts_settings_open_file(0, "epgdb.v%d.%s", EPG_DB_VERSION, name)) < 0)
+    return 0;
+  ld->ver     = EPG_DB_VERSION;
+  ld->records = 0;
+  _epgdb_read(fd, _epgdb_load_record, ld, &ld->time);
   close(fd);
+  return ld->records;
+}
+
+/*
+ * Load data
+ */
+void epg_init ( void )
+{
+  int fd = -1, loaded = 0, journal = 0, i;
+  epgdb_load_t ld;
+  int ver = EPG_DB_VERSION;
+  int64_t mono = _epgdb_clock();
+
+  memset(&ld, 0, sizeof(ld));
+
+  /* Find the right file (and version) */
+  while (fd < 0 && ver > 0) {
+    fd = hts_settings_open_file(0, "epgdb.v%d", ver);
+    if (fd > 0) break;
+    ver--;
+  }
+  if ( fd < 0 )
+    fd = hts_settings_open_file(0, "epgdb");
+  if ( fd < 0 ) {
+    tvhlog(LOG_DEBUG, "epgdb", "database does not exist");
+  } else {
+    ld.ver = ver;
+    loaded = !_epgdb_read(fd, _epgdb_load_record, &ld, &ld.time);
+    close(fd);
+  }
+
+  /* Replay journal (rotated part first) */
+  if (!loaded)
+    ver = EPG_DB_VERSION;
+  if (ver == EPG_DB_VERSION) {
+    journal += _epgdb_journal_replay(&ld, "journal.1");
+    journal += _epgdb_journal_replay(&ld, "journal");
+  }
+
+  if (loaded || journal) {
+    if (!ld.stats.config.total) {
+      htsmsg_t *m = htsmsg_create_map();
+      /* it's not correct, but at least something */
+      htsmsg_add_u32(m, "last_id", 64 * 1024 * 1024);
+      if (!epg_config_deserialize(m))
+        assert(0);
+    }
+
+    /* Stats */
+    tvhlog(LOG_INFO, "epgdb", "loaded v%d", ver);
+    tvhlog(LOG_INFO, "epgdb", "  config     %d", ld.stats.config.total);
+    tvhlog(LOG_INFO, "epgdb", "  channels   %d", ld.stats.channels.total);
+    tvhlog(LOG_INFO, "epgdb", "  brands     %d", ld.stats.brands.total);
+    tvhlog(LOG_INFO, "epgdb", "  seasons    %d", ld.stats.seasons.total);
+    tvhlog(LOG_INFO, "epgdb", "  episodes   %d", ld.stats.episodes.total);
+    tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", ld.stats.broadcasts.total);
+    if (journal)
+      tvhlog(LOG_INFO, "epgdb", "  journal    %d", journal);
+    tvhlog(LOG_INFO, "epgdb", "  load time  %"PRId64" ms"
+           " (%d decoder threads, %"PRId64" ms waiting for decode)",
+           (_epgdb_clock() - mono) / 1000, ld.time.threads,
+           ld.time.decode / 1000);
+    for (i = 0; i < ld.time.count; i++)
+      tvhlog(LOG_INFO, "epgdb", "  %-11s %d records in %"PRId64" ms",
+             ld.time.sect[i].name, ld.time.sect[i].records,
+             ld.time.sect[i].time / 1000);
+  }
+  for (i = 0; i < ld.time.count; i++)
+    free(ld.time.sect[i].name);
+
+  /* Continue journalling on top of what was loaded */
+  if (epggrab_epgdb_journal)
+    _epgdb_journal_start();
 }
 
 void epg_done ( void )
@@ -251,6 +560,12 @@ void epg_done ( void )
   channel_t *ch;
 
   pthread_mutex_lock(&global_lock);
+  if (epg_journal_active) {
+    tvh_domain_wrlock(LOCK_EPG);
+    epg_journal_flush();
+    tvh_domain_unlock(LOCK_EPG);
+    _epgdb_journal_stop();
+  }
   CHANNEL_FOREACH(ch)
     epg_channel_unlink(ch);
   epg_skel_done();
@@ -279,21 +594,51 @@ static int _epg_write ( int fd, htsmsg_t *m )
   return ret;
 }
 
-static int _epg_write_sect ( int fd, const char *sect )
+static htsmsg_t *_epg_sect ( const char *sect )
 {
   htsmsg_t *m = htsmsg_create_map();
   htsmsg_add_str(m, "__section__", sect);
-  return _epg_write(fd, m);
+  return m;
+}
+
+static int _epg_write_sect ( int fd, const char *sect )
+{
+  return _epg_write(fd, _epg_sect(sect));
+}
+
+static void _epg_sbuf_add ( sbuf_t *sb, htsmsg_t *m )
+{
+  size_t msglen;
+  void *msgdata;
+  if (!m) return;
+  if (!htsmsg_binary_serialize(m, &msgdata, &msglen, 0x10000)) {
+    sbuf_append(sb, msgdata, msglen);
+    free(msgdata);
+  }
+  htsmsg_destroy(m);
 }
 
+static void _epgdb_journal_compact_request ( void );
+static void _epgdb_journal_wait ( void );
+
+/* Whole database writes and switching the journal on/off */
+static pthread_mutex_t epgdb_save_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Periodic save, runs as a LOCK_EPG domain timer (without global_lock).
+ * epg_save() takes the read lock itself only while serializing.
+ */
 void epg_save_callback ( void *p )
 {
+  tvh_domain_unlock(LOCK_EPG);
   epg_save();
+  tvh_domain_rdlock(LOCK_EPG);
 }
 
 void epg_save ( void )
 {
-  int fd;
+  int fd, r;
+  sbuf_t sb;
   epg_object_t *eo;
   epg_broadcast_t *ebc;
   channel_t *ch;
@@ -302,42 +647,72 @@ void epg_save ( void )
 
   if (epggrab_epgdb_periodicsave)
     gtimer_arm(&epggrab_save_timer, epg_save_callback, NULL, epggrab_epgdb_periodicsave);
-  
-  fd = hts_settings_open_file(1, "epgdb.v%d", EPG_DB_VERSION);
-  if (fd < 0)
+
+  /* Journalled, the journal thread writes the new snapshot */
+  pthread_mutex_lock(&epgdb_save_mutex);
+  if (epg_journal_active) {
+    _epgdb_journal_compact_request();
+    pthread_mutex_unlock(&epgdb_save_mutex);
     return;
+  }
+  _epgdb_journal_wait();
 
+  /* Serialize in memory, the file is written without the EPG lock */
   memset(&stats, 0, sizeof(stats));
-  if ( _epg_write_sect(fd, "config") ) goto error;
-  if (_epg_write(fd, epg_config_serialize())) goto error;
-  if ( _epg_write_sect(fd, "brands") ) goto error;
+  sbuf_init(&sb);
+  tvh_domain_rdlock(LOCK_EPG);
+  _epg_sbuf_add(&sb, _epg_sect("config"));
+  _epg_sbuf_add(&sb, epg_config_serialize());
+  _epg_sbuf_add(&sb, _epg_sect("brands"));
   RB_FOREACH(eo,  &epg_brands, uri_link) {
-    if (_epg_write(fd, epg_brand_serialize((epg_brand_t*)eo))) goto error;
+    _epg_sbuf_add(&sb, epg_brand_serialize((epg_brand_t*)eo));
     stats.brands.total++;
   }
-  if ( _epg_write_sect(fd, "seasons") ) goto error;
+  _epg_sbuf_add(&sb, _epg_sect("seasons"));
   RB_FOREACH(eo,  &epg_seasons, uri_link) {
-    if (_epg_write(fd, epg_season_serialize((epg_season_t*)eo))) goto error;
+    _epg_sbuf_add(&sb, epg_season_serialize((epg_season_t*)eo));
     stats.seasons.total++;
   }
-  if ( _epg_write_sect(fd, "episodes") ) goto error;
+  _epg_sbuf_add(&sb, _epg_sect("episodes"));
   RB_FOREACH(eo,  &epg_episodes, uri_link) {
-    if (_epg_write(fd, epg_episode_serialize((epg_episode_t*)eo))) goto error;
+    _epg_sbuf_add(&sb, epg_episode_serialize((epg_episode_t*)eo));
     stats.episodes.total++;
   }
-  if ( _epg_write_sect(fd, "serieslinks") ) goto error;
+  _epg_sbuf_add(&sb, _epg_sect("serieslinks"));
   RB_FOREACH(eo, &epg_serieslinks, uri_link) {
-    if (_epg_write(fd, epg_serieslink_serialize((epg_serieslink_t*)eo))) goto error;
+    _epg_sbuf_add(&sb, epg_serieslink_serialize((epg_serieslink_t*)eo));
     stats.seasons.total++;
   }
-  if ( _epg_write_sect(fd, "broadcasts") ) goto error;
+  _epg_sbuf_add(&sb, _epg_sect("broadcasts"));
+  tvh_domain_rdlock(LOCK_CHANNEL);
   CHANNEL_FOREACH(ch) {
     RB_FOREACH(ebc, &ch->ch_epg_schedule, sched_link) {
-      if (_epg_write(fd, epg_broadcast_serialize(ebc))) goto error;
+      _epg_sbuf_add(&sb, epg_broadcast_serialize(ebc));
       stats.broadcasts.total++;
     }
   }
+  tvh_domain_unlock(LOCK_CHANNEL);
+  tvh_domain_unlock(LOCK_EPG);
+
+  fd = hts_settings_open_file(1, "epgdb.v%d", EPG_DB_VERSION);
+  if (fd < 0) {
+    sbuf_free(&sb);
+    pthread_mutex_unlock(&epgdb_save_mutex);
+    return;
+  }
+  r = tvh_write(fd, sb.sb_data, sb.sb_ptr);
   close(fd);
+  sbuf_free(&sb);
+  if (r) {
+    tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk");
+    hts_settings_remove("epgdb.v%d", EPG_DB_VERSION);
+    pthread_mutex_unlock(&epgdb_save_mutex);
+    return;
+  }
+
+  /* The snapshot is complete, a journal would be stale */
+  hts_settings_remove("epgdb.v%d.journal.1", EPG_DB_VERSION);
+  hts_settings_remove("epgdb.v%d.journal", EPG_DB_VERSION);
 
   /* Stats */
   tvhlog(LOG_INFO, "epgdb", "saved");
@@ -346,10 +721,648 @@ void epg_save ( void )
   tvhlog(LOG_INFO, "epgdb", "  episodes   %d", stats.episodes.total);
   tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", stats.broadcasts.total);
 
-  return;
+  pthread_mutex_unlock(&epgdb_save_mutex);
+}
 
-error:
-  tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk");
-  hts_settings_remove("epgdb.v%d", EPG_DB_VERSION);
-  close(fd);
+/* **************************************************************************
+ * Journal
+ *
+ * In journalled mode the database is not rewritten as a whole. Objects
+ * changed since the last epg_updated() call are serialized in the
+ * snapshot format (so the loader simply replays them on top of the
+ * snapshot) and appended to epgdb.v2.journal by the journal thread.
+ * Removed broadcasts and episodes are written first, as deletion records
+ * (channel and start time, or URI) in the deleted_broadcasts and
+ * deleted_episodes sections.
+ *
+ * The same thread compacts the journal into a new snapshot. That works
+ * on the files only: the journal is rotated to epgdb.v2.journal.1,
+ * merged with the old snapshot (last record for an object wins, expired
+ * broadcasts and objects no longer referenced are dropped) and the
+ * result replaces epgdb.v2. Neither global_lock nor the EPG lock is
+ * taken for this.
+ * *************************************************************************/
+
+typedef struct epgdb_journal_buf
+{
+  TAILQ_ENTRY(epgdb_journal_buf) link;
+  sbuf_t                         sb;
+} epgdb_journal_buf_t;
+
+int                    epg_journal_active;
+static pthread_t       epgdb_journal_tid;
+static pthread_mutex_t epgdb_journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t  epgdb_journal_cond  = PTHREAD_COND_INITIALIZER;
+static TAILQ_HEAD(, epgdb_journal_buf) epgdb_journal_queue =
+  TAILQ_HEAD_INITIALIZER(epgdb_journal_queue);
+static int             epgdb_journal_run;
+static int             epgdb_journal_compact;
+static int             epgdb_journal_stopping;
+static pthread_cond_t  epgdb_journal_stop_cond = PTHREAD_COND_INITIALIZER;
+/* deletions since the last flush (LOCK_EPG write lock) */
+static sbuf_t          epgdb_journal_deleted[2];
+/* journal thread only */
+static int             epgdb_journal_fd = -1;
+static off_t           epgdb_journal_size;
+static off_t           epgdb_snapshot_size;
+static time_t          epgdb_journal_retry; // no automatic compaction before
+
+/*
+ * Record a removed broadcast or episode (LOCK_EPG write lock)
+ */
+void epg_journal_deleted ( epg_object_t *eo )
+{
+  epg_broadcast_t *ebc;
+
+  if (eo->type == EPG_BROADCAST) {
+    /* Expired ones are dropped on load and compaction anyway */
+    ebc = (epg_broadcast_t *)eo;
+    if (ebc->stop > dispatch_clock)
+      _epg_sbuf_add(&epgdb_journal_deleted[0],
+                         epg_broadcast_serialize_deleted(ebc));
+  } else if (eo->type == EPG_EPISODE) {
+    _epg_sbuf_add(&epgdb_journal_deleted[1],
+                       epg_episode_serialize_deleted((epg_episode_t *)eo));
+  }
+}
+
+/*
+ * Queue objects changed since the last call (LOCK_EPG write lock)
+ */
+void epg_journal_flush ( void )
+{
+  static const char *deleted[2] = { "deleted_broadcasts", "deleted_episodes" };
+  static const struct {
+    epg_object_type_t  type;
+    const char        *sect;
+  } order[] = {
+    { EPG_BRAND,      "brands" },
+    { EPG_SEASON,     "seasons" },
+    { EPG_EPISODE,    "episodes" },
+    { EPG_SERIESLINK, "serieslinks" },
+    { EPG_BROADCAST,  "broadcasts" },
+  };
+  epgdb_journal_buf_t *jb;
+  epg_object_t *eo;
+  int i, first;
+
+  if (LIST_EMPTY(&epg_object_journal) &&
+      !epgdb_journal_deleted[0].sb_ptr && !epgdb_journal_deleted[1].sb_ptr)
+    return;
+
+  /* Deletions first, an object may have been recreated since */
+  jb = calloc(1, sizeof(*jb));
+  sbuf_init(&jb->sb);
+  _epg_sbuf_add(&jb->sb, _epg_sect("config"));
+  _epg_sbuf_add(&jb->sb, epg_config_serialize());
+  for (i = 0; i < 2; i++) {
+    if (!epgdb_journal_deleted[i].sb_ptr) continue;
+    _epg_sbuf_add(&jb->sb, _epg_sect(deleted[i]));
+    sbuf_append(&jb->sb, epgdb_journal_deleted[i].sb_data,
+                epgdb_journal_deleted[i].sb_ptr);
+    sbuf_free(&epgdb_journal_deleted[i]);
+  }
+
+  /* Referenced objects go before the referencing ones */
+  for (i = 0; i < ARRAY_SIZE(order); i++) {
+    first = 1;
+    LIST_FOREACH(eo, &epg_object_journal, jn_link) {
+      if (eo->type != order[i].type) continue;
+      if (first) {
+        _epg_sbuf_add(&jb->sb, _epg_sect(order[i].sect));
+        first = 0;
+      }
+      _epg_sbuf_add(&jb->sb, epg_object_serialize(eo));
+    }
+  }
+  while ((eo = LIST_FIRST(&epg_object_journal)) != NULL) {
+    LIST_REMOVE(eo, jn_link);
+    eo->_journal = 0;
+  }
+
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  TAILQ_INSERT_TAIL(&epgdb_journal_queue, jb, link);
+  pthread_cond_signal(&epgdb_journal_cond);
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+}
+
+/* A stopping journal thread may still be compacting (epgdb_save_mutex) */
+static void _epgdb_journal_wait ( void )
+{
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  while (epgdb_journal_stopping)
+    pthread_cond_wait(&epgdb_journal_stop_cond, &epgdb_journal_mutex);
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+}
+
+static void _epgdb_journal_compact_request ( void )
+{
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  epgdb_journal_compact = 1;
+  pthread_cond_signal(&epgdb_journal_cond);
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+}
+
+/*
+ * Append to the journal file
+ */
+static void _epgdb_journal_write ( sbuf_t *sb )
+{
+  char path[PATH_MAX];
+
+  if (epgdb_journal_fd < 0) {
+    hts_settings_buildpath(path, sizeof(path), "epgdb.v%d.journal",
+                           EPG_DB_VERSION);
+    if (hts_settings_makedirs(path) ||
+        (epgdb_journal_fd = tvh_open(path, O_WRONLY | O_CREAT | O_APPEND,
+                                     0700)) < 0) {
+      tvhlog(LOG_ERR, "epgdb", "unable to open journal %s", path);
+      return;
+    }
+  }
+  if (tvh_write(epgdb_journal_fd, sb->sb_data, sb->sb_ptr)) {
+    tvhlog(LOG_ERR, "epgdb", "failed to write journal");
+    return;
+  }
+  epgdb_journal_size += sb->sb_ptr;
+}
+
+/*
+ * Compaction
+ */
+enum {
+  EPGDB_SECT_CONFIG,
+  EPGDB_SECT_BRANDS,
+  EPGDB_SECT_SEASONS,
+  EPGDB_SECT_EPISODES,
+  EPGDB_SECT_SERIESLINKS,
+  EPGDB_SECT_BROADCASTS,
+  EPGDB_SECT_COUNT
+};
+
+static const char *epgdb_sections[EPGDB_SECT_COUNT] = {
+  "config", "brands", "seasons", "episodes", "serieslinks", "broadcasts"
+};
+
+typedef struct epgdb_rec
+{
+  RB_ENTRY(epgdb_rec)    link;
+  RB_ENTRY(epgdb_rec)    sched_link;
+  TAILQ_ENTRY(epgdb_rec) order;
+  int                    sect;
+  int                    used;
+  char                  *key;
+  char                  *ref[2];     ///< URIs of referenced objects
+  char                  *channel;    ///< Broadcast channel
+  int64_t                start;      ///< Broadcast start
+  int64_t                stop;       ///< Broadcast end
+  const uint8_t         *raw;        ///< Serialized record (mapped file)
+  size_t                 rawlen;
+} epgdb_rec_t;
+
+typedef struct epgdb_compact
+{
+  RB_HEAD(, epgdb_rec)    tree;
+  RB_HEAD(, epgdb_rec)    sched;
+  TAILQ_HEAD(, epgdb_rec) order[EPGDB_SECT_COUNT];
+} epgdb_compact_t;
+
+static int _epgdb_rec_cmp ( const void *a, const void *b )
+{
+  const epgdb_rec_t *ra = a, *rb = b;
+  if (ra->sect != rb->sect)
+    return ra->sect - rb->sect;
+  return strcmp(ra->key, rb->key);
+}
+
+static int _epgdb_rec_sched_cmp ( const void *a, const void *b )
+{
+  const epgdb_rec_t *ra = a, *rb = b;
+  int r = strcmp(ra->channel, rb->channel);
+  if (r) return r;
+  return ra->start < rb->start ? -1 : (ra->start > rb->start);
+}
+
+static char *_epgdb_rec_str ( htsmsg_t *m, const char *name )
+{
+  const char *s = htsmsg_get_str(m, name);
+  return s ? strdup(s) : NULL;
+}
+
+static void _epgdb_compact_free ( epgdb_rec_t *rec )
+{
+  free(rec->key);
+  free(rec->ref[0]);
+  free(rec->ref[1]);
+  free(rec->channel);
+  free(rec);
+}
+
+/* Deletion record, drop the older record of the object */
+static void _epgdb_compact_delete
+  ( epgdb_compact_t *ec, int sect, htsmsg_t *m )
+{
+  epgdb_rec_t skel, *rec;
+  const char *s;
+  char buf[128];
+  int64_t start;
+
+  if (sect == EPGDB_SECT_BROADCASTS) {
+    if (!(s = htsmsg_get_str(m, "channel")) ||
+        htsmsg_get_s64(m, "start", &start))
+      return;
+    snprintf(buf, sizeof(buf), "%s/%"PRId64, s, start);
+    s = buf;
+  } else if (!(s = htsmsg_get_str(m, "uri"))) {
+    return;
+  }
+  skel.sect = sect;
+  skel.key  = (char *)s;
+  if ((rec = RB_FIND(&ec->tree, &skel, link, _epgdb_rec_cmp))) {
+    RB_REMOVE(&ec->tree, rec, link);
+    TAILQ_REMOVE(&ec->order[sect], rec, order);
+    _epgdb_compact_free(rec);
+  }
+}
+
+static int _epgdb_compact_record
+  ( void *aux, char **sect, htsmsg_t *m, const uint8_t *raw, size_t rawlen )
+{
+  epgdb_compact_t *ec = aux;
+  epgdb_rec_t *rec, *old;
+  const char *s, *key;
+  char buf[128];
+  int64_t start;
+  int i;
+
+  if ((s = htsmsg_get_str(m, "__section__"))) {
+    free(*sect);
+    *sect = strdup(s);
+    return 0;
+  }
+  if (!*sect)
+    return 0;
+  if (!strcmp(*sect, "deleted_broadcasts")) {
+    _epgdb_compact_delete(ec, EPGDB_SECT_BROADCASTS, m);
+    return 0;
+  }
+  if (!strcmp(*sect, "deleted_episodes")) {
+    _epgdb_compact_delete(ec, EPGDB_SECT_EPISODES, m);
+    return 0;
+  }
+  for (i = 0; i < EPGDB_SECT_COUNT; i++)
+    if (!strcmp(*sect, epgdb_sections[i]))
+      break;
+
+  /* Key */
+  if (i == EPGDB_SECT_COUNT) {
+    return 0;
+  } else if (i == EPGDB_SECT_CONFIG) {
+    key = "";
+  } else if (i == EPGDB_SECT_BROADCASTS) {
+    if (!(s = htsmsg_get_str(m, "channel")) ||
+        htsmsg_get_s64(m, "start", &start))
+      return 0;
+    snprintf(buf, sizeof(buf), "%s/%"PRId64, s, start);
+    key = buf;
+  } else if (!(key = htsmsg_get_str(m, "uri"))) {
+    return 0;
+  }
+
+  /* Newer record replaces the older one (and moves to the end) */
+  rec = calloc(1, sizeof(*rec));
+  rec->sect = i;
+  rec->key  = strdup(key);
+  old = RB_INSERT_SORTED(&ec->tree, rec, link, _epgdb_rec_cmp);
+  if (old) {
+    free(rec->key);
+    free(rec);
+    rec = old;
+    TAILQ_REMOVE(&ec->order[i], rec, order);
+    free(rec->ref[0]);
+    free(rec->ref[1]);
+    rec->ref[0] = rec->ref[1] = NULL;
+  }
+  TAILQ_INSERT_TAIL(&ec->order[i], rec, order);
+  rec->raw    = raw;
+  rec->rawlen = rawlen;
+
+  /* References */
+  switch (i) {
+    case EPGDB_SECT_SEASONS:
+      rec->ref[0] = _epgdb_rec_str(m, "brand");
+      break;
+    case EPGDB_SECT_EPISODES:
+      rec->ref[0] = _epgdb_rec_str(m, "season");
+      rec->ref[1] = _epgdb_rec_str(m, "brand");
+      break;
+    case EPGDB_SECT_BROADCASTS:
+      rec->ref[0] = _epgdb_rec_str(m, "episode");
+      rec->ref[1] = _epgdb_rec_str(m, "serieslink");
+      if (!rec->channel)
+        rec->channel = strdup(s);
+      rec->start  = start;
+      rec->stop   = htsmsg_get_s64_or_default(m, "stop", 0);
+      break;
+  }
+  return 0;
+}
+
+static void _epgdb_compact_use ( epgdb_compact_t *ec, int sect, char *key )
+{
+  epgdb_rec_t skel, *rec;
+  if (!key) return;
+  skel.sect = sect;
+  skel.key  = key;
+  if ((rec = RB_FIND(&ec->tree, &skel, link, _epgdb_rec_cmp)))
+    rec->used = 1;
+}
+
+static int _epgdb_compact_write ( epgdb_compact_t *ec, int fd, int *count )
+{
+  epgdb_rec_t *rec;
+  int i;
+
+  for (i = 0; i < EPGDB_SECT_COUNT; i++) {
+    count[i] = 0;
+    if (_epg_write_sect(fd, epgdb_sections[i]))
+      return -1;
+    TAILQ_FOREACH(rec, &ec->order[i], order) {
+      if (!rec->used) continue;
+      if (tvh_write(fd, rec->raw, rec->rawlen))
+        return -1;
+      count[i]++;
+    }
+  }
+  return 0;
+}
+
+static int _epgdb_compact ( void )
+{
+  epgdb_compact_t ec;
+  epgdb_rec_t *rec, *old;
+  char path[PATH_MAX], path2[PATH_MAX];
+  uint8_t *mem[2] = { NULL, NULL };
+  size_t size[2] = { 0, 0 };
+  int64_t now = dispatch_clock;
+  int i, fd, count[EPGDB_SECT_COUNT], ret = -1;
+  struct stat st;
+
+  /* Rotate (unless a previous compaction was interrupted) */
+  if (epgdb_journal_fd >= 0) {
+    close(epgdb_journal_fd);
+    epgdb_journal_fd = -1;
+  }
+  hts_settings_buildpath(path, sizeof(path), "epgdb.v%d.journal",
+                         EPG_DB_VERSION);
+  hts_settings_buildpath(path2, sizeof(path2), "epgdb.v%d.journal.1",
+                         EPG_DB_VERSION);
+  if (stat(path2, &st)) {
+    if (rename(path, path2)) {
+      tvhlog(LOG_ERR, "epgdb", "unable to rotate journal %s", path);
+      return -1;
+    }
+    epgdb_journal_size = 0;
+  }
+
+  /* Merge */
+  RB_INIT(&ec.tree);
+  RB_INIT(&ec.sched);
+  for (i = 0; i < EPGDB_SECT_COUNT; i++)
+    TAILQ_INIT(&ec.order[i]);
+  if ((fd = hts_settings_open_file(0, "epgdb.v%d", EPG_DB_VERSION)) >= 0) {
+    mem[0] = _epgdb_map(fd, &size[0]);
+    close(fd);
+  }
+  if ((fd = hts_settings_open_file(0, "epgdb.v%d.journal.1", EPG_DB_VERSION)) >= 0) {
+    mem[1] = _epgdb_map(fd, &size[1]);
+    close(fd);
+  }
+  for (i = 0; i < 2; i++)
+    if (mem[i])
+      _epgdb_parse(mem[i], size[i], _epgdb_compact_record, &ec, NULL);
+
+  /* Rebuild the schedules, a broadcast removes older ones it overlaps */
+  TAILQ_FOREACH(rec, &ec.order[EPGDB_SECT_BROADCASTS], order) {
+    RB_INSERT_SORTED(&ec.sched, rec, sched_link, _epgdb_rec_sched_cmp);
+    rec->used = 1;
+    while ((old = RB_PREV(rec, sched_link)) != NULL &&
+           !strcmp(old->channel, rec->channel) && old->stop > rec->start) {
+      RB_REMOVE(&ec.sched, old, sched_link);
+      old->used = 0;
+    }
+    while ((old = RB_NEXT(rec, sched_link)) != NULL &&
+           !strcmp(old->channel, rec->channel) && old->start < rec->stop) {
+      RB_REMOVE(&ec.sched, old, sched_link);
+      old->used = 0;
+    }
+  }
+
+  /* Drop expired broadcasts and unreferenced objects */
+  TAILQ_FOREACH(rec, &ec.order[EPGDB_SECT_CONFIG], order)
+    rec->used = 1;
+  TAILQ_FOREACH(rec, &ec.order[EPGDB_SECT_BROADCASTS], order) {
+    if (!rec->used) continue;
+    if (rec->stop < now) {
+      rec->used = 0;
+      continue;
+    }
+    _epgdb_compact_use(&ec, EPGDB_SECT_EPISODES, rec->ref[0]);
+    _epgdb_compact_use(&ec, EPGDB_SECT_SERIESLINKS, rec->ref[1]);
+  }
+  TAILQ_FOREACH(rec, &ec.order[EPGDB_SECT_EPISODES], order) {
+    if (!rec->used) continue;
+    _epgdb_compact_use(&ec, EPGDB_SECT_SEASONS, rec->ref[0]);
+    _epgdb_compact_use(&ec, EPGDB_SECT_BRANDS, rec->ref[1]);
+  }
+  TAILQ_FOREACH(rec, &ec.order[EPGDB_SECT_SEASONS], order)
+    if (rec->used)
+      _epgdb_compact_use(&ec, EPGDB_SECT_BRANDS, rec->ref[0]);
+
+  /* Write the new snapshot and replace the old one */
+  fd = hts_settings_open_file(1, "epgdb.v%d.tmp", EPG_DB_VERSION);
+  if (fd < 0) {
+    tvhlog(LOG_ERR, "epgdb", "unable to create the new database");
+  } else if (_epgdb_compact_write(&ec, fd, count)) {
+    tvhlog(LOG_ERR, "epgdb", "failed to store epg to disk");
+    close(fd);
+    hts_settings_remove("epgdb.v%d.tmp", EPG_DB_VERSION);
+  } else {
+    close(fd);
+    hts_settings_buildpath(path, sizeof(path), "epgdb.v%d.tmp",
+                           EPG_DB_VERSION);
+    hts_settings_buildpath(path2, sizeof(path2), "epgdb.v%d",
+                           EPG_DB_VERSION);
+    if (rename(path, path2)) {
+      tvhlog(LOG_ERR, "epgdb", "unable to replace database %s", path2);
+    } else {
+      hts_settings_remove("epgdb.v%d.journal.1", EPG_DB_VERSION);
+      if (!stat(path2, &st))
+        epgdb_snapshot_size = st.st_size;
+      ret = 0;
+      tvhlog(LOG_INFO, "epgdb", "compacted");
+      tvhlog(LOG_INFO, "epgdb", "  brands     %d", count[EPGDB_SECT_BRANDS]);
+      tvhlog(LOG_INFO, "epgdb", "  seasons    %d",
+             count[EPGDB_SECT_SEASONS] + count[EPGDB_SECT_SERIESLINKS]);
+      tvhlog(LOG_INFO, "epgdb", "  episodes   %d", count[EPGDB_SECT_EPISODES]);
+      tvhlog(LOG_INFO, "epgdb", "  broadcasts %d", count[EPGDB_SECT_BROADCASTS]);
+    }
+  }
+
+  /* Cleanup */
+  while ((rec = RB_FIRST(&ec.tree)) != NULL) {
+    RB_REMOVE(&ec.tree, rec, link);
+    _epgdb_compact_free(rec);
+  }
+  for (i = 0; i < 2; i++)
+    if (mem[i])
+      munmap(mem[i], size[i]);
+  return ret;
+}
+
+/*
+ * Journal thread
+ */
+static void *_epgdb_journal_thread ( void *p )
+{
+  epgdb_journal_buf_t *jb;
+  struct timespec ts;
+  int compact, r;
+
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  while (1) {
+
+    /* Append */
+    if ((jb = TAILQ_FIRST(&epgdb_journal_queue)) != NULL) {
+      TAILQ_REMOVE(&epgdb_journal_queue, jb, link);
+      pthread_mutex_unlock(&epgdb_journal_mutex);
+      _epgdb_journal_write(&jb->sb);
+      sbuf_free(&jb->sb);
+      free(jb);
+      pthread_mutex_lock(&epgdb_journal_mutex);
+      continue;
+    }
+
+    /* Compact (on request or when the journal grows too big). A failed
+       compaction (e.g. a full disk) is retried on request or after
+       EPG_DB_JOURNAL_RETRY seconds only. */
+    if (epgdb_journal_retry && time(NULL) >= epgdb_journal_retry)
+      epgdb_journal_compact = 1;
+    compact = epgdb_journal_compact ||
+              (!epgdb_journal_retry &&
+               epgdb_journal_size > MAX(epgdb_snapshot_size,
+                                        EPG_DB_JOURNAL_MINCOMPACT));
+    epgdb_journal_compact = 0;
+    if (compact && (epgdb_journal_size > 0 || epgdb_journal_retry)) {
+      pthread_mutex_unlock(&epgdb_journal_mutex);
+      r = _epgdb_compact();
+      pthread_mutex_lock(&epgdb_journal_mutex);
+      epgdb_journal_retry = r ? time(NULL) + EPG_DB_JOURNAL_RETRY : 0;
+      continue;
+    }
+
+    if (!epgdb_journal_run)
+      break;
+    if (epgdb_journal_retry) {
+      ts.tv_sec  = epgdb_journal_retry;
+      ts.tv_nsec = 0;
+      pthread_cond_timedwait(&epgdb_journal_cond, &epgdb_journal_mutex, &ts);
+    } else {
+      pthread_cond_wait(&epgdb_journal_cond, &epgdb_journal_mutex);
+    }
+  }
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+
+  if (epgdb_journal_fd >= 0) {
+    close(epgdb_journal_fd);
+    epgdb_journal_fd = -1;
+  }
+  return NULL;
+}
+
+static void _epgdb_journal_start ( void )
+{
+  char path[PATH_MAX];
+  struct stat st;
+
+  lock_assert(&global_lock);
+
+  pthread_mutex_lock(&epgdb_save_mutex);
+  if (epg_journal_active) {
+    pthread_mutex_unlock(&epgdb_save_mutex);
+    return;
+  }
+  _epgdb_journal_wait();
+
+  hts_settings_buildpath(path, sizeof(path), "epgdb.v%d.journal",
+                         EPG_DB_VERSION);
+  epgdb_journal_size  = stat(path, &st) ? 0 : st.st_size;
+  hts_settings_buildpath(path, sizeof(path), "epgdb.v%d", EPG_DB_VERSION);
+  epgdb_snapshot_size = stat(path, &st) ? 0 : st.st_size;
+  epgdb_journal_run     = 1;
+  epgdb_journal_compact = 0;
+  epgdb_journal_retry   = 0;
+  tvhthread_create(&epgdb_journal_tid, NULL, _epgdb_journal_thread, NULL);
+  epg_journal_active = 1;
+  pthread_mutex_unlock(&epgdb_save_mutex);
+  tvhlog(LOG_DEBUG, "epgdb", "journal started");
+}
+
+static void _epgdb_journal_stop ( void )
+{
+  epg_object_t *eo;
+
+  lock_assert(&global_lock);
+
+  pthread_mutex_lock(&epgdb_save_mutex);
+  if (!epg_journal_active) {
+    pthread_mutex_unlock(&epgdb_save_mutex);
+    return;
+  }
+  epg_journal_active = 0;
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  epgdb_journal_run      = 0;
+  epgdb_journal_stopping = 1;
+  pthread_cond_signal(&epgdb_journal_cond);
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+  pthread_mutex_unlock(&epgdb_save_mutex);
+
+  /* The thread may be compacting, don't hold up everything meanwhile */
+  pthread_mutex_unlock(&global_lock);
+  pthread_join(epgdb_journal_tid, NULL);
+  pthread_mutex_lock(&epgdb_journal_mutex);
+  epgdb_journal_stopping = 0;
+  pthread_cond_broadcast(&epgdb_journal_stop_cond);
+  pthread_mutex_unlock(&epgdb_journal_mutex);
+  pthread_mutex_lock(&global_lock);
+
+  /* Unwritten changes (unless restarted meanwhile) */
+  if (epg_journal_active)
+    return;
+  tvh_domain_wrlock(LOCK_EPG);
+  while ((eo = LIST_FIRST(&epg_object_journal)) != NULL) {
+    LIST_REMOVE(eo, jn_link);
+    eo->_journal = 0;
+  }
+  sbuf_free(&epgdb_journal_deleted[0]);
+  sbuf_free(&epgdb_journal_deleted[1]);
+  tvh_domain_unlock(LOCK_EPG);
+}
+
+/*
+ * Switch the journalled mode, a full save gives the base in both cases
+ */
+void epg_journal ( int on )
+{
+  lock_assert(&global_lock);
+
+  if (!on == !epg_journal_active)
+    return;
+  if (on) {
+    epg_save();
+    _epgdb_journal_start();
+  } else {
+    _epgdb_journal_stop();
+    epg_save();
+  }
 }
@@ -52,8 +52,9 @@ uint32_t              epggrab_channel_rename;
 uint32_t              epggrab_channel_renumber;
 uint32_t              epggrab_channel_reicon;
 uint32_t              epggrab_epgdb_periodicsave;
+uint32_t              epggrab_epgdb_journal;
 
-gtimer_t              epggrab_save_timer;
+gtimer_t              epggrab_save_timer = { .gti_domain = LOCK_EPG };
 
 static cron_multi_t  *epggrab_cron_multi;
 
@@ -68,6 +69,17 @@ static void _epggrab_module_grab ( epggrab_module_int_t *mod )
 {
   time_t tm1, tm2;
   htsmsg_t *data;
+  int fd;
+
+  /* Streamed (default spawn only, custom grabbers return a buffer) */
+  if (mod->stream && mod->grab == epggrab_module_grab_spawn) {
+    if ((fd = epggrab_module_spawn(mod)) < 0 ||
+        epggrab_module_parse_stream(mod, fd) <= 0)
+      tvhlog(LOG_WARNING, mod->id, "grab returned no data");
+    if (fd >= 0)
+      close(fd);
+    return;
+  }
 
   /* Grab */
   time(&tm1);
@@ -151,6 +163,7 @@ static void _epggrab_load ( void )
     if (epggrab_epgdb_periodicsave)
       gtimer_arm(&epggrab_save_timer, epg_save_callback, NULL,
                  epggrab_epgdb_periodicsave);
+    htsmsg_get_u32(m, "epgdb_journal", &epggrab_epgdb_journal);
     if ((str = htsmsg_get_str(m, "cron")) != NULL)
       epggrab_set_cron(str);
     htsmsg_get_u32(m, "grab-enabled", &enabled);
@@ -218,6 +231,7 @@ void epggrab_save ( void )
   htsmsg_add_u32(m, "channel_renumber", epggrab_channel_renumber);
   htsmsg_add_u32(m, "channel_reicon", epggrab_channel_reicon);
   htsmsg_add_u32(m, "epgdb_periodicsave", epggrab_epgdb_periodicsave);
+  htsmsg_add_u32(m, "epgdb_journal", epggrab_epgdb_journal);
   htsmsg_add_str(m, "cron", epggrab_cron);
   htsmsg_add_str(m, "ota_cron", epggrab_ota_cron);
   htsmsg_add_u32(m, "ota_timeout", epggrab_ota_timeout);
@@ -301,7 +315,23 @@ int epggrab_set_periodicsave ( uint32_t e )
     if (!e)
       gtimer_disarm(&epggrab_save_timer);
     else
-      epg_save(); // will arm the timer
+      gtimer_arm(&epggrab_save_timer, epg_save_callback, NULL, 0);
+    pthread_mutex_unlock(&global_lock);
+    save = 1;
+  }
+  return save;
+}
+
+/*
+ * Journalled EPG database (append changes, compact in background)
+ */
+int epggrab_set_epgdb_journal ( uint32_t e )
+{
+  int save = 0;
+  if ( e != epggrab_epgdb_journal ) {
+    epggrab_epgdb_journal = e;
+    pthread_mutex_lock(&global_lock);
+    epg_journal(e);
     pthread_mutex_unlock(&global_lock);
     save = 1;
   }
@@ -361,6 +391,7 @@ void epggrab_init ( void )
   epggrab_channel_renumber   = 0;
   epggrab_channel_reicon     = 0;
   epggrab_epgdb_periodicsave = 0;
+  epggrab_epgdb_journal      = 0;
 
   epggrab_cron_multi         = NULL;
 
@@ -173,6 +173,9 @@ struct epggrab_module_int
   char*     (*grab)   ( void *mod );
   htsmsg_t* (*trans)  ( void *mod, char *data );
   int       (*parse)  ( void *mod, htsmsg_t *data, epggrab_stats_t *stat );
+
+  /* Streamed XML: parse a single child of the root element */
+  int       (*stream) ( void *mod, htsmsg_t *data, epggrab_stats_t *stat );
 };
 
 /*
@@ -273,6 +276,7 @@ extern uint32_t              epggrab_channel_rename;
 extern uint32_t              epggrab_channel_renumber;
 extern uint32_t              epggrab_channel_reicon;
 extern uint32_t              epggrab_epgdb_periodicsave;
+extern uint32_t              epggrab_epgdb_journal;
 extern char                 *epggrab_ota_cron;
 extern uint32_t              epggrab_ota_timeout;
 extern uint32_t              epggrab_ota_initial;
@@ -287,6 +291,7 @@ int  epggrab_set_channel_rename   ( uint32_t e );
 int  epggrab_set_channel_renumber ( uint32_t e );
 int  epggrab_set_channel_reicon   ( uint32_t e );
 int  epggrab_set_periodicsave     ( uint32_t e );
+int  epggrab_set_epgdb_journal    ( uint32_t e );
 int  epggrab_enable_module        ( epggrab_module_t *mod, uint8_t e );
 int  epggrab_enable_module_by_id  ( const char *id, uint8_t e );
 int  epggrab_ota_set_cron         ( const char *cron, int lock );
@@ -105,6 +105,29 @@ epggrab_module_t *epggrab_module_create
   return skel;
 }
 
+/*
+ * Parse statistics
+ */
+static void _epggrab_module_parse_stats
+  ( epggrab_module_t *mod, epggrab_stats_t *stats )
+{
+  tvhlog(LOG_INFO, mod->id, "  channels   tot=%5d new=%5d mod=%5d",
+         stats->channels.total, stats->channels.created,
+         stats->channels.modified);
+  tvhlog(LOG_INFO, mod->id, "  brands     tot=%5d new=%5d mod=%5d",
+         stats->brands.total, stats->brands.created,
+         stats->brands.modified);
+  tvhlog(LOG_INFO, mod->id, "  seasons    tot=%5d new=%5d mod=%5d",
+         stats->seasons.total, stats->seasons.created,
+         stats->seasons.modified);
+  tvhlog(LOG_INFO, mod->id, "  episodes   tot=%5d new=%5d mod=%5d",
+         stats->episodes.total, stats->episodes.created,
+         stats->episodes.modified);
+  tvhlog(LOG_INFO, mod->id, "  broadcasts tot=%5d new=%5d mod=%5d",
+         stats->broadcasts.total, stats->broadcasts.created,
+         stats->broadcasts.modified);
+}
+
 /*
  * Run the parse
  */
@@ -118,30 +141,91 @@ void epggrab_module_parse( void *m, htsmsg_t *data )
   /* Parse */
   memset(&stats, 0, sizeof(stats));
   pthread_mutex_lock(&global_lock);
+  tvh_domain_wrlock(LOCK_EPG);
   time(&tm1);
   save |= mod->parse(mod, data, &stats);
   time(&tm2);
   if (save) epg_updated();  
+  tvh_domain_unlock(LOCK_EPG);
   pthread_mutex_unlock(&global_lock);
   htsmsg_destroy(data);
 
   /* Debug stats */
   tvhlog(LOG_INFO, mod->id, "parse took %"PRItime_t" seconds", tm2 - tm1);
-  tvhlog(LOG_INFO, mod->id, "  channels   tot=%5d new=%5d mod=%5d",
-         stats.channels.total, stats.channels.created,
-         stats.channels.modified);
-  tvhlog(LOG_INFO, mod->id, "  brands     tot=%5d new=%5d mod=%5d",
-         stats.brands.total, stats.brands.created,
-         stats.brands.modified);
-  tvhlog(LOG_INFO, mod->id, "  seasons    tot=%5d new=%5d mod=%5d",
-         stats.seasons.total, stats.seasons.created,
-         stats.seasons.modified);
-  tvhlog(LOG_INFO, mod->id, "  episodes   tot=%5d new=%5d mod=%5d",
-         stats.episodes.total, stats.episodes.created,
-         stats.episodes.modified);
-  tvhlog(LOG_INFO, mod->id, "  broadcasts tot=%5d new=%5d mod=%5d",
-         stats.broadcasts.total, stats.broadcasts.created,
-         stats.broadcasts.modified);
+  _epggrab_module_parse_stats((epggrab_module_t*)mod, &stats);
+}
+
+/*
+ * Streamed parse
+ *
+ * Elements are applied as they arrive, EPGGRAB_STREAM_BATCH at a time
+ * per global_lock acquisition, so neither the whole document nor the
+ * lock is held for the duration of the grab.
+ */
+#define EPGGRAB_STREAM_BATCH 256
+
+typedef struct epggrab_stream
+{
+  epggrab_module_int_t *mod;
+  epggrab_stats_t       stats;
+  int                   batches;
+  int                   count;
+  htsmsg_t             *batch[EPGGRAB_STREAM_BATCH];
+} epggrab_stream_t;
+
+static void _epggrab_stream_flush ( epggrab_stream_t *es )
+{
+  int i, save = 0;
+
+  if (!es->count) return;
+
+  pthread_mutex_lock(&global_lock);
+  tvh_domain_wrlock(LOCK_EPG);
+  for (i = 0; i < es->count; i++)
+    save |= es->mod->stream(es->mod, es->batch[i], &es->stats);
+  if (save) epg_updated();
+  tvh_domain_unlock(LOCK_EPG);
+  pthread_mutex_unlock(&global_lock);
+
+  for (i = 0; i < es->count; i++)
+    htsmsg_destroy(es->batch[i]);
+  es->count = 0;
+  es->batches++;
+}
+
+static void _epggrab_stream_elem ( void *aux, htsmsg_t *elem )
+{
+  epggrab_stream_t *es = aux;
+
+  es->batch[es->count++] = elem;
+  if (es->count == EPGGRAB_STREAM_BATCH)
+    _epggrab_stream_flush(es);
+}
+
+int epggrab_module_parse_stream ( void *m, int fd )
+{
+  time_t tm1, tm2;
+  int r;
+  char errbuf[100];
+  epggrab_stream_t *es = calloc(1, sizeof(epggrab_stream_t));
+
+  es->mod = m;
+  time(&tm1);
+  r = htsmsg_xml_stream(fd, _epggrab_stream_elem, es, errbuf, sizeof(errbuf));
+  _epggrab_stream_flush(es);
+  time(&tm2);
+
+  if (r < 0)
+    tvhlog(LOG_ERR, es->mod->id, "htsmsg_xml_stream error %s", errbuf);
+  if (r > 0) {
+    tvhlog(LOG_INFO, es->mod->id,
+           "grab and parse took %"PRItime_t" seconds (%d elements, %d batches)",
+           tm2 - tm1, r, es->batches);
+    _epggrab_module_parse_stats((epggrab_module_t*)es->mod, &es->stats);
+  }
+
+  free(es);
+  return r;
 }
 
 /* **************************************************************************
@@ -278,10 +362,9 @@ epggrab_module_int_t *epggrab_module_int_create
   return skel;
 }
 
-char *epggrab_module_grab_spawn ( void *m )
-{ 
-  int        rd = -1, outlen;
-  char       *outbuf;
+int epggrab_module_spawn ( void *m )
+{
+  int        rd = -1, r;
   epggrab_module_int_t *mod = m;
   char **argv = NULL;
 
@@ -291,27 +374,38 @@ char *epggrab_module_grab_spawn ( void *m )
   /* Arguments */
   if (spawn_parse_args(&argv, 64, mod->path, NULL)) {
     tvhlog(LOG_ERR, mod->id, "unable to parse arguments");
-    return NULL;
+    return -1;
   }
 
   /* Grab */
-  outlen = spawn_and_give_stdout(argv[0], (char **)argv, NULL, &rd, NULL, 1);
+  r = spawn_and_give_stdout(argv[0], (char **)argv, NULL, &rd, NULL, 1);
+  spawn_free_args(argv);
+
+  if (r < 0) {
+    if (rd >= 0)
+      close(rd);
+    return -1;
+  }
+  return rd;
+}
 
-  if (outlen < 0)
+char *epggrab_module_grab_spawn ( void *m )
+{ 
+  int        rd, outlen;
+  char       *outbuf;
+  epggrab_module_int_t *mod = m;
+
+  if ((rd = epggrab_module_spawn(mod)) < 0)
     goto error;
 
   outlen = file_readall(rd, &outbuf);
+  close(rd);
   if (outlen < 1)
     goto error;
 
-  close(rd);
-
   return outbuf;
 
 error:
-  spawn_free_args(argv);
-  if (rd >= 0)
-    close(rd);
   tvhlog(LOG_ERR, mod->id, "no output detected");
   return NULL;
 }
@@ -347,6 +441,14 @@ static void _epggrab_socket_handler ( epggrab_module_ext_t *mod, int s )
   time_t tm1, tm2;
   htsmsg_t *data = NULL;
 
+  /* Streamed */
+  if (mod->stream) {
+    if (epggrab_module_parse_stream(mod, s) <= 0)
+      tvhlog(LOG_ERR, mod->id, "failed to read data");
+    close(s);
+    return;
+  }
+
   /* Grab/Translate */
   time(&tm1);
   outlen = file_readall(s, &outbuf);
@@ -637,6 +637,7 @@ _eit_callback
     goto done;
 
   /* Process events */
+  tvh_domain_wrlock(LOCK_EPG);
   save = resched = 0;
   len -= 11;
   ptr += 11;
@@ -652,6 +653,7 @@ _eit_callback
   /* Update EPG */
   if (resched) epggrab_resched();
   if (save)    epg_updated();
+  tvh_domain_unlock(LOCK_EPG);
   
 done:
   r = dvb_table_end(mt, st, sect);
@@ -634,10 +634,10 @@ static int _xmltv_parse_channel
 }
 
 /**
- *
+ * Parse the body of <tv>, also used for each streamed child element
  */
 static int _xmltv_parse_tv
-  (epggrab_module_t *mod, htsmsg_t *body, epggrab_stats_t *stats)
+  (void *mod, htsmsg_t *body, epggrab_stats_t *stats)
 {
   int save = 0;
   htsmsg_t *tags;
@@ -681,6 +681,7 @@ static void _xmltv_load_grabbers ( void )
   char *outbuf;
   char name[1000];
   char *tmp, *tmp2 = NULL, *path;
+  epggrab_module_int_t *mod;
 
   /* Load data */
   if (spawn_and_give_stdout(XMLTV_FIND, NULL, NULL, &rd, NULL, 1) >= 0)
@@ -695,8 +696,9 @@ static void _xmltv_load_grabbers ( void )
       if ( outbuf[i] == '\n' || outbuf[i] == '\0' ) {
         outbuf[i] = '\0';
         sprintf(name, "XMLTV: %s", &outbuf[n]);
-        epggrab_module_int_create(NULL, &outbuf[p], name, 3, &outbuf[p],
-                                  NULL, _xmltv_parse, NULL, NULL);
+        mod = epggrab_module_int_create(NULL, &outbuf[p], name, 3, &outbuf[p],
+                                        NULL, _xmltv_parse, NULL, NULL);
+        mod->stream = _xmltv_parse_tv;
         p = n = i + 1;
       } else if ( outbuf[i] == '\\') {
         memmove(outbuf, outbuf + 1, strlen(outbuf));
@@ -740,8 +742,9 @@ static void _xmltv_load_grabbers ( void )
             close(rd);
             if (outbuf[outlen-1] == '\n') outbuf[outlen-1] = '\0';
             snprintf(name, sizeof(name), "XMLTV: %s", outbuf);
-            epggrab_module_int_create(NULL, bin, name, 3, bin,
-                                      NULL, _xmltv_parse, NULL, NULL);
+            mod = epggrab_module_int_create(NULL, bin, name, 3, bin,
+                                            NULL, _xmltv_parse, NULL, NULL);
+            mod->stream = _xmltv_parse_tv;
             free(outbuf);
           } else {
             if (rd >= 0)
@@ -758,13 +761,16 @@ static void _xmltv_load_grabbers ( void )
 
 void xmltv_init ( void )
 {
+  epggrab_module_ext_t *mod;
+
   RB_INIT(&_xmltv_channels);
 
   /* External module */
-  _xmltv_module = (epggrab_module_t*)
-    epggrab_module_ext_create(NULL, "xmltv", "XMLTV", 3, "xmltv",
-                              _xmltv_parse, NULL,
-                              &_xmltv_channels);
+  mod = epggrab_module_ext_create(NULL, "xmltv", "XMLTV", 3, "xmltv",
+                                  _xmltv_parse, NULL,
+                                  &_xmltv_channels);
+  mod->stream   = _xmltv_parse_tv;
+  _xmltv_module = (epggrab_module_t*)mod;
 
   /* Standard modules */
   _xmltv_load_grabbers();
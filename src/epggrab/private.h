@@ -30,6 +30,7 @@ epggrab_module_t *epggrab_module_create
     const char *id, const char *name, int priority,
     epggrab_channel_tree_t *channels );
 
+int       epggrab_module_spawn      ( void *m );
 char     *epggrab_module_grab_spawn ( void *m );
 htsmsg_t *epggrab_module_trans_xml  ( void *m, char *data );
 
@@ -39,6 +40,7 @@ void      epggrab_module_ch_mod  ( void *m, struct channel *ch );
 void      epggrab_module_ch_save ( void *m, epggrab_channel_t *ec );
 
 void      epggrab_module_parse ( void *m, htsmsg_t *data );
+int       epggrab_module_parse_stream ( void *m, int fd );
 
 void      epggrab_module_channels_load ( epggrab_module_t *m );
 
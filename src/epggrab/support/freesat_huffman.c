@@ -26,6 +26,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <pthread.h>
 #include "tvheadend.h"
 #include "channels.h"
 #include "input/mpegts/dvb.h"
@@ -5757,44 +5758,121 @@ unsigned fsat_index_2[] = {
 		3160  /* 128 */
 };
 
+/*
+ * Per context lookup on the next 8 bits: the table entries that can match
+ * there, in table order and cut after the first one that always matches.
+ * Nearly every slot has a single candidate, so a code is found without
+ * scanning the whole context.
+ */
+struct fsatlookup {
+	unsigned short first;
+	unsigned short count;
+};
+
+struct fsatdecoder {
+	struct fsattab *table;
+	unsigned *index;
+	struct fsatlookup lookup[128][256];
+	unsigned short *cand; /* NULL if the lookup didn't fit, scan instead */
+};
+
+static struct fsatdecoder fsat_decoder_1 = { fsat_table_1, fsat_index_1 };
+static struct fsatdecoder fsat_decoder_2 = { fsat_table_2, fsat_index_2 };
+static pthread_once_t fsat_once = PTHREAD_ONCE_INIT;
+
+static inline unsigned int fsat_mask(short bits)
+{
+	return bits ? 0xffffffffU << (32 - bits) : 0;
+}
+
+static void fsat_decoder_build(struct fsatdecoder *d)
+{
+	struct fsatlookup *l;
+	unsigned short *cand = NULL;
+	size_t count = 0, size = 0;
+	unsigned int c, p, j;
+	short bits;
+
+	for (c = 0; c < 128; c++) {
+		for (p = 0; p < 256; p++) {
+			l = &d->lookup[c][p];
+			l->first = count;
+			for (j = d->index[c]; j < d->index[c + 1]; j++) {
+				bits = d->table[j].bits;
+				if (bits <= 8) {
+					if (((p << 24) & fsat_mask(bits)) != d->table[j].value)
+						continue;
+				} else if ((d->table[j].value >> 24) != p)
+					continue;
+				if (count == 0xffff) {
+					free(cand);
+					return;
+				}
+				if (count == size) {
+					size = size ? size * 2 : 4096;
+					cand = realloc(cand, size * sizeof(*cand));
+				}
+				cand[count++] = j;
+				if (bits <= 8)
+					break;
+			}
+			l->count = count - l->first;
+		}
+	}
+	d->cand = cand;
+}
+
+static void fsat_init(void)
+{
+	fsat_decoder_build(&fsat_decoder_1);
+	fsat_decoder_build(&fsat_decoder_2);
+}
+
+/* 32 bits of 'src' from bit 'pos' on, zero past the end */
+static inline unsigned int fsat_window(const uint8_t *src, size_t srclen, size_t pos)
+{
+	size_t i = pos >> 3;
+	uint64_t w = 0;
+	int k;
+
+	if (i + 5 <= srclen) {
+		for (k = 0; k < 5; k++)
+			w = (w << 8) | src[i + k];
+	} else {
+		for (k = 0; k < 5; k++, i++)
+			w = (w << 8) | (i < srclen ? src[i] : 0);
+	}
+	return (unsigned int)(w >> (8 - (pos & 7)));
+}
+
 size_t freesat_huffman_decode
   (char *dst, size_t* dstlen, const uint8_t *src, size_t srclen)
 {
-	struct fsattab *fsat_table;
-	unsigned int *fsat_index;
-  size_t p;
+	struct fsatdecoder *d;
+	struct fsatlookup *l;
+	const unsigned short *cand;
+	size_t p;
+	size_t byte0;
+	size_t shifted;
 	unsigned int value;
-	unsigned int byte;
-	unsigned int bit;
 	char lastch;
 	int found;
 	unsigned int bitShift;
 	char nextCh;
 	unsigned int indx;
-	unsigned int j;
-	unsigned int mask;
-	unsigned int maskbit;
-	unsigned short kk;
-	unsigned int b;
+	unsigned int j, k, n;
 
   if (src[0] != 0x1f) return -1;
 
 	p = 0;
 	if (src[1] == 1 || src[1] == 2) {
-		if (src[1] == 1) {
-			fsat_table = fsat_table_1;
-			fsat_index = fsat_index_1;
-		} else {
-			fsat_table = fsat_table_2;
-			fsat_index = fsat_index_2;
-		}
-		value = 0;
-		byte = 2;
-		bit = 0;
-		while (byte < 6 && byte < srclen) {
-			value |= src[byte] << ((5 - byte) * 8);
-			byte++;
-		}
+		pthread_once(&fsat_once, fsat_init);
+		d = src[1] == 1 ? &fsat_decoder_1 : &fsat_decoder_2;
+		// Bits are read through a 32 bit window starting after the
+		// header, 'byte0' is where reading the next bit starts
+		byte0 = MAX(2, MIN(6, srclen));
+		shifted = 0;
+		value = fsat_window(src, srclen, 16);
 		lastch = START;
 
 		do {
@@ -5814,18 +5892,19 @@ size_t freesat_huffman_decode
 				}
 			} else {
 				indx = (unsigned int) lastch;
-				//if (src[1] == 2)
-				//    indx |= 0x80;
-				for (j = fsat_index[indx]; j < fsat_index[indx + 1]; j++) {
-					mask = 0;
-					maskbit = 0x80000000;
-					for (kk = 0; kk < fsat_table[j].bits; kk++) {
-						mask |= maskbit;
-						maskbit >>= 1;
-					}
-					if ((value & mask) == fsat_table[j].value) {
-						nextCh = fsat_table[j].next;
-						bitShift = fsat_table[j].bits;
+				if (d->cand) {
+					l = &d->lookup[indx][value >> 24];
+					cand = d->cand + l->first;
+					n = l->count;
+				} else {
+					cand = NULL;
+					n = d->index[indx + 1] - d->index[indx];
+				}
+				for (k = 0; k < n; k++) {
+					j = cand ? cand[k] : d->index[indx] + k;
+					if ((value & fsat_mask(d->table[j].bits)) == d->table[j].value) {
+						nextCh = d->table[j].next;
+						bitShift = d->table[j].bits;
 						found = 1;
 						lastch = nextCh;
 						break;
@@ -5838,20 +5917,12 @@ size_t freesat_huffman_decode
 					dst[p++] = nextCh;
 				}
 				// Shift up by the number of bits.
-				for (b = 0; b < bitShift; b++) {
-					value = (value << 1) & 0xfffffffe;
-					if (byte < srclen)
-						value |= (src[byte] >> (7 - bit)) & 1;
-					if (bit == 7) {
-						bit = 0;
-						byte++;
-					} else
-						bit++;
-				}
+				shifted += bitShift;
+				value = fsat_window(src, srclen, 16 + shifted);
 			} else {
         return -1;
 			}
-		} while (lastch != STOP && byte < srclen + 4);
+		} while (lastch != STOP && byte0 + (shifted >> 3) < srclen + 4);
 
 		dst[p] = '\0';
     *dstlen = p;
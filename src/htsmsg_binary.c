@@ -258,6 +258,87 @@ htsmsg_binary_write(htsmsg_t *msg, uint8_t *ptr)
 }
 
 
+/*
+ *
+ */
+static inline size_t
+htsmsg_binary_field_hdr(uint8_t *ptr, int type, const char *name, size_t l)
+{
+  int namelen = strlen(name);
+
+  ptr[0] = type;
+  ptr[1] = namelen;
+  ptr[2] = l >> 24;
+  ptr[3] = l >> 16;
+  ptr[4] = l >> 8;
+  ptr[5] = l;
+  memcpy(ptr + 6, name, namelen);
+  return 6 + namelen;
+}
+
+size_t
+htsmsg_binary_field_s64(uint8_t *ptr, const char *name, int64_t s64)
+{
+  uint64_t u64 = s64;
+  size_t hl;
+  int l = 0, i;
+
+  while (u64 != 0) {
+    l++;
+    u64 = u64 >> 8;
+  }
+  hl = htsmsg_binary_field_hdr(ptr, HMF_S64, name, l);
+  ptr += hl;
+  u64 = s64;
+  for (i = 0; i < l; i++) {
+    ptr[i] = u64;
+    u64 = u64 >> 8;
+  }
+  return hl + l;
+}
+
+size_t
+htsmsg_binary_field_str(uint8_t *ptr, const char *name, const char *str)
+{
+  size_t l = strlen(str), hl;
+
+  hl = htsmsg_binary_field_hdr(ptr, HMF_STR, name, l);
+  memcpy(ptr + hl, str, l);
+  return hl + l;
+}
+
+/*
+ * Only the field header, len bytes of data must follow
+ */
+size_t
+htsmsg_binary_field_bin(uint8_t *ptr, const char *name, size_t len)
+{
+  return htsmsg_binary_field_hdr(ptr, HMF_BIN, name, len);
+}
+
+/*
+ *
+ */
+size_t
+htsmsg_binary_length(htsmsg_t *msg)
+{
+  return htsmsg_binary_count(msg) + 4;
+}
+
+void
+htsmsg_binary_serialize_to(htsmsg_t *msg, void *data, size_t len)
+{
+  uint8_t *ptr = data;
+
+  len -= 4;
+  ptr[0] = len >> 24;
+  ptr[1] = len >> 16;
+  ptr[2] = len >> 8;
+  ptr[3] = len;
+
+  htsmsg_binary_write(msg, ptr + 4);
+}
+
 /*
  *
  */
@@ -30,4 +30,23 @@ htsmsg_t *htsmsg_binary_deserialize(const void *data, size_t len,
 int htsmsg_binary_serialize(htsmsg_t *msg, void **datap, size_t *lenp,
 			    int maxlen);
 
+/**
+ * Serialized size including the length prefix, and serialization
+ * into a caller supplied buffer of (at least) that size
+ */
+size_t htsmsg_binary_length(htsmsg_t *msg);
+
+void htsmsg_binary_serialize_to(htsmsg_t *msg, void *data, size_t len);
+
+/**
+ * Encode single fields directly (for hot paths that do not build a
+ * htsmsg_t), return the number of bytes written to ptr
+ */
+size_t htsmsg_binary_field_s64(uint8_t *ptr, const char *name, int64_t s64);
+
+size_t htsmsg_binary_field_str(uint8_t *ptr, const char *name,
+                               const char *str);
+
+size_t htsmsg_binary_field_bin(uint8_t *ptr, const char *name, size_t len);
+
 #endif /* HTSMSG_BINARY_H_ */
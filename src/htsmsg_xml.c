@@ -43,6 +43,7 @@
  */
 
 
+#define _GNU_SOURCE /* for memmem() */
 #include <assert.h>
 #include <sys/types.h>
 #include <stdio.h>
@@ -818,6 +819,25 @@ htsmsg_parse_prolog(xmlparser_t *xp, char *src)
 
 
 
+/**
+ *
+ */
+static void
+htsmsg_xml_errbuf(xmlparser_t *xp, char *errbuf, size_t errbufsize)
+{
+  int i;
+
+  snprintf(errbuf, errbufsize, "%s", xp->xp_errmsg);
+  
+  /* Remove any odd chars inside of errmsg */
+  for(i = 0; i < errbufsize; i++) {
+    if(errbuf[i] < 32) {
+      errbuf[i] = 0;
+      break;
+    }
+  }
+}
+
 /**
  *
  */
@@ -827,7 +847,6 @@ htsmsg_xml_deserialize(char *src, char *errbuf, size_t errbufsize)
   htsmsg_t *m;
   xmlparser_t xp;
   char *src0 = src;
-  int i;
 
   memset(&xp, 0, sizeof(xp));
   xp.xp_encoding = XML_ENCODING_UTF8;
@@ -853,17 +872,246 @@ htsmsg_xml_deserialize(char *src, char *errbuf, size_t errbufsize)
 
  err:
   free(src0);
-  snprintf(errbuf, errbufsize, "%s", xp.xp_errmsg);
-  
-  /* Remove any odd chars inside of errmsg */
-  for(i = 0; i < errbufsize; i++) {
-    if(errbuf[i] < 32) {
-      errbuf[i] = 0;
+  htsmsg_xml_errbuf(&xp, errbuf, errbufsize);
+  return NULL;
+}
+
+/* **************************************************************************
+ * Streaming parser
+ *
+ * The document is read from a descriptor in chunks, and only the markup
+ * structure is tokenized incrementally. Each child of the root element
+ * is cut out once complete and handed to the regular parser, so memory
+ * use is bounded by the largest element rather than by the document.
+ * *************************************************************************/
+
+#define HTSMSG_XML_STREAM_CHUNK (64 * 1024)
+
+enum {
+  XML_MARKUP_OTHER,
+  XML_MARKUP_OPEN,
+  XML_MARKUP_CLOSE,
+  XML_MARKUP_EMPTY,
+};
+
+/**
+ * Find the end of a markup construct starting at src[0] == '<'
+ *
+ * Returns the length of the construct, 0 if more data is needed
+ */
+static size_t
+htsmsg_xml_stream_markup(const char *src, size_t len, int *kind)
+{
+  const char *s, *e = src + len;
+  char quote = 0;
+  int nest = 0;
+
+  *kind = XML_MARKUP_OTHER;
+  if(len < 2)
+    return 0;
+
+  if(src[1] == '?') {
+    s = memmem(src + 2, len - 2, "?>", 2);
+    return s ? s + 2 - src : 0;
+  }
+
+  if(src[1] == '!') {
+    if(len < 4)
+      return 0;
+    if(src[2] == '-' && src[3] == '-') {
+      s = memmem(src + 4, len - 4, "-->", 3);
+      return s ? s + 3 - src : 0;
+    }
+    if(!strncmp(src + 2, "[CDATA[", MIN(len - 2, 7))) {
+      if(len < 9)
+        return 0;
+      s = memmem(src + 9, len - 9, "]]>", 3);
+      return s ? s + 3 - src : 0;
+    }
+    /* <!DOCTYPE> and friends, may carry an internal subset */
+    for(s = src + 2; s < e; s++) {
+      if(quote) {
+        if(*s == quote)
+          quote = 0;
+      } else if(*s == '"' || *s == '\'') {
+        quote = *s;
+      } else if(*s == '[') {
+        nest++;
+      } else if(*s == ']') {
+        nest--;
+      } else if(*s == '>' && nest <= 0) {
+        return s + 1 - src;
+      }
+    }
+    return 0;
+  }
+
+  if(src[1] == '/') {
+    s = memchr(src + 2, '>', len - 2);
+    if(s == NULL)
+      return 0;
+    *kind = XML_MARKUP_CLOSE;
+    return s + 1 - src;
+  }
+
+  for(s = src + 1; s < e; s++) {
+    if(quote) {
+      if(*s == quote)
+        quote = 0;
+    } else if(*s == '"' || *s == '\'') {
+      quote = *s;
+    } else if(*s == '>') {
+      *kind = s[-1] == '/' ? XML_MARKUP_EMPTY : XML_MARKUP_OPEN;
+      return s + 1 - src;
+    }
+  }
+  return 0;
+}
+
+/**
+ * Parse a single complete element cut out of the stream
+ */
+static htsmsg_t *
+htsmsg_xml_stream_element(xmlparser_t *xp, const char *src, size_t len)
+{
+  htsmsg_t *m;
+  char *s = malloc(len + 1);
+
+  memcpy(s, src, len);
+  s[len] = 0;
+
+  xp->xp_srcdataused = 0;
+  m = htsmsg_create_map();
+  if(htsmsg_xml_parse_cd(xp, m, s) == NULL) {
+    htsmsg_destroy(m);
+    free(s);
+    return NULL;
+  }
+  m->hm_data = s;
+  return m;
+}
+
+/**
+ * Parse the XML document read from fd, passing each child of the root
+ * element to cb as soon as it is complete. The message has the same
+ * layout as the root's body in a full parse ("tags" holding one element)
+ * and ownership passes to the callback.
+ *
+ * Returns the number of elements passed to cb, or -1 on error
+ */
+int
+htsmsg_xml_stream(int fd, htsmsg_xml_stream_cb_t *cb, void *aux,
+                  char *errbuf, size_t errbufsize)
+{
+  xmlparser_t xp;
+  htsmsg_t *m;
+  char *buf = NULL, *p, *prolog;
+  size_t len = 0, size = 0, pos = 0, n, keep;
+  ssize_t elem = -1, r;
+  int kind, depth = 0, root = 0, eof = 0, count = 0;
+
+  memset(&xp, 0, sizeof(xp));
+  xp.xp_encoding = XML_ENCODING_UTF8;
+  LIST_INIT(&xp.xp_namespaces);
+
+  while(1) {
+
+    /* Tokenize what we have */
+    while(pos < len) {
+      if((p = memchr(buf + pos, '<', len - pos)) == NULL) {
+        pos = len;
+        break;
+      }
+      if((n = htsmsg_xml_stream_markup(p, buf + len - p, &kind)) == 0) {
+        pos = p - buf;
+        break;
+      }
+      pos = p + n - buf;
+
+      switch(kind) {
+      case XML_MARKUP_OPEN:
+        if(!root) {
+          prolog = strndup(buf, p - buf);
+          htsmsg_parse_prolog(&xp, prolog);
+          free(prolog);
+          root = 1;
+        } else if(depth == 1) {
+          elem = p - buf;
+        }
+        depth++;
+        break;
+      case XML_MARKUP_EMPTY:
+        if(!root)
+          goto done;
+        if(depth == 1)
+          elem = p - buf;
+        break;
+      case XML_MARKUP_CLOSE:
+        if(--depth <= 0)
+          goto done;
+        break;
+      }
+
+      /* Child of the root complete */
+      if(depth == 1 && elem >= 0) {
+        m = htsmsg_xml_stream_element(&xp, buf + elem, pos - elem);
+        elem = -1;
+        if(m == NULL)
+          goto err;
+        cb(aux, m);
+        count++;
+      }
+    }
+
+    if(eof)
       break;
+
+    /* Only the unfinished element (or the prolog) needs to be kept */
+    keep = !root ? 0 : elem >= 0 ? elem : pos;
+    if(keep) {
+      memmove(buf, buf + keep, len - keep);
+      len -= keep;
+      pos -= keep;
+      if(elem >= 0)
+        elem -= keep;
+    }
+
+    if(size - len < HTSMSG_XML_STREAM_CHUNK + 1) {
+      size = len + HTSMSG_XML_STREAM_CHUNK + 1;
+      buf  = realloc(buf, size);
+    }
+
+    r = read(fd, buf + len, size - len - 1);
+    if(r < 0 && ERRNO_AGAIN(errno))
+      continue;
+    if(r < 0) {
+      xmlerr(&xp, "Read error: %s", strerror(errno));
+      goto err;
     }
+    if(r == 0)
+      eof = 1;
+    else
+      len += r;
+    buf[len] = 0;
   }
 
-  return NULL;
+  if(!root) {
+    xmlerr(&xp, "No root element found");
+    goto err;
+  }
+
+  /* The root element was not closed (writer died, socket closed early) */
+  xmlerr(&xp, "Unexpected end of document");
+  goto err;
+
+ done:
+  free(buf);
+  return count;
+
+ err:
+  free(buf);
+  htsmsg_xml_errbuf(&xp, errbuf, errbufsize);
+  return -1;
 }
 
 /*
@@ -31,6 +31,7 @@
 #include "imagecache.h"
 #include "descrambler.h"
 #include "notify.h"
+#include "config.h"
 #if ENABLE_TIMESHIFT
 #include "timeshift.h"
 #endif
@@ -51,6 +52,7 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #if ENABLE_ANDROID
 #include <sys/vfs.h>
 #define statvfs statfs
@@ -109,6 +111,14 @@ typedef struct htsp_msg {
 			   hm_msg can contain messages that points
 			   to packet payload so to avoid copy we
 			   keep a reference here */
+
+  uint8_t *hm_hdr;      /* Pre-encoded muxpkt (hm_msg is NULL), the
+                           hm_pb data follows it on the wire */
+  size_t hm_hdrlen;
+
+  int64_t hm_dts;       /* For the queue delay report */
+  TAILQ_ENTRY(htsp_msg) hm_dts_min_link;
+  TAILQ_ENTRY(htsp_msg) hm_dts_max_link;
 } htsp_msg_t;
 
 
@@ -123,6 +133,8 @@ typedef struct htsp_msg_q {
   int hmq_length;
   int hmq_payload;          /* Bytes of streaming payload that's enqueued */
   int hmq_dead;
+  struct htsp_msg_queue hmq_dts_min; /* Monotonic DTS deques for the */
+  struct htsp_msg_queue hmq_dts_max; /* queue delay report */
 } htsp_msg_q_t;
 
 /**
@@ -160,6 +172,10 @@ typedef struct htsp_connection {
   pthread_mutex_t htsp_out_mutex;
   pthread_cond_t htsp_out_cond;
 
+  size_t htsp_write_budget;   /* bytes collected per writer wakeup */
+  uint8_t *htsp_wbuf;         /* serialized messages (writer only) */
+  size_t htsp_wbuf_size;
+
   htsp_msg_q_t htsp_hmq_ctrl;
   htsp_msg_q_t htsp_hmq_epg;
   htsp_msg_q_t htsp_hmq_qstatus;
@@ -209,6 +225,9 @@ typedef struct htsp_subscription {
 
   int hs_first;
 
+  uint8_t hs_muxpkt_tmpl[64]; /* Encoded "method" and "subscriptionId" */
+  int hs_muxpkt_tmpllen;
+
 } htsp_subscription_t;
 
 
@@ -224,6 +243,9 @@ typedef struct htsp_file {
 
 #define HTSP_DEFAULT_QUEUE_DEPTH 500000
 
+#define HTSP_MUXPKT_HDR_MAX 192 /* length + fields + payload field header */
+#define HTSP_WRITE_BATCH    64  /* max. messages per writev() */
+
 /* **************************************************************************
  * Support routines
  * *************************************************************************/
@@ -290,10 +312,63 @@ static void
 htsp_init_queue(htsp_msg_q_t *hmq, int strict_prio)
 {
   TAILQ_INIT(&hmq->hmq_q);
+  TAILQ_INIT(&hmq->hmq_dts_min);
+  TAILQ_INIT(&hmq->hmq_dts_max);
   hmq->hmq_length = 0;
   hmq->hmq_strict_prio = strict_prio;
 }
 
+/**
+ * Queue delay tracking
+ *
+ * Messages leave a queue strictly in FIFO order, so the min/max DTS of
+ * the queued packets is kept in two monotonic deques: a new message
+ * drops the tail entries it supersedes, the deque heads are the current
+ * min/max and are removed once their message is dequeued.
+ */
+static void
+htsp_dts_enqueue(htsp_msg_q_t *hmq, htsp_msg_t *hm)
+{
+  htsp_msg_t *t;
+  int64_t dts = hm->hm_dts;
+
+  if(dts == PTS_UNSET)
+    return;
+
+  while((t = TAILQ_LAST(&hmq->hmq_dts_min, htsp_msg_queue)) != NULL &&
+        t->hm_dts >= dts)
+    TAILQ_REMOVE(&hmq->hmq_dts_min, t, hm_dts_min_link);
+  TAILQ_INSERT_TAIL(&hmq->hmq_dts_min, hm, hm_dts_min_link);
+
+  while((t = TAILQ_LAST(&hmq->hmq_dts_max, htsp_msg_queue)) != NULL &&
+        t->hm_dts <= dts)
+    TAILQ_REMOVE(&hmq->hmq_dts_max, t, hm_dts_max_link);
+  TAILQ_INSERT_TAIL(&hmq->hmq_dts_max, hm, hm_dts_max_link);
+}
+
+static void
+htsp_dts_dequeue(htsp_msg_q_t *hmq, htsp_msg_t *hm)
+{
+  if(TAILQ_FIRST(&hmq->hmq_dts_min) == hm)
+    TAILQ_REMOVE(&hmq->hmq_dts_min, hm, hm_dts_min_link);
+  if(TAILQ_FIRST(&hmq->hmq_dts_max) == hm)
+    TAILQ_REMOVE(&hmq->hmq_dts_max, hm, hm_dts_max_link);
+}
+
+/**
+ * Queued DTS span (caller must hold htsp_out_mutex)
+ */
+static int64_t
+htsp_queue_delay(htsp_msg_q_t *hmq)
+{
+  htsp_msg_t *min = TAILQ_FIRST(&hmq->hmq_dts_min);
+  htsp_msg_t *max = TAILQ_FIRST(&hmq->hmq_dts_max);
+
+  if(min == NULL || max == NULL)
+    return 0;
+  return max->hm_dts - min->hm_dts;
+}
+
 /**
  *
  */
@@ -313,6 +388,8 @@ htsp_flush_queue(htsp_connection_t *htsp, htsp_msg_q_t *hmq, int dead)
   }
 
   // reset
+  TAILQ_INIT(&hmq->hmq_dts_min);
+  TAILQ_INIT(&hmq->hmq_dts_max);
   hmq->hmq_length = 0;
   hmq->hmq_payload = 0;
   hmq->hmq_dead = dead;
@@ -351,12 +428,9 @@ htsp_subscription_free(htsp_connection_t *htsp, htsp_subscription_t *hs)
  *
  */
 static void
-htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
-	  htsp_msg_q_t *hmq, int payloadsize)
+htsp_enqueue(htsp_connection_t *htsp, htsp_msg_t *hm, pktbuf_t *pb,
+	     htsp_msg_q_t *hmq, int payloadsize)
 {
-  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
-
-  hm->hm_msg = m;
   hm->hm_pb = pb;
   if(pb != NULL)
     pktbuf_ref_inc(pb);
@@ -367,6 +441,7 @@ htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
   assert(!hmq->hmq_dead);
 
   TAILQ_INSERT_TAIL(&hmq->hmq_q, hm, hm_link);
+  htsp_dts_enqueue(hmq, hm);
 
   if(hmq->hmq_length == 0) {
     /* Activate queue */
@@ -384,6 +459,22 @@ htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
 }
 
+/**
+ *
+ */
+static void
+htsp_send(htsp_connection_t *htsp, htsmsg_t *m, pktbuf_t *pb,
+	  htsp_msg_q_t *hmq, int payloadsize)
+{
+  htsp_msg_t *hm = malloc(sizeof(htsp_msg_t));
+
+  hm->hm_msg = m;
+  hm->hm_hdr = NULL;
+  hm->hm_hdrlen = 0;
+  hm->hm_dts = PTS_UNSET;
+  htsp_enqueue(htsp, hm, pb, hmq, payloadsize);
+}
+
 /**
  *
  */
@@ -1936,6 +2027,11 @@ htsp_method_subscribe(htsp_connection_t *htsp, htsmsg_t *in)
   htsp_init_queue(&hs->hs_q, 0);
 
   hs->hs_sid = sid;
+  hs->hs_muxpkt_tmpllen =
+    htsmsg_binary_field_str(hs->hs_muxpkt_tmpl, "method", "muxpkt");
+  hs->hs_muxpkt_tmpllen +=
+    htsmsg_binary_field_s64(hs->hs_muxpkt_tmpl + hs->hs_muxpkt_tmpllen,
+                            "subscriptionId", (uint32_t)hs->hs_sid);
   streaming_target_init(&hs->hs_input, htsp_streaming_input, hs, 0);
 
 #if ENABLE_TIMESHIFT
@@ -2639,50 +2735,102 @@ htsp_write_scheduler(void *aux)
 {
   htsp_connection_t *htsp = aux;
   htsp_msg_q_t *hmq;
-  htsp_msg_t *hm;
-  void *dptr;
-  size_t dlen;
-  int r;
+  htsp_msg_t *hm, *batch[HTSP_WRITE_BATCH];
+  size_t lens[HTSP_WRITE_BATCH];
+  struct iovec iov[HTSP_WRITE_BATCH * 2];
+  size_t budget, bytes, off, l;
+  uint8_t *p;
+  int i, n, iovcnt, r = 0;
 
   pthread_mutex_lock(&htsp->htsp_out_mutex);
 
   while(htsp->htsp_writer_run) {
 
-    if((hmq = TAILQ_FIRST(&htsp->htsp_active_output_queues)) == NULL) {
+    if(TAILQ_FIRST(&htsp->htsp_active_output_queues) == NULL) {
       /* Nothing to be done, go to sleep */
       pthread_cond_wait(&htsp->htsp_out_cond, &htsp->htsp_out_mutex);
       continue;
     }
 
-    hm = TAILQ_FIRST(&hmq->hmq_q);
-    TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
-    hmq->hmq_length--;
-    hmq->hmq_payload -= hm->hm_payloadsize;
+    /*
+     * Drain the active queues up to the byte budget, the queue order
+     * is the same as when sending message by message
+     */
+    budget = htsp->htsp_write_budget;
+    bytes = off = 0;
+    n = 0;
+    while (n < HTSP_WRITE_BATCH && bytes < budget &&
+           (hmq = TAILQ_FIRST(&htsp->htsp_active_output_queues)) != NULL) {
 
-    TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
-    if(hmq->hmq_length) {
-      /* Still messages to be sent, put back in active queues */
-      if(hmq->hmq_strict_prio) {
-        TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
+      hm = TAILQ_FIRST(&hmq->hmq_q);
+      TAILQ_REMOVE(&hmq->hmq_q, hm, hm_link);
+      htsp_dts_dequeue(hmq, hm);
+      hmq->hmq_length--;
+      hmq->hmq_payload -= hm->hm_payloadsize;
+
+      TAILQ_REMOVE(&htsp->htsp_active_output_queues, hmq, hmq_link);
+      if(hmq->hmq_length) {
+        /* Still messages to be sent, put back in active queues */
+        if(hmq->hmq_strict_prio) {
+          TAILQ_INSERT_HEAD(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        } else {
+          TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        }
+      }
+
+      /* Muxpkt headers are copied, the payload is sent from the pktbuf */
+      if (hm->hm_hdr) {
+        lens[n] = hm->hm_hdrlen;
+        bytes  += lens[n] + (hm->hm_pb ? pktbuf_len(hm->hm_pb) : 0);
       } else {
-        TAILQ_INSERT_TAIL(&htsp->htsp_active_output_queues, hmq, hmq_link);
+        lens[n] = htsmsg_binary_length(hm->hm_msg);
+        bytes  += lens[n];
       }
+      off += lens[n];
+      batch[n++] = hm;
     }
 
     pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
-    if (htsmsg_binary_serialize(hm->hm_msg, &dptr, &dlen, INT32_MAX) != 0) {
-      tvhlog(LOG_WARNING, "htsp", "%s: failed to serialize data",
-             htsp->htsp_logname);
-      htsp_msg_destroy(hm);
-      pthread_mutex_lock(&htsp->htsp_out_mutex);
-      continue;
+    /* Serialize into the connection buffer */
+    if (off > htsp->htsp_wbuf_size) {
+      free(htsp->htsp_wbuf);
+      htsp->htsp_wbuf_size = MAX(off, budget);
+      htsp->htsp_wbuf = malloc(htsp->htsp_wbuf_size);
+    }
+    p = htsp->htsp_wbuf;
+    for (i = iovcnt = 0; i < n; i++) {
+      hm = batch[i];
+      l  = lens[i];
+      if (hm->hm_hdr)
+        memcpy(p, hm->hm_hdr, l);
+      else
+        htsmsg_binary_serialize_to(hm->hm_msg, p, l);
+      if (iovcnt && iov[iovcnt-1].iov_base + iov[iovcnt-1].iov_len == p) {
+        iov[iovcnt-1].iov_len += l;
+      } else {
+        iov[iovcnt].iov_base = p;
+        iov[iovcnt++].iov_len = l;
+      }
+      p += l;
+      if (hm->hm_hdr && hm->hm_pb && pktbuf_len(hm->hm_pb)) {
+        iov[iovcnt].iov_base = pktbuf_ptr(hm->hm_pb);
+        iov[iovcnt++].iov_len = pktbuf_len(hm->hm_pb);
+      }
     }
 
-    htsp_msg_destroy(hm);
+    r = tvh_writev(htsp->htsp_fd, iov, iovcnt);
+
+    for (i = 0; i < n; i++)
+      htsp_msg_destroy(batch[i]);
+
+    /* Do not keep a large buffer around after a big message */
+    if (htsp->htsp_wbuf_size > 4 * budget) {
+      free(htsp->htsp_wbuf);
+      htsp->htsp_wbuf = NULL;
+      htsp->htsp_wbuf_size = 0;
+    }
 
-    r = tvh_write(htsp->htsp_fd, dptr, dlen);
-    free(dptr);
     pthread_mutex_lock(&htsp->htsp_out_mutex);
     
     if (r) {
@@ -2695,6 +2843,8 @@ htsp_write_scheduler(void *aux)
 
   shutdown(htsp->htsp_fd, SHUT_RDWR);
   pthread_mutex_unlock(&htsp->htsp_out_mutex);
+  free(htsp->htsp_wbuf);
+  htsp->htsp_wbuf = NULL;
   return NULL;
 }
 
@@ -2728,6 +2878,7 @@ htsp_serve(int fd, void **opaque, struct sockaddr_storage *source,
   htsp.htsp_fd = fd;
   htsp.htsp_peer = source;
   htsp.htsp_writer_run = 1;
+  htsp.htsp_write_budget = config_get_htsp_write_budget() * 1024;
 
   LIST_INSERT_HEAD(&htsp_connections, &htsp, htsp_link);
   pthread_mutex_unlock(&global_lock);
@@ -3196,9 +3347,10 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
   htsmsg_t *m;
   htsp_msg_t *hm;
   htsp_connection_t *htsp = hs->hs_htsp;
-  int64_t ts;
+  int64_t delay;
   int qlen = hs->hs_q.hmq_payload;
-  size_t payloadlen;
+  size_t payloadlen, len;
+  uint8_t *p;
 
   if(!htsp_is_stream_enabled(hs, pkt->pkt_componentindex)) {
     pkt_ref_dec(pkt);
@@ -3216,35 +3368,51 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
     return;
   }
 
-  m = htsmsg_create_map();
- 
-  htsmsg_add_str(m, "method", "muxpkt");
-  htsmsg_add_u32(m, "subscriptionId", hs->hs_sid);
-  htsmsg_add_u32(m, "frametype", frametypearray[pkt->pkt_frametype]);
+  /**
+   * The muxpkt is encoded here straight into a small header (same
+   * field layout as the htsmsg binary serializer would produce), the
+   * payload is written from the packet buffer by the write scheduler.
+   */
+  hm = malloc(sizeof(htsp_msg_t) + HTSP_MUXPKT_HDR_MAX);
+  hm->hm_msg = NULL;
+  hm->hm_hdr = p = (uint8_t *)(hm + 1);
+  hm->hm_dts = PTS_UNSET;
 
-  htsmsg_add_u32(m, "stream", pkt->pkt_componentindex);
-  htsmsg_add_u32(m, "com", pkt->pkt_commercial);
+  p += 4;
+  memcpy(p, hs->hs_muxpkt_tmpl, hs->hs_muxpkt_tmpllen);
+  p += hs->hs_muxpkt_tmpllen;
+  p += htsmsg_binary_field_s64(p, "frametype",
+                               frametypearray[pkt->pkt_frametype]);
+
+  p += htsmsg_binary_field_s64(p, "stream", (uint32_t)pkt->pkt_componentindex);
+  p += htsmsg_binary_field_s64(p, "com", (uint32_t)pkt->pkt_commercial);
 
   if(pkt->pkt_pts != PTS_UNSET) {
     int64_t pts = hs->hs_90khz ? pkt->pkt_pts : ts_rescale(pkt->pkt_pts, 1000000);
-    htsmsg_add_s64(m, "pts", pts);
+    p += htsmsg_binary_field_s64(p, "pts", pts);
   }
 
   if(pkt->pkt_dts != PTS_UNSET) {
     int64_t dts = hs->hs_90khz ? pkt->pkt_dts : ts_rescale(pkt->pkt_dts, 1000000);
-    htsmsg_add_s64(m, "dts", dts);
+    p += htsmsg_binary_field_s64(p, "dts", dts);
+    hm->hm_dts = dts;
   }
 
   uint32_t dur = hs->hs_90khz ? pkt->pkt_duration : ts_rescale(pkt->pkt_duration, 1000000);
-  htsmsg_add_u32(m, "duration", dur);
-  
-  /**
-   * Since we will serialize directly we use 'binptr' which is a binary
-   * object that just points to data, thus avoiding a copy.
-   */
+  p += htsmsg_binary_field_s64(p, "duration", dur);
+
   payloadlen = pktbuf_len(pkt->pkt_payload);
-  htsmsg_add_binptr(m, "payload", pktbuf_ptr(pkt->pkt_payload), payloadlen);
-  htsp_send(htsp, m, pkt->pkt_payload, &hs->hs_q, payloadlen);
+  p += htsmsg_binary_field_bin(p, "payload", payloadlen);
+
+  hm->hm_hdrlen = p - hm->hm_hdr;
+  assert(hm->hm_hdrlen <= HTSP_MUXPKT_HDR_MAX);
+  len = hm->hm_hdrlen - 4 + payloadlen;
+  hm->hm_hdr[0] = len >> 24;
+  hm->hm_hdr[1] = len >> 16;
+  hm->hm_hdr[2] = len >> 8;
+  hm->hm_hdr[3] = len;
+
+  htsp_enqueue(htsp, hm, pkt->pkt_payload, &hs->hs_q, payloadlen);
   atomic_add(&hs->hs_s->ths_bytes_out, payloadlen);
 
   if(hs->hs_last_report != dispatch_clock) {
@@ -3264,31 +3432,15 @@ htsp_stream_deliver(htsp_subscription_t *hs, th_pkt_t *pkt)
      */
     
     pthread_mutex_lock(&htsp->htsp_out_mutex);
+    delay = htsp_queue_delay(&hs->hs_q);
+    pthread_mutex_unlock(&htsp->htsp_out_mutex);
 
-    int64_t min_dts = PTS_UNSET;
-    int64_t max_dts = PTS_UNSET;
-    TAILQ_FOREACH(hm, &hs->hs_q.hmq_q, hm_link) {
-      if(!hm->hm_msg)
-	continue;
-      if(htsmsg_get_s64(hm->hm_msg, "dts", &ts))
-	continue;
-      if(ts == PTS_UNSET)
-	continue;
-  
-      if(min_dts == PTS_UNSET)
-	min_dts = ts;
-      else
-	min_dts = MIN(ts, min_dts);
-
-      if(max_dts == PTS_UNSET)
-	max_dts = ts;
-      else
-	max_dts = MAX(ts, max_dts);
-    }
-
-    htsmsg_add_s64(m, "delay", max_dts - min_dts);
+    htsmsg_add_s64(m, "delay", delay);
 
-    pthread_mutex_unlock(&htsp->htsp_out_mutex);
+    /* Same numbers for the status API (delay in microseconds) */
+    hs->hs_s->ths_queue_packets = hs->hs_q.hmq_length;
+    hs->hs_s->ths_queue_bytes   = hs->hs_q.hmq_payload;
+    hs->hs_s->ths_queue_delay   = hs->hs_90khz ? ts_rescale(delay, 1000000) : delay;
 
     htsmsg_add_u32(m, "Bdrops", hs->hs_dropstats[PKT_B_FRAME]);
     htsmsg_add_u32(m, "Pdrops", hs->hs_dropstats[PKT_P_FRAME]);
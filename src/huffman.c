@@ -19,16 +19,199 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include "tvheadend.h"
 #include "huffman.h"
 #include "htsmsg.h"
 #include "settings.h"
 
+/*
+ * Compiled decoder, a byte of input per step. There's a state for every
+ * node a code can be left unfinished at (root and nodes without data), for
+ * each state and input byte the entry holds the text emitted and the state
+ * the byte ends in. The first byte is special as decoding may start at any
+ * bit, it has its own (root only) entries per start bit. Identical texts
+ * share pool space.
+ */
+#define HUFFMAN_END 0xFFFF /* missing branch, decoding stops */
+
+typedef struct huffman_entry
+{
+  uint32_t out;  ///< Emitted text (offset into pool)
+  uint16_t len;  ///< Emitted text length
+  uint16_t next; ///< Next state or HUFFMAN_END
+} huffman_entry_t;
+
+typedef struct huffman_table
+{
+  huffman_entry_t  *entries; ///< [state * 256 + byte]
+  huffman_entry_t  *first;   ///< [start bit * 256 + byte]
+  char             *pool;
+} huffman_table_t;
+
+typedef struct huffman_table_build
+{
+  huffman_node_t   *tree;
+  huffman_node_t  **nodes;   ///< States, sorted by address
+  size_t            count;
+  char             *pool;
+  size_t            pool_len;
+  size_t            pool_size;
+  huffman_entry_t  *texts;   ///< Pool texts by hash (len == 0 is free)
+  size_t            texts_count;
+  size_t            texts_size;
+} huffman_table_build_t;
+
+static int _huffman_node_cmp ( const void *a, const void *b )
+{
+  const huffman_node_t *n1 = *(huffman_node_t **)a, *n2 = *(huffman_node_t **)b;
+  return n1 < n2 ? -1 : (n1 > n2);
+}
+
+static void _huffman_states
+  ( huffman_table_build_t *b, huffman_node_t *n, size_t *size )
+{
+  if (!n || (n->data && n != b->tree)) return;
+  if (b->count == *size) {
+    *size = *size ? *size * 2 : 256;
+    b->nodes = realloc(b->nodes, *size * sizeof(huffman_node_t *));
+  }
+  b->nodes[b->count++] = n;
+  _huffman_states(b, n->b0, size);
+  _huffman_states(b, n->b1, size);
+}
+
+static uint32_t _huffman_text_hash ( const char *s, size_t l )
+{
+  uint32_t h = 2166136261U;
+  while (l--)
+    h = (h ^ (uint8_t)*s++) * 16777619U;
+  return h;
+}
+
+/* Share the text just appended to the pool with an earlier copy */
+static void _huffman_text_intern ( huffman_table_build_t *b, huffman_entry_t *e )
+{
+  huffman_entry_t *t, *old;
+  size_t i, size;
+
+  if (e->len == 0) return;
+  if (2 * (b->texts_count + 1) > b->texts_size) {
+    old  = b->texts;
+    size = b->texts_size;
+    b->texts_size = size ? size * 2 : 4096;
+    b->texts = calloc(b->texts_size, sizeof(huffman_entry_t));
+    b->texts_count = 0;
+    for (i = 0; i < size; i++)
+      if (old[i].len)
+        _huffman_text_intern(b, &old[i]);
+    free(old);
+  }
+  i = _huffman_text_hash(b->pool + e->out, e->len) & (b->texts_size - 1);
+  for ( ; (t = &b->texts[i])->len; i = (i + 1) & (b->texts_size - 1)) {
+    if (t->len == e->len && t != e &&
+        !memcmp(b->pool + t->out, b->pool + e->out, e->len)) {
+      if (e->out + e->len == b->pool_len)
+        b->pool_len = e->out;
+      e->out = t->out;
+      return;
+    }
+  }
+  *t = *e;
+  b->texts_count++;
+}
+
+static int _huffman_entry
+  ( huffman_table_build_t *b, huffman_entry_t *e, huffman_node_t *node,
+    uint8_t byte, uint8_t mask )
+{
+  huffman_node_t **s;
+  size_t l;
+
+  e->out  = b->pool_len;
+  e->next = HUFFMAN_END;
+  for ( ; mask; mask >>= 1) {
+    node = (byte & mask) ? node->b1 : node->b0;
+    if (!node) goto end;
+    if (node->data) {
+      l = strlen(node->data);
+      if (b->pool_len + l > b->pool_size) {
+        b->pool_size = MAX(b->pool_size * 2, b->pool_len + l);
+        b->pool = realloc(b->pool, b->pool_size);
+      }
+      memcpy(b->pool + b->pool_len, node->data, l);
+      b->pool_len += l;
+      node = b->tree;
+    }
+  }
+  s = bsearch(&node, b->nodes, b->count, sizeof(huffman_node_t *),
+              _huffman_node_cmp);
+  e->next = s - b->nodes;
+end:
+  if (b->pool_len - e->out > UINT16_MAX || b->pool_len > UINT32_MAX)
+    return -1;
+  e->len = b->pool_len - e->out;
+  _huffman_text_intern(b, e);
+  return 0;
+}
+
+static huffman_table_t *huffman_table_build ( huffman_node_t *tree )
+{
+  huffman_table_build_t b;
+  huffman_table_t *t;
+  huffman_entry_t *e;
+  size_t size = 0, i;
+  int v, bit;
+
+  memset(&b, 0, sizeof(b));
+  b.tree = tree;
+  _huffman_states(&b, tree, &size);
+  if (b.count >= HUFFMAN_END) {
+    free(b.nodes);
+    return NULL;
+  }
+  qsort(b.nodes, b.count, sizeof(huffman_node_t *), _huffman_node_cmp);
+
+  t = calloc(1, sizeof(huffman_table_t));
+  t->entries = malloc(b.count * 256 * sizeof(huffman_entry_t));
+  t->first   = malloc(8 * 256 * sizeof(huffman_entry_t));
+  e = t->entries;
+  for (i = 0; i < b.count; i++)
+    for (v = 0; v < 256; v++)
+      if (_huffman_entry(&b, e++, b.nodes[i], v, 0x80)) goto fail;
+  e = t->first;
+  for (bit = 0; bit < 8; bit++)
+    for (v = 0; v < 256; v++)
+      if (_huffman_entry(&b, e++, tree, v, 1 << bit)) goto fail;
+  t->pool = realloc(b.pool, b.pool_len ?: 1);
+  free(b.texts);
+  free(b.nodes);
+  return t;
+
+fail:
+  free(t->entries);
+  free(t->first);
+  free(t);
+  free(b.pool);
+  free(b.texts);
+  free(b.nodes);
+  return NULL;
+}
+
+static void huffman_table_destroy ( huffman_table_t *t )
+{
+  free(t->entries);
+  free(t->first);
+  free(t->pool);
+  free(t);
+}
+
 void huffman_tree_destroy ( huffman_node_t *n )
 {
   if (!n) return;
   huffman_tree_destroy(n->b0);
   huffman_tree_destroy(n->b1);
   if (n->data) free(n->data);
+  if (n->table) huffman_table_destroy(n->table);
   free(n);
 }
 
@@ -70,9 +253,32 @@ huffman_node_t *huffman_tree_build ( htsmsg_t *m )
       node->data = strdup(data);
     }
   }
+  root->table = huffman_table_build(root);
   return root; 
 }
 
+static char *huffman_decode_table
+  ( huffman_table_t *t, const uint8_t *data, size_t len, uint8_t mask,
+    char *outb, int outl )
+{
+  char                  *ret = outb;
+  const huffman_entry_t *e   = t->first + __builtin_ctz(mask) * 256;
+  int                    l;
+
+  outl--; // leave space for NULL
+  while (len) {
+    len--;
+    e += *data++;
+    l = MIN(e->len, outl);
+    memcpy(outb, t->pool + e->out, l);
+    outb += l; outl -= l;
+    if (!outl || e->next == HUFFMAN_END) break;
+    e = t->entries + e->next * 256;
+  }
+  *outb = '\0';
+  return ret;
+}
+
 char *huffman_decode 
   ( huffman_node_t *tree, const uint8_t *data, size_t len, uint8_t mask,
     char *outb, int outl )
@@ -81,6 +287,10 @@ char *huffman_decode
   huffman_node_t *node = tree;
   if (!len) return NULL;
 
+  /* Compiled decoder, a single start bit only */
+  if (tree->table && mask && !(mask & (mask - 1)) && outl > 0)
+    return huffman_decode_table(tree->table, data, len, mask, outb, outl);
+
   outl--; // leave space for NULL
   while (len) {
     len--;
@@ -24,9 +24,10 @@
 
 typedef struct huffman_node
 {
-  struct huffman_node *b0;
-  struct huffman_node *b1;
-  char                *data;
+  struct huffman_node  *b0;
+  struct huffman_node  *b1;
+  char                 *data;
+  struct huffman_table *table; ///< Compiled decoder (root only)
 } huffman_node_t;
 
 void huffman_tree_destroy ( huffman_node_t *tree );
@@ -67,7 +67,8 @@ htsmsg_t *
 tvh_input_stream_create_msg
   ( tvh_input_stream_t *st )
 {
-  htsmsg_t *m = htsmsg_create_map();
+  htsmsg_t *m = htsmsg_create_map(), *l;
+  int i;
   htsmsg_add_str(m, "uuid", st->uuid);
   if (st->input_name)
     htsmsg_add_str(m, "input",  st->input_name);
@@ -88,6 +89,16 @@ tvh_input_stream_create_msg
   htsmsg_add_u32(m, "tc_bit", st->stats.tc_bit);
   htsmsg_add_u32(m, "ec_block", st->stats.ec_block);
   htsmsg_add_u32(m, "tc_block", st->stats.tc_block);
+  htsmsg_add_u32(m, "bps_p50", st->bps_p50);
+  htsmsg_add_u32(m, "bps_p95", st->bps_p95);
+  l = htsmsg_create_list();
+  for (i = 0; i < TVH_INPUT_STREAM_HISTORY; i++)
+    htsmsg_add_u32(l, NULL, st->bps_history[i]);
+  htsmsg_add_msg(m, "bps_history", l);
+  l = htsmsg_create_list();
+  for (i = 0; i < TVH_INPUT_STREAM_HISTORY; i++)
+    htsmsg_add_u32(l, NULL, st->cc_history[i]);
+  htsmsg_add_msg(m, "cc_history", l);
   return m;
 }
 
@@ -63,6 +63,8 @@ struct tvh_input_stream_stats
   int tc_block;  ///< TOTAL_BLOCK_COUNT
 };
 
+#define TVH_INPUT_STREAM_HISTORY 30 ///< seconds of bandwidth/error history
+
 struct tvh_input_stream {
 
   LIST_ENTRY(tvh_input_stream) link;
@@ -74,6 +76,11 @@ struct tvh_input_stream {
   int   max_weight;   ///< Current max weight
 
   tvh_input_stream_stats_t stats;
+
+  unsigned int bps_history[TVH_INPUT_STREAM_HISTORY]; ///< bps, newest first
+  unsigned int cc_history[TVH_INPUT_STREAM_HISTORY];  ///< cc errors per second
+  unsigned int bps_p50;  ///< median bandwidth over the history (bps)
+  unsigned int bps_p95;  ///< 95th percentile bandwidth (bps)
 };
 
 /*
@@ -27,6 +27,7 @@
 #include "atomic.h"
 #include "input.h"
 #include "service.h"
+#include "packet.h"
 #include "mpegts/dvb.h"
 #include "subscriptions.h"
 
@@ -46,9 +47,11 @@ typedef struct mpegts_mux_instance  mpegts_mux_instance_t;
 typedef struct mpegts_mux_sub       mpegts_mux_sub_t;
 typedef struct mpegts_input         mpegts_input_t;
 typedef struct mpegts_table_feed    mpegts_table_feed_t;
+typedef struct mpegts_table_section mpegts_table_section_t;
 typedef struct mpegts_network_link  mpegts_network_link_t;
 typedef struct mpegts_packet        mpegts_packet_t;
 typedef struct mpegts_buffer        mpegts_buffer_t;
+typedef struct mpegts_input_worker  mpegts_input_worker_t;
 
 /* Lists */
 typedef LIST_HEAD (,mpegts_network)             mpegts_network_list_t;
@@ -58,6 +61,8 @@ typedef LIST_HEAD (,mpegts_mux)                 mpegts_mux_list_t;
 typedef LIST_HEAD (,mpegts_network_link)        mpegts_network_link_list_t;
 typedef TAILQ_HEAD(mpegts_table_feed_queue, mpegts_table_feed)
   mpegts_table_feed_queue_t;
+typedef TAILQ_HEAD(mpegts_table_section_queue, mpegts_table_section)
+  mpegts_table_section_queue_t;
 
 /* Classes */
 extern const idclass_t mpegts_network_class;
@@ -82,7 +87,8 @@ struct mpegts_packet
   TAILQ_ENTRY(mpegts_packet)  mp_link;
   size_t                      mp_len;
   mpegts_mux_t               *mp_mux;
-  uint8_t                     mp_data[0];
+  pktbuf_t                   *mp_buf;   /* refcounted TS data */
+  uint8_t                    *mp_data;
 };
 
 typedef int (*mpegts_table_callback_t)
@@ -123,6 +129,7 @@ typedef struct mpegts_pid_sub
 #define MPS_STREAM 0x1
 #define MPS_TABLE  0x2
 #define MPS_FTABLE 0x4
+#define MPS_ALL    0x8 // stream data to all services (MT_RECORD tables)
   int                       mps_type;
   void                     *mps_owner;
 } mpegts_pid_sub_t;
@@ -132,6 +139,9 @@ typedef struct mpegts_pid
   int                      mp_pid;
   int                      mp_fd;   // linuxdvb demux fd
   int8_t                   mp_cc;
+  int                      mp_type; // MPS_* of all subscribers
+  int                      mp_nsvcs;
+  mpegts_service_t       **mp_svcs; // services subscribed to stream data
   RB_HEAD(,mpegts_pid_sub) mp_subs; // subscribers to pid
   RB_ENTRY(mpegts_pid)     mp_link;
 } mpegts_pid_t;
@@ -207,6 +217,20 @@ struct mpegts_table
 
   mpegts_psi_section_t mt_sect;
 
+  /**
+   * Keys of sections that belong to an already complete table state,
+   * repeats of these are dropped by the table thread before global_lock
+   * is taken. Only maintained for tables fed by the table thread.
+   *
+   * mt_sect_lock protects the set and the reassembly state (mt_sect,
+   * mt_cc) of these tables. It is a leaf lock, taken after mm_tables_lock.
+   */
+  pthread_mutex_t mt_sect_lock;
+  uint64_t *mt_dedup;
+  int       mt_dedup_size;
+  int       mt_dedup_count;
+  uint64_t  mt_dedup_key; // key of the section being dispatched
+
   struct mpegts_table_mux_cb *mt_mux_cb;
 
   mpegts_service_t *mt_service;
@@ -228,6 +252,18 @@ struct mpegts_table_feed {
   mpegts_mux_t *mtf_mux;
 };
 
+/**
+ * Section reassembled by the table thread (outside global_lock),
+ * waiting to be dispatched to its table
+ */
+
+struct mpegts_table_section {
+  TAILQ_ENTRY(mpegts_table_section) mts_link;
+  mpegts_table_t *mts_table; // referenced
+  size_t mts_len;
+  uint8_t mts_data[0];
+};
+
 /*
  * Assemble SI section
  */
@@ -388,13 +424,20 @@ struct mpegts_mux
    * Data processing
    */
 
+  // Note: mm_output_lock protects the PID list, the list of active
+  //       services and the streaming pad of the active instance, it
+  //       is held by the input processing thread for this mux
+  pthread_mutex_t             mm_output_lock;
+  LIST_HEAD(, mpegts_service) mm_transports;
+  int                         mm_worker;
+
   RB_HEAD(, mpegts_pid)       mm_pids;
-  int                         mm_last_pid;
-  mpegts_pid_t               *mm_last_mp;
+  mpegts_pid_t              **mm_pid_table; // direct lookup, PIDs < 0x2000
 
   int                         mm_num_tables;
   LIST_HEAD(, mpegts_table)   mm_tables;
   TAILQ_HEAD(, mpegts_table)  mm_defer_tables;
+  volatile int                mm_defer_pending; // mm_defer_tables filled
   pthread_mutex_t             mm_tables_lock;
   TAILQ_HEAD(, mpegts_table)  mm_table_queue;
 
@@ -477,6 +520,7 @@ struct mpegts_service
    */
 
   LIST_ENTRY(mpegts_service) s_dvb_mux_link;
+  LIST_ENTRY(mpegts_service) s_dvb_active_link;
   mpegts_mux_t               *s_dvb_mux;
   mpegts_input_t             *s_dvb_active_input;
 
@@ -531,6 +575,8 @@ struct mpegts_mux_instance
   LIST_HEAD(,th_subscription) mmi_subs;
 
   tvh_input_stream_stats_t mmi_stats;
+  avgstat_t       mmi_rate;       /* Bytes per second history */
+  avgstat_t       mmi_cc_errors;  /* Continuity errors per second history */
 
   int             mmi_tune_failed;
 
@@ -544,6 +590,19 @@ struct mpegts_mux_sub
   int                       mms_weight;
 };
 
+/* Input processing thread */
+struct mpegts_input_worker
+{
+  mpegts_input_t             *miw_input;
+  pthread_t                   miw_tid;
+  pthread_cond_t              miw_cond;
+  TAILQ_HEAD(,mpegts_packet)  miw_queue;
+  int                         miw_muxes;   /* number of assigned muxes */
+  uint8_t                     miw_running;
+};
+
+#define MPEGTS_INPUT_THREADS_MAX 64
+
 /* Input source */
 struct mpegts_input
 {
@@ -563,6 +622,8 @@ struct mpegts_input
   int mi_initscan;
   int mi_idlescan;
 
+  int mi_input_threads;
+
   LIST_ENTRY(mpegts_input) mi_global_link;
 
   mpegts_network_link_list_t mi_networks;
@@ -585,14 +646,17 @@ struct mpegts_input
 
   /* Data input */
   // Note: this section is protected by mi_input_lock
-  pthread_t                       mi_input_tid;
+  //       each active mux is assigned to one of the processing
+  //       threads, so muxes of one input are demuxed in parallel
   pthread_mutex_t                 mi_input_lock;
-  pthread_cond_t                  mi_input_cond;
-  TAILQ_HEAD(,mpegts_packet)      mi_input_queue;
+  mpegts_input_worker_t          *mi_input_workers;
+  int                             mi_input_nworkers;
 
   /* Data processing/output */
   // Note: this lock (mi_output_lock) protects all the remaining
-  //       data fields (excluding the callback functions)
+  //       data fields (excluding the callback functions), the
+  //       per-mux data are also protected by mm_output_lock
+  //       (lock order: mi_output_lock -> mm_output_lock)
   pthread_mutex_t                 mi_output_lock;
 
   /* Active sources */
@@ -600,9 +664,13 @@ struct mpegts_input
   LIST_HEAD(,service)             mi_transports;
 
   /* Table processing */
+  // Note: the table queue is protected by mi_table_lock
   pthread_t                       mi_table_tid;
+  pthread_mutex_t                 mi_table_lock;
   pthread_cond_t                  mi_table_cond;
   mpegts_table_feed_queue_t       mi_table_queue;
+  int                             mi_table_busy; // batch being reassembled
+  pthread_cond_t                  mi_table_busy_cond;
 
   /* DBus */
 #if ENABLE_DBUS_1
@@ -796,12 +864,15 @@ mpegts_pid_t *mpegts_mux_find_pid_(mpegts_mux_t *mm, int pid, int create);
 static inline mpegts_pid_t *
 mpegts_mux_find_pid(mpegts_mux_t *mm, int pid, int create)
 {
-  if (mm->mm_last_pid != pid)
-    return mpegts_mux_find_pid_(mm, pid, create);
-  else
-    return mm->mm_last_mp;
+  if (!create && pid >= 0 && pid < MPEGTS_FULLMUX_PID)
+    return mm->mm_pid_table ? mm->mm_pid_table[pid] : NULL;
+  return mpegts_mux_find_pid_(mm, pid, create);
 }
 
+void mpegts_mux_update_pid ( mpegts_mux_t *mm, mpegts_pid_t *mp );
+
+void mpegts_mux_remove_pid ( mpegts_mux_t *mm, mpegts_pid_t *mp );
+
 void mpegts_input_recv_packets
   (mpegts_input_t *mi, mpegts_mux_instance_t *mmi, sbuf_t *sb,
    int64_t *pcr, uint16_t *pcr_pid);
@@ -846,6 +917,14 @@ sbuf_tsdebug_read(mpegts_mux_t *mm, sbuf_t *sb, int fd)
 
 void mpegts_table_dispatch
   (const uint8_t *sec, size_t r, void *mt);
+int mpegts_table_dedup_check
+  (mpegts_table_t *mt, const uint8_t *sec, size_t r);
+void mpegts_table_dedup_add
+  (mpegts_table_t *mt);
+void mpegts_table_dedup_flush
+  (mpegts_table_t *mt);
+void mpegts_table_dedup_flush_all
+  (mpegts_mux_t *mm);
 static inline void mpegts_table_grab
   (mpegts_table_t *mt)
 {
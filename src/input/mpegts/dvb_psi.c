@@ -963,6 +963,7 @@ dvb_table_begin
       if (st->complete)
         mt->mt_incomplete++;
       tvhtrace(mt->mt_name, "  new version, restart");
+      mpegts_table_dedup_flush(mt);
       mpegts_table_state_reset(mt, st, *last);
       st->version = *ver;
     }
@@ -975,6 +976,7 @@ dvb_table_begin
         mt->mt_complete++;
         return dvb_table_complete(mt);
       } else if (st->complete == 2) {
+        mpegts_table_dedup_add(mt);
         return dvb_table_complete(mt);
       }
       assert(0);
@@ -1002,6 +1004,7 @@ dvb_table_reset(mpegts_table_t *mt)
   tvhtrace(mt->mt_name, "pid %02X complete reset", mt->mt_pid);
   mt->mt_incomplete = 0;
   mt->mt_complete   = 0;
+  mpegts_table_dedup_flush(mt);
   while ((st = RB_FIRST(&mt->mt_state)) != NULL) {
     RB_REMOVE(&mt->mt_state, st, link);
     free(st);
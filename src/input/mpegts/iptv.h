@@ -20,6 +20,8 @@
 #ifndef __IPTV_H__
 #define __IPTV_H__
 
+extern int iptv_input_threads;
+
 void iptv_init ( void );
 void iptv_done ( void );
 
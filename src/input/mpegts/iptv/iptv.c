@@ -43,6 +43,7 @@ iptv_input_t   *iptv_input;
 tvhpoll_t      *iptv_poll;
 pthread_t       iptv_thread;
 pthread_mutex_t iptv_lock;
+int             iptv_input_threads = 1;
 
 /* **************************************************************************
  * IPTV handlers
@@ -602,6 +603,7 @@ void iptv_init ( void )
   iptv_input = calloc(1, sizeof(iptv_input_t));
 
   /* Init Input */
+  iptv_input->mi_input_threads = iptv_input_threads;
   mpegts_input_create0((mpegts_input_t*)iptv_input,
                        &iptv_input_class, NULL, NULL);
   iptv_input->mi_warm_mux       = iptv_input_warm_mux;
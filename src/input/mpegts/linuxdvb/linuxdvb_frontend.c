@@ -572,8 +572,10 @@ linuxdvb_frontend_monitor ( void *aux )
 
       /* Locked - ensure everything is open */
       pthread_mutex_lock(&lfe->mi_output_lock);
+      pthread_mutex_lock(&mm->mm_output_lock);
       RB_FOREACH(mp, &mm->mm_pids, mp_link)
         linuxdvb_frontend_open_pid0(lfe, mp);
+      pthread_mutex_unlock(&mm->mm_output_lock);
       pthread_mutex_unlock(&lfe->mi_output_lock);
 
     /* Re-arm (quick) */
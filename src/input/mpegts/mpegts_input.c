@@ -26,6 +26,7 @@
 #include "notify.h"
 #include "idnode.h"
 #include "dbus.h"
+#include "mempool.h"
 
 #include <pthread.h>
 #include <assert.h>
@@ -33,9 +34,18 @@
 #include <sys/stat.h>
 
 
+static mempool_t mpegts_table_feed_mempool =
+  MEMPOOL_INIT("mpegts_table_feed", mpegts_table_feed_t);
+
 static void
 mpegts_input_del_network ( mpegts_network_link_t *mnl );
 
+static void
+mpegts_input_workers_start ( mpegts_input_t *mi );
+
+static void
+mpegts_input_workers_stop ( mpegts_input_t *mi );
+
 /*
  * DBUS
  */
@@ -140,6 +150,25 @@ mpegts_input_enabled_notify ( void *p )
     mi->mi_enabled_updated(mi);
 }
 
+static void
+mpegts_input_threads_notify ( void *p )
+{
+  mpegts_input_t *mi = p;
+  mpegts_mux_instance_t *mmi;
+
+  /* Not yet started (config load) */
+  if (!mi->mi_running)
+    return;
+
+  /* Stop (muxes are assigned to the threads when started) */
+  while ((mmi = LIST_FIRST(&mi->mi_mux_active)))
+    mmi->mmi_mux->mm_stop(mmi->mmi_mux, 1);
+
+  /* Restart processing threads */
+  mpegts_input_workers_stop(mi);
+  mpegts_input_workers_start(mi);
+}
+
 const idclass_t mpegts_input_class =
 {
   .ic_class      = "mpegts_input",
@@ -202,6 +231,15 @@ const idclass_t mpegts_input_class =
       .def.i    = 1,
       .opts     = PO_ADVANCED,
     },
+    {
+      .type     = PT_INT,
+      .id       = "threads",
+      .name     = "Processing Threads",
+      .off      = offsetof(mpegts_input_t, mi_input_threads),
+      .notify   = mpegts_input_threads_notify,
+      .def.i    = 1,
+      .opts     = PO_ADVANCED,
+    },
     {
       .type     = PT_STR,
       .id       = "networks",
@@ -322,12 +360,8 @@ mpegts_input_stop_mux ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
 static int
 mps_cmp ( mpegts_pid_sub_t *a, mpegts_pid_sub_t *b )
 {
-  if (a->mps_type != b->mps_type) {
-    if (a->mps_type & MPS_STREAM)
-      return 1;
-    else
-      return -1;
-  }
+  if (a->mps_type != b->mps_type)
+    return a->mps_type < b->mps_type ? -1 : 1;
   if (a->mps_owner < b->mps_owner) return -1;
   if (a->mps_owner > b->mps_owner) return 1;
   return 0;
@@ -342,11 +376,13 @@ mpegts_input_open_pid
   mpegts_pid_sub_t *mps;
   assert(owner != NULL);
   lock_assert(&mi->mi_output_lock);
+  lock_assert(&mm->mm_output_lock);
   if ((mp = mpegts_mux_find_pid(mm, pid, 1))) {
     mps = calloc(1, sizeof(*mps));
     mps->mps_type  = type;
     mps->mps_owner = owner;
     if (!RB_INSERT_SORTED(&mp->mp_subs, mps, mps_link, mps_cmp)) {
+      mpegts_mux_update_pid(mm, mp);
       mpegts_mux_nice_name(mm, buf, sizeof(buf));
       tvhdebug("mpegts", "%s - open PID %04X (%d) [%d/%p]",
                buf, mp->mp_pid, mp->mp_pid, type, owner);
@@ -367,27 +403,22 @@ mpegts_input_close_pid
   mpegts_pid_t *mp;
   assert(owner != NULL);
   lock_assert(&mi->mi_output_lock);
+  lock_assert(&mm->mm_output_lock);
   if (!(mp = mpegts_mux_find_pid(mm, pid, 0)))
     return;
   skel.mps_type  = type;
   skel.mps_owner = owner;
   mps = RB_FIND(&mp->mp_subs, &skel, mps_link, mps_cmp);
-  if (pid == mm->mm_last_pid) {
-    mm->mm_last_pid = -1;
-    mm->mm_last_mp = NULL;
-  }
   if (mps) {
     mpegts_mux_nice_name(mm, buf, sizeof(buf));
     tvhdebug("mpegts", "%s - close PID %04X (%d) [%d/%p]",
              buf, mp->mp_pid, mp->mp_pid, type, owner);
     RB_REMOVE(&mp->mp_subs, mps, mps_link);
     free(mps);
-    if (!RB_FIRST(&mp->mp_subs)) {
-      RB_REMOVE(&mm->mm_pids, mp, mp_link);
-      if (mp->mp_fd != -1)
-        linuxdvb_filter_close(mp->mp_fd);
-      free(mp);
-    }
+    if (!RB_FIRST(&mp->mp_subs))
+      mpegts_mux_remove_pid(mm, mp);
+    else
+      mpegts_mux_update_pid(mm, mp);
   }
 }
 
@@ -395,27 +426,31 @@ void
 mpegts_input_open_service ( mpegts_input_t *mi, mpegts_service_t *s, int init )
 {
   elementary_stream_t *st;
+  mpegts_mux_t *mm = s->s_dvb_mux;
 
   /* Add to list */
   pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mm->mm_output_lock);
   if (!s->s_dvb_active_input) {
     LIST_INSERT_HEAD(&mi->mi_transports, ((service_t*)s), s_active_link);
+    LIST_INSERT_HEAD(&mm->mm_transports, s, s_dvb_active_link);
     s->s_dvb_active_input = mi;
   }
 
   /* Register PIDs */
   pthread_mutex_lock(&s->s_stream_mutex);
-  mi->mi_open_pid(mi, s->s_dvb_mux, s->s_pmt_pid, MPS_STREAM, s);
-  mi->mi_open_pid(mi, s->s_dvb_mux, s->s_pcr_pid, MPS_STREAM, s);
+  mi->mi_open_pid(mi, mm, s->s_pmt_pid, MPS_STREAM, s);
+  mi->mi_open_pid(mi, mm, s->s_pcr_pid, MPS_STREAM, s);
   /* Open only filtered components here */
   TAILQ_FOREACH(st, &s->s_filt_components, es_filt_link) {
     if (st->es_type != SCT_CA) {
       st->es_pid_opened = 1;
-      mi->mi_open_pid(mi, s->s_dvb_mux, st->es_pid, MPS_STREAM, s);
+      mi->mi_open_pid(mi, mm, st->es_pid, MPS_STREAM, s);
     }
   }
 
   pthread_mutex_unlock(&s->s_stream_mutex);
+  pthread_mutex_unlock(&mm->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 
    /* Add PMT monitor */
@@ -429,6 +464,9 @@ void
 mpegts_input_close_service ( mpegts_input_t *mi, mpegts_service_t *s )
 {
   elementary_stream_t *st;
+  mpegts_mux_t *mm = s->s_dvb_mux;
+  mpegts_pid_t *mp, *mp_next;
+  mpegts_pid_sub_t *mps, skel;
 
   /* Close PMT table */
   if (s->s_pmt_mon)
@@ -437,25 +475,36 @@ mpegts_input_close_service ( mpegts_input_t *mi, mpegts_service_t *s )
 
   /* Remove from list */
   pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mm->mm_output_lock);
   if (s->s_dvb_active_input != NULL) {
     LIST_REMOVE(((service_t*)s), s_active_link);
+    LIST_REMOVE(s, s_dvb_active_link);
     s->s_dvb_active_input = NULL;
   }
   
   /* Close PID */
   pthread_mutex_lock(&s->s_stream_mutex);
-  mi->mi_close_pid(mi, s->s_dvb_mux, s->s_pmt_pid, MPS_STREAM, s);
-  mi->mi_close_pid(mi, s->s_dvb_mux, s->s_pcr_pid, MPS_STREAM, s);
+  mi->mi_close_pid(mi, mm, s->s_pmt_pid, MPS_STREAM, s);
+  mi->mi_close_pid(mi, mm, s->s_pcr_pid, MPS_STREAM, s);
   /* Close all opened PIDs (the component filter may be changed at runtime) */
   TAILQ_FOREACH(st, &s->s_components, es_link) {
     if (st->es_pid_opened) {
       st->es_pid_opened = 0;
-      mi->mi_close_pid(mi, s->s_dvb_mux, st->es_pid, MPS_STREAM, s);
+      mi->mi_close_pid(mi, mm, st->es_pid, MPS_STREAM, s);
     }
   }
-
+  /* Close PIDs left over from PMT changes (the PID tables refer to s) */
+  skel.mps_type  = MPS_STREAM;
+  skel.mps_owner = s;
+  for (mp = RB_FIRST(&mm->mm_pids); mp; mp = mp_next) {
+    mp_next = RB_NEXT(mp, mp_link);
+    mps = RB_FIND(&mp->mp_subs, &skel, mps_link, mps_cmp);
+    if (mps)
+      mi->mi_close_pid(mi, mm, mp->mp_pid, MPS_STREAM, s);
+  }
 
   pthread_mutex_unlock(&s->s_stream_mutex);
+  pthread_mutex_unlock(&mm->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 
   /* Stop mux? */
@@ -474,6 +523,31 @@ mpegts_input_create_mux_instance
     (void)mpegts_mux_instance_create(mpegts_mux_instance, NULL, mi, mm);
 }
 
+static void
+mpegts_input_worker_assign ( mpegts_input_t *mi, mpegts_mux_t *mm )
+{
+  int i, w = 0;
+
+  lock_assert(&mi->mi_input_lock);
+
+  for (i = 1; i < mi->mi_input_nworkers; i++)
+    if (mi->mi_input_workers[i].miw_muxes < mi->mi_input_workers[w].miw_muxes)
+      w = i;
+  mm->mm_worker = w;
+  if (mi->mi_input_workers)
+    mi->mi_input_workers[w].miw_muxes++;
+}
+
+static void
+mpegts_input_worker_release ( mpegts_input_t *mi, mpegts_mux_t *mm )
+{
+  lock_assert(&mi->mi_input_lock);
+
+  if (mm->mm_worker < mi->mi_input_nworkers)
+    mi->mi_input_workers[mm->mm_worker].miw_muxes--;
+  mm->mm_worker = 0;
+}
+
 static void
 mpegts_input_started_mux
   ( mpegts_input_t *mi, mpegts_mux_instance_t *mmi )
@@ -511,6 +585,11 @@ mpegts_input_started_mux
   /* Wait for first TS packet */
   mi->mi_live = 0;
 
+  /* Assign the least loaded processing thread */
+  pthread_mutex_lock(&mi->mi_input_lock);
+  mpegts_input_worker_assign(mi, mmi->mmi_mux);
+  pthread_mutex_unlock(&mi->mi_input_lock);
+
   /* Arm timer */
   if (LIST_FIRST(&mi->mi_mux_active) == NULL)
     gtimer_arm(&mi->mi_status_timer, mpegts_input_status_timer,
@@ -535,7 +614,9 @@ mpegts_input_stopping_mux
   mmi->mmi_mux->mm_active = NULL;
   pthread_mutex_unlock(&mi->mi_input_lock);
   pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mmi->mmi_mux->mm_output_lock);
   mmi->mmi_mux->mm_active = NULL;
+  pthread_mutex_unlock(&mmi->mmi_mux->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 }
 
@@ -549,6 +630,11 @@ mpegts_input_stopped_mux
   /* no longer active */
   LIST_REMOVE(mmi, mmi_active_link);
 
+  /* Release processing thread */
+  pthread_mutex_lock(&mi->mi_input_lock);
+  mpegts_input_worker_release(mi, mmi->mmi_mux);
+  pthread_mutex_unlock(&mi->mi_input_lock);
+
   /* Disarm timer */
   if (LIST_FIRST(&mi->mi_mux_active) == NULL)
     gtimer_disarm(&mi->mi_status_timer);
@@ -616,6 +702,13 @@ mpegts_input_tuning_error ( mpegts_input_t *mi, mpegts_mux_t *mm )
  * Data processing
  * *************************************************************************/
 
+static inline void
+mpegts_packet_destroy ( mpegts_packet_t *mp )
+{
+  pktbuf_ref_dec(mp->mp_buf);
+  free(mp);
+}
+
 static int inline
 ts_sync_count ( const uint8_t *tsb, int len )
 {
@@ -648,6 +741,7 @@ mpegts_input_recv_packets
 {
   int p = 0, len2, off = 0;
   mpegts_packet_t *mp;
+  mpegts_input_worker_t *miw;
   uint8_t *tsb = sb->sb_data;
   int     len  = sb->sb_ptr;
 #define MIN_TS_PKT 100
@@ -690,22 +784,37 @@ mpegts_input_recv_packets
   if (p >= MIN_TS_SYN) {
     len2 = p * 188;
     
-    mp = malloc(sizeof(mpegts_packet_t) + len2);
+    mp = malloc(sizeof(mpegts_packet_t));
     mp->mp_mux  = mmi->mmi_mux;
     mp->mp_len  = len2;
-    memcpy(mp->mp_data, tsb, len2);
 
-    len -= len2;
-    off += len2;
+    // Note: a well filled buffer is passed on as is (no copy), the
+    //       frontend continues with a recycled one
+    if (len2 >= sb->sb_size / 4) {
+      if (off)
+        sbuf_cut(sb, off);
+      mp->mp_buf = pktbuf_from_sbuf(sb, len2);
+      len = off = 0;
+    } else {
+      mp->mp_buf = pktbuf_alloc(tsb, len2);
+      len -= len2;
+      off += len2;
+    }
+    mp->mp_data = pktbuf_ptr(mp->mp_buf);
 
     pthread_mutex_lock(&mi->mi_input_lock);
-    if (mmi->mmi_mux->mm_active == mmi) {
-      TAILQ_INSERT_TAIL(&mi->mi_input_queue, mp, mp_link);
-      pthread_cond_signal(&mi->mi_input_cond);
+    if (mmi->mmi_mux->mm_active == mmi && mi->mi_input_workers) {
+      miw = &mi->mi_input_workers[mmi->mmi_mux->mm_worker];
+      TAILQ_INSERT_TAIL(&miw->miw_queue, mp, mp_link);
+      pthread_cond_signal(&miw->miw_cond);
     } else {
-      free(mp);
+      mpegts_packet_destroy(mp);
     }
     pthread_mutex_unlock(&mi->mi_input_lock);
+
+    /* Buffer already adjusted */
+    if (!off)
+      return;
   }
 
   /* Adjust buffer */
@@ -840,15 +949,14 @@ mpegts_input_process
   uint8_t cc;
   uint8_t *tsb = mpkt->mp_data;
   int len = mpkt->mp_len;
-  int table = 0, stream = 0, f;
+  int table, type, f, i;
   mpegts_pid_t *mp;
-  mpegts_pid_sub_t *mps;
-  service_t *s;
-  int table_wakeup = 0;
+  mpegts_service_t *s;
+  mpegts_table_feed_t *mtf;
+  mpegts_table_feed_queue_t table_queue;
   uint8_t *end = mpkt->mp_data + len;
   mpegts_mux_t          *mm  = mpkt->mp_mux;
   mpegts_mux_instance_t *mmi;
-  mpegts_pid_t *last_mp = NULL;
 #if ENABLE_TSDEBUG
   off_t tsdebug_pos;
 #endif
@@ -856,6 +964,9 @@ mpegts_input_process
   if (mm == NULL || (mmi = mm->mm_active) == NULL)
     return;
 
+  lock_assert(&mm->mm_output_lock);
+  TAILQ_INIT(&table_queue);
+
   assert(mm == mmi->mmi_mux);
 
 #if ENABLE_TSDEBUG
@@ -894,42 +1005,31 @@ mpegts_input_process
         if (mp->mp_cc != -1 && mp->mp_cc != cc) {
           tvhtrace("mpegts", "pid %04X cc err %2d != %2d", pid, cc, mp->mp_cc);
           ++mmi->mmi_stats.cc;
+          avgstat_add(&mmi->mmi_cc_errors, 1, dispatch_clock);
         }
         mp->mp_cc = (cc + 1) & 0xF;
       }
 
-      if (mp != last_mp) {
-        last_mp = mp;
-        if (pid == 0) {
-          stream = MPS_STREAM;
-          table  = MPS_TABLE;
-        } else {
-          stream = table = 0;
+      /* PID type (precomputed on open/close) */
+      type  = pid ? mp->mp_type : (MPS_STREAM | MPS_ALL | MPS_TABLE);
+      table = type & (MPS_TABLE | MPS_FTABLE);
 
-          /* Determine PID type */
-          RB_FOREACH(mps, &mp->mp_subs, mps_link) {
-            stream |= mps->mps_type & MPS_STREAM;
-            table  |= mps->mps_type & (MPS_TABLE | MPS_FTABLE);
-            if (table == (MPS_TABLE|MPS_FTABLE) && stream) break;
+      /* Stream data */
+      if (type & MPS_STREAM) {
+        if (type & MPS_ALL) {
+          /* PAT and recorded tables go to all services */
+          LIST_FOREACH(s, &mm->mm_transports, s_dvb_active_link) {
+            f = table || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid);
+            ts_recv_packet1(s, tsb, NULL, f);
           }
-
-          /* Special case streams */
-          LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-            if (((mpegts_service_t*)s)->s_dvb_mux != mm) continue;
-                 if (pid == s->s_pmt_pid) stream = MPS_STREAM;
-            else if (pid == s->s_pcr_pid) stream = MPS_STREAM;
+        } else {
+          for (i = 0; i < mp->mp_nsvcs; i++) {
+            s = mp->mp_svcs[i];
+            f = table || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid);
+            ts_recv_packet1(s, tsb, NULL, f);
           }
         }
       }
-    
-      /* Stream data */
-      if (stream) {
-        LIST_FOREACH(s, &mi->mi_transports, s_active_link) {
-          if (((mpegts_service_t*)s)->s_dvb_mux != mm) continue;
-          f = table || (pid == s->s_pmt_pid) || (pid == s->s_pcr_pid);
-          ts_recv_packet1((mpegts_service_t*)s, tsb, NULL, f);
-        }
-      }
 
       /* Table data */
       if (table) {
@@ -940,11 +1040,10 @@ mpegts_input_process
             // TODO: might be able to optimise this a bit by having slightly
             //       larger buffering and trying to aggregate data (if we get
             //       same PID multiple times in the loop)
-            mpegts_table_feed_t *mtf = malloc(sizeof(mpegts_table_feed_t));
+            mtf = mempool_alloc(&mpegts_table_feed_mempool);
             memcpy(mtf->mtf_tsb, tsb, 188);
             mtf->mtf_mux   = mm;
-            TAILQ_INSERT_TAIL(&mi->mi_table_queue, mtf, mtf_link);
-            table_wakeup = 1;
+            TAILQ_INSERT_TAIL(&table_queue, mtf, mtf_link);
           }
         } else {
           //tvhdebug("tsdemux", "%s - SI packet had errors", name);
@@ -959,17 +1058,15 @@ done:
 #endif
   }
 
-  /* Raw stream */
+  /* Raw stream (shares the input buffer) */
   if (tsb != mpkt->mp_data &&
       LIST_FIRST(&mmi->mmi_streaming_pad.sp_targets) != NULL) {
 
     streaming_message_t sm;
-    pktbuf_t *pb = pktbuf_alloc(mpkt->mp_data, tsb - mpkt->mp_data);
     memset(&sm, 0, sizeof(sm));
     sm.sm_type = SMT_MPEGTS;
-    sm.sm_data = pb;
+    sm.sm_data = mpkt->mp_buf;
     streaming_pad_deliver(&mmi->mmi_streaming_pad, streaming_msg_clone(&sm));
-    pktbuf_ref_dec(pb);
   }
 #if ENABLE_TSDEBUG
   {
@@ -994,38 +1091,55 @@ done:
 #endif
 
   /* Wake table */
-  if (table_wakeup)
+  if (!TAILQ_EMPTY(&table_queue)) {
+    pthread_mutex_lock(&mi->mi_table_lock);
+    TAILQ_CONCAT(&mi->mi_table_queue, &table_queue, mtf_link);
     pthread_cond_signal(&mi->mi_table_cond);
+    pthread_mutex_unlock(&mi->mi_table_lock);
+  }
 
   /* Bandwidth monitoring */
   atomic_add(&mmi->mmi_stats.bps, tsb - mpkt->mp_data);
+  avgstat_add(&mmi->mmi_rate, tsb - mpkt->mp_data, dispatch_clock);
 }
 
 static void *
 mpegts_input_thread ( void * p )
 {
-  mpegts_packet_t *mp;
-  mpegts_input_t  *mi = p;
+  mpegts_packet_t       *mp;
+  mpegts_mux_t          *mm;
+  mpegts_input_worker_t *miw = p;
+  mpegts_input_t        *mi  = miw->miw_input;
 
   pthread_mutex_lock(&mi->mi_input_lock);
-  while (mi->mi_running) {
+  while (miw->miw_running) {
 
     /* Wait for a packet */
-    if (!(mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-      pthread_cond_wait(&mi->mi_input_cond, &mi->mi_input_lock);
+    if (!(mp = TAILQ_FIRST(&miw->miw_queue))) {
+      pthread_cond_wait(&miw->miw_cond, &mi->mi_input_lock);
       continue;
     }
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
+    TAILQ_REMOVE(&miw->miw_queue, mp, mp_link);
     pthread_mutex_unlock(&mi->mi_input_lock);
       
     /* Process */
-    pthread_mutex_lock(&mi->mi_output_lock);
-    mpegts_input_table_waiting(mi, mp->mp_mux);
-    mpegts_input_process(mi, mp);
-    pthread_mutex_unlock(&mi->mi_output_lock);
+    if ((mm = mp->mp_mux) != NULL) {
+      // Note: deferred PID changes need the input wide lock, the
+      //       flag keeps the common path per-mux only
+      if (atomic_exchange(&mm->mm_defer_pending, 0)) {
+        pthread_mutex_lock(&mi->mi_output_lock);
+        pthread_mutex_lock(&mm->mm_output_lock);
+        mpegts_input_table_waiting(mi, mm);
+        pthread_mutex_unlock(&mm->mm_output_lock);
+        pthread_mutex_unlock(&mi->mi_output_lock);
+      }
+      pthread_mutex_lock(&mm->mm_output_lock);
+      mpegts_input_process(mi, mp);
+      pthread_mutex_unlock(&mm->mm_output_lock);
+    }
 
     /* Cleanup */
-    free(mp);
+    mpegts_packet_destroy(mp);
 
 #if ENABLE_TSDEBUG
     {
@@ -1038,49 +1152,148 @@ mpegts_input_thread ( void * p )
   }
 
   /* Flush */
-  while ((mp = TAILQ_FIRST(&mi->mi_input_queue))) {
-    TAILQ_REMOVE(&mi->mi_input_queue, mp, mp_link);
-    free(mp);
+  while ((mp = TAILQ_FIRST(&miw->miw_queue))) {
+    TAILQ_REMOVE(&miw->miw_queue, mp, mp_link);
+    mpegts_packet_destroy(mp);
   }
   pthread_mutex_unlock(&mi->mi_input_lock);
 
   return NULL;
 }
 
+/*
+ * Table thread
+ *
+ * Feeds are taken off the queue in batches and reassembled into sections
+ * without global_lock, with mt_sect_lock of each table held. While a batch
+ * is being reassembled mi_table_busy is set, mpegts_input_flush_mux()
+ * waits for it, so the mux teardown cannot run under us. Repeats of
+ * sections that are already known complete are dropped here and the
+ * remainder is dispatched with a single global_lock acquisition per batch.
+ */
+#define MPEGTS_TABLE_BATCH 256
+
+typedef struct mpegts_table_collect {
+  mpegts_table_t               *mt;
+  mpegts_table_section_queue_t *q;
+} mpegts_table_collect_t;
+
+static void
+mpegts_input_table_collect ( const uint8_t *sec, size_t r, void *aux )
+{
+  mpegts_table_collect_t *tc = aux;
+  mpegts_table_section_t *mts;
+
+  if (mpegts_table_dedup_check(tc->mt, sec, r))
+    return;
+
+  mts = malloc(sizeof(mpegts_table_section_t) + r);
+  memcpy(mts->mts_data, sec, r);
+  mts->mts_len   = r;
+  mts->mts_table = tc->mt;
+  mpegts_table_grab(tc->mt);
+  TAILQ_INSERT_TAIL(tc->q, mts, mts_link);
+}
+
+static void
+mpegts_input_table_reassemble
+  ( mpegts_mux_t *mm, const uint8_t *tsb, mpegts_table_section_queue_t *q )
+{
+  uint16_t pid = ((tsb[1] & 0x1f) << 8) | tsb[2];
+  uint8_t  cc  = (tsb[3] & 0x0f);
+  mpegts_table_t *mt;
+  mpegts_table_collect_t tc;
+  int ccerr;
+
+  tc.q = q;
+  pthread_mutex_lock(&mm->mm_tables_lock);
+  LIST_FOREACH(mt, &mm->mm_tables, mt_link) {
+    if (mt->mt_destroyed || !mt->mt_subscribed || mt->mt_pid != pid)
+      continue;
+    if (tsb[3] & 0x10) {
+      ccerr = 0;
+      pthread_mutex_lock(&mt->mt_sect_lock);
+      if (mt->mt_cc != -1 && mt->mt_cc != cc) {
+        ccerr = 1;
+        tvhdebug("psi", "PID %04X CC error %d != %d", pid, cc, mt->mt_cc);
+      }
+      mt->mt_cc = (cc + 1) & 0xF;
+      tc.mt = mt;
+      mpegts_psi_section_reassemble(&mt->mt_sect, tsb, 0, ccerr,
+                                    mpegts_input_table_collect, &tc);
+      pthread_mutex_unlock(&mt->mt_sect_lock);
+    }
+  }
+  pthread_mutex_unlock(&mm->mm_tables_lock);
+}
+
 static void *
 mpegts_input_table_thread ( void *aux )
 {
   mpegts_table_feed_t   *mtf;
+  mpegts_table_feed_queue_t batch;
+  mpegts_table_section_t *mts;
+  mpegts_table_section_queue_t q;
+  mpegts_table_t        *mt;
   mpegts_input_t        *mi = aux;
+  int                    i;
 
-  pthread_mutex_lock(&mi->mi_output_lock);
+  TAILQ_INIT(&batch);
+  TAILQ_INIT(&q);
+  pthread_mutex_lock(&mi->mi_table_lock);
   while (mi->mi_running) {
 
     /* Wait for data */
     if (!(mtf = TAILQ_FIRST(&mi->mi_table_queue))) {
-      pthread_cond_wait(&mi->mi_table_cond, &mi->mi_output_lock);
+      pthread_cond_wait(&mi->mi_table_cond, &mi->mi_table_lock);
       continue;
     }
-    TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
-    pthread_mutex_unlock(&mi->mi_output_lock);
-    
-    /* Process */
+
+    /* Take a batch */
+    for (i = 0; i < MPEGTS_TABLE_BATCH && mtf; i++) {
+      TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
+      TAILQ_INSERT_TAIL(&batch, mtf, mtf_link);
+      mtf = TAILQ_FIRST(&mi->mi_table_queue);
+    }
+    mi->mi_table_busy = 1;
+    pthread_mutex_unlock(&mi->mi_table_lock);
+
+    /* Reassemble */
+    while ((mtf = TAILQ_FIRST(&batch)) != NULL) {
+      TAILQ_REMOVE(&batch, mtf, mtf_link);
+      if (mtf->mtf_mux)
+        mpegts_input_table_reassemble(mtf->mtf_mux, mtf->mtf_tsb, &q);
+      mempool_free(&mpegts_table_feed_mempool, mtf);
+    }
+
+    pthread_mutex_lock(&mi->mi_table_lock);
+    mi->mi_table_busy = 0;
+    pthread_cond_broadcast(&mi->mi_table_busy_cond);
+    if (TAILQ_EMPTY(&q))
+      continue;
+    pthread_mutex_unlock(&mi->mi_table_lock);
+
+    /* Dispatch */
     pthread_mutex_lock(&global_lock);
-    if (mtf->mtf_mux && mtf->mtf_mux->mm_active)
-      mpegts_input_table_dispatch(mtf->mtf_mux, mtf->mtf_tsb);
+    while ((mts = TAILQ_FIRST(&q)) != NULL) {
+      TAILQ_REMOVE(&q, mts, mts_link);
+      mt = mts->mts_table;
+      if (!mt->mt_destroyed && mt->mt_mux->mm_active)
+        mpegts_table_dispatch(mts->mts_data, mts->mts_len, mt);
+      mpegts_table_release(mt);
+      free(mts);
+    }
     pthread_mutex_unlock(&global_lock);
 
-    /* Cleanup */
-    free(mtf);
-    pthread_mutex_lock(&mi->mi_output_lock);
+    pthread_mutex_lock(&mi->mi_table_lock);
   }
 
   /* Flush */
   while ((mtf = TAILQ_FIRST(&mi->mi_table_queue)) != NULL) {
     TAILQ_REMOVE(&mi->mi_table_queue, mtf, mtf_link);
-    free(mtf);
+    mempool_free(&mpegts_table_feed_mempool, mtf);
   }
-  pthread_mutex_unlock(&mi->mi_output_lock);
+  pthread_mutex_unlock(&mi->mi_table_lock);
 
   return NULL;
 }
@@ -1091,6 +1304,7 @@ mpegts_input_flush_mux
 {
   mpegts_table_feed_t *mtf;
   mpegts_packet_t *mp;
+  int i;
 
   lock_assert(&global_lock);
 
@@ -1100,19 +1314,22 @@ mpegts_input_flush_mux
 
   /* Flush input Q */
   pthread_mutex_lock(&mi->mi_input_lock);
-  TAILQ_FOREACH(mp, &mi->mi_input_queue, mp_link) {
-    if (mp->mp_mux == mm)
-      mp->mp_mux = NULL;
-  }
+  for (i = 0; i < mi->mi_input_nworkers; i++)
+    TAILQ_FOREACH(mp, &mi->mi_input_workers[i].miw_queue, mp_link) {
+      if (mp->mp_mux == mm)
+        mp->mp_mux = NULL;
+    }
   pthread_mutex_unlock(&mi->mi_input_lock);
 
-  /* Flush table Q */
-  pthread_mutex_lock(&mi->mi_output_lock);
+  /* Flush table Q (and wait for the batch being reassembled) */
+  pthread_mutex_lock(&mi->mi_table_lock);
   TAILQ_FOREACH(mtf, &mi->mi_table_queue, mtf_link) {
     if (mtf->mtf_mux == mm)
       mtf->mtf_mux = NULL;
   }
-  pthread_mutex_unlock(&mi->mi_output_lock);
+  while (mi->mi_table_busy)
+    pthread_cond_wait(&mi->mi_table_busy_cond, &mi->mi_table_lock);
+  pthread_mutex_unlock(&mi->mi_table_lock);
   /* mux active must be NULL here */
   /* otherwise the picked mtf might be processed after mux deactivation */
   assert(mm->mm_active == NULL);
@@ -1122,7 +1339,7 @@ static void
 mpegts_input_stream_status
   ( mpegts_mux_instance_t *mmi, tvh_input_stream_t *st )
 {
-  int s = 0, w = 0;
+  int s = 0, w = 0, i;
   char buf[512];
   th_subscription_t *sub;
   mpegts_mux_t *mm = mmi->mmi_mux;
@@ -1156,6 +1373,17 @@ mpegts_input_stream_status
   st->max_weight  = w;
   st->stats       = mmi->mmi_stats;
   st->stats.bps   = atomic_exchange(&mmi->mmi_stats.bps, 0) * 8;
+
+  avgstat_history(&mmi->mmi_rate, st->bps_history,
+                  TVH_INPUT_STREAM_HISTORY, dispatch_clock);
+  avgstat_history(&mmi->mmi_cc_errors, st->cc_history,
+                  TVH_INPUT_STREAM_HISTORY, dispatch_clock);
+  for (i = 0; i < TVH_INPUT_STREAM_HISTORY; i++)
+    st->bps_history[i] *= 8;
+  st->bps_p50 = avgstat_percentile(&mmi->mmi_rate, TVH_INPUT_STREAM_HISTORY,
+                                   50, dispatch_clock) * 8;
+  st->bps_p95 = avgstat_percentile(&mmi->mmi_rate, TVH_INPUT_STREAM_HISTORY,
+                                   95, dispatch_clock) * 8;
 }
 
 static void
@@ -1175,6 +1403,63 @@ mpegts_input_get_streams
   pthread_mutex_unlock(&mi->mi_output_lock);
 }
 
+static void
+mpegts_input_workers_start ( mpegts_input_t *mi )
+{
+  mpegts_input_worker_t *miw, *workers;
+  int i, n = mi->mi_input_threads;
+
+  if (n < 1) n = 1;
+  if (n > MPEGTS_INPUT_THREADS_MAX) n = MPEGTS_INPUT_THREADS_MAX;
+
+  workers = calloc(n, sizeof(mpegts_input_worker_t));
+  for (i = 0; i < n; i++) {
+    miw = &workers[i];
+    miw->miw_input   = mi;
+    miw->miw_running = 1;
+    pthread_cond_init(&miw->miw_cond, NULL);
+    TAILQ_INIT(&miw->miw_queue);
+  }
+
+  pthread_mutex_lock(&mi->mi_input_lock);
+  mi->mi_input_workers  = workers;
+  mi->mi_input_nworkers = n;
+  pthread_mutex_unlock(&mi->mi_input_lock);
+
+  for (i = 0; i < n; i++)
+    tvhthread_create(&workers[i].miw_tid, NULL,
+                     mpegts_input_thread, &workers[i]);
+}
+
+static void
+mpegts_input_workers_stop ( mpegts_input_t *mi )
+{
+  mpegts_input_worker_t *workers;
+  int i, n;
+
+  /* Detach and stop input threads */
+  pthread_mutex_lock(&mi->mi_input_lock);
+  workers = mi->mi_input_workers;
+  n       = mi->mi_input_nworkers;
+  mi->mi_input_workers  = NULL;
+  mi->mi_input_nworkers = 0;
+  for (i = 0; i < n; i++) {
+    workers[i].miw_running = 0;
+    pthread_cond_signal(&workers[i].miw_cond);
+  }
+  pthread_mutex_unlock(&mi->mi_input_lock);
+
+  /* Join threads (relinquish lock due to potential deadlock) */
+  pthread_mutex_unlock(&global_lock);
+  for (i = 0; i < n; i++)
+    pthread_join(workers[i].miw_tid, NULL);
+  pthread_mutex_lock(&global_lock);
+
+  for (i = 0; i < n; i++)
+    pthread_cond_destroy(&workers[i].miw_cond);
+  free(workers);
+}
+
 static void
 mpegts_input_thread_start ( mpegts_input_t *mi )
 {
@@ -1182,8 +1467,7 @@ mpegts_input_thread_start ( mpegts_input_t *mi )
   
   tvhthread_create(&mi->mi_table_tid, NULL,
                    mpegts_input_table_thread, mi);
-  tvhthread_create(&mi->mi_input_tid, NULL,
-                   mpegts_input_thread, mi);
+  mpegts_input_workers_start(mi);
 }
 
 static void
@@ -1191,19 +1475,16 @@ mpegts_input_thread_stop ( mpegts_input_t *mi )
 {
   mi->mi_running = 0;
 
-  /* Stop input thread */
-  pthread_mutex_lock(&mi->mi_input_lock);
-  pthread_cond_signal(&mi->mi_input_cond);
-  pthread_mutex_unlock(&mi->mi_input_lock);
+  /* Stop input threads */
+  mpegts_input_workers_stop(mi);
 
   /* Stop table thread */
-  pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mi->mi_table_lock);
   pthread_cond_signal(&mi->mi_table_cond);
-  pthread_mutex_unlock(&mi->mi_output_lock);
+  pthread_mutex_unlock(&mi->mi_table_lock);
 
-  /* Join threads (relinquish lock due to potential deadlock) */
+  /* Join thread (relinquish lock due to potential deadlock) */
   pthread_mutex_unlock(&global_lock);
-  pthread_join(mi->mi_input_tid, NULL);
   pthread_join(mi->mi_table_tid, NULL);
   pthread_mutex_lock(&global_lock);
 }
@@ -1282,11 +1563,11 @@ mpegts_input_create0
 
   /* Init input/output structures */
   pthread_mutex_init(&mi->mi_input_lock, NULL);
-  pthread_cond_init(&mi->mi_input_cond, NULL);
-  TAILQ_INIT(&mi->mi_input_queue);
 
   pthread_mutex_init(&mi->mi_output_lock, NULL);
+  pthread_mutex_init(&mi->mi_table_lock, NULL);
   pthread_cond_init(&mi->mi_table_cond, NULL);
+  pthread_cond_init(&mi->mi_table_busy_cond, NULL);
   TAILQ_INIT(&mi->mi_table_queue);
 
   /* Defaults */
@@ -1300,6 +1581,8 @@ mpegts_input_create0
   /* Load config */
   if (c)
     idnode_load(&mi->ti_id, c);
+  if (mi->mi_input_threads < 1)
+    mi->mi_input_threads = 1;
 
   /* Start threads */
   mpegts_input_thread_start(mi);
@@ -1343,7 +1626,9 @@ mpegts_input_delete ( mpegts_input_t *mi, int delconf )
   mpegts_input_thread_stop(mi);
 
   pthread_mutex_destroy(&mi->mi_output_lock);
+  pthread_mutex_destroy(&mi->mi_table_lock);
   pthread_cond_destroy(&mi->mi_table_cond);
+  pthread_cond_destroy(&mi->mi_table_busy_cond);
   free(mi->mi_name);
   free(mi);
 }
@@ -26,6 +26,7 @@
 #include "access.h"
 #include "profile.h"
 #include "dvb_charset.h"
+#include "atomic.h"
 
 #include <assert.h>
 
@@ -66,6 +67,9 @@ mpegts_mux_instance_create0
   /* Setup links */
   mmi->mmi_mux   = mm;
   mmi->mmi_input = mi;
+
+  avgstat_init(&mmi->mmi_rate, TVH_INPUT_STREAM_HISTORY);
+  avgstat_init(&mmi->mmi_cc_errors, TVH_INPUT_STREAM_HISTORY);
   
   /* Callbacks */
   mmi->mmi_delete = mpegts_mux_instance_delete;
@@ -86,6 +90,7 @@ mpegts_mux_scan_active
   /* Setup scan */
   if (mm->mm_scan_state == MM_SCAN_STATE_PEND) {
     mpegts_network_scan_mux_active(mm);
+    mpegts_table_dedup_flush_all(mm);
 
     /* Get timeout */
     t = mpegts_input_grace(mi, mm);
@@ -738,8 +743,7 @@ mpegts_mux_stop ( mpegts_mux_t *mm, int force )
 
   /* Ensure PIDs are cleared */
   pthread_mutex_lock(&mi->mi_output_lock);
-  mm->mm_last_pid = -1;
-  mm->mm_last_mp = NULL;
+  pthread_mutex_lock(&mm->mm_output_lock);
   while ((mp = RB_FIRST(&mm->mm_pids))) {
     assert(mi);
     while ((mps = RB_FIRST(&mp->mp_subs))) {
@@ -748,11 +752,9 @@ mpegts_mux_stop ( mpegts_mux_t *mm, int force )
       RB_REMOVE(&mp->mp_subs, mps, mps_link);
       free(mps);
     }
-    RB_REMOVE(&mm->mm_pids, mp, mp_link);
-    if (mp->mp_fd != -1)
-      linuxdvb_filter_close(mp->mp_fd);
-    free(mp);
+    mpegts_mux_remove_pid(mm, mp);
   }
+  pthread_mutex_unlock(&mm->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 
   /* Scanning */
@@ -785,6 +787,7 @@ mpegts_mux_open_table ( mpegts_mux_t *mm, mpegts_table_t *mt, int subscribe )
     mm->mm_num_tables++;
     mt->mt_defer_cmd = MT_DEFER_OPEN_PID;
     TAILQ_INSERT_TAIL(&mm->mm_defer_tables, mt, mt_defer_link);
+    atomic_exchange(&mm->mm_defer_pending, 1);
     return;
   }
   mi = mm->mm_active->mmi_input;
@@ -795,7 +798,9 @@ mpegts_mux_open_table ( mpegts_mux_t *mm, mpegts_table_t *mt, int subscribe )
     mt->mt_subscribed = 1;
     pthread_mutex_unlock(&mm->mm_tables_lock);
     pthread_mutex_lock(&mi->mi_output_lock);
+    pthread_mutex_lock(&mm->mm_output_lock);
     mi->mi_open_pid(mi, mm, mt->mt_pid, mpegts_table_type(mt), mt);
+    pthread_mutex_unlock(&mm->mm_output_lock);
     pthread_mutex_unlock(&mi->mi_output_lock);
     pthread_mutex_lock(&mm->mm_tables_lock);
     mpegts_table_release(mt);
@@ -834,6 +839,7 @@ mpegts_mux_close_table ( mpegts_mux_t *mm, mpegts_table_t *mt )
     mpegts_table_grab(mt); /* thread will free the table */
     mt->mt_defer_cmd = MT_DEFER_CLOSE_PID;
     TAILQ_INSERT_TAIL(&mm->mm_defer_tables, mt, mt_defer_link);
+    atomic_exchange(&mm->mm_defer_pending, 1);
     return;
   }
   mi = mm->mm_active->mmi_input;
@@ -844,7 +850,9 @@ mpegts_mux_close_table ( mpegts_mux_t *mm, mpegts_table_t *mt )
     mt->mt_subscribed = 0;
     pthread_mutex_unlock(&mm->mm_tables_lock);
     pthread_mutex_lock(&mi->mi_output_lock);
+    pthread_mutex_lock(&mm->mm_output_lock);
     mi->mi_close_pid(mi, mm, mt->mt_pid, mpegts_table_type(mt), mt);
+    pthread_mutex_unlock(&mm->mm_output_lock);
     pthread_mutex_unlock(&mi->mi_output_lock);
     pthread_mutex_lock(&mm->mm_tables_lock);
     mpegts_table_release(mt);
@@ -1013,6 +1021,10 @@ mpegts_mux_create0
   mm->mm_stop                = mpegts_mux_stop;
   mm->mm_create_instances    = mpegts_mux_create_instances;
 
+  /* Data processing */
+  pthread_mutex_init(&mm->mm_output_lock, NULL);
+  LIST_INIT(&mm->mm_transports);
+
   /* Table processing */
   mm->mm_open_table          = mpegts_mux_open_table;
   mm->mm_close_table         = mpegts_mux_close_table;
@@ -1024,8 +1036,6 @@ mpegts_mux_create0
   TAILQ_INIT(&mm->mm_descrambler_emms);
   pthread_mutex_init(&mm->mm_descrambler_lock, NULL);
 
-  mm->mm_last_pid            = -1;
-
   /* Configuration */
   if (conf)
     idnode_load(&mm->mm_id, conf);
@@ -1227,18 +1237,71 @@ mpegts_mux_find_pid_ ( mpegts_mux_t *mm, int pid, int create )
     if (!RB_INSERT_SORTED(&mm->mm_pids, mp, mp_link, mp_cmp)) {
       mp->mp_fd = -1;
       mp->mp_cc = -1;
+      if (pid < MPEGTS_FULLMUX_PID) {
+        if (mm->mm_pid_table == NULL)
+          mm->mm_pid_table = calloc(MPEGTS_FULLMUX_PID, sizeof(mpegts_pid_t *));
+        mm->mm_pid_table[pid] = mp;
+      }
     } else {
       free(mp);
       mp = NULL;
     }
   }
-  if (mp) {
-    mm->mm_last_pid = pid;
-    mm->mm_last_mp = mp;
-  }
   return mp;
 }
 
+/*
+ * Recalculate the PID type and the list of services receiving
+ * the stream data (called when the subscribers change)
+ */
+void
+mpegts_mux_update_pid ( mpegts_mux_t *mm, mpegts_pid_t *mp )
+{
+  mpegts_pid_sub_t *mps;
+  int type = 0, n = 0;
+
+  lock_assert(&mm->mm_output_lock);
+
+  /* Only service subscribers go to mp_svcs, table owners (MPS_ALL) are
+   * not services - their data is passed to all services on the mux */
+  RB_FOREACH(mps, &mp->mp_subs, mps_link) {
+    type |= mps->mps_type;
+    if ((mps->mps_type & (MPS_STREAM | MPS_ALL)) == MPS_STREAM)
+      n++;
+  }
+  if (n > mp->mp_nsvcs)
+    mp->mp_svcs = realloc(mp->mp_svcs, n * sizeof(mpegts_service_t *));
+  n = 0;
+  RB_FOREACH(mps, &mp->mp_subs, mps_link)
+    if ((mps->mps_type & (MPS_STREAM | MPS_ALL)) == MPS_STREAM)
+      mp->mp_svcs[n++] = mps->mps_owner;
+  mp->mp_nsvcs = n;
+  mp->mp_type  = type;
+}
+
+/*
+ * Remove PID (all subscribers must be removed)
+ */
+void
+mpegts_mux_remove_pid ( mpegts_mux_t *mm, mpegts_pid_t *mp )
+{
+  lock_assert(&mm->mm_output_lock);
+  assert(RB_FIRST(&mp->mp_subs) == NULL);
+
+  RB_REMOVE(&mm->mm_pids, mp, mp_link);
+  if (mp->mp_pid < MPEGTS_FULLMUX_PID && mm->mm_pid_table) {
+    mm->mm_pid_table[mp->mp_pid] = NULL;
+    if (RB_FIRST(&mm->mm_pids) == NULL) {
+      free(mm->mm_pid_table);
+      mm->mm_pid_table = NULL;
+    }
+  }
+  if (mp->mp_fd != -1)
+    linuxdvb_filter_close(mp->mp_fd);
+  free(mp->mp_svcs);
+  free(mp);
+}
+
 /******************************************************************************
  * Editor Configuration
  *
@@ -534,6 +534,7 @@ mpegts_service_create0
 
   /* Create */
   sbuf_init(&s->s_tsbuf);
+  avgstat_init(&s->s_cc_errors, 10);
   if (!conf) {
     if (sid)     s->s_dvb_service_id = sid;
     if (pmt_pid) s->s_pmt_pid        = pmt_pid;
@@ -66,6 +66,133 @@ mpegts_table_fastswitch ( mpegts_mux_t *mm )
   mpegts_mux_scan_done(mm, buf, 1);
 }
 
+/*
+ * Complete section tracking
+ *
+ * Sections are identified by table id, extension, section number and
+ * CRC (a different version always yields a different CRC for otherwise
+ * identical headers). The set is an open addressed hash, bounded in size.
+ */
+#define MPEGTS_TABLE_DEDUP_MAX 65536
+
+static inline uint64_t
+mpegts_table_dedup_key ( const uint8_t *sec, size_t r )
+{
+  /* Long form sections only (header + CRC) */
+  if (r < 12 || !(sec[1] & 0x80))
+    return 0;
+  return ((uint64_t)sec[r-4] << 56) | ((uint64_t)sec[r-3] << 48) |
+         ((uint64_t)sec[r-2] << 40) | ((uint64_t)sec[r-1] << 32) |
+         ((uint32_t)sec[0] << 24) | (sec[3] << 16) | (sec[4] << 8) | sec[6];
+}
+
+static inline uint32_t
+mpegts_table_dedup_hash ( uint64_t key, int size )
+{
+  return (uint32_t)((key * 0x9E3779B97F4A7C15ULL) >> 32) & (size - 1);
+}
+
+/* Called by the table thread with mt_sect_lock held */
+int
+mpegts_table_dedup_check
+  ( mpegts_table_t *mt, const uint8_t *sec, size_t r )
+{
+  uint64_t key, k;
+  uint32_t i;
+
+  lock_assert(&mt->mt_sect_lock);
+
+  if (!mt->mt_dedup_count)
+    return 0;
+  if (!(key = mpegts_table_dedup_key(sec, r)))
+    return 0;
+  i = mpegts_table_dedup_hash(key, mt->mt_dedup_size);
+  while ((k = mt->mt_dedup[i]) != 0) {
+    if (k == key)
+      return 1;
+    i = (i + 1) & (mt->mt_dedup_size - 1);
+  }
+  return 0;
+}
+
+static void
+mpegts_table_dedup_flush0 ( mpegts_table_t *mt )
+{
+  free(mt->mt_dedup);
+  mt->mt_dedup       = NULL;
+  mt->mt_dedup_size  = 0;
+  mt->mt_dedup_count = 0;
+}
+
+void
+mpegts_table_dedup_add ( mpegts_table_t *mt )
+{
+  uint64_t key = mt->mt_dedup_key, k, *old;
+  uint32_t i;
+  int j, size;
+
+  if (!key || (mt->mt_flags & MT_FAST))
+    return;
+  /* Scanning relies on repeats to signal completion */
+  if (mt->mt_mux->mm_scan_state == MM_SCAN_STATE_ACTIVE)
+    return;
+
+  pthread_mutex_lock(&mt->mt_sect_lock);
+
+  /* Grow (or start over once the bound is reached) */
+  if (mt->mt_dedup_count * 2 >= mt->mt_dedup_size) {
+    if (mt->mt_dedup_count >= MPEGTS_TABLE_DEDUP_MAX) {
+      mpegts_table_dedup_flush0(mt);
+      pthread_mutex_unlock(&mt->mt_sect_lock);
+      return;
+    }
+    old  = mt->mt_dedup;
+    size = mt->mt_dedup_size;
+    mt->mt_dedup_size = size ? size * 2 : 256;
+    mt->mt_dedup = calloc(mt->mt_dedup_size, sizeof(uint64_t));
+    for (j = 0; j < size; j++) {
+      if (!(k = old[j])) continue;
+      i = mpegts_table_dedup_hash(k, mt->mt_dedup_size);
+      while (mt->mt_dedup[i])
+        i = (i + 1) & (mt->mt_dedup_size - 1);
+      mt->mt_dedup[i] = k;
+    }
+    free(old);
+  }
+
+  i = mpegts_table_dedup_hash(key, mt->mt_dedup_size);
+  while ((k = mt->mt_dedup[i]) != 0) {
+    if (k == key)
+      break;
+    i = (i + 1) & (mt->mt_dedup_size - 1);
+  }
+  if (!k) {
+    mt->mt_dedup[i] = key;
+    mt->mt_dedup_count++;
+  }
+  pthread_mutex_unlock(&mt->mt_sect_lock);
+}
+
+void
+mpegts_table_dedup_flush ( mpegts_table_t *mt )
+{
+  pthread_mutex_lock(&mt->mt_sect_lock);
+  mpegts_table_dedup_flush0(mt);
+  pthread_mutex_unlock(&mt->mt_sect_lock);
+}
+
+/* The mux is being scanned, stop dropping repeats */
+void
+mpegts_table_dedup_flush_all ( mpegts_mux_t *mm )
+{
+  mpegts_table_t *mt;
+
+  pthread_mutex_lock(&mm->mm_tables_lock);
+  LIST_FOREACH(mt, &mm->mm_tables, mt_link)
+    mpegts_table_dedup_flush(mt);
+  pthread_mutex_unlock(&mm->mm_tables_lock);
+}
+
 void
 mpegts_table_dispatch
   ( const uint8_t *sec, size_t r, void *aux )
@@ -116,12 +243,14 @@ mpegts_table_dispatch
     len -= 4;
 
   /* Pass with tableid / len in data */
+  mt->mt_dedup_key = mpegts_table_dedup_key(sec, r);
   if (mt->mt_flags & MT_FULL)
     ret = mt->mt_callback(mt, sec, len+3, tid);
 
   /* Pass w/out tableid/len in data */
   else
     ret = mt->mt_callback(mt, sec+3, len, tid);
+  mt->mt_dedup_key = 0;
   
   /* Good */
   if(ret >= 0)
@@ -140,6 +269,8 @@ mpegts_table_release_ ( mpegts_table_t *mt )
     RB_REMOVE(&mt->mt_state, st, link);
     free(st);
   }
+  mpegts_table_dedup_flush0(mt);
+  pthread_mutex_destroy(&mt->mt_sect_lock);
   tvhtrace("mpegts", "table: mux %p free %s %02X/%02X (%d) pid %04X (%d)",
            mt->mt_mux, mt->mt_name, mt->mt_table, mt->mt_mask, mt->mt_table,
            mt->mt_pid, mt->mt_pid);
@@ -191,7 +322,7 @@ mpegts_table_type ( mpegts_table_t *mt )
   int type = 0;
   if (mt->mt_flags & MT_FAST) type |= MPS_FTABLE;
   if (mt->mt_flags & MT_SLOW) type |= MPS_TABLE;
-  if (mt->mt_flags & MT_RECORD) type |= MPS_STREAM;
+  if (mt->mt_flags & MT_RECORD) type |= MPS_STREAM | MPS_ALL;
   if ((type & (MPS_FTABLE | MPS_TABLE)) == 0) type |= MPS_TABLE;
   return type;
 }
@@ -251,6 +382,7 @@ mpegts_table_add
   mt->mt_mask      = mask;
   mt->mt_mux       = mm;
   mt->mt_cc        = -1;
+  pthread_mutex_init(&mt->mt_sect_lock, NULL);
 
   /* Open table */
   if (pid < 0) {
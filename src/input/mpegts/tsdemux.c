@@ -278,7 +278,7 @@ ts_remux(mpegts_service_t *t, const uint8_t *src)
   if(sb->sb_ptr < TS_REMUX_BUFSIZE) 
     return;
 
-  pb = pktbuf_alloc(sb->sb_data, sb->sb_ptr);
+  pb = pktbuf_from_sbuf(sb, sb->sb_ptr);
 
   sm.sm_type = SMT_MPEGTS;
   sm.sm_data = pb;
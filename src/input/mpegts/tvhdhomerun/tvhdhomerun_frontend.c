@@ -290,8 +290,10 @@ tvhdhomerun_frontend_monitor_cb( void *aux )
       tvhdhomerun_frontend_default_tables(hfe, (dvb_mux_t*)mm);
       /* open PIDs */
       pthread_mutex_lock(&hfe->mi_output_lock);
+      pthread_mutex_lock(&mm->mm_output_lock);
       RB_FOREACH(mp, &mm->mm_pids, mp_link)
         tvhdhomerun_device_open_pid(hfe, mp);
+      pthread_mutex_unlock(&mm->mm_output_lock);
       pthread_mutex_unlock(&hfe->mi_output_lock);
     } else { // quick re-arm the timer to wait for signal lock
       gtimer_arm_ms(&hfe->hf_monitor_timer, tvhdhomerun_frontend_monitor_cb, hfe, 50);
@@ -70,26 +70,21 @@ lang_str_t *lang_str_copy ( const lang_str_t *ls )
   return ret;
 }
 
-/* Get language element */
-lang_str_ele_t *lang_str_get2
-  ( lang_str_t *ls, const char *lang )
+/* Get language element, 'langs' as returned by lang_code_split() */
+lang_str_ele_t *lang_str_get3
+  ( lang_str_t *ls, const char **langs )
 {
-  int i;
-  const char **langs;
   lang_str_ele_t skel, *e = NULL;
 
   if (!ls) return NULL;
-  
+
   /* Check config/requested langs */
-  if ((langs = lang_code_split(lang))) {
-    i = 0;
-    while (langs[i]) {
-      skel.lang = langs[i];
+  if (langs) {
+    for ( ; *langs; langs++) {
+      skel.lang = *langs;
       if ((e = RB_FIND(ls, &skel, link, _lang_cmp)))
         break;
-      i++;
     }
-    free(langs);
   }
 
   /* Use first available */
@@ -99,6 +94,21 @@ lang_str_ele_t *lang_str_get2
   return e;
 }
 
+/* Get language element */
+lang_str_ele_t *lang_str_get2
+  ( lang_str_t *ls, const char *lang )
+{
+  const char **langs;
+  lang_str_ele_t *e;
+
+  if (!ls) return NULL;
+
+  langs = lang_code_split(lang);
+  e = lang_str_get3(ls, langs);
+  free(langs);
+  return e;
+}
+
 /* Get string */
 const char *lang_str_get
   ( lang_str_t *ls, const char *lang )
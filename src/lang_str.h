@@ -39,6 +39,7 @@ lang_str_t     *lang_str_copy    ( const lang_str_t *ls );
 /* Get elements */
 const char     *lang_str_get     ( lang_str_t *ls, const char *lang );
 lang_str_ele_t *lang_str_get2    ( lang_str_t *ls, const char *lang );
+lang_str_ele_t *lang_str_get3    ( lang_str_t *ls, const char **langs );
 
 /* Add/Update elements */
 int             lang_str_add      
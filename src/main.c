@@ -55,6 +55,8 @@
 #include "input.h"
 #include "service.h"
 #include "trap.h"
+#include "packet.h"
+#include "mempool.h"
 #include "settings.h"
 #include "config.h"
 #include "idnode.h"
@@ -162,9 +164,17 @@ pthread_mutex_t atomic_lock;
 /*
  * Locals
  */
-static LIST_HEAD(, gtimer) gtimers;
+static gtimer_t **gtimer_heap;
+static int gtimer_heap_count;
+static int gtimer_heap_size;
+static uint32_t gtimer_seq;
+static pthread_mutex_t gtimer_lock;
 static pthread_cond_t gtimer_cond;
 
+static pthread_rwlock_t domain_locks[LOCK_DOMAIN_COUNT];
+static __thread uint32_t domain_depth[LOCK_DOMAIN_COUNT];
+static __thread uint8_t  domain_write[LOCK_DOMAIN_COUNT];
+
 static void
 handle_sigpipe(int x)
 {
@@ -210,7 +220,89 @@ get_user_groups (const struct passwd *pw, gid_t* glist, size_t gmax)
 }
 
 /**
- *
+ * Lock domains, see tvheadend.h
+ */
+void
+tvh_domain_rdlock(tvh_lock_domain_t d)
+{
+  assert(d > LOCK_GLOBAL && d < LOCK_DOMAIN_COUNT);
+  if (domain_depth[d]++ == 0)
+    pthread_rwlock_rdlock(&domain_locks[d]);
+}
+
+void
+tvh_domain_wrlock(tvh_lock_domain_t d)
+{
+  assert(d > LOCK_GLOBAL && d < LOCK_DOMAIN_COUNT);
+  if (domain_depth[d]++ == 0) {
+    lock_assert(&global_lock);
+    pthread_rwlock_wrlock(&domain_locks[d]);
+    domain_write[d] = 1;
+  } else {
+    /* read -> write upgrade would deadlock */
+    assert(domain_write[d]);
+  }
+}
+
+void
+tvh_domain_unlock(tvh_lock_domain_t d)
+{
+  assert(domain_depth[d] > 0);
+  if (--domain_depth[d] == 0) {
+    domain_write[d] = 0;
+    pthread_rwlock_unlock(&domain_locks[d]);
+  }
+}
+
+/**
+ * Debug statistics, reported every minute with the gtimer debug
+ * subsystem (gtimer_lock)
+ */
+static struct {
+  time_t          since;
+  int             peak;         /* armed timers */
+  int             fired;
+  int64_t         latency;      /* last expiry to dispatch delay (us) */
+  int64_t         latency_sum;
+  int64_t         latency_max;
+  int64_t         run_max;      /* slowest callback (us) */
+  gti_callback_t *run_max_cb;
+} gtimer_stats;
+
+static void
+gtimer_stats_add(gti_callback_t *cb, int64_t run)
+{
+  gtimer_stats.fired++;
+  gtimer_stats.latency_sum += gtimer_stats.latency;
+  if (gtimer_stats.latency > gtimer_stats.latency_max)
+    gtimer_stats.latency_max = gtimer_stats.latency;
+  if (run > gtimer_stats.run_max) {
+    gtimer_stats.run_max    = run;
+    gtimer_stats.run_max_cb = cb;
+  }
+}
+
+static void
+gtimer_stats_report(time_t now)
+{
+  if (gtimer_stats.since == 0)
+    gtimer_stats.since = now;
+  if (now - gtimer_stats.since < 60)
+    return;
+  tvhdebug("gtimer", "armed %d (peak %d), fired %d, latency avg %"PRId64
+           "us max %"PRId64"us, slowest callback %p %"PRId64"us",
+           gtimer_heap_count, gtimer_stats.peak, gtimer_stats.fired,
+           gtimer_stats.fired ? gtimer_stats.latency_sum / gtimer_stats.fired : 0,
+           gtimer_stats.latency_max, gtimer_stats.run_max_cb,
+           gtimer_stats.run_max);
+  memset(&gtimer_stats, 0, sizeof(gtimer_stats));
+  gtimer_stats.since = now;
+  gtimer_stats.peak  = gtimer_heap_count;
+}
+
+/**
+ * Armed timers are kept in a binary min-heap (gtimer_lock), equal
+ * expiry times fire the most recently armed timer first
  */
 static int
 gtimercmp(gtimer_t *a, gtimer_t *b)
@@ -223,31 +315,113 @@ gtimercmp(gtimer_t *a, gtimer_t *b)
     return -1;
   if(a->gti_expire.tv_nsec > b->gti_expire.tv_nsec)
     return 1;
- return 0;
+  return (int32_t)(b->gti_seq - a->gti_seq);
+}
+
+static inline void
+gtimer_heap_set(int idx, gtimer_t *gti)
+{
+  gtimer_heap[idx] = gti;
+  gti->gti_heap_idx = idx;
+}
+
+static void
+gtimer_heap_up(int idx)
+{
+  gtimer_t *gti = gtimer_heap[idx];
+  int parent;
+
+  while (idx > 0) {
+    parent = (idx - 1) / 2;
+    if (gtimercmp(gtimer_heap[parent], gti) <= 0)
+      break;
+    gtimer_heap_set(idx, gtimer_heap[parent]);
+    idx = parent;
+  }
+  gtimer_heap_set(idx, gti);
+}
+
+static void
+gtimer_heap_down(int idx)
+{
+  gtimer_t *gti = gtimer_heap[idx];
+  int child;
+
+  while ((child = 2 * idx + 1) < gtimer_heap_count) {
+    if (child + 1 < gtimer_heap_count &&
+        gtimercmp(gtimer_heap[child + 1], gtimer_heap[child]) < 0)
+      child++;
+    if (gtimercmp(gti, gtimer_heap[child]) <= 0)
+      break;
+    gtimer_heap_set(idx, gtimer_heap[child]);
+    idx = child;
+  }
+  gtimer_heap_set(idx, gti);
+}
+
+static void
+gtimer_heap_insert(gtimer_t *gti)
+{
+  if (gtimer_heap_count == gtimer_heap_size) {
+    gtimer_heap_size = MAX(256, gtimer_heap_size * 2);
+    gtimer_heap = realloc(gtimer_heap, gtimer_heap_size * sizeof(gtimer_t *));
+  }
+  gtimer_heap_set(gtimer_heap_count++, gti);
+  gtimer_heap_up(gti->gti_heap_idx);
+  if (gtimer_heap_count > gtimer_stats.peak)
+    gtimer_stats.peak = gtimer_heap_count;
+}
+
+static void
+gtimer_heap_remove(gtimer_t *gti)
+{
+  int idx = gti->gti_heap_idx;
+  gtimer_t *last = gtimer_heap[--gtimer_heap_count];
+
+  if (last == gti)
+    return;
+  gtimer_heap_set(idx, last);
+  if (idx > 0 && gtimercmp(last, gtimer_heap[(idx - 1) / 2]) < 0)
+    gtimer_heap_up(idx);
+  else
+    gtimer_heap_down(idx);
+}
+
+static inline gtimer_t *
+gtimer_heap_first(void)
+{
+  return gtimer_heap_count ? gtimer_heap[0] : NULL;
 }
 
 /**
- *
+ * Timers are armed with global_lock held, domain timers may also be armed
+ * without it (the heap itself is protected by gtimer_lock)
  */
 void
 gtimer_arm_abs2
   (gtimer_t *gti, gti_callback_t *callback, void *opaque, struct timespec *when)
 {
-  lock_assert(&global_lock);
+  if (gti->gti_domain == LOCK_GLOBAL)
+    lock_assert(&global_lock);
+
+  pthread_mutex_lock(&gtimer_lock);
 
   if (gti->gti_callback != NULL)
-    LIST_REMOVE(gti, gti_link);
+    gtimer_heap_remove(gti);
 
   gti->gti_callback = callback;
   gti->gti_opaque   = opaque;
   gti->gti_expire   = *when;
+  gti->gti_seq      = ++gtimer_seq;
 
-  LIST_INSERT_SORTED(&gtimers, gti, gti_link, gtimercmp);
+  gtimer_heap_insert(gti);
 
   //tvhdebug("gtimer", "%p @ %ld.%09ld", gti, when->tv_sec, when->tv_nsec);
 
-  if (LIST_FIRST(&gtimers) == gti)
+  if (gtimer_heap_first() == gti)
     pthread_cond_signal(&gtimer_cond); // force timer re-check
+
+  pthread_mutex_unlock(&gtimer_lock);
 }
 
 /**
@@ -293,11 +467,13 @@ gtimer_arm_ms
 void
 gtimer_disarm(gtimer_t *gti)
 {
+  pthread_mutex_lock(&gtimer_lock);
   if(gti->gti_callback) {
     //tvhdebug("gtimer", "%p disarm", gti);
-    LIST_REMOVE(gti, gti_link);
+    gtimer_heap_remove(gti);
     gti->gti_callback = NULL;
   }
+  pthread_mutex_unlock(&gtimer_lock);
 }
 
 /**
@@ -367,7 +543,10 @@ mainloop(void)
 {
   gtimer_t *gti;
   gti_callback_t *cb;
-  struct timespec ts;
+  void *opaque;
+  tvh_lock_domain_t domain;
+  struct timespec ts, now;
+  int64_t mono;
 
   while(tvheadend_running) {
     clock_gettime(CLOCK_REALTIME, &ts);
@@ -381,18 +560,15 @@ mainloop(void)
 
     /* Global timers */
     pthread_mutex_lock(&global_lock);
+    pthread_mutex_lock(&gtimer_lock);
 
     // TODO: there is a risk that if timers re-insert themselves to
     //       the top of the list with a 0 offset we could loop indefinitely
     
-#if 0
-    tvhdebug("gtimer", "now %ld.%09ld", ts.tv_sec, ts.tv_nsec);
-    LIST_FOREACH(gti, &gtimers, gti_link)
-      tvhdebug("gtimer", "  gti %p expire %ld.%08ld",
-               gti, gti->gti_expire.tv_sec, gti->gti_expire.tv_nsec);
-#endif
+    gtimer_stats_report(ts.tv_sec);
+    now = ts;
 
-    while((gti = LIST_FIRST(&gtimers)) != NULL) {
+    while((gti = gtimer_heap_first()) != NULL) {
       
       if ((gti->gti_expire.tv_sec > ts.tv_sec) ||
           ((gti->gti_expire.tv_sec == ts.tv_sec) &&
@@ -401,25 +577,45 @@ mainloop(void)
         break;
       }
 
-      cb = gti->gti_callback;
+      cb     = gti->gti_callback;
+      opaque = gti->gti_opaque;
+      domain = gti->gti_domain;
       //tvhdebug("gtimer", "%p callback", gti);
 
-      LIST_REMOVE(gti, gti_link);
+      gtimer_stats.latency = (now.tv_sec - gti->gti_expire.tv_sec) * 1000000LL +
+                             (now.tv_nsec - gti->gti_expire.tv_nsec) / 1000;
+      gtimer_heap_remove(gti);
       gti->gti_callback = NULL;
+      pthread_mutex_unlock(&gtimer_lock);
+
+      mono = getmonoclock();
+
+      if (domain == LOCK_GLOBAL) {
+        cb(opaque);
+      } else {
+        /* Let the rest of the system run while the callback reads */
+        pthread_mutex_unlock(&global_lock);
+        tvh_domain_rdlock(domain);
+        cb(opaque);
+        tvh_domain_unlock(domain);
+        pthread_mutex_lock(&global_lock);
+      }
 
-      cb(gti->gti_opaque);
+      pthread_mutex_lock(&gtimer_lock);
+      gtimer_stats_add(cb, getmonoclock() - mono);
     }
+    pthread_mutex_unlock(&global_lock);
 
     /* Bound wait */
-    if ((LIST_FIRST(&gtimers) == NULL) || (ts.tv_sec > (dispatch_clock + 1))) {
+    if ((gtimer_heap_first() == NULL) || (ts.tv_sec > (dispatch_clock + 1))) {
       ts.tv_sec  = dispatch_clock + 1;
       ts.tv_nsec = 0;
     }
 
     /* Wait */
     //tvhdebug("gtimer", "wait till %ld.%09ld", ts.tv_sec, ts.tv_nsec);
-    pthread_cond_timedwait(&gtimer_cond, &global_lock, &ts);
-    pthread_mutex_unlock(&global_lock);
+    pthread_cond_timedwait(&gtimer_cond, &gtimer_lock, &ts);
+    pthread_mutex_unlock(&gtimer_lock);
   }
 }
 
@@ -449,7 +645,10 @@ main(int argc, char **argv)
   pthread_mutex_init(&fork_lock, NULL);
   pthread_mutex_init(&global_lock, NULL);
   pthread_mutex_init(&atomic_lock, NULL);
+  pthread_mutex_init(&gtimer_lock, NULL);
   pthread_cond_init(&gtimer_cond, NULL);
+  for (i = LOCK_GLOBAL + 1; i < LOCK_DOMAIN_COUNT; i++)
+    pthread_rwlock_init(&domain_locks[i], NULL);
 
   /* Defaults */
   tvheadend_webui_port      = 9981;
@@ -525,6 +724,10 @@ main(int argc, char **argv)
 #if ENABLE_SATIP_CLIENT
     {   0, "satip_xml", "URL with the SAT>IP server XML location",
       OPT_STR_LIST, &opt_satip_xml },
+#endif
+#if ENABLE_IPTV
+    {   0, "iptv_threads", "Number of IPTV demux threads",
+      OPT_INT, &iptv_input_threads },
 #endif
     {   0, NULL,         "Server Connectivity",    OPT_BOOL, NULL         },
     { '6', "ipv6",       "Listen on IPv6",         OPT_BOOL, &opt_ipv6    },
@@ -958,6 +1161,8 @@ main(int argc, char **argv)
   tvhftrace("main", urlparse_done);
   tvhftrace("main", idnode_done);
   tvhftrace("main", spawn_done);
+  tvhftrace("main", pktbuf_pool_done);
+  tvhftrace("main", mempool_done);
 
   tvhlog(LOG_NOTICE, "STOP", "Exiting HTS Tvheadend");
   tvhlog_end();
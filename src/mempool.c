@@ -0,0 +1,244 @@
+/*
+ *  tvheadend, fixed size object pools
+ *  Copyright (C) 2015 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "tvheadend.h"
+#include "atomic.h"
+#include "mempool.h"
+
+/*
+ * Per thread free list
+ */
+typedef struct mempool_tcache {
+  void *mt_free;  /* next pointer is stored in object */
+  int   mt_count;
+} mempool_tcache_t;
+
+static LIST_HEAD(, mempool) mempools;
+static mempool_t           *mempool_table[MEMPOOL_MAX];
+static int                  mempool_count;
+static pthread_mutex_t      mempools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_once_t       mempool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t        mempool_key;
+
+static __thread mempool_tcache_t mempool_tcache[MEMPOOL_MAX];
+static __thread int              mempool_tcache_active;
+
+/*
+ * Move up to count objects from the thread cache to the depot,
+ * the surplus over MEMPOOL_DEPOT_MAX is returned to libc
+ */
+static void
+mempool_depot_put ( mempool_t *mp, mempool_tcache_t *tc, int count )
+{
+  void *p, *surplus = NULL;
+  int released = 0;
+
+  pthread_mutex_lock(&mp->mp_lock);
+  while (count-- > 0 && (p = tc->mt_free) != NULL) {
+    tc->mt_free = *(void **)p;
+    tc->mt_count--;
+    if (mp->mp_depot_count < MEMPOOL_DEPOT_MAX) {
+      *(void **)p = mp->mp_depot;
+      mp->mp_depot = p;
+      mp->mp_depot_count++;
+    } else {
+      *(void **)p = surplus;
+      surplus = p;
+      released++;
+    }
+  }
+  pthread_mutex_unlock(&mp->mp_lock);
+
+  while ((p = surplus) != NULL) {
+    surplus = *(void **)p;
+    free(p);
+  }
+  if (released)
+    atomic_add(&mp->mp_release, released);
+}
+
+/*
+ * Move up to count objects from the depot to the thread cache
+ */
+static void
+mempool_depot_get ( mempool_t *mp, mempool_tcache_t *tc, int count )
+{
+  void *p;
+
+  pthread_mutex_lock(&mp->mp_lock);
+  while (count-- > 0 && (p = mp->mp_depot) != NULL) {
+    mp->mp_depot = *(void **)p;
+    mp->mp_depot_count--;
+    *(void **)p = tc->mt_free;
+    tc->mt_free = p;
+    tc->mt_count++;
+  }
+  pthread_mutex_unlock(&mp->mp_lock);
+}
+
+/*
+ * Thread exit, hand the cached objects back to the depot
+ */
+static void
+mempool_thread_exit ( void *aux )
+{
+  mempool_tcache_t *tc = aux;
+  int i;
+
+  for (i = 0; i < MEMPOOL_MAX; i++)
+    if (tc[i].mt_count)
+      mempool_depot_put(mempool_table[i], &tc[i], tc[i].mt_count);
+}
+
+static void
+mempool_key_create ( void )
+{
+  pthread_key_create(&mempool_key, mempool_thread_exit);
+}
+
+static void
+mempool_register ( mempool_t *mp )
+{
+  pthread_once(&mempool_once, mempool_key_create);
+  pthread_mutex_lock(&mempools_lock);
+  if (mp->mp_id < 0) {
+    assert(mempool_count < MEMPOOL_MAX);
+    assert(mp->mp_size >= sizeof(void *));
+    mempool_table[mempool_count] = mp;
+    LIST_INSERT_HEAD(&mempools, mp, mp_link);
+    __sync_synchronize();
+    mp->mp_id = mempool_count++;
+  }
+  pthread_mutex_unlock(&mempools_lock);
+}
+
+static inline mempool_tcache_t *
+mempool_tcache_get ( mempool_t *mp )
+{
+  if (mp->mp_id < 0)
+    mempool_register(mp);
+  if (!mempool_tcache_active) {
+    mempool_tcache_active = 1;
+    pthread_setspecific(mempool_key, mempool_tcache);
+  }
+  return &mempool_tcache[mp->mp_id];
+}
+
+/*
+ * Allocate object
+ */
+void *
+mempool_alloc ( mempool_t *mp )
+{
+  mempool_tcache_t *tc = mempool_tcache_get(mp);
+  void *p;
+
+  if (tc->mt_free == NULL && mp->mp_depot_count > 0)
+    mempool_depot_get(mp, tc, MEMPOOL_TCACHE_MAX / 2);
+
+  if ((p = tc->mt_free) != NULL) {
+    tc->mt_free = *(void **)p;
+    tc->mt_count--;
+    return p;
+  }
+
+  if ((p = malloc(mp->mp_size)) == NULL) {
+    fprintf(stderr, "Unable to allocate %zu bytes (pool %s)\n",
+            mp->mp_size, mp->mp_name);
+    abort();
+  }
+  atomic_add(&mp->mp_malloc, 1);
+  return p;
+}
+
+void *
+mempool_calloc ( mempool_t *mp )
+{
+  void *p = mempool_alloc(mp);
+  memset(p, 0, mp->mp_size);
+  return p;
+}
+
+/*
+ * Release object
+ */
+void
+mempool_free ( mempool_t *mp, void *ptr )
+{
+  mempool_tcache_t *tc;
+
+  if (ptr == NULL)
+    return;
+  tc = mempool_tcache_get(mp);
+  *(void **)ptr = tc->mt_free;
+  tc->mt_free = ptr;
+  if (++tc->mt_count > MEMPOOL_TCACHE_MAX)
+    mempool_depot_put(mp, tc, MEMPOOL_TCACHE_MAX / 2);
+}
+
+/*
+ * Statistics
+ */
+htsmsg_t *
+mempool_stats ( void )
+{
+  htsmsg_t *l = htsmsg_create_list(), *e;
+  mempool_t *mp;
+
+  pthread_mutex_lock(&mempools_lock);
+  LIST_FOREACH(mp, &mempools, mp_link) {
+    e = htsmsg_create_map();
+    htsmsg_add_str(e, "name", mp->mp_name);
+    htsmsg_add_u32(e, "size", mp->mp_size);
+    htsmsg_add_s64(e, "allocated", mp->mp_malloc - mp->mp_release);
+    htsmsg_add_s64(e, "cached", mp->mp_depot_count);
+    htsmsg_add_s64(e, "mallocs", mp->mp_malloc);
+    htsmsg_add_msg(l, NULL, e);
+  }
+  pthread_mutex_unlock(&mempools_lock);
+  return l;
+}
+
+/*
+ * Shutdown, free the depots and the calling thread cache
+ */
+void
+mempool_done ( void )
+{
+  mempool_t *mp;
+  void *p;
+
+  pthread_mutex_lock(&mempools_lock);
+  LIST_FOREACH(mp, &mempools, mp_link) {
+    mempool_tcache_t *tc = &mempool_tcache[mp->mp_id];
+    while ((p = tc->mt_free) != NULL) {
+      tc->mt_free = *(void **)p;
+      free(p);
+    }
+    tc->mt_count = 0;
+    pthread_mutex_lock(&mp->mp_lock);
+    while ((p = mp->mp_depot) != NULL) {
+      mp->mp_depot = *(void **)p;
+      free(p);
+    }
+    mp->mp_depot_count = 0;
+    pthread_mutex_unlock(&mp->mp_lock);
+  }
+  pthread_mutex_unlock(&mempools_lock);
+}
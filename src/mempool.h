@@ -0,0 +1,66 @@
+/*
+ *  tvheadend, fixed size object pools
+ *  Copyright (C) 2015 Tvheadend
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TVH_MEMPOOL_H
+#define TVH_MEMPOOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include "queue.h"
+#include "htsmsg.h"
+
+#define MEMPOOL_MAX         16   /* max. number of pools */
+#define MEMPOOL_TCACHE_MAX  128  /* max. objects cached per thread */
+#define MEMPOOL_DEPOT_MAX   8192 /* max. objects cached globally */
+
+/*
+ * Pool of fixed size objects
+ *
+ * Each thread keeps a small free list per pool, so allocations and
+ * frees in the streaming threads don't touch the libc allocator. Objects
+ * freed by a different thread than they were allocated in travel back
+ * through the shared depot in batches.
+ */
+typedef struct mempool {
+  LIST_ENTRY(mempool) mp_link;
+  const char         *mp_name;
+  size_t              mp_size;
+  int                 mp_id;
+
+  pthread_mutex_t     mp_lock;  /* depot lock */
+  void               *mp_depot; /* next pointer is stored in object */
+  int                 mp_depot_count;
+
+  /* Statistics (updated on the slow paths only) */
+  volatile int        mp_malloc;  /* objects taken from libc */
+  volatile int        mp_release; /* objects returned to libc */
+} mempool_t;
+
+#define MEMPOOL_INIT(name, type) \
+  { .mp_name = (name), .mp_size = sizeof(type), .mp_id = -1, \
+    .mp_lock = PTHREAD_MUTEX_INITIALIZER }
+
+void *mempool_alloc ( mempool_t *mp );
+void *mempool_calloc ( mempool_t *mp );
+void  mempool_free ( mempool_t *mp, void *ptr );
+
+htsmsg_t *mempool_stats ( void );
+
+void mempool_done ( void );
+
+#endif /* TVH_MEMPOOL_H */
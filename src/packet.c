@@ -21,11 +21,31 @@
 #include "packet.h"
 #include "string.h"
 #include "atomic.h"
+#include "mempool.h"
 
 #ifndef PKTBUF_DATA_ALIGN
 #define PKTBUF_DATA_ALIGN 64
 #endif
 
+#define PKTBUF_POOL_MAX 32 /* max. cached data blocks per pool */
+
+/*
+ * Data block pool, blocks are recycled by pktbuf_ref_dec
+ */
+typedef struct pktbuf_pool {
+  LIST_ENTRY(pktbuf_pool) pp_link;
+  pthread_mutex_t         pp_lock;
+  size_t                  pp_size;
+  int                     pp_count;
+  void                   *pp_free;  /* next block pointer is stored in block */
+} pktbuf_pool_t;
+
+static LIST_HEAD(, pktbuf_pool) pktbuf_pools;
+static pthread_mutex_t          pktbuf_pools_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static mempool_t pkt_mempool    = MEMPOOL_INIT("packet", th_pkt_t);
+static mempool_t pktbuf_mempool = MEMPOOL_INIT("pktbuf", pktbuf_t);
+
 /*
  *
  */
@@ -35,7 +55,7 @@ pkt_destroy(th_pkt_t *pkt)
   pktbuf_ref_dec(pkt->pkt_payload);
   pktbuf_ref_dec(pkt->pkt_meta);
 
-  free(pkt);
+  mempool_free(&pkt_mempool, pkt);
 }
 
 
@@ -48,7 +68,7 @@ pkt_alloc(const void *data, size_t datalen, int64_t pts, int64_t dts)
 {
   th_pkt_t *pkt;
 
-  pkt = calloc(1, sizeof(th_pkt_t));
+  pkt = mempool_calloc(&pkt_mempool);
   if(datalen)
     pkt->pkt_payload = pktbuf_alloc(data, datalen);
   pkt->pkt_dts = dts;
@@ -133,7 +153,7 @@ pktref_remove(struct th_pktref_queue *q, th_pktref_t *pr)
 th_pkt_t *
 pkt_copy_shallow(th_pkt_t *pkt)
 {
-  th_pkt_t *n = malloc(sizeof(th_pkt_t));
+  th_pkt_t *n = mempool_alloc(&pkt_mempool);
   *n = *pkt;
 
   n->pkt_refcount = 1;
@@ -156,6 +176,79 @@ pktref_create(th_pkt_t *pkt)
   return pr;
 }
 
+/*
+ *
+ */
+static pktbuf_pool_t *
+pktbuf_pool_find(size_t size)
+{
+  pktbuf_pool_t *pp;
+
+  pthread_mutex_lock(&pktbuf_pools_lock);
+  LIST_FOREACH(pp, &pktbuf_pools, pp_link)
+    if (pp->pp_size == size)
+      break;
+  if (pp == NULL) {
+    pp = calloc(1, sizeof(*pp));
+    pthread_mutex_init(&pp->pp_lock, NULL);
+    pp->pp_size = size;
+    LIST_INSERT_HEAD(&pktbuf_pools, pp, pp_link);
+  }
+  pthread_mutex_unlock(&pktbuf_pools_lock);
+  return pp;
+}
+
+static void *
+pktbuf_pool_get(pktbuf_pool_t *pp)
+{
+  void *data;
+
+  pthread_mutex_lock(&pp->pp_lock);
+  if ((data = pp->pp_free) != NULL) {
+    pp->pp_free = *(void **)data;
+    pp->pp_count--;
+  }
+  pthread_mutex_unlock(&pp->pp_lock);
+  if (data == NULL && (data = malloc(pp->pp_size)) == NULL) {
+    fprintf(stderr, "Unable to allocate %zu bytes\n", pp->pp_size);
+    abort();
+  }
+  return data;
+}
+
+static void
+pktbuf_pool_put(pktbuf_pool_t *pp, void *data)
+{
+  pthread_mutex_lock(&pp->pp_lock);
+  if (pp->pp_count < PKTBUF_POOL_MAX) {
+    *(void **)data = pp->pp_free;
+    pp->pp_free = data;
+    pp->pp_count++;
+    data = NULL;
+  }
+  pthread_mutex_unlock(&pp->pp_lock);
+  free(data);
+}
+
+void
+pktbuf_pool_done(void)
+{
+  pktbuf_pool_t *pp;
+  void *data;
+
+  pthread_mutex_lock(&pktbuf_pools_lock);
+  while ((pp = LIST_FIRST(&pktbuf_pools)) != NULL) {
+    LIST_REMOVE(pp, pp_link);
+    while ((data = pp->pp_free) != NULL) {
+      pp->pp_free = *(void **)data;
+      free(data);
+    }
+    pthread_mutex_destroy(&pp->pp_lock);
+    free(pp);
+  }
+  pthread_mutex_unlock(&pktbuf_pools_lock);
+}
+
 /*
  *
  */
@@ -165,8 +258,11 @@ pktbuf_ref_dec(pktbuf_t *pb)
 {
   if (pb) {
     if((atomic_add(&pb->pb_refcount, -1)) == 1) {
-      free(pb->pb_data);
-      free(pb);
+      if (pb->pb_pool)
+        pktbuf_pool_put(pb->pb_pool, pb->pb_data);
+      else
+        free(pb->pb_data);
+      mempool_free(&pktbuf_mempool, pb);
     }
   }
 }
@@ -184,9 +280,10 @@ pktbuf_ref_inc(pktbuf_t *pb)
 pktbuf_t *
 pktbuf_alloc(const void *data, size_t size)
 {
-  pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  pktbuf_t *pb = mempool_alloc(&pktbuf_mempool);
   pb->pb_refcount = 1;
   pb->pb_size = size;
+  pb->pb_pool = NULL;
 
   if(size > 0) {
     pb->pb_data = malloc(size);
@@ -199,10 +296,11 @@ pktbuf_alloc(const void *data, size_t size)
 pktbuf_t *
 pktbuf_make(void *data, size_t size)
 {
-  pktbuf_t *pb = malloc(sizeof(pktbuf_t));
+  pktbuf_t *pb = mempool_alloc(&pktbuf_mempool);
   pb->pb_refcount = 1;
   pb->pb_size = size;
   pb->pb_data = data;
+  pb->pb_pool = NULL;
   return pb;
 }
 
@@ -211,8 +309,40 @@ pktbuf_append(pktbuf_t *pb, const void *data, size_t size)
 {
   if (pb == NULL)
     return pktbuf_alloc(data, size);
+  assert(pb->pb_pool == NULL);
   pb->pb_data = realloc(pb->pb_data, pb->pb_size + size);
   memcpy(pb->pb_data + pb->pb_size, data, size);
   pb->pb_size += size;
   return pb;
 }
+
+/**
+ * Take over the first len bytes of the sbuf data without copying them,
+ * the sbuf continues with a recycled block of the same size holding
+ * the remaining (not consumed) bytes. The pool is looked up once and
+ * cached in the sbuf (again only if the sbuf size changes).
+ */
+pktbuf_t *
+pktbuf_from_sbuf(sbuf_t *sb, int len)
+{
+  pktbuf_pool_t *pp = sb->sb_pool;
+  pktbuf_t *pb;
+  uint8_t *data;
+
+  if (pp == NULL || pp->pp_size != sb->sb_size)
+    pp = sb->sb_pool = pktbuf_pool_find(sb->sb_size);
+  pb = mempool_alloc(&pktbuf_mempool);
+  data = pktbuf_pool_get(pp);
+
+  assert(len <= sb->sb_ptr);
+  pb->pb_refcount = 1;
+  pb->pb_data = sb->sb_data;
+  pb->pb_size = len;
+  pb->pb_pool = pp;
+
+  sb->sb_ptr -= len;
+  if (sb->sb_ptr)
+    memcpy(data, sb->sb_data + len, sb->sb_ptr);
+  sb->sb_data = data;
+  return pb;
+}
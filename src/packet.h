@@ -19,6 +19,9 @@
 #ifndef PACKET_H_
 #define PACKET_H_
 
+struct sbuf;
+struct pktbuf_pool;
+
 /**
  * Packet buffer
  */
@@ -27,6 +30,7 @@ typedef struct pktbuf {
   int pb_refcount;
   uint8_t *pb_data;
   size_t pb_size;
+  struct pktbuf_pool *pb_pool; // data block is returned here (if set)
 } pktbuf_t;
 
 /**
@@ -115,6 +119,10 @@ pktbuf_t *pktbuf_make(void *data, size_t size);
 
 pktbuf_t *pktbuf_append(pktbuf_t *pb, const void *data, size_t size);
 
+pktbuf_t *pktbuf_from_sbuf(struct sbuf *sb, int len);
+
+void pktbuf_pool_done(void);
+
 static inline size_t   pktbuf_len(pktbuf_t *pb) { return pb->pb_size; }
 static inline uint8_t *pktbuf_ptr(pktbuf_t *pb) { return pb->pb_data; }
 
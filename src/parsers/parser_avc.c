@@ -212,7 +212,7 @@ th_pkt_t *
 avc_convert_pkt(th_pkt_t *src)
 {
   sbuf_t payload;
-  th_pkt_t *pkt = malloc(sizeof(*pkt));
+  th_pkt_t *pkt = pkt_alloc(NULL, 0, 0, 0);
 
   *pkt = *src;
   pkt->pkt_refcount = 1;
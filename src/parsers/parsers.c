@@ -34,6 +34,14 @@
 #include "packet.h"
 #include "streaming.h"
 
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if ENABLE_AVX2 && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define PARSE_SC_AVX2 1
+#endif
+
 #define PTS_MASK 0x1ffffffffLL
 //#define PTS_MASK 0x7ffffLL
 
@@ -276,21 +284,139 @@ parse_aac(service_t *t, elementary_stream_t *st, const uint8_t *data,
 }
 
 
+/**
+ * Find the first 00 00 01 sequence in data, returns the offset
+ * of the first zero byte or -1
+ */
+#if PARSE_SC_AVX2
+__attribute__((target("avx2")))
+static int
+parse_sc_find_avx2(const uint8_t *data, int len)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i one  = _mm256_set1_epi8(1);
+  __m256i a, b, c;
+  uint32_t m;
+  int i;
+
+  for (i = 0; i + 34 <= len; i += 32) {
+    a = _mm256_loadu_si256((const __m256i *)(data + i));
+    b = _mm256_loadu_si256((const __m256i *)(data + i + 1));
+    c = _mm256_loadu_si256((const __m256i *)(data + i + 2));
+    m = _mm256_movemask_epi8(_mm256_and_si256(
+          _mm256_and_si256(_mm256_cmpeq_epi8(a, zero),
+                           _mm256_cmpeq_epi8(b, zero)),
+          _mm256_cmpeq_epi8(c, one)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+  for (; i + 3 <= len; i++)
+    if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1)
+      return i;
+  return -1;
+}
+#endif
+
+static int
+parse_sc_find(const uint8_t *data, int len)
+{
+  int i = 0;
+
+#if PARSE_SC_AVX2
+  if (len >= 64 && __builtin_cpu_supports("avx2"))
+    return parse_sc_find_avx2(data, len);
+#endif
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i one  = _mm_set1_epi8(1);
+  __m128i a, b, c;
+  int m;
+
+  for (; i + 18 <= len; i += 16) {
+    a = _mm_loadu_si128((const __m128i *)(data + i));
+    b = _mm_loadu_si128((const __m128i *)(data + i + 1));
+    c = _mm_loadu_si128((const __m128i *)(data + i + 2));
+    m = _mm_movemask_epi8(_mm_and_si128(
+          _mm_and_si128(_mm_cmpeq_epi8(a, zero), _mm_cmpeq_epi8(b, zero)),
+          _mm_cmpeq_epi8(c, one)));
+    if (m)
+      return i + __builtin_ctz(m);
+  }
+#else
+  const uint8_t *p;
+
+  /* the middle byte of 00 00 01 is zero and next one is not above one */
+  while (i + 3 <= len) {
+    p = memchr(data + i + 1, 0, len - i - 2);
+    if (p == NULL)
+      return -1;
+    i = p - data - 1;
+    if (data[i] == 0 && p[1] == 1)
+      return i;
+    i += p[1] > 1 ? 3 : 1;
+  }
+#endif
+  for (; i + 3 <= len; i++)
+    if (data[i] == 0 && data[i+1] == 0 && data[i+2] == 1)
+      return i;
+  return -1;
+}
+
+/**
+ * Number of bytes which can be consumed before the startcode
+ * state matches 0x000001xx
+ */
+static inline int
+parse_sc_skip(uint32_t sc, const uint8_t *data, int len)
+{
+  int i, m;
+
+  /* startcodes continuing from the previous bytes */
+  for (i = 0; i < 3 && i < len; i++) {
+    sc = sc << 8 | data[i];
+    if ((sc & 0xffffff00) == 0x00000100)
+      return i;
+  }
+  if (len <= 3)
+    return len;
+  m = parse_sc_find(data, len - 1);
+  return m < 0 ? len : m + 3;
+}
+
 /**
  * Generic video parser
  *
  * We scan for startcodes a'la 0x000001xx and let a specific parser
  * derive further information.
+ *
+ * The bytes between the startcodes are located with the vector
+ * scanner and copied to es_buf in one go.
  */
 static void
 parse_sc(service_t *t, elementary_stream_t *st, const uint8_t *data, int len,
          packet_parser_t *vp)
 {
   uint32_t sc = st->es_startcond;
-  int i, r;
+  int i, j, n, r;
   sbuf_alloc(&st->es_buf, len);
 
   for(i = 0; i < len; i++) {
+    if(st->es_ssc_intercept != 1) {
+      n = parse_sc_skip(sc, data + i, len - i);
+      if(n > 0) {
+        sbuf_append(&st->es_buf, data + i, n);
+        if(n >= 4)
+          sc = data[i+n-4] << 24 | data[i+n-3] << 16 |
+               data[i+n-2] << 8 | data[i+n-1];
+        else
+          for(j = 0; j < n; j++)
+            sc = sc << 8 | data[i+j];
+        i += n;
+        if(i >= len)
+          break;
+      }
+    }
+
     if(st->es_ssc_intercept == 1) {
       if(st->es_ssc_ptr < sizeof(st->es_ssc_buf))
         st->es_ssc_buf[st->es_ssc_ptr] = data[i];
@@ -218,6 +218,17 @@ profile_class_default_set(void *o, const void *v)
   return 0;
 }
 
+static htsmsg_t *
+profile_class_drop_policy_list ( void *o )
+{
+  static const struct strtab tab[] = {
+    { "Drop newest",                   SQ_DROP_NEWEST },
+    { "Drop oldest non-keyframe",      SQ_DROP_OLDEST_NONKEY },
+    { "Drop to next I-frame",          SQ_DROP_TO_IFRAME },
+  };
+  return strtab2htsmsg(tab);
+}
+
 static uint32_t
 profile_class_name_opts(void *o)
 {
@@ -288,6 +299,15 @@ const idclass_t profile_class =
       .off      = offsetof(profile_t, pro_restart),
       .def.i    = 0,
     },
+    {
+      .type     = PT_INT,
+      .id       = "drop_policy",
+      .name     = "Queue Overflow",
+      .off      = offsetof(profile_t, pro_drop_policy),
+      .list     = profile_class_drop_policy_list,
+      .def.i    = SQ_DROP_NEWEST,
+      .opts     = PO_ADVANCED,
+    },
     { }
   }
 };
@@ -672,6 +692,9 @@ profile_chain_init(profile_chain_t *prch, profile_t *pro, void *id)
   prch->prch_pro = pro;
   prch->prch_id  = id;
   streaming_queue_init(&prch->prch_sq, 0, 0);
+  if (pro && pro->pro_drop_policy >= 0 &&
+      pro->pro_drop_policy <= SQ_DROP_TO_IFRAME)
+    prch->prch_sq.sq_drop_policy = pro->pro_drop_policy;
   LIST_INSERT_HEAD(&profile_chains, prch, prch_link);
   prch->prch_linked = 1;
   prch->prch_stop = 1;
@@ -105,6 +105,7 @@ typedef struct profile {
   char *pro_comment;
   int pro_timeout;
   int pro_restart;
+  int pro_drop_policy;
 
   void (*pro_free)(struct profile *pro);
   void (*pro_conf_changed)(struct profile *pro);
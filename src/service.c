@@ -901,6 +901,7 @@ service_create0
   TAILQ_INIT(&t->s_components);
   TAILQ_INIT(&t->s_filt_components);
   t->s_last_pid = -1;
+  avgstat_init(&t->s_rate, 10);
 
   streaming_pad_init(&t->s_streaming_pad);
   
@@ -25,6 +25,10 @@
 #include "atomic.h"
 #include "service.h"
 #include "timeshift.h"
+#include "mempool.h"
+
+static mempool_t streaming_msg_mempool =
+  MEMPOOL_INIT("streaming_message", streaming_message_t);
 
 void
 streaming_pad_init(streaming_pad_t *sp)
@@ -47,6 +51,122 @@ streaming_target_init(streaming_target_t *st, st_callback_t *cb, void *opaque,
 }
 
 
+/**
+ * Payload bytes accounted for a queued message
+ */
+static inline size_t
+streaming_message_data_size(streaming_message_t *sm)
+{
+  if (sm->sm_type == SMT_PACKET) {
+    th_pkt_t *pkt = sm->sm_data;
+    if (pkt && pkt->pkt_payload)
+      return pkt->pkt_payload->pb_size;
+  } else if (sm->sm_type == SMT_MPEGTS) {
+    pktbuf_t *pkt_payload = sm->sm_data;
+    if (pkt_payload)
+      return pkt_payload->pb_size;
+  }
+  return 0;
+}
+
+static inline int
+streaming_message_is_data(streaming_message_t *sm)
+{
+  return sm->sm_type == SMT_PACKET || sm->sm_type == SMT_MPEGTS;
+}
+
+static inline int
+streaming_message_frametype(streaming_message_t *sm)
+{
+  th_pkt_t *pkt;
+  if (sm->sm_type != SMT_PACKET)
+    return 0;
+  pkt = sm->sm_data;
+  return pkt ? pkt->pkt_frametype : 0;
+}
+
+/**
+ * Remove a message from the queue (caller must hold sq_mutex)
+ *
+ * Every consumer must dequeue using this, so that sq_size stays valid.
+ */
+void
+streaming_queue_remove(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+  sq->sq_size -= streaming_message_data_size(sm);
+}
+
+static void
+streaming_queue_drop(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  streaming_queue_remove(sq, sm);
+  streaming_msg_free(sm);
+}
+
+/**
+ * Overflow policies
+ *
+ * Called when the queue is full and another data message arrives,
+ * control messages are never dropped. Return 0 if the new message
+ * should be queued.
+ */
+static int
+streaming_queue_drop_newest(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  return -1;
+}
+
+static int
+streaming_queue_drop_oldest_nonkey(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  streaming_message_t *q, *n;
+
+  for (q = TAILQ_FIRST(&sq->sq_queue);
+       q && sq->sq_size >= sq->sq_maxsize; q = n) {
+    n = TAILQ_NEXT(q, sm_link);
+    if (streaming_message_is_data(q) &&
+        streaming_message_frametype(q) != PKT_I_FRAME)
+      streaming_queue_drop(sq, q);
+  }
+  return sq->sq_size >= sq->sq_maxsize ? -1 : 0;
+}
+
+static int
+streaming_queue_drop_to_iframe(streaming_queue_t *sq, streaming_message_t *sm)
+{
+  streaming_message_t *q, *n;
+  int frametype, video = 0;
+
+  /*
+   * Drop the oldest data, once a video frame is gone keep dropping
+   * up to the next queued I-frame
+   */
+  for (q = TAILQ_FIRST(&sq->sq_queue); q; q = n) {
+    n = TAILQ_NEXT(q, sm_link);
+    if (!streaming_message_is_data(q))
+      continue;
+    frametype = streaming_message_frametype(q);
+    if (video ? frametype == PKT_I_FRAME : sq->sq_size < sq->sq_maxsize)
+      break;
+    video |= frametype != 0;
+    streaming_queue_drop(sq, q);
+  }
+
+  /* No I-frame left, skip the video until the next one arrives */
+  if (q == NULL && video)
+    sq->sq_wait_iframe = 1;
+
+  return sq->sq_size >= sq->sq_maxsize ? -1 : 0;
+}
+
+static int (*const streaming_queue_overflow[])
+  (streaming_queue_t *sq, streaming_message_t *sm) = {
+  [SQ_DROP_NEWEST]        = streaming_queue_drop_newest,
+  [SQ_DROP_OLDEST_NONKEY] = streaming_queue_drop_oldest_nonkey,
+  [SQ_DROP_TO_IFRAME]     = streaming_queue_drop_to_iframe,
+};
+
 /**
  *
  */
@@ -54,20 +174,34 @@ static void
 streaming_queue_deliver(void *opauqe, streaming_message_t *sm)
 {
   streaming_queue_t *sq = opauqe;
+  int frametype;
 
   pthread_mutex_lock(&sq->sq_mutex);
 
   /* queue size protection */
-  // TODO: would be better to update size as we go, but this would
-  //       require updates elsewhere to ensure all removals from the queue
-  //       are covered (new function)
-  if (sq->sq_maxsize && streaming_queue_size(&sq->sq_queue) >= sq->sq_maxsize)
-    streaming_msg_free(sm);
-  else
-    TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
+  if (sq->sq_maxsize && streaming_message_is_data(sm)) {
+    if (sq->sq_wait_iframe) {
+      frametype = streaming_message_frametype(sm);
+      if (frametype == PKT_I_FRAME)
+        sq->sq_wait_iframe = 0;
+      else if (frametype != 0)
+        goto drop;
+    }
+    if (sq->sq_size >= sq->sq_maxsize &&
+        streaming_queue_overflow[sq->sq_drop_policy](sq, sm))
+      goto drop;
+  }
+
+  TAILQ_INSERT_TAIL(&sq->sq_queue, sm, sm_link);
+  sq->sq_size += streaming_message_data_size(sm);
 
   pthread_cond_signal(&sq->sq_cond);
   pthread_mutex_unlock(&sq->sq_mutex);
+  return;
+
+drop:
+  streaming_msg_free(sm);
+  pthread_mutex_unlock(&sq->sq_mutex);
 }
 
 
@@ -83,7 +217,10 @@ streaming_queue_init(streaming_queue_t *sq, int reject_filter, size_t maxsize)
   pthread_cond_init(&sq->sq_cond, NULL);
   TAILQ_INIT(&sq->sq_queue);
 
+  sq->sq_size = 0;
   sq->sq_maxsize = maxsize;
+  sq->sq_drop_policy = SQ_DROP_NEWEST;
+  sq->sq_wait_iframe = 0;
 }
 
 /**
@@ -92,7 +229,7 @@ streaming_queue_init(streaming_queue_t *sq, int reject_filter, size_t maxsize)
 void
 streaming_queue_deinit(streaming_queue_t *sq)
 {
-  streaming_queue_clear(&sq->sq_queue);
+  streaming_queue_clear(sq);
   pthread_mutex_destroy(&sq->sq_mutex);
   pthread_cond_destroy(&sq->sq_cond);
 }
@@ -137,7 +274,7 @@ streaming_target_disconnect(streaming_pad_t *sp, streaming_target_t *st)
 streaming_message_t *
 streaming_msg_create(streaming_message_type_t type)
 {
-  streaming_message_t *sm = malloc(sizeof(streaming_message_t));
+  streaming_message_t *sm = mempool_alloc(&streaming_msg_mempool);
   sm->sm_type = type;
 #if ENABLE_TIMESHIFT
   sm->sm_time      = 0;
@@ -190,7 +327,7 @@ streaming_msg_create_code(streaming_message_type_t type, int code)
 streaming_message_t *
 streaming_msg_clone(streaming_message_t *src)
 {
-  streaming_message_t *dst = malloc(sizeof(streaming_message_t));
+  streaming_message_t *dst = mempool_alloc(&streaming_msg_mempool);
   streaming_start_t *ss;
 
   dst->sm_type      = src->sm_type;
@@ -310,7 +447,7 @@ streaming_msg_free(streaming_message_t *sm)
   default:
     abort();
   }
-  free(sm);
+  mempool_free(&streaming_msg_mempool, sm);
 }
 
 /**
@@ -352,44 +489,16 @@ streaming_pad_deliver(streaming_pad_t *sp, streaming_message_t *sm)
  *
  */
 void
-streaming_queue_clear(struct streaming_message_queue *q)
+streaming_queue_clear(streaming_queue_t *sq)
 {
   streaming_message_t *sm;
 
-  while((sm = TAILQ_FIRST(q)) != NULL) {
-    TAILQ_REMOVE(q, sm, sm_link);
+  while((sm = TAILQ_FIRST(&sq->sq_queue)) != NULL) {
+    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
     streaming_msg_free(sm);
   }
-}
-
-
-/**
- *
- */
-size_t streaming_queue_size(struct streaming_message_queue *q)
-{
-  streaming_message_t *sm;
-  int size = 0;
-
-  TAILQ_FOREACH(sm, q, sm_link) {
-    if (sm->sm_type == SMT_PACKET)
-    {
-      th_pkt_t *pkt = sm->sm_data;
-      if (pkt && pkt->pkt_payload)
-      {
-        size += pkt->pkt_payload->pb_size;
-      }
-    }
-    else if (sm->sm_type == SMT_MPEGTS)
-    {
-      pktbuf_t *pkt_payload = sm->sm_data;
-      if (pkt_payload)
-      {
-        size += pkt_payload->pb_size;
-      }
-    }
-  }
-  return size;
+  sq->sq_size = 0;
+  sq->sq_wait_iframe = 0;
 }
 
 
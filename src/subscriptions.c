@@ -164,6 +164,7 @@ subscription_unlink_mux(th_subscription_t *s, int reason)
   assert(mi);
 
   pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mm->mm_output_lock);
   s->ths_mmi = NULL;
 
   if (!(s->ths_flags & SUBSCRIPTION_NONE))
@@ -176,6 +177,7 @@ subscription_unlink_mux(th_subscription_t *s, int reason)
     mi->mi_close_pid(mi, mm, MPEGTS_FULLMUX_PID, MPS_NONE, s);
   LIST_REMOVE(s, ths_mmi_link);
 
+  pthread_mutex_unlock(&mm->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 }
 
@@ -789,6 +791,7 @@ subscription_create_from_mux(profile_chain_t *prch,
   assert(mi);
 
   pthread_mutex_lock(&mi->mi_output_lock);
+  pthread_mutex_lock(&mm->mm_output_lock);
 
   if (s->ths_flags & SUBSCRIPTION_FULLMUX)
     mi->mi_open_pid(mi, mm, MPEGTS_FULLMUX_PID, MPS_NONE, s);
@@ -829,6 +832,7 @@ subscription_create_from_mux(profile_chain_t *prch,
   sm = streaming_msg_create_code(SMT_GRACE, r);
   streaming_target_deliver(s->ths_output, sm);
 
+  pthread_mutex_unlock(&mm->mm_output_lock);
   pthread_mutex_unlock(&mi->mi_output_lock);
 
   if (r > 0)
@@ -855,6 +859,9 @@ subscription_create_msg(th_subscription_t *s)
   htsmsg_add_u32(m, "id", s->ths_id);
   htsmsg_add_u32(m, "start", s->ths_start);
   htsmsg_add_u32(m, "errors", s->ths_total_err);
+  htsmsg_add_u32(m, "queue_packets", s->ths_queue_packets);
+  htsmsg_add_u32(m, "queue_bytes", s->ths_queue_bytes);
+  htsmsg_add_s64(m, "queue_delay", s->ths_queue_delay);
 
   const char *state;
   switch(s->ths_state) {
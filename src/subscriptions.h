@@ -79,6 +79,9 @@ typedef struct th_subscription {
   int ths_total_err; /* total errors during entire subscription */
   int ths_bytes_in;   // Reset every second to get aprox. bandwidth (in)
   int ths_bytes_out; // Reset every second to get approx bandwidth (out)
+  int ths_queue_packets; // Output queue backlog, updated by the consumer
+  int ths_queue_bytes;
+  int64_t ths_queue_delay; // (us)
 
   streaming_target_t ths_input;
 
@@ -21,6 +21,8 @@
 
 #define TIMESHIFT_PLAY_BUF     200000 // us to buffer in TX
 #define TIMESHIFT_FILE_PERIOD      60 // number of secs in each buffer file
+#define TIMESHIFT_RAM_CHUNK   1048576 // RAM segment allocation granularity
+#define TIMESHIFT_READ_BUF      65536 // read-ahead when reading from disk
 
 /**
  * Indexes of import data in the stream
@@ -48,12 +50,20 @@ typedef TAILQ_HEAD(timeshift_index_data_list,timeshift_index_data) timeshift_ind
 
 /**
  * Timeshift file
+ *
+ * While there is room in the global RAM budget the segment data is kept
+ * in memory only (ram != NULL), path is then just the place the segment
+ * will be spilled to once it has to leave RAM.
  */
 typedef struct timeshift_file
 {
   int                           fd;       ///< Write descriptor
   char                          *path;    ///< Full path to file
 
+  uint8_t                       *ram;     ///< RAM segment (NULL if on disk)
+  size_t                        ram_size; ///< RAM segment allocation
+  uint8_t                       ram_wr;   ///< RAM segment open for writing
+
   time_t                        time;     ///< Files coarse timestamp
   size_t                        size;     ///< Current file size;
   int64_t                       last;     ///< Latest timestamp
@@ -114,14 +124,15 @@ typedef struct timeshift {
  * Write functions
  */
 ssize_t timeshift_write_start   ( int fd, int64_t time, streaming_start_t *ss );
-ssize_t timeshift_write_sigstat ( int fd, int64_t time, signal_status_t *ss );
-ssize_t timeshift_write_packet  ( int fd, int64_t time, th_pkt_t *pkt );
-ssize_t timeshift_write_mpegts  ( int fd, int64_t time, void *data );
+ssize_t timeshift_write_sigstat ( timeshift_file_t *tsf, int64_t time, signal_status_t *ss );
+ssize_t timeshift_write_packet  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt );
+ssize_t timeshift_write_mpegts  ( timeshift_file_t *tsf, int64_t time, void *data );
 ssize_t timeshift_write_skip    ( int fd, streaming_skip_t *skip );
 ssize_t timeshift_write_speed   ( int fd, int speed );
 ssize_t timeshift_write_stop    ( int fd, int code );
 ssize_t timeshift_write_exit    ( int fd );
-ssize_t timeshift_write_eof     ( int fd );
+ssize_t timeshift_write_eof     ( timeshift_file_t *tsf );
+ssize_t timeshift_write_ram     ( int fd, timeshift_file_t *tsf );
 
 void timeshift_writer_flush ( timeshift_t *ts );
 
@@ -152,5 +163,7 @@ void timeshift_filemgr_remove
   ( timeshift_t *ts, timeshift_file_t *tsf, int force );
 void timeshift_filemgr_flush ( timeshift_t *ts, timeshift_file_t *end );
 void timeshift_filemgr_close ( timeshift_file_t *tsf );
+int  timeshift_filemgr_spill ( timeshift_t *ts, timeshift_file_t *tsf );
+void timeshift_filemgr_ram_check ( timeshift_t *ts );
 
 #endif /* __TVH_TIMESHIFT_PRIVATE_H__ */
@@ -39,6 +39,7 @@ static pthread_mutex_t       timeshift_reaper_lock;
 static pthread_cond_t        timeshift_reaper_cond;
 
 uint64_t                     timeshift_total_size;
+uint64_t                     timeshift_total_ram_size;
 
 /* **************************************************************************
  * File reaper thread
@@ -65,13 +66,18 @@ static void* timeshift_reaper_callback ( void *p )
 
     tvhtrace("timeshift", "remove file %s", tsf->path);
 
-    /* Remove */
-    unlink(tsf->path);
-    dpath = dirname(tsf->path);
-    if (rmdir(dpath) == -1)
-      if (errno != ENOTEMPTY)
-        tvhlog(LOG_ERR, "timeshift", "failed to remove %s [e=%s]",
-               dpath, strerror(errno));
+    /* Remove (RAM segments never made it to disk) */
+    if (tsf->ram) {
+      atomic_add_u64(&timeshift_total_ram_size, -tsf->ram_size);
+      free(tsf->ram);
+    } else {
+      unlink(tsf->path);
+      dpath = dirname(tsf->path);
+      if (rmdir(dpath) == -1)
+        if (errno != ENOTEMPTY)
+          tvhlog(LOG_ERR, "timeshift", "failed to remove %s [e=%s]",
+                 dpath, strerror(errno));
+    }
 
     /* Free memory */
     while ((ti = TAILQ_FIRST(&tsf->iframes))) {
@@ -140,14 +146,81 @@ int timeshift_filemgr_makedirs ( int index, char *buf, size_t len )
  */
 void timeshift_filemgr_close ( timeshift_file_t *tsf )
 {
-  ssize_t r = timeshift_write_eof(tsf->fd);
+  uint8_t *p;
+  ssize_t r = timeshift_write_eof(tsf);
   if (r > 0)
   {
     tsf->size += r;
     atomic_add_u64(&timeshift_total_size, r);
   }
-  close(tsf->fd);
-  tsf->fd = -1;
+  if (tsf->ram_wr) {
+    /* Give back the unused tail of the last allocation chunk */
+    if (tsf->ram && tsf->size < tsf->ram_size &&
+        (p = realloc(tsf->ram, tsf->size))) {
+      atomic_add_u64(&timeshift_total_ram_size, tsf->size - tsf->ram_size);
+      tsf->ram      = p;
+      tsf->ram_size = tsf->size;
+    }
+    tsf->ram_wr = 0;
+  } else {
+    close(tsf->fd);
+    tsf->fd = -1;
+  }
+}
+
+/*
+ * Move RAM segment to disk (one large write)
+ *
+ * A segment which is still being written continues on disk.
+ */
+int timeshift_filemgr_spill ( timeshift_t *ts, timeshift_file_t *tsf )
+{
+  int fd;
+
+  tvhtrace("timeshift", "ts %d spill %zu bytes to %s",
+           ts->id, tsf->size, tsf->path);
+  if ((fd = open(tsf->path, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+    tvhlog(LOG_ERR, "timeshift", "ts %d unable to create %s [e=%s]",
+           ts->id, tsf->path, strerror(errno));
+    return -1;
+  }
+  if (timeshift_write_ram(fd, tsf) < 0) {
+    tvhlog(LOG_ERR, "timeshift", "ts %d unable to write %s [e=%s]",
+           ts->id, tsf->path, strerror(errno));
+    close(fd);
+    unlink(tsf->path);
+    return -1;
+  }
+  if (tsf->ram_wr) {
+    tsf->fd     = fd;
+    tsf->ram_wr = 0;
+  } else {
+    close(fd);
+  }
+  atomic_add_u64(&timeshift_total_ram_size, -tsf->ram_size);
+  free(tsf->ram);
+  tsf->ram      = NULL;
+  tsf->ram_size = 0;
+  return 0;
+}
+
+/*
+ * Keep the RAM segments within the global budget, the oldest
+ * segment of this buffer goes to disk first
+ */
+void timeshift_filemgr_ram_check ( timeshift_t *ts )
+{
+  timeshift_file_t *tsf;
+
+  if (atomic_pre_add_u64(&timeshift_total_ram_size, 0) <= timeshift_ram_size)
+    return;
+  TAILQ_FOREACH(tsf, &ts->files, link)
+    if (tsf->ram)
+      break;
+  if (tsf && timeshift_filemgr_spill(ts, tsf)) {
+    tvhlog(LOG_DEBUG, "timeshift", "ts %d buffer full", ts->id);
+    ts->full = 1;
+  }
 }
 
 /*
@@ -158,6 +231,7 @@ void timeshift_filemgr_remove
 {
   if (tsf->fd != -1)
     close(tsf->fd);
+  tsf->fd = -1;
   tvhlog(LOG_DEBUG, "timeshift", "ts %d remove %s", ts->id, tsf->path);
   TAILQ_REMOVE(&ts->files, tsf, link);
   atomic_add_u64(&timeshift_total_size, -tsf->size);
@@ -204,7 +278,7 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
     tsf_hd = TAILQ_FIRST(&ts->files);
 
     /* Close existing */
-    if (tsf_tl && tsf_tl->fd != -1)
+    if (tsf_tl && (tsf_tl->fd != -1 || tsf_tl->ram_wr))
       timeshift_filemgr_close(tsf_tl);
 
     /* Check period */
@@ -247,13 +321,26 @@ timeshift_file_t *timeshift_filemgr_get ( timeshift_t *ts, int create )
         ts->path = strdup(path);
       }
 
-      /* Create File */
+      /* Make room in RAM */
+      if (timeshift_ram_size)
+        timeshift_filemgr_ram_check(ts);
+
+      /* Create RAM segment or File */
       snprintf(path, sizeof(path), "%s/tvh-%"PRItime_t, ts->path, time);
-      tvhtrace("timeshift", "ts %d create file %s", ts->id, path);
-      if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) > 0) {
+      if (timeshift_ram_size &&
+          atomic_pre_add_u64(&timeshift_total_ram_size, 0) < timeshift_ram_size) {
+        tvhtrace("timeshift", "ts %d create RAM segment %s", ts->id, path);
+        fd = -1;
+      } else {
+        tvhtrace("timeshift", "ts %d create file %s", ts->id, path);
+        if ((fd = open(path, O_WRONLY | O_CREAT, 0600)) < 0)
+          fd = -2;
+      }
+      if (fd != -2) {
         tsf_tmp = calloc(1, sizeof(timeshift_file_t));
         tsf_tmp->time     = time;
         tsf_tmp->fd       = fd;
+        tsf_tmp->ram_wr   = fd < 0;
         tsf_tmp->path     = strdup(path);
         tsf_tmp->refcount = 0;
         tsf_tmp->last     = getmonoclock();
@@ -341,7 +428,8 @@ void timeshift_filemgr_init ( void )
     rmtree(path);
 
   /* Size processing */
-  timeshift_total_size = 0;
+  timeshift_total_size     = 0;
+  timeshift_total_ram_size = 0;
 
   /* Start the reaper thread */
   timeshift_reaper_run = 1;
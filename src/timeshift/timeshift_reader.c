@@ -41,13 +41,81 @@
  * File Reading
  * *************************************************************************/
 
-static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
+/*
+ * Read source, either a pipe (plain read()), a RAM segment or a buffer
+ * file read through a read-ahead buffer filled with large pread()s
+ */
+typedef struct timeshift_read {
+  int            fd;       ///< Pipe or file descriptor
+  const uint8_t *ram;      ///< RAM segment (valid under rdwr_mutex only)
+  size_t         ram_len;  ///< RAM segment data length
+  uint8_t       *buf;      ///< Read-ahead buffer (NULL for pipes)
+  size_t         buf_size; ///< Read-ahead buffer allocation
+  off_t          buf_off;  ///< File offset of the buffered data
+  size_t         buf_len;  ///< Buffered data length
+  off_t          pos;      ///< Current read position
+} timeshift_read_t;
+
+static ssize_t _read ( timeshift_read_t *rd, void *data, size_t len )
+{
+  const uint8_t *src;
+  size_t avail;
+  ssize_t r;
+  uint8_t *p;
+
+  /* Pipe */
+  if (!rd->ram && !rd->buf)
+    return read(rd->fd, data, len);
+
+  /* RAM segment */
+  if (rd->ram) {
+    if (rd->pos >= rd->ram_len)
+      return 0;
+    src   = rd->ram + rd->pos;
+    avail = rd->ram_len - rd->pos;
+
+  /* Buffer file */
+  } else {
+    if (rd->pos < rd->buf_off ||
+        rd->pos + len > rd->buf_off + rd->buf_len) {
+      if (len > rd->buf_size) {
+        if ((p = realloc(rd->buf, len)) == NULL)
+          return -1;
+        rd->buf      = p;
+        rd->buf_size = len;
+      }
+      r = pread(rd->fd, rd->buf, rd->buf_size, rd->pos);
+      if (r < 0) return -1;
+      rd->buf_off = rd->pos;
+      rd->buf_len = r;
+    }
+    src   = rd->buf + (rd->pos - rd->buf_off);
+    avail = rd->buf_len - (rd->pos - rd->buf_off);
+  }
+
+  if (len > avail)
+    len = avail;
+  memcpy(data, src, len);
+  rd->pos += len;
+  return len;
+}
+
+static void _read_close ( timeshift_read_t *rd )
+{
+  if (rd->fd != -1)
+    close(rd->fd);
+  rd->fd      = -1;
+  rd->buf_off = 0;
+  rd->buf_len = 0;
+}
+
+static ssize_t _read_pktbuf ( timeshift_read_t *rd, pktbuf_t **pktbuf )
 {
   ssize_t r, cnt = 0;
   size_t sz;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
+  r = _read(rd, &sz, sizeof(sz));
   if (r < 0) return -1;
   if (r != sizeof(sz)) return 0;
   cnt += r;
@@ -60,10 +128,10 @@ static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
 
   /* Data */
   *pktbuf = pktbuf_alloc(NULL, sz);
-  r = read(fd, (*pktbuf)->pb_data, sz);
+  r = _read(rd, (*pktbuf)->pb_data, sz);
   if (r != sz) {
-    free((*pktbuf)->pb_data);
-    free(*pktbuf);
+    pktbuf_ref_dec(*pktbuf);
+    *pktbuf = NULL;
     return r < 0 ? -1 : 0;
   }
   cnt += r;
@@ -72,7 +140,7 @@ static ssize_t _read_pktbuf ( int fd, pktbuf_t **pktbuf )
 }
 
 
-static ssize_t _read_msg ( int fd, streaming_message_t **sm )
+static ssize_t _read_msg ( timeshift_read_t *rd, streaming_message_t **sm )
 {
   ssize_t r, cnt = 0;
   size_t sz;
@@ -85,7 +153,7 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   *sm = NULL;
 
   /* Size */
-  r = read(fd, &sz, sizeof(sz));
+  r = _read(rd, &sz, sizeof(sz));
   if (r < 0) return -1;
   if (r != sizeof(sz)) return 0;
   cnt += r;
@@ -97,13 +165,13 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
   if (sz > 1024 * 1024) return -1;
 
   /* Type */
-  r = read(fd, &type, sizeof(type));
+  r = _read(rd, &type, sizeof(type));
   if (r < 0) return -1;
   if (r != sizeof(type)) return 0;
   cnt += r;
 
   /* Time */
-  r = read(fd, &time, sizeof(time));
+  r = _read(rd, &time, sizeof(time));
   if (r < 0) return -1;
   if (r != sizeof(time)) return 0;
   cnt += r;
@@ -127,7 +195,7 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
     case SMT_EXIT:
     case SMT_SPEED:
       if (sz != sizeof(code)) return -1;
-      r = read(fd, &code, sz);
+      r = _read(rd, &code, sz);
       if (r != sz) {
         if (r < 0) return -1;
         return 0;
@@ -141,24 +209,31 @@ static ssize_t _read_msg ( int fd, streaming_message_t **sm )
     case SMT_MPEGTS:
     case SMT_PACKET:
       data = malloc(sz);
-      r = read(fd, data, sz);
+      r = _read(rd, data, sz);
       if (r != sz) {
         free(data);
         if (r < 0) return -1;
         return 0;
       }
       if (type == SMT_PACKET) {
-        th_pkt_t *pkt = data;
+        th_pkt_t *pkt;
+        if (sz != sizeof(th_pkt_t)) {
+          free(data);
+          return -1;
+        }
+        pkt = pkt_alloc(NULL, 0, 0, 0);
+        memcpy(pkt, data, sz);
+        free(data);
         pkt->pkt_payload  = pkt->pkt_meta = NULL;
         pkt->pkt_refcount = 0;
         *sm = streaming_msg_create_pkt(pkt);
-        r   = _read_pktbuf(fd, &pkt->pkt_meta);
+        r   = _read_pktbuf(rd, &pkt->pkt_meta);
         if (r < 0) {
           streaming_msg_free(*sm);
           return r;
         }
         cnt += r;
-        r   = _read_pktbuf(fd, &pkt->pkt_payload);
+        r   = _read_pktbuf(rd, &pkt->pkt_payload);
         if (r < 0) {
           streaming_msg_free(*sm);
           return r;
@@ -317,24 +392,37 @@ static int _timeshift_skip
  * Output packet
  */
 static int _timeshift_read
-  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off, int *fd,
-    streaming_message_t **sm, int *wait )
+  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off,
+    timeshift_read_t *rd, streaming_message_t **sm, int *wait )
 {
-  if (*cur_file) {
-
-    /* Open file */
-    if (*fd < 0) {
-      tvhtrace("timeshift", "ts %d open file %s",
-               ts->id, (*cur_file)->path);
-      *fd = open((*cur_file)->path, O_RDONLY);
-      if (*fd < 0)
-        return -1;
-    }
+  timeshift_file_t *tsf = *cur_file;
+  ssize_t r;
+
+  if (tsf) {
+
     tvhtrace("timeshift", "ts %d seek to %jd", ts->id, (intmax_t)*cur_off);
-    lseek(*fd, *cur_off, SEEK_SET);
+    rd->pos = *cur_off;
+
+    /* Read msg (RAM segment, cannot be spilled while locked) */
+    pthread_mutex_lock(&ts->rdwr_mutex);
+    if (tsf->ram || tsf->ram_wr) {
+      rd->ram     = tsf->ram;
+      rd->ram_len = tsf->size;
+      r = tsf->ram ? _read_msg(rd, sm) : 0;
+      rd->ram     = NULL;
+      pthread_mutex_unlock(&ts->rdwr_mutex);
 
-    /* Read msg */
-    ssize_t r = _read_msg(*fd, sm);
+    /* Read msg (file) */
+    } else {
+      pthread_mutex_unlock(&ts->rdwr_mutex);
+      if (rd->fd < 0) {
+        tvhtrace("timeshift", "ts %d open file %s", ts->id, tsf->path);
+        rd->fd = open(tsf->path, O_RDONLY);
+        if (rd->fd < 0)
+          return -1;
+      }
+      r = _read_msg(rd, sm);
+    }
     if (r < 0) {
       streaming_message_t *e = streaming_msg_create_code(SMT_STOP, SM_CODE_UNDEFINED_ERROR);
       streaming_target_deliver2(ts->output, e);
@@ -348,18 +436,15 @@ static int _timeshift_read
 #endif
 
     /* Incomplete */
-    if (r == 0) {
-      lseek(*fd, *cur_off, SEEK_SET);
+    if (r == 0)
       return 0;
-    }
 
     /* Update */
     *cur_off += r;
 
     /* Special case - EOF */
     if (r == sizeof(size_t) || *cur_off > (*cur_file)->size) {
-      close(*fd);
-      *fd       = -1;
+      _read_close(rd);
       pthread_mutex_lock(&ts->rdwr_mutex);
       *cur_file = timeshift_filemgr_next(*cur_file, NULL, 0);
       pthread_mutex_unlock(&ts->rdwr_mutex);
@@ -386,12 +471,12 @@ static int _timeshift_read
  * Flush all data to live
  */
 static int _timeshift_flush_to_live
-  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off, int *fd,
-    streaming_message_t **sm, int *wait )
+  ( timeshift_t *ts, timeshift_file_t **cur_file, off_t *cur_off,
+    timeshift_read_t *rd, streaming_message_t **sm, int *wait )
 {
   time_t pts = 0;
   while (*cur_file) {
-    if (_timeshift_read(ts, cur_file, cur_off, fd, sm, wait) == -1)
+    if (_timeshift_read(ts, cur_file, cur_off, rd, sm, wait) == -1)
       return -1;
     if (!*sm) break;
     if ((*sm)->sm_type == SMT_PACKET) {
@@ -415,7 +500,7 @@ static int _timeshift_flush_to_live
 void *timeshift_reader ( void *p )
 {
   timeshift_t *ts = p;
-  int nfds, end, fd = -1, run = 1, wait = -1;
+  int nfds, end, run = 1, wait = -1;
   timeshift_file_t *cur_file = NULL;
   off_t cur_off = 0;
   int cur_speed = 100, keyframe_mode = 0;
@@ -427,6 +512,10 @@ void *timeshift_reader ( void *p )
   time_t last_status = 0;
   tvhpoll_t *pd;
   tvhpoll_event_t ev = { 0 };
+  timeshift_read_t rd = { .fd = -1 }, ctl = { .fd = ts->rd_pipe.rd };
+
+  rd.buf      = malloc(TIMESHIFT_READ_BUF);
+  rd.buf_size = TIMESHIFT_READ_BUF;
 
   pd = tvhpoll_create(1);
   ev.fd     = ts->rd_pipe.rd;
@@ -454,7 +543,7 @@ void *timeshift_reader ( void *p )
     /* Control */
     pthread_mutex_lock(&ts->state_mutex);
     if (nfds == 1) {
-      if (_read_msg(ts->rd_pipe.rd, &ctrl) > 0) {
+      if (_read_msg(&ctl, &ctrl) > 0) {
 
         /* Exit */
         if (ctrl->sm_type == SMT_EXIT) {
@@ -695,10 +784,8 @@ void *timeshift_reader ( void *p )
           tvhlog(LOG_DEBUG, "timeshift", "ts %d skip found pkt @ %"PRId64, ts->id, tsi->time);
 
         /* File changed (close) */
-        if ((tsf != cur_file) && (fd != -1)) {
-          close(fd);
-          fd = -1;
-        }
+        if (tsf != cur_file)
+          _read_close(&rd);
 
         /* Position */
         if (cur_file)
@@ -711,7 +798,7 @@ void *timeshift_reader ( void *p )
       }
 
       /* Find packet */
-      if (_timeshift_read(ts, &cur_file, &cur_off, &fd, &sm, &wait) == -1) {
+      if (_timeshift_read(ts, &cur_file, &cur_off, &rd, &sm, &wait) == -1) {
         pthread_mutex_unlock(&ts->state_mutex);
         break;
       }
@@ -782,14 +869,11 @@ void *timeshift_reader ( void *p )
         streaming_target_deliver2(ts->output, ctrl);
 
         /* Flush timeshift buffer to live */
-        if (_timeshift_flush_to_live(ts, &cur_file, &cur_off, &fd, &sm, &wait) == -1)
+        if (_timeshift_flush_to_live(ts, &cur_file, &cur_off, &rd, &sm, &wait) == -1)
           break;
 
         /* Close file (if open) */
-        if (fd != -1) {
-          close(fd);
-          fd = -1;
-        }
+        _read_close(&rd);
 
         /* Flush ALL files */
         if (ts->ondemand)
@@ -823,7 +907,8 @@ void *timeshift_reader ( void *p )
 
   /* Cleanup */
   tvhpoll_destroy(pd);
-  if (fd != -1) close(fd);
+  _read_close(&rd);
+  free(rd.buf);
   if (sm)       streaming_msg_free(sm);
   if (ctrl)     streaming_msg_free(ctrl);
   tvhtrace("timeshift", "ts %d exit reader thread", ts->id);
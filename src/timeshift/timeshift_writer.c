@@ -24,6 +24,7 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
@@ -55,82 +56,146 @@ static ssize_t _write
 }
 
 /*
- * Write message
+ * Write data vector (retry on EAGAIN and short writes)
  */
-static ssize_t _write_msg
-  ( int fd, streaming_message_type_t type, int64_t time,
-    const void *buf, size_t len )
+static ssize_t _writev
+  ( int fd, struct iovec *iov, int iovcnt )
 {
-  size_t len2 = len + sizeof(type) + sizeof(time);
-  ssize_t err, ret;
-  ret = err = _write(fd, &len2, sizeof(len2));
-  if (err < 0) return err;
-  err = _write(fd, &type, sizeof(type));
-  if (err < 0) return err;
-  ret += err;
-  err = _write(fd, &time, sizeof(time));
-  if (err < 0) return err;
-  ret += err;
-  if (len) {
-    err = _write(fd, buf, len);
-    if (err < 0) return err;
-    ret += err;
+  ssize_t r, ret = 0;
+  while (iovcnt > 0) {
+    r = writev(fd, iov, iovcnt);
+    if (r == -1) {
+      if (ERRNO_AGAIN(errno))
+        continue;
+      else
+        return -1;
+    }
+    ret += r;
+    while (iovcnt > 0 && r >= iov->iov_len) {
+      r -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt > 0) {
+      iov->iov_base  = (uint8_t *)iov->iov_base + r;
+      iov->iov_len  -= r;
+    }
   }
   return ret;
 }
 
 /*
- * Write packet buffer
+ * Append data vector to the RAM segment
  */
-static int _write_pktbuf ( int fd, pktbuf_t *pktbuf )
+static ssize_t _write_ram
+  ( timeshift_file_t *tsf, struct iovec *iov, int iovcnt )
 {
-  ssize_t ret, err;
-  if (pktbuf) {
-    ret = err = _write(fd, &pktbuf->pb_size, sizeof(pktbuf->pb_size));
-    if (err < 0) return err;
-    err = _write(fd, pktbuf->pb_data, pktbuf->pb_size);
-    if (err < 0) return err;
-    ret += err;
-  } else {
-    size_t sz = 0;
-    ret = _write(fd, &sz, sizeof(sz));
+  size_t len = 0, alloc;
+  uint8_t *p;
+  int i;
+
+  for (i = 0; i < iovcnt; i++)
+    len += iov[i].iov_len;
+
+  /* Grow in big steps, realloc() can usually just remap the pages */
+  if (tsf->size + len > tsf->ram_size) {
+    alloc = tsf->size + len + TIMESHIFT_RAM_CHUNK - 1;
+    alloc -= alloc % TIMESHIFT_RAM_CHUNK;
+    if ((p = realloc(tsf->ram, alloc)) == NULL)
+      return -1;
+    atomic_add_u64(&timeshift_total_ram_size, alloc - tsf->ram_size);
+    tsf->ram      = p;
+    tsf->ram_size = alloc;
   }
-  return ret;
+
+  p = tsf->ram + tsf->size;
+  for (i = 0; i < iovcnt; i++) {
+    memcpy(p, iov[i].iov_base, iov[i].iov_len);
+    p += iov[i].iov_len;
+  }
+  return len;
+}
+
+/*
+ * Store data vector into the segment (RAM or file)
+ */
+static ssize_t _write_tsf
+  ( timeshift_file_t *tsf, struct iovec *iov, int iovcnt )
+{
+  if (tsf->ram_wr)
+    return _write_ram(tsf, iov, iovcnt);
+  return _writev(tsf->fd, iov, iovcnt);
+}
+
+static inline void _iov_add
+  ( struct iovec *iov, int *iovcnt, const void *buf, size_t len )
+{
+  iov[*iovcnt].iov_base = (void *)buf;
+  iov[*iovcnt].iov_len  = len;
+  (*iovcnt)++;
+}
+
+/*
+ * Write message
+ *
+ * The header, body and (for packets) both packet buffers are gathered
+ * into a single writev() / RAM copy.
+ */
+static ssize_t _write_msg
+  ( int fd, timeshift_file_t *tsf, streaming_message_type_t type,
+    int64_t time, const void *buf, size_t len, th_pkt_t *pkt )
+{
+  size_t len2 = len + sizeof(type) + sizeof(time), zero = 0;
+  struct iovec iov[8];
+  int iovcnt = 0;
+  _iov_add(iov, &iovcnt, &len2, sizeof(len2));
+  _iov_add(iov, &iovcnt, &type, sizeof(type));
+  _iov_add(iov, &iovcnt, &time, sizeof(time));
+  if (len)
+    _iov_add(iov, &iovcnt, buf, len);
+  if (pkt) {
+    if (pkt->pkt_meta) {
+      _iov_add(iov, &iovcnt, &pkt->pkt_meta->pb_size, sizeof(size_t));
+      _iov_add(iov, &iovcnt, pkt->pkt_meta->pb_data, pkt->pkt_meta->pb_size);
+    } else
+      _iov_add(iov, &iovcnt, &zero, sizeof(zero));
+    if (pkt->pkt_payload) {
+      _iov_add(iov, &iovcnt, &pkt->pkt_payload->pb_size, sizeof(size_t));
+      _iov_add(iov, &iovcnt, pkt->pkt_payload->pb_data, pkt->pkt_payload->pb_size);
+    } else
+      _iov_add(iov, &iovcnt, &zero, sizeof(zero));
+  }
+  if (tsf)
+    return _write_tsf(tsf, iov, iovcnt);
+  return _writev(fd, iov, iovcnt);
 }
 
 /*
  * Write signal status
  */
 ssize_t timeshift_write_sigstat
-  ( int fd, int64_t time, signal_status_t *sigstat )
+  ( timeshift_file_t *tsf, int64_t time, signal_status_t *sigstat )
 {
-  return _write_msg(fd, SMT_SIGNAL_STATUS, time, sigstat,
-                    sizeof(signal_status_t));
+  return _write_msg(-1, tsf, SMT_SIGNAL_STATUS, time, sigstat,
+                    sizeof(signal_status_t), NULL);
 }
 
 /*
  * Write packet
  */
-ssize_t timeshift_write_packet ( int fd, int64_t time, th_pkt_t *pkt )
+ssize_t timeshift_write_packet
+  ( timeshift_file_t *tsf, int64_t time, th_pkt_t *pkt )
 {
-  ssize_t ret = 0, err;
-  ret = err = _write_msg(fd, SMT_PACKET, time, pkt, sizeof(th_pkt_t));
-  if (err <= 0) return err;
-  err = _write_pktbuf(fd, pkt->pkt_meta);
-  if (err <= 0) return err;
-  ret += err;
-  err = _write_pktbuf(fd, pkt->pkt_payload);
-  if (err <= 0) return err;
-  ret += err;
-  return ret;
+  return _write_msg(-1, tsf, SMT_PACKET, time, pkt, sizeof(th_pkt_t), pkt);
 }
 
 /*
  * Write MPEGTS data
  */
-ssize_t timeshift_write_mpegts ( int fd, int64_t time, void *data )
+ssize_t timeshift_write_mpegts
+  ( timeshift_file_t *tsf, int64_t time, void *data )
 {
-  return _write_msg(fd, SMT_MPEGTS, time, data, 188);
+  return _write_msg(-1, tsf, SMT_MPEGTS, time, data, 188, NULL);
 }
 
 /*
@@ -138,7 +203,8 @@ ssize_t timeshift_write_mpegts ( int fd, int64_t time, void *data )
  */
 ssize_t timeshift_write_skip ( int fd, streaming_skip_t *skip )
 {
-  return _write_msg(fd, SMT_SKIP, 0, skip, sizeof(streaming_skip_t));
+  return _write_msg(fd, NULL, SMT_SKIP, 0, skip,
+                    sizeof(streaming_skip_t), NULL);
 }
 
 /*
@@ -146,7 +212,7 @@ ssize_t timeshift_write_skip ( int fd, streaming_skip_t *skip )
  */
 ssize_t timeshift_write_speed ( int fd, int speed )
 {
-  return _write_msg(fd, SMT_SPEED, 0, &speed, sizeof(speed));
+  return _write_msg(fd, NULL, SMT_SPEED, 0, &speed, sizeof(speed), NULL);
 }
 
 /*
@@ -154,7 +220,7 @@ ssize_t timeshift_write_speed ( int fd, int speed )
  */
 ssize_t timeshift_write_stop ( int fd, int code )
 {
-  return _write_msg(fd, SMT_STOP, 0, &code, sizeof(code));
+  return _write_msg(fd, NULL, SMT_STOP, 0, &code, sizeof(code), NULL);
 }
 
 /*
@@ -163,16 +229,25 @@ ssize_t timeshift_write_stop ( int fd, int code )
 ssize_t timeshift_write_exit ( int fd )
 {
   int code = 0;
-  return _write_msg(fd, SMT_EXIT, 0, &code, sizeof(code));
+  return _write_msg(fd, NULL, SMT_EXIT, 0, &code, sizeof(code), NULL);
 }
 
 /*
  * Write end of file (special internal message)
  */
-ssize_t timeshift_write_eof ( int fd )
+ssize_t timeshift_write_eof ( timeshift_file_t *tsf )
 {
   size_t sz = 0;
-  return _write(fd, &sz, sizeof(sz));
+  struct iovec iov = { &sz, sizeof(sz) };
+  return _write_tsf(tsf, &iov, 1);
+}
+
+/*
+ * Write out the whole RAM segment (spill to disk)
+ */
+ssize_t timeshift_write_ram ( int fd, timeshift_file_t *tsf )
+{
+  return _write(fd, tsf->ram, tsf->size);
 }
 
 /* **************************************************************************
@@ -200,9 +275,9 @@ static inline ssize_t _process_msg0
       if (SCT_ISVIDEO(ss->ss_components[i].ssc_type))
         ts->vididx = ss->ss_components[i].ssc_index;
   } else if (sm->sm_type == SMT_SIGNAL_STATUS)
-    err = timeshift_write_sigstat(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_sigstat(tsf, sm->sm_time, sm->sm_data);
   else if (sm->sm_type == SMT_PACKET) {
-    err = timeshift_write_packet(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_packet(tsf, sm->sm_time, sm->sm_data);
     if (err > 0) {
       th_pkt_t *pkt = sm->sm_data;
 
@@ -216,7 +291,7 @@ static inline ssize_t _process_msg0
       }
     }
   } else if (sm->sm_type == SMT_MPEGTS)
-    err = timeshift_write_mpegts(tsf->fd, sm->sm_time, sm->sm_data);
+    err = timeshift_write_mpegts(tsf, sm->sm_time, sm->sm_data);
   else
     err = 0;
 
@@ -265,13 +340,16 @@ static void _process_msg
     case SMT_MPEGTS:
     case SMT_PACKET:
       pthread_mutex_lock(&ts->rdwr_mutex);
-      if ((tsf = timeshift_filemgr_get(ts, 1)) && (tsf->fd != -1)) {
+      if ((tsf = timeshift_filemgr_get(ts, 1)) &&
+          (tsf->fd != -1 || tsf->ram_wr)) {
         if ((err = _process_msg0(ts, tsf, &sm)) < 0) {
           timeshift_filemgr_close(tsf);
           tsf->bad = 1;
           ts->full = 1; ///< Stop any more writing
         }
         tsf->refcount--;
+        if (tsf->ram)
+          timeshift_filemgr_ram_check(ts);
       }
       pthread_mutex_unlock(&ts->rdwr_mutex);
       break;
@@ -299,7 +377,7 @@ void *timeshift_writer ( void *aux )
       pthread_cond_wait(&sq->sq_cond, &sq->sq_mutex);
       continue;
     }
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     pthread_mutex_unlock(&sq->sq_mutex);
 
     _process_msg(ts, sm, &run);
@@ -323,7 +401,7 @@ void timeshift_writer_flush ( timeshift_t *ts )
 
   pthread_mutex_lock(&sq->sq_mutex);
   while ((sm = TAILQ_FIRST(&sq->sq_queue))) {
-    TAILQ_REMOVE(&sq->sq_queue, sm, sm_link);
+    streaming_queue_remove(sq, sm);
     _process_msg(ts, sm, NULL);
   }
   pthread_mutex_unlock(&sq->sq_mutex);
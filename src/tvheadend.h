@@ -134,6 +134,34 @@ lock_assert0(pthread_mutex_t *l, const char *file, int line)
 
 #define lock_assert(l) lock_assert0(l, __FILE__, __LINE__)
 
+/*
+ * Lock domains
+ *
+ * Some data sets have a read/write lock of their own besides global_lock.
+ * Writers hold global_lock *and* the domain write lock, so the data can be
+ * read either with global_lock (as before) or with the domain read lock
+ * only, which does not stall the rest of the system. Domain locks are
+ * taken after global_lock and in the order below, the write lock can be
+ * nested (a read lock cannot be upgraded).
+ *
+ * Only the EPG store and the channel tree have a domain: the bulk EPG
+ * work (grabber batches, the periodic database save) is what used to
+ * hold global_lock for seconds. DVR entries, service config and the
+ * idnode trees are still protected by global_lock alone, so their
+ * readers (api_idnode_grid, the HTSP methods, subscription_reschedule)
+ * keep using it.
+ */
+typedef enum {
+  LOCK_GLOBAL = 0,   /* global_lock only */
+  LOCK_EPG,          /* EPG objects and channel schedules */
+  LOCK_CHANNEL,      /* channel tree */
+  LOCK_DOMAIN_COUNT
+} tvh_lock_domain_t;
+
+void tvh_domain_rdlock(tvh_lock_domain_t d);
+void tvh_domain_wrlock(tvh_lock_domain_t d);
+void tvh_domain_unlock(tvh_lock_domain_t d);
+
 
 /*
  * Commercial status
@@ -153,10 +181,12 @@ typedef enum {
 typedef void (gti_callback_t)(void *opaque);
 
 typedef struct gtimer {
-  LIST_ENTRY(gtimer) gti_link;
+  int gti_heap_idx;             /* position in the timer heap while armed */
+  uint32_t gti_seq;             /* arm order, breaks expiry ties */
   gti_callback_t *gti_callback;
   void *gti_opaque;
   struct timespec gti_expire;
+  tvh_lock_domain_t gti_domain; /* callback runs with this read lock only */
 } gtimer_t;
 
 void gtimer_arm(gtimer_t *gti, gti_callback_t *callback, void *opaque,
@@ -482,6 +512,15 @@ typedef struct streaming_target {
 } streaming_target_t;
 
 
+/**
+ * Streaming queue overflow policy
+ */
+typedef enum {
+  SQ_DROP_NEWEST = 0,          /* Drop the incoming message */
+  SQ_DROP_OLDEST_NONKEY,       /* Drop the oldest non I-frame data */
+  SQ_DROP_TO_IFRAME,           /* Drop the oldest data up to the next I-frame */
+} streaming_queue_drop_t;
+
 /**
  *
  */
@@ -492,7 +531,10 @@ typedef struct streaming_queue {
   pthread_mutex_t sq_mutex;    /* Protects sp_queue */
   pthread_cond_t  sq_cond;     /* Condvar for signalling new packets */
 
+  size_t          sq_size;     /* Current queue size (bytes) */
   size_t          sq_maxsize;  /* Max queue size (bytes) */
+  streaming_queue_drop_t sq_drop_policy; /* What to drop on overflow */
+  int             sq_wait_iframe; /* Video is skipped until an I-frame */
   
   struct streaming_message_queue sq_queue;
 
@@ -502,12 +544,15 @@ typedef struct streaming_queue {
 /**
  * Simple dynamically growing buffer
  */
+struct pktbuf_pool;
+
 typedef struct sbuf {
   uint8_t *sb_data;
   int sb_ptr;
   int sb_size;
   unsigned int sb_err  : 1;
   unsigned int sb_bswap: 1;
+  struct pktbuf_pool *sb_pool; // block pool cache of pktbuf_from_sbuf()
 } sbuf_t;
 
 
@@ -620,6 +665,9 @@ void tvh_pipe_close(th_pipe_t *pipe);
 
 int tvh_write(int fd, const void *buf, size_t len);
 
+struct iovec;
+int tvh_writev(int fd, struct iovec *iov, int iovcnt);
+
 FILE *tvh_fopen(const char *filename, const char *mode);
 
 void hexdump(const char *pfx, const uint8_t *data, int len);
@@ -710,6 +758,9 @@ int makedirs ( const char *path, int mode );
 int rmtree ( const char *path );
 
 char *regexp_escape ( const char *str );
+char *regexp_literal ( const char *re );
+int regexp_literal_match ( const char *str, const char *lit );
+int regexp_icase_ascii ( const char *str );
 
 /* URL decoding */
 char to_hex(char code);
@@ -36,22 +36,74 @@ htsmsg_t                *tvhlog_trace;
 pthread_t                tvhlog_tid;
 pthread_mutex_t          tvhlog_mutex;
 pthread_cond_t           tvhlog_cond;
-TAILQ_HEAD(,tvhlog_msg)  tvhlog_queue;
-int                      tvhlog_queue_size;
-int                      tvhlog_queue_full;
 
-#define TVHLOG_QUEUE_MAXSIZE 10000
 #define TVHLOG_THREAD 1
 
+/*
+ * Messages are passed to the log thread through a preallocated byte ring
+ * (bounded MPSC queue of variable length records). Producers reserve
+ * space by advancing the head, fill the record and publish it by setting
+ * its size last. A record never wraps, the rest of the ring is skipped
+ * with a padding record instead. The log thread zeroes consumed records
+ * before advancing the tail, so reserved space always reads as "not yet
+ * written". Producers never lock or allocate, a full ring drops the
+ * message and counts it.
+ */
+#define TVHLOG_RING_SIZE     (512 * 1024) /* bytes, power of two */
+#define TVHLOG_REC_ALIGN     8
+#define TVHLOG_MSG_SIZE      1024
+
 typedef struct tvhlog_msg
 {
-  TAILQ_ENTRY(tvhlog_msg)  link;
-  char                    *msg;
   int                      severity;
   int                      notify;
   struct timeval           time;
+  const char              *msg;
 } tvhlog_msg_t;
 
+typedef struct tvhlog_rec
+{
+  volatile uint32_t        size;     /* 0 = not written yet */
+  int                      severity; /* -1 = padding */
+  int                      notify;
+  struct timeval           time;
+  char                     msg[0];
+} tvhlog_rec_t;
+
+static uint8_t          *tvhlog_ring;
+static volatile uint32_t tvhlog_ring_head;    /* producers */
+static volatile uint32_t tvhlog_ring_tail;    /* log thread */
+static volatile int      tvhlog_dropped;
+static volatile int      tvhlog_sleeping;
+static int               tvhlog_threaded;
+
+/*
+ * Debug/trace filter
+ *
+ * The debug and trace subsystem lists are compiled into a small hash
+ * table of per-subsystem masks whenever they change. tvhlogv() reads
+ * the published table without locking, replaced tables are kept until
+ * tvhlog_end() as a reader might still be using them.
+ */
+#define TVHLOG_MASK_DEBUG    0x01
+#define TVHLOG_MASK_TRACE    0x02
+
+typedef struct tvhlog_subsys_ent {
+  char                    *name;
+  uint32_t                 hash;
+  uint32_t                 mask;
+} tvhlog_subsys_ent_t;
+
+typedef struct tvhlog_subsys_map {
+  struct tvhlog_subsys_map *next;       /* retired list */
+  uint32_t                  all;        /* mask of unlisted subsystems */
+  uint32_t                  size;       /* power of two, 0 = no entries */
+  tvhlog_subsys_ent_t       ent[];
+} tvhlog_subsys_map_t;
+
+static tvhlog_subsys_map_t * volatile tvhlog_subsys_map;
+static tvhlog_subsys_map_t *tvhlog_subsys_retired;
+
 static const char *logtxtmeta[9][2] = {
   {"EMERGENCY", "\033[31m"},
   {"ALERT",     "\033[31m"},
@@ -122,16 +174,145 @@ next:
   free(s);
 }
 
+static inline uint32_t
+tvhlog_subsys_hash ( const char *s )
+{
+  uint32_t h = 2166136261u;
+  while (*s)
+    h = (h ^ (uint8_t)*s++) * 16777619u;
+  return h;
+}
+
+static uint32_t
+tvhlog_subsys_mask_get ( const char *subsys )
+{
+  uint32_t mask = 0, all;
+  all = htsmsg_get_u32_or_default(tvhlog_debug, "all", 0) ? TVHLOG_MASK_DEBUG : 0;
+  if (htsmsg_get_u32_or_default(tvhlog_debug, subsys, all))
+    mask |= TVHLOG_MASK_DEBUG;
+  all = htsmsg_get_u32_or_default(tvhlog_trace, "all", 0) ? TVHLOG_MASK_TRACE : 0;
+  if (htsmsg_get_u32_or_default(tvhlog_trace, subsys, all))
+    mask |= TVHLOG_MASK_TRACE;
+  return mask;
+}
+
+static void
+tvhlog_subsys_add ( tvhlog_subsys_map_t *map, const char *name )
+{
+  uint32_t h = tvhlog_subsys_hash(name), i;
+  for (i = h & (map->size - 1); map->ent[i].name;
+       i = (i + 1) & (map->size - 1))
+    if (!strcmp(map->ent[i].name, name))
+      return;
+  map->ent[i].name = strdup(name);
+  map->ent[i].hash = h;
+  map->ent[i].mask = tvhlog_subsys_mask_get(name);
+}
+
+/* Rebuild and publish the filter table */
+static void
+tvhlog_subsys_compile ( void )
+{
+  tvhlog_subsys_map_t *map;
+  htsmsg_field_t *f;
+  uint32_t n = 0, size = 0;
+
+  if (tvhlog_debug)
+    HTSMSG_FOREACH(f, tvhlog_debug) n++;
+  if (tvhlog_trace)
+    HTSMSG_FOREACH(f, tvhlog_trace) n++;
+  if (n)
+    for (size = 8; size < n * 2; size <<= 1);
+
+  map = calloc(1, sizeof(*map) + size * sizeof(tvhlog_subsys_ent_t));
+  map->size = size;
+  map->all  = (tvhlog_debug && htsmsg_get_u32_or_default(tvhlog_debug, "all", 0) ?
+               TVHLOG_MASK_DEBUG : 0) |
+              (tvhlog_trace && htsmsg_get_u32_or_default(tvhlog_trace, "all", 0) ?
+               TVHLOG_MASK_TRACE : 0);
+  if (tvhlog_debug)
+    HTSMSG_FOREACH(f, tvhlog_debug)
+      if (f->hmf_type == HMF_S64 && strcmp(f->hmf_name, "all"))
+        tvhlog_subsys_add(map, f->hmf_name);
+  if (tvhlog_trace)
+    HTSMSG_FOREACH(f, tvhlog_trace)
+      if (f->hmf_type == HMF_S64 && strcmp(f->hmf_name, "all"))
+        tvhlog_subsys_add(map, f->hmf_name);
+
+  __sync_synchronize();
+  if (tvhlog_subsys_map) {
+    tvhlog_subsys_map->next = tvhlog_subsys_retired;
+    tvhlog_subsys_retired = tvhlog_subsys_map;
+  }
+  tvhlog_subsys_map = map;
+}
+
+static void
+tvhlog_subsys_free ( void )
+{
+  tvhlog_subsys_map_t *map;
+  uint32_t i;
+
+  if (tvhlog_subsys_map) {
+    tvhlog_subsys_map->next = tvhlog_subsys_retired;
+    tvhlog_subsys_retired = tvhlog_subsys_map;
+    tvhlog_subsys_map = NULL;
+  }
+  while ((map = tvhlog_subsys_retired) != NULL) {
+    tvhlog_subsys_retired = map->next;
+    for (i = 0; i < map->size; i++)
+      free(map->ent[i].name);
+    free(map);
+  }
+}
+
+static inline uint32_t
+tvhlog_subsys_lookup ( tvhlog_subsys_map_t *map, const char *subsys )
+{
+  uint32_t h, i;
+
+  if (map->size == 0)
+    return map->all;
+  h = tvhlog_subsys_hash(subsys);
+  for (i = h & (map->size - 1); map->ent[i].name;
+       i = (i + 1) & (map->size - 1))
+    if (map->ent[i].hash == h && !strcmp(map->ent[i].name, subsys))
+      return map->ent[i].mask;
+  return map->all;
+}
+
+/* Is the message wanted? (no locking) */
+static inline int
+tvhlog_accept ( int severity, const char *subsys )
+{
+  tvhlog_subsys_map_t *map;
+  uint32_t mask;
+
+  if (severity < LOG_DEBUG)
+    return 1;
+  if (severity > tvhlog_level)
+    return 0;
+  map = tvhlog_subsys_map;
+  if (map == NULL)
+    return 0;
+  mask = tvhlog_subsys_lookup(map, subsys);
+  if (mask & TVHLOG_MASK_TRACE)
+    return 1;
+  return severity == LOG_DEBUG && (mask & TVHLOG_MASK_DEBUG);
+}
+
 void
 tvhlog_set_debug ( const char *subsys )
 {
   tvhlog_set_subsys(&tvhlog_debug, subsys);
+  tvhlog_subsys_compile();
 }
 
 void
 tvhlog_set_trace ( const char *subsys )
 {
   tvhlog_set_subsys(&tvhlog_trace, subsys);
+  tvhlog_subsys_compile();
 }
 
 void
@@ -208,9 +389,62 @@ tvhlog_process
         fprintf(*fp, "%s [%7s]:%s\n", t, ltxt, msg->msg);
     }
   }
-  
-  free(msg->msg);
-  free(msg);
+}
+
+static void
+tvhlog_ring_release ( tvhlog_rec_t *rec )
+{
+  uint32_t size = rec->size;
+  memset(rec, 0, size);
+  __sync_synchronize();
+  tvhlog_ring_tail += size;
+}
+
+/* Take the next message from the ring (log thread only) */
+static tvhlog_rec_t *
+tvhlog_ring_get ( void )
+{
+  tvhlog_rec_t *rec;
+  while (1) {
+    rec = (tvhlog_rec_t *)(tvhlog_ring +
+                           (tvhlog_ring_tail & (TVHLOG_RING_SIZE - 1)));
+    if (!rec->size)
+      return NULL;
+    __sync_synchronize();
+    if (rec->severity >= 0)
+      return rec;
+    tvhlog_ring_release(rec);
+  }
+}
+
+static void
+tvhlog_process_rec
+  ( tvhlog_rec_t *rec, int options, FILE **fp, const char *path )
+{
+  tvhlog_msg_t msg;
+  msg.severity = rec->severity;
+  msg.notify   = rec->notify;
+  msg.time     = rec->time;
+  msg.msg      = rec->msg;
+  tvhlog_process(&msg, options, fp, path);
+}
+
+/* Report messages dropped on a full ring */
+static void
+tvhlog_process_dropped ( int options, FILE **fp, const char *path )
+{
+  tvhlog_msg_t msg;
+  char buf[64];
+  int dropped = __sync_lock_test_and_set(&tvhlog_dropped, 0);
+  if (dropped <= 0)
+    return;
+  gettimeofday(&msg.time, NULL);
+  msg.severity = LOG_ERR;
+  msg.notify   = 1;
+  msg.msg      = buf;
+  snprintf(buf, sizeof(buf),
+           "log: log buffer full, %d messages dropped", dropped);
+  tvhlog_process(&msg, options, fp, path);
 }
 
 /* Log */
@@ -220,25 +454,26 @@ tvhlog_thread ( void *p )
   int options;
   char *path = NULL, buf[512];
   FILE *fp = NULL;
-  tvhlog_msg_t *msg;
+  tvhlog_rec_t *msg;
 
   pthread_mutex_lock(&tvhlog_mutex);
   while (tvhlog_run) {
 
     /* Wait */
-    if (!(msg = TAILQ_FIRST(&tvhlog_queue))) {
+    if (!(msg = tvhlog_ring_get())) {
       if (fp) {
         fclose(fp); // only issue here is we close with mutex!
                     // but overall performance will be higher
         fp = NULL;
       }
-      pthread_cond_wait(&tvhlog_cond, &tvhlog_mutex);
-      continue;
+      tvhlog_sleeping = 1;
+      __sync_synchronize();
+      if (!tvhlog_ring_get() && !tvhlog_dropped)
+        pthread_cond_wait(&tvhlog_cond, &tvhlog_mutex);
+      tvhlog_sleeping = 0;
+      if (!(msg = tvhlog_ring_get()) && !tvhlog_dropped)
+        continue;
     }
-    TAILQ_REMOVE(&tvhlog_queue, msg, link);
-    tvhlog_queue_size--;
-    if (tvhlog_queue_size < (TVHLOG_QUEUE_MAXSIZE / 2))
-      tvhlog_queue_full = 0;
 
     /* Copy options and path */
     if (!fp) {
@@ -251,7 +486,11 @@ tvhlog_thread ( void *p )
     }
     options  = tvhlog_options; 
     pthread_mutex_unlock(&tvhlog_mutex);
-    tvhlog_process(msg, options, &fp, path);
+    tvhlog_process_dropped(options, &fp, path);
+    if (msg) {
+      tvhlog_process_rec(msg, options, &fp, path);
+      tvhlog_ring_release(msg);
+    }
     pthread_mutex_lock(&tvhlog_mutex);
   }
   if (fp)
@@ -260,55 +499,70 @@ tvhlog_thread ( void *p )
   return NULL;
 }
 
-void tvhlogv ( const char *file, int line,
-               int notify, int severity,
-               const char *subsys, const char *fmt, va_list *args )
+/* Queue a formatted message (no locking unless the log thread sleeps) */
+static void
+tvhlog_ring_put ( int severity, int notify, const char *buf, size_t len )
 {
-  int ok, options;
-  size_t l;
-  char buf[1024];
-
-  pthread_mutex_lock(&tvhlog_mutex);
-
-  /* Check for full */
-  if (tvhlog_queue_full) {
-    pthread_mutex_unlock(&tvhlog_mutex);
-    return;
-  }
-
-  /* Check debug enabled (and cache config) */
-  options = tvhlog_options;
-  if (severity >= LOG_DEBUG) {
-    ok = 0;
-    if (severity <= tvhlog_level) {
-      if (tvhlog_trace) {
-        ok = htsmsg_get_u32_or_default(tvhlog_trace, "all", 0);
-        ok = htsmsg_get_u32_or_default(tvhlog_trace, subsys, ok);
-      }
-      if (!ok && severity == LOG_DEBUG && tvhlog_debug) {
-        ok = htsmsg_get_u32_or_default(tvhlog_debug, "all", 0);
-        ok = htsmsg_get_u32_or_default(tvhlog_debug, subsys, ok);
-      }
+  tvhlog_rec_t *rec;
+  uint32_t pos, off, pad, need;
+
+  if (len >= TVHLOG_MSG_SIZE)
+    len = TVHLOG_MSG_SIZE - 1;
+  need = (sizeof(tvhlog_rec_t) + len + 1 + TVHLOG_REC_ALIGN - 1) &
+         ~(TVHLOG_REC_ALIGN - 1);
+
+  /* Reserve */
+  do {
+    pos = tvhlog_ring_head;
+    off = pos & (TVHLOG_RING_SIZE - 1);
+    pad = off + need > TVHLOG_RING_SIZE ? TVHLOG_RING_SIZE - off : 0;
+    if (pos + pad + need - tvhlog_ring_tail > TVHLOG_RING_SIZE) {
+      __sync_fetch_and_add(&tvhlog_dropped, 1);
+      goto wake;
     }
-  } else {
-    ok = 1;
+  } while (!__sync_bool_compare_and_swap(&tvhlog_ring_head, pos,
+                                         pos + pad + need));
+
+  /* Skip the end of the ring */
+  if (pad) {
+    rec = (tvhlog_rec_t *)(tvhlog_ring + off);
+    rec->severity = -1;
+    __sync_synchronize();
+    rec->size = pad;
   }
 
-  /* Ignore */
-  if (!ok) {
+  rec = (tvhlog_rec_t *)(tvhlog_ring + ((pos + pad) & (TVHLOG_RING_SIZE - 1)));
+  gettimeofday(&rec->time, NULL);
+  rec->severity = severity;
+  rec->notify   = notify;
+  memcpy(rec->msg, buf, len);
+  rec->msg[len] = '\0';
+  __sync_synchronize();
+  rec->size = need;
+
+wake:
+  __sync_synchronize();
+  if (tvhlog_sleeping) {
+    pthread_mutex_lock(&tvhlog_mutex);
+    pthread_cond_signal(&tvhlog_cond);
     pthread_mutex_unlock(&tvhlog_mutex);
-    return;
   }
+}
 
-  /* FULL */
-  if (tvhlog_queue_size == TVHLOG_QUEUE_MAXSIZE) {
-    tvhlog_queue_full = 1;
-    fmt      = "log buffer full";
-    args     = NULL;
-    severity = LOG_ERR;
-  }
+void tvhlogv ( const char *file, int line,
+               int notify, int severity,
+               const char *subsys, const char *fmt, va_list *args )
+{
+  int options;
+  size_t l;
+  char buf[TVHLOG_MSG_SIZE];
+
+  /* Check debug enabled */
+  if (!tvhlog_accept(severity, subsys))
+    return;
 
   /* Basic message */
+  options = tvhlog_options;
   l = 0;
   if (options & TVHLOG_OPT_THREAD) {
     l += snprintf(buf + l, sizeof(buf) - l, "tid %ld: ", (long)pthread_self());
@@ -316,31 +570,32 @@ void tvhlogv ( const char *file, int line,
   l += snprintf(buf + l, sizeof(buf) - l, "%s: ", subsys);
   if (options & TVHLOG_OPT_FILELINE && severity >= LOG_DEBUG)
     l += snprintf(buf + l, sizeof(buf) - l, "(%s:%d) ", file, line);
-  if (args)
-    l += vsnprintf(buf + l, sizeof(buf) - l, fmt, *args);
-  else
-    l += snprintf(buf + l, sizeof(buf) - l, "%s", fmt);
+  if (l < sizeof(buf)) {
+    if (args)
+      l += vsnprintf(buf + l, sizeof(buf) - l, fmt, *args);
+    else
+      l += snprintf(buf + l, sizeof(buf) - l, "%s", fmt);
+  }
 
   /* Store */
-  tvhlog_msg_t *msg = calloc(1, sizeof(tvhlog_msg_t));
-  gettimeofday(&msg->time, NULL);
-  msg->msg      = strdup(buf);
-  msg->severity = severity;
-  msg->notify   = notify;
 #if TVHLOG_THREAD
-  if (tvhlog_run) {
-    TAILQ_INSERT_TAIL(&tvhlog_queue, msg, link);
-    tvhlog_queue_size++;
-    pthread_cond_signal(&tvhlog_cond);
-  } else {
+  if (tvhlog_threaded) {
+    tvhlog_ring_put(severity, notify, buf, l);
+    return;
+  }
 #endif
+  {
+    tvhlog_msg_t msg;
     FILE *fp = NULL;
-    tvhlog_process(msg, tvhlog_options, &fp, tvhlog_path);
+    msg.msg      = buf;
+    msg.severity = severity;
+    msg.notify   = notify;
+    gettimeofday(&msg.time, NULL);
+    pthread_mutex_lock(&tvhlog_mutex);
+    tvhlog_process(&msg, tvhlog_options, &fp, tvhlog_path);
+    pthread_mutex_unlock(&tvhlog_mutex);
     if (fp) fclose(fp);
-#if TVHLOG_THREAD
   }
-#endif
-  pthread_mutex_unlock(&tvhlog_mutex);
 }
 
 
@@ -367,14 +622,11 @@ _tvhlog_hexdump(const char *file, int line,
                 const char *subsys,
                 const uint8_t *data, ssize_t len )
 {
-  int i, c, skip;
+  int i, c;
   char str[1024];
 
   /* Don't process if trace is OFF */
-  pthread_mutex_lock(&tvhlog_mutex);
-  skip = (severity > tvhlog_level);
-  pthread_mutex_unlock(&tvhlog_mutex);
-  if (skip) return;
+  if (!tvhlog_accept(severity, subsys)) return;
  
   /* Build and log output */
   while (len > 0) {
@@ -417,12 +669,15 @@ tvhlog_init ( int level, int options, const char *path )
   openlog("tvheadend", LOG_PID, LOG_DAEMON);
   pthread_mutex_init(&tvhlog_mutex, NULL);
   pthread_cond_init(&tvhlog_cond, NULL);
-  TAILQ_INIT(&tvhlog_queue);
+  tvhlog_subsys_compile();
 }
 
 void
 tvhlog_start ( void )
 {
+  tvhlog_ring = calloc(1, TVHLOG_RING_SIZE);
+  tvhlog_ring_head = tvhlog_ring_tail = 0;
+  tvhlog_threaded = 1;
   tvhthread_create(&tvhlog_tid, NULL, tvhlog_thread, NULL);
 }
 
@@ -430,23 +685,30 @@ void
 tvhlog_end ( void )
 {
   FILE *fp = NULL;
-  tvhlog_msg_t *msg;
+  tvhlog_rec_t *msg;
   pthread_mutex_lock(&tvhlog_mutex);
   tvhlog_run = 0;
   pthread_cond_signal(&tvhlog_cond);
   pthread_mutex_unlock(&tvhlog_mutex);
   pthread_join(tvhlog_tid, NULL);
+  /* Flush the ring, later messages are written synchronously */
   pthread_mutex_lock(&tvhlog_mutex);
-  while ((msg = TAILQ_FIRST(&tvhlog_queue)) != NULL) {
-    TAILQ_REMOVE(&tvhlog_queue, msg, link);
-    tvhlog_process(msg, tvhlog_options, &fp, tvhlog_path);
+  tvhlog_threaded = 0;
+  __sync_synchronize();
+  while ((msg = tvhlog_ring_get()) != NULL) {
+    tvhlog_process_rec(msg, tvhlog_options, &fp, tvhlog_path);
+    tvhlog_ring_release(msg);
   }
-  tvhlog_queue_full = 1;
+  tvhlog_process_dropped(tvhlog_options, &fp, tvhlog_path);
+  free(tvhlog_ring);
+  tvhlog_ring = NULL;
+  free(tvhlog_path);
+  tvhlog_path = NULL;
   pthread_mutex_unlock(&tvhlog_mutex);
   if (fp)
     fclose(fp);
-  free(tvhlog_path);
   htsmsg_destroy(tvhlog_debug);
   htsmsg_destroy(tvhlog_trace);
+  tvhlog_subsys_free();
   closelog();
 }
@@ -28,6 +28,12 @@
 #include <ctype.h>
 #include "tvheadend.h"
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <immintrin.h>
+#define TVH_CRC32_CLMUL 1
+#endif
+
 #if defined(PLATFORM_DARWIN)
 #include <machine/endian.h>
 #elif defined(PLATFORM_FREEBSD)
@@ -100,8 +106,17 @@ static uint32_t crc_tab[256] = {
   0xbcb4666d, 0xb8757bda, 0xb5365d03, 0xb1f740b4
 };
 
-uint32_t
-tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
+static uint32_t crc_tab8[8][256];
+
+static uint32_t tvh_crc32_bytes(const uint8_t *, size_t, uint32_t);
+static uint32_t (*tvh_crc32_fn)(const uint8_t *, size_t, uint32_t) =
+  tvh_crc32_bytes;
+
+/**
+ * Byte at a time
+ */
+static uint32_t
+tvh_crc32_bytes(const uint8_t *data, size_t datalen, uint32_t crc)
 {
   while(datalen--)
     crc = (crc << 8) ^ crc_tab[((crc >> 24) ^ *data++) & 0xff];
@@ -109,6 +124,129 @@ tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
   return crc;
 }
 
+/**
+ * Slicing-by-8, crc_tab8[k][b] is the crc of byte b followed
+ * by k zero bytes
+ */
+static void
+tvh_crc32_tab8(void)
+{
+  uint32_t c;
+  int i, k;
+
+  for (i = 0; i < 256; i++) {
+    c = crc_tab8[0][i] = crc_tab[i];
+    for (k = 1; k < 8; k++) {
+      c = (c << 8) ^ crc_tab[c >> 24];
+      crc_tab8[k][i] = c;
+    }
+  }
+}
+
+static uint32_t
+tvh_crc32_slice8(const uint8_t *data, size_t datalen, uint32_t crc)
+{
+  uint32_t a;
+
+  for ( ; datalen >= 8; data += 8, datalen -= 8) {
+    a = crc ^ ((uint32_t)data[0] << 24 | data[1] << 16 | data[2] << 8 | data[3]);
+    crc = crc_tab8[7][a >> 24] ^
+          crc_tab8[6][(a >> 16) & 0xff] ^
+          crc_tab8[5][(a >> 8) & 0xff] ^
+          crc_tab8[4][a & 0xff] ^
+          crc_tab8[3][data[4]] ^
+          crc_tab8[2][data[5]] ^
+          crc_tab8[1][data[6]] ^
+          crc_tab8[0][data[7]];
+  }
+  return tvh_crc32_bytes(data, datalen, crc);
+}
+
+#if TVH_CRC32_CLMUL
+/**
+ * Carry-less multiplication folding
+ *
+ * The data are kept as big endian 128 bit polynomials, so the bit
+ * order matches the MSB first MPEG-2 CRC. A 128 bit block X = H*x^64 + L
+ * which is followed by n more bits is equal (mod P) to
+ * H*(x^(n+64) mod P) + L*(x^n mod P). The folded remainder is finally
+ * fed through the table code with the trailing bytes.
+ */
+__attribute__((target("pclmul,ssse3")))
+static inline __m128i
+tvh_crc32_fold(__m128i x, __m128i k, __m128i y)
+{
+  return _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x11),
+                                     _mm_clmulepi64_si128(x, k, 0x00)), y);
+}
+
+__attribute__((target("pclmul,ssse3")))
+static uint32_t
+tvh_crc32_clmul(const uint8_t *data, size_t datalen, uint32_t crc)
+{
+  const __m128i bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                                     8, 9, 10, 11, 12, 13, 14, 15);
+  /* { x^128 mod P, x^192 mod P }, { x^512 mod P, x^576 mod P } */
+  const __m128i k1 = _mm_set_epi64x(0xc5b9cd4c, 0xe8a45605);
+  const __m128i k4 = _mm_set_epi64x(0x8833794c, 0xe6228b11);
+  __m128i x0, x1, x2, x3;
+  uint8_t buf[16];
+
+  if (datalen < 64)
+    return tvh_crc32_slice8(data, datalen, crc);
+
+#define LOAD(p) _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(p)), bswap)
+  x0 = _mm_xor_si128(LOAD(data), _mm_set_epi32(crc, 0, 0, 0));
+  x1 = LOAD(data + 16);
+  x2 = LOAD(data + 32);
+  x3 = LOAD(data + 48);
+  data += 64;
+  datalen -= 64;
+
+  for ( ; datalen >= 64; data += 64, datalen -= 64) {
+    x0 = tvh_crc32_fold(x0, k4, LOAD(data));
+    x1 = tvh_crc32_fold(x1, k4, LOAD(data + 16));
+    x2 = tvh_crc32_fold(x2, k4, LOAD(data + 32));
+    x3 = tvh_crc32_fold(x3, k4, LOAD(data + 48));
+  }
+
+  x0 = tvh_crc32_fold(x0, k1, x1);
+  x0 = tvh_crc32_fold(x0, k1, x2);
+  x0 = tvh_crc32_fold(x0, k1, x3);
+
+  for ( ; datalen >= 16; data += 16, datalen -= 16)
+    x0 = tvh_crc32_fold(x0, k1, LOAD(data));
+#undef LOAD
+
+  _mm_storeu_si128((__m128i *)buf, _mm_shuffle_epi8(x0, bswap));
+  crc = tvh_crc32_slice8(buf, sizeof(buf), 0);
+  return tvh_crc32_slice8(data, datalen, crc);
+}
+#endif
+
+/**
+ * Pick the fastest implementation, done at load time so the tables
+ * are ready before any thread is started
+ */
+static void __attribute__((constructor))
+tvh_crc32_init(void)
+{
+  tvh_crc32_tab8();
+  tvh_crc32_fn = tvh_crc32_slice8;
+#if TVH_CRC32_CLMUL
+  unsigned int eax, ebx, ecx, edx;
+  if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+      (ecx & bit_PCLMUL) && (ecx & bit_SSSE3))
+    tvh_crc32_fn = tvh_crc32_clmul;
+#endif
+}
+
+uint32_t
+tvh_crc32(const uint8_t *data, size_t datalen, uint32_t crc)
+{
+  return tvh_crc32_fn(data, datalen, crc);
+}
+
 
 /**
  *
@@ -337,6 +475,7 @@ sbuf_free(sbuf_t *sb)
   free(sb->sb_data);
   sb->sb_size = sb->sb_ptr = sb->sb_err = 0;
   sb->sb_data = NULL;
+  sb->sb_pool = NULL;
 }
 
 void
@@ -590,6 +729,137 @@ regexp_escape(const char* str)
   return tmp;
 }
 
+static inline int
+regexp_lower(int c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+/*
+ * REG_ICASE folds a few non-ASCII characters onto ASCII letters in UTF-8
+ * locales (KELVIN SIGN, LATIN SMALL LETTER LONG S, dotted/dotless I); plain
+ * ASCII literal tests can't be trusted for strings containing them, zero
+ * is returned for such strings
+ */
+int
+regexp_icase_ascii(const char *s)
+{
+  return !strstr(s, "\xe2\x84\xaa") && !strstr(s, "\xc5\xbf") &&
+         !strstr(s, "\xc4\xb0") && !strstr(s, "\xc4\xb1");
+}
+
+/*
+ * Zero only when 's' can't match a regex whose literal (see regexp_literal())
+ * is 'lit'
+ */
+int
+regexp_literal_match(const char *s, const char *lit)
+{
+  const char *a, *b;
+
+  if (!regexp_icase_ascii(s))
+    return 1;
+  for ( ; *s; s++) {
+    for (a = s, b = lit; *b && regexp_lower((uint8_t)*a) == *b; a++, b++);
+    if (*b == '\0')
+      return 1;
+  }
+  return 0;
+}
+
+/*
+ * Longest ASCII literal every string matched by the extended regex 're'
+ * (REG_ICASE) must contain, lower cased, or NULL. Conservative: alternation,
+ * groups, bracket expressions, escapes with special meaning and quantified
+ * atoms end a run.
+ */
+char *
+regexp_literal(const char *re)
+{
+  char run[128], best[128];
+  size_t rlen = 0, blen = 0;
+  int depth = 0, lit, opt, more;
+  const char *p = re;
+  uint8_t c;
+
+  if (strchr(re, '|'))
+    return NULL;
+  while ((c = *p++) != '\0') {
+    lit = 0;
+    switch (c) {
+    case '{':
+      if ((p = strchr(p, '}')) == NULL)
+        return NULL;
+      p++;
+      break;
+    case '*':
+    case '?':
+    case '+':
+    case '.':
+    case '^':
+    case '$':
+      break;
+    case '(':
+      depth++;
+      break;
+    case ')':
+      if (depth == 0)
+        return NULL;
+      depth--;
+      break;
+    case '[':
+      if (*p == '^') p++;
+      if (*p == ']') p++;
+      while (*p && *p != ']') {
+        if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+          const char *e = p + 2;
+          while (*e && !(e[0] == p[1] && e[1] == ']')) e++;
+          if (*e == '\0')
+            return NULL;
+          p = e + 1;
+        }
+        p++;
+      }
+      if (*p++ != ']')
+        return NULL;
+      break;
+    case '\\':
+      if ((c = *p++) == '\0')
+        return NULL;
+      lit = !isalnum(c) && c != '<' && c != '>' && c != '`' && c != '\'';
+      break;
+    default:
+      lit = 1;
+      break;
+    }
+    if (lit && depth == 0 && c < 0x80 && rlen < sizeof(run) - 1) {
+      /* only a run of '+' keeps the atom required, nothing may follow it */
+      for (opt = more = 0; *p == '*' || *p == '?' || *p == '+' || *p == '{';
+           p++, more = 1) {
+        if (*p != '+')
+          opt = 1;
+        if (*p == '{' && (p = strchr(p, '}')) == NULL)
+          return NULL;
+      }
+      if (!opt)
+        run[rlen++] = regexp_lower(c);
+      if (!more)
+        continue;
+    }
+    if (rlen > blen)
+      memcpy(best, run, blen = rlen);
+    rlen = 0;
+  }
+  if (depth)
+    return NULL;
+  if (rlen > blen)
+    memcpy(best, run, blen = rlen);
+  if (blen < 3)
+    return NULL;
+  best[blen] = '\0';
+  return strdup(best);
+}
+
 /* Converts an integer value to its hex character
    http://www.geekhideout.com/urlcode.shtml */
 char to_hex(char code) {
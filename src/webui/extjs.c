@@ -47,6 +47,7 @@
 #include "timeshift.h"
 #include "tvhtime.h"
 #include "input.h"
+#include "descrambler/caclient.h"
 
 /**
  *
@@ -324,6 +325,7 @@ extjs_epggrab(http_connection_t *hc, const char *remain, void *opaque)
     htsmsg_add_u32(r, "channel_renumber", epggrab_channel_renumber);
     htsmsg_add_u32(r, "channel_reicon", epggrab_channel_reicon);
     htsmsg_add_u32(r, "epgdb_periodicsave", epggrab_epgdb_periodicsave / 3600);
+    htsmsg_add_u32(r, "epgdb_journal", epggrab_epgdb_journal);
     htsmsg_add_str(r, "ota_cron", epggrab_ota_cron ? epggrab_ota_cron : "");
     htsmsg_add_u32(r, "ota_timeout", epggrab_ota_timeout);
     htsmsg_add_u32(r, "ota_initial", epggrab_ota_initial);
@@ -359,6 +361,8 @@ extjs_epggrab(http_connection_t *hc, const char *remain, void *opaque)
       save |= epggrab_ota_set_timeout(atoi(str));
     str = http_arg_get(&hc->hc_req_args, "ota_initial");
     save |= epggrab_ota_set_initial(str ? 1 : 0);
+    str = http_arg_get(&hc->hc_req_args, "epgdb_journal");
+    save |= epggrab_set_epgdb_journal(str ? 1 : 0);
     if ( (str = http_arg_get(&hc->hc_req_args, "epgdb_periodicsave")) )
       save |= epggrab_set_periodicsave(atoi(str) * 3600);
     if ( (str = http_arg_get(&hc->hc_req_args, "module")) )
@@ -497,7 +501,7 @@ extjs_config(http_connection_t *hc, const char *remain, void *opaque)
 
   /* Save settings */
   } else if (!strcmp(op, "saveSettings") ) {
-    int save = 0;
+    int save = 0, csa = 0;
 
     /* Misc settings */
     pthread_mutex_lock(&global_lock);
@@ -511,8 +515,17 @@ extjs_config(http_connection_t *hc, const char *remain, void *opaque)
       save |= config_set_chicon_path(str);
     if ((str = http_arg_get(&hc->hc_req_args, "piconpath")))
       save |= config_set_picon_path(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "htsp_write_budget")))
+      save |= config_set_htsp_write_budget(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "csa_threads")))
+      csa |= config_set_csa_threads(str);
+    if ((str = http_arg_get(&hc->hc_req_args, "csa_batch")))
+      csa |= config_set_csa_batch(str);
+    save |= csa;
     if (save)
       config_save();
+    if (csa)
+      caclient_csa_update();
 
     /* Time */
     str = http_arg_get(&hc->hc_req_args, "tvhtime_update_enabled");
@@ -677,6 +690,7 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     htsmsg_add_u32(m, "timeshift_max_period", timeshift_max_period / 60);
     htsmsg_add_u32(m, "timeshift_unlimited_size", timeshift_unlimited_size);
     htsmsg_add_u32(m, "timeshift_max_size", timeshift_max_size / 1048576);
+    htsmsg_add_u32(m, "timeshift_ram_size", timeshift_ram_size / 1048576);
     pthread_mutex_unlock(&global_lock);
     out = json_single_record(m, "config");
 
@@ -696,6 +710,8 @@ extjs_timeshift(http_connection_t *hc, const char *remain, void *opaque)
     timeshift_unlimited_size = http_arg_get(&hc->hc_req_args, "timeshift_unlimited_size") ? 1 : 0;
     if ((str = http_arg_get(&hc->hc_req_args, "timeshift_max_size")))
       timeshift_max_size   = atol(str) * 1048576LL;
+    if ((str = http_arg_get(&hc->hc_req_args, "timeshift_ram_size")))
+      timeshift_ram_size   = atol(str) * 1048576LL;
     timeshift_save();
     pthread_mutex_unlock(&global_lock);
 
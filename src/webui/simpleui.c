@@ -187,6 +187,7 @@ page_simple(http_connection_t *hc,
 
     memset(&eq, 0, sizeof(eq));
     eq.lang = strdup(lang);
+    eq.limit = 25;
 
     //Note: force min/max durations for this interface to 0 and INT_MAX seconds respectively
     epg_query(&eq, hc->hc_access);
@@ -46,7 +46,9 @@ tvheadend.miscconf = function(panel, index) {
         'tvhtime_tolerance',
         'prefer_picon',
         'chiconpath',
-        'piconpath'
+        'piconpath',
+        'htsp_write_budget',
+        'csa_threads', 'csa_batch'
     ]);
 
     /* ****************************************************************
@@ -159,6 +161,64 @@ tvheadend.miscconf = function(panel, index) {
         items: [preferPicon, chiconPath, piconPath]
     });
 
+    /*
+    * HTSP
+    */
+
+    var htspWriteBudget = new Ext.form.NumberField({
+        name: 'htsp_write_budget',
+        fieldLabel: 'Write budget per wakeup (kB)',
+        allowNegative: false,
+        allowDecimals: false,
+        minValue: 1,
+        maxValue: 4096
+    });
+
+    var htspPanel = new Ext.form.FieldSet({
+        title: 'HTSP',
+        width: 700,
+        autoHeight: true,
+        collapsible: true,
+        animCollapse: true,
+        items: [htspWriteBudget]
+    });
+
+    /*
+    * Descrambling
+    */
+
+    var csaThreads = new Ext.form.NumberField({
+        name: 'csa_threads',
+        fieldLabel: 'Descrambling threads',
+        allowNegative: false,
+        allowDecimals: false,
+        minValue: 0,
+        maxValue: 64
+    });
+
+    var csaBatch = new Ext.form.NumberField({
+        name: 'csa_batch',
+        fieldLabel: 'Descrambling batch size (packets)',
+        allowNegative: false,
+        allowDecimals: false,
+        minValue: 0,
+        maxValue: 4096
+    });
+
+    var csaPanel = new Ext.form.FieldSet({
+        title: 'Descrambling',
+        width: 700,
+        autoHeight: true,
+        collapsible: true,
+        animCollapse: true,
+        items: [csaThreads, csaBatch]
+    });
+
+    var confitems = [languageWrap, dvbscanWrap, tvhtimePanel, piconPanel,
+        htspPanel];
+    if (tvheadend.capabilities.indexOf('caclient') !== -1)
+        confitems.push(csaPanel);
+
     /*
     * Image cache
     */
@@ -251,7 +311,7 @@ tvheadend.miscconf = function(panel, index) {
         layout: 'form',
         defaultType: 'textfield',
         autoHeight: true,
-        items: [languageWrap, dvbscanWrap, tvhtimePanel, piconPanel]
+        items: confitems
     });
 
     var _items = [confpanel];
@@ -83,7 +83,7 @@ tvheadend.epggrab = function(panel, index) {
     var confreader = new Ext.data.JsonReader({
         root: 'epggrabSettings'
     }, ['module', 'cron', 'channel_rename', 'channel_renumber',
-        'channel_reicon', 'epgdb_periodicsave',
+        'channel_reicon', 'epgdb_periodicsave', 'epgdb_journal',
         'ota_cron', 'ota_timeout', 'ota_initial']);
 
     /* ****************************************************************
@@ -144,6 +144,11 @@ tvheadend.epggrab = function(panel, index) {
         name: 'epgdb_periodicsave'
     });
 
+    var epgJournal = new Ext.form.Checkbox({
+        name: 'epgdb_journal',
+        fieldLabel: 'Journalled EPG database'
+    });
+
     /*
      * Simple fields
      */
@@ -152,7 +157,8 @@ tvheadend.epggrab = function(panel, index) {
         width: 700,
         autoHeight: true,
         collapsible: true,
-        items: [channelRename, channelRenumber, channelReicon, epgPeriodicSave]
+        items: [channelRename, channelRenumber, channelReicon, epgPeriodicSave,
+                epgJournal]
     });
 
     /*
@@ -214,6 +214,8 @@ tvheadend.status_streams = function(panel, index)
         r.data.unc = m.unc;
         r.data.snr = m.snr;
         r.data.bps = m.bps;
+        r.data.bps_p50 = m.bps_p50;
+        r.data.bps_p95 = m.bps_p95;
         r.data.cc = m.cc;
         r.data.te = m.te;
         r.data.signal_scale = m.signal_scale;
@@ -246,6 +248,8 @@ tvheadend.status_streams = function(panel, index)
                 { name: 'unc' },
                 { name: 'snr' },
                 { name: 'bps' },
+                { name: 'bps_p50' },
+                { name: 'bps_p95' },
                 { name: 'cc' },
                 { name: 'te' },
                 { name: 'signal_scale' },
@@ -269,6 +273,10 @@ tvheadend.status_streams = function(panel, index)
             return '<span class="x-linked">&nbsp;</span>' + txt;
         }
 
+        function renderBwStat(value) {
+            return parseInt(value / 1024);
+        }
+
         function renderBer(value, item, store) {
             if (store.data.tc_bit == 0)
               return value; // fallback (driver/vendor dependent ber)
@@ -315,6 +323,20 @@ tvheadend.status_streams = function(panel, index)
                 renderer: renderBw,
                 listeners: { click: { fn: clicked } }
             },
+            {
+                width: 50,
+                header: "Median Bandwidth (kb/s)",
+                dataIndex: 'bps_p50',
+                renderer: renderBwStat,
+                hidden: true
+            },
+            {
+                width: 50,
+                header: "95% Bandwidth (kb/s)",
+                dataIndex: 'bps_p95',
+                renderer: renderBwStat,
+                hidden: true
+            },
             {
                 width: 50,
                 header: "BER",
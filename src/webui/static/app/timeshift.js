@@ -12,7 +12,8 @@ tvheadend.timeshift = function(panel, index) {
         'timeshift_enabled', 'timeshift_ondemand',
         'timeshift_path',
         'timeshift_unlimited_period', 'timeshift_max_period',
-        'timeshift_unlimited_size', 'timeshift_max_size'
+        'timeshift_unlimited_size', 'timeshift_max_size',
+        'timeshift_ram_size'
     ]
             );
 
@@ -65,6 +66,13 @@ tvheadend.timeshift = function(panel, index) {
         width: 300
     });
 
+    var timeshiftRamSize = new Ext.form.NumberField({
+        fieldLabel: 'Max. RAM Size (MB)',
+        name: 'timeshift_ram_size',
+        allowBlank: false,
+        width: 300
+    });
+
     /* ****************************************************************
      * Events
      * ***************************************************************/
@@ -120,6 +128,7 @@ tvheadend.timeshift = function(panel, index) {
             timeshiftEnabled, 
             timeshiftOndemand, 
             timeshiftPath,
+            timeshiftRamSize,
             {
                 layout: 'column', 
                 border: false,
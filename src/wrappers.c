@@ -3,6 +3,7 @@
 #include <fcntl.h>
 #include <sys/types.h>          /* See NOTES */
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <signal.h>
 #include <pthread.h>
@@ -89,6 +90,37 @@ tvh_write(int fd, const void *buf, size_t len)
   return len ? 1 : 0;
 }
 
+/*
+ * Note: iov is modified on short writes
+ */
+int
+tvh_writev(int fd, struct iovec *iov, int iovcnt)
+{
+  ssize_t c;
+
+  while (iovcnt > 0) {
+    c = writev(fd, iov, iovcnt > IOV_MAX ? IOV_MAX : iovcnt);
+    if (c < 0) {
+      if (ERRNO_AGAIN(errno)) {
+        usleep(100);
+        continue;
+      }
+      break;
+    }
+    while (iovcnt > 0 && c >= iov->iov_len) {
+      c -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (c > 0) {
+      iov->iov_base += c;
+      iov->iov_len  -= c;
+    }
+  }
+
+  return iovcnt > 0 ? 1 : 0;
+}
+
 FILE *
 tvh_fopen(const char *filename, const char *mode)
 {
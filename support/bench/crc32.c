@@ -0,0 +1,135 @@
+/*
+ *  tvh_crc32() micro benchmark
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Checks that all tvh_crc32() implementations agree and measures their
+ * throughput. The static variants are reached by including utils.c.
+ *
+ *   make bench && build.linux/bench/crc32 [MB per run]
+ */
+
+#include "utils.c"
+
+#include <stdio.h>
+#include <time.h>
+
+void
+_tvhlog ( const char *file, int line, int notify, int severity,
+          const char *subsys, const char *fmt, ... )
+{
+}
+
+typedef uint32_t (*crc_fn_t)(const uint8_t *, size_t, uint32_t);
+
+static const struct {
+  const char *name;
+  crc_fn_t    fn;
+  int         clmul;
+} variants[] = {
+  { "bytes",  tvh_crc32_bytes,  0 },
+  { "slice8", tvh_crc32_slice8, 0 },
+#if TVH_CRC32_CLMUL
+  { "clmul",  tvh_crc32_clmul,  1 },
+#endif
+};
+
+#define NVARIANTS (sizeof(variants) / sizeof(variants[0]))
+#define DATALEN   (1 << 20)
+
+static double
+now ( void )
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+has_clmul ( void )
+{
+#if TVH_CRC32_CLMUL
+  unsigned int eax, ebx, ecx, edx;
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+         (ecx & bit_PCLMUL) && (ecx & bit_SSSE3);
+#else
+  return 0;
+#endif
+}
+
+int
+main ( int argc, char **argv )
+{
+  static const int sizes[] = { 184, 1024, 4096 };
+  uint8_t *data;
+  uint32_t c, a, b;
+  size_t i, k, len, off;
+  long total, mb = argc > 1 ? atol(argv[1]) : 400;
+  volatile uint32_t sink = 0;
+  double t;
+  int clmul = has_clmul(), bad = 0, s;
+
+  data = malloc(DATALEN);
+  srand(5);
+  for (i = 0; i < DATALEN; i++)
+    data[i] = rand();
+
+  /* Equivalence, random lengths, alignments and initial values */
+  for (i = 0; i < 20000; i++) {
+    len = rand() % 5000;
+    off = rand() % 16;
+    c   = rand();
+    a   = tvh_crc32_bytes(data + off, len, c);
+    for (k = 1; k < NVARIANTS; k++) {
+      if (variants[k].clmul && !clmul) continue;
+      b = variants[k].fn(data + off, len, c);
+      if (a != b) {
+        printf("%s: len %zu off %zu crc %08x: %08x != %08x\n",
+               variants[k].name, len, off, c, b, a);
+        bad++;
+      }
+    }
+  }
+
+  /* MPEG-2 check value */
+  c = tvh_crc32((const uint8_t *)"123456789", 9, 0xffffffff);
+  if (c != 0x0376e6e7) {
+    printf("check value %08x != 0376e6e7\n", c);
+    bad++;
+  }
+  printf("equivalence: %d mismatches%s\n", bad,
+         clmul ? "" : " (no PCLMULQDQ, clmul skipped)");
+
+  /* Throughput */
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+    len = sizes[s];
+    for (k = 0; k < NVARIANTS; k++) {
+      if (variants[k].clmul && !clmul) continue;
+      total = 0;
+      t = now();
+      while (total < (mb << 20)) {
+        for (off = 0; off + len <= DATALEN; off += len)
+          sink ^= variants[k].fn(data + off, len, 0xffffffff);
+        total += DATALEN / len * len;
+      }
+      printf("%5zu bytes %-6s %8.0f MB/s\n", len, variants[k].name,
+             total / (now() - t) / 1e6);
+    }
+  }
+
+  free(data);
+  return bad ? 1 : 0;
+}
@@ -0,0 +1,443 @@
+/*
+ *  Huffman decoder equivalence check and micro benchmark
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Compares the table driven OpenTV (huffman.c) and Freesat decoders
+ * with bit at a time reference decoders on random and encoded input,
+ * then measures the throughput of both.
+ *
+ *   make bench && build.linux/bench/huffman [opentv dict ...]
+ *
+ * The OpenTV dictionaries default to data/conf/epggrab/opentv/dict.
+ */
+
+#include "src/huffman.c"
+#include "src/epggrab/support/freesat_huffman.c"
+#include "htsmsg_json.h"
+
+#include <time.h>
+
+void
+_tvhlog ( const char *file, int line, int notify, int severity,
+          const char *subsys, const char *fmt, ... )
+{
+}
+
+htsmsg_t *
+hts_settings_load ( const char *pathfmt, ... )
+{
+  FILE *fp;
+  char *buf;
+  long size;
+  htsmsg_t *m = NULL;
+
+  if (!(fp = fopen(pathfmt, "r")))
+    return NULL;
+  fseek(fp, 0, SEEK_END);
+  size = ftell(fp);
+  fseek(fp, 0, SEEK_SET);
+  buf = malloc(size + 1);
+  if (fread(buf, 1, size, fp) == size) {
+    buf[size] = '\0';
+    m = htsmsg_json_deserialize(buf);
+  }
+  free(buf);
+  fclose(fp);
+  return m;
+}
+
+static double
+now ( void )
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* ************************************************************************
+ * Reference decoders (bit at a time)
+ * ***********************************************************************/
+
+static char *
+ref_huffman_decode
+  ( huffman_node_t *tree, const uint8_t *data, size_t len, uint8_t mask,
+    char *outb, int outl )
+{
+  char           *ret  = outb;
+  huffman_node_t *node = tree;
+  if (!len) return NULL;
+
+  outl--; // leave space for NULL
+  while (len) {
+    len--;
+    while (mask) {
+      if (*data & mask) {
+        node = node->b1;
+      } else {
+        node = node->b0;
+      }
+      mask >>= 1;
+      if (!node) goto end;
+      if (node->data) {
+        char *t = node->data;
+        while (*t && outl) {
+          *outb = *t;
+          outb++; t++; outl--;
+        }
+        if (!outl) goto end;
+        node = tree;
+      }
+    }
+    mask = 0x80;
+    data++;
+  }
+end:
+  *outb = '\0';
+  return ret;
+}
+
+static size_t
+ref_freesat_decode
+  ( char *dst, size_t *dstlen, const uint8_t *src, size_t srclen )
+{
+  struct fsattab *table;
+  unsigned int *index;
+  unsigned int value, byte, bit, bitShift, indx, j, mask, b;
+  char lastch, nextCh;
+  int found;
+  size_t p = 0;
+
+  if (src[0] != 0x1f) return -1;
+  if (src[1] != 1 && src[1] != 2) return -1;
+
+  table = src[1] == 1 ? fsat_table_1 : fsat_table_2;
+  index = src[1] == 1 ? fsat_index_1 : fsat_index_2;
+  value = 0;
+  byte  = 2;
+  bit   = 0;
+  while (byte < 6 && byte < srclen) {
+    value |= src[byte] << ((5 - byte) * 8);
+    byte++;
+  }
+  lastch = START;
+
+  do {
+    found    = 0;
+    bitShift = 0;
+    nextCh   = STOP;
+    if (lastch == ESCAPE) {
+      found    = 1;
+      nextCh   = (value >> 24) & 0xff;
+      bitShift = 8;
+      if ((nextCh & 0x80) == 0) {
+        if (nextCh < ' ')
+          nextCh = STOP;
+        lastch = nextCh;
+      }
+    } else {
+      indx = (unsigned int)lastch;
+      for (j = index[indx]; j < index[indx + 1]; j++) {
+        mask = table[j].bits ? 0xffffffffu << (32 - table[j].bits) : 0;
+        if ((value & mask) == table[j].value) {
+          nextCh   = table[j].next;
+          bitShift = table[j].bits;
+          found    = 1;
+          lastch   = nextCh;
+          break;
+        }
+      }
+    }
+    if (!found)
+      return -1;
+    if (nextCh != STOP && nextCh != ESCAPE) {
+      if (p >= *dstlen) return 0;
+      dst[p++] = nextCh;
+    }
+    for (b = 0; b < bitShift; b++) {
+      value <<= 1;
+      if (byte < srclen)
+        value |= (src[byte] >> (7 - bit)) & 1;
+      if (bit == 7) {
+        bit = 0;
+        byte++;
+      } else
+        bit++;
+    }
+  } while (lastch != STOP && byte < srclen + 4);
+
+  dst[p] = '\0';
+  *dstlen = p;
+  return 0;
+}
+
+/* ************************************************************************
+ * Encoders for test input
+ * ***********************************************************************/
+
+static uint8_t enc_buf[1024];
+static int     enc_pos;
+
+static void
+put_bits ( uint32_t v, int bits )
+{
+  int i;
+  for (i = 0; i < bits; i++, enc_pos++)
+    if (v & (0x80000000u >> i))
+      enc_buf[enc_pos >> 3] |= 0x80 >> (enc_pos & 7);
+}
+
+static int
+fsat_emit ( struct fsattab *t, unsigned *ix, int ctx, int ch )
+{
+  unsigned j;
+  for (j = ix[ctx]; j < ix[ctx + 1]; j++)
+    if (t[j].next == ch) {
+      put_bits(t[j].value, t[j].bits);
+      return 1;
+    }
+  return 0;
+}
+
+static int
+fsat_encode ( int tab, const char *s )
+{
+  struct fsattab *t = tab == 1 ? fsat_table_1 : fsat_table_2;
+  unsigned *ix = tab == 1 ? fsat_index_1 : fsat_index_2;
+  int ch, ctx = 0;
+
+  memset(enc_buf, 0, sizeof(enc_buf));
+  enc_buf[0] = 0x1f;
+  enc_buf[1] = tab;
+  enc_pos = 16;
+  for ( ; *s; s++) {
+    ch = (uint8_t)*s;
+    if (ch < 128 && fsat_emit(t, ix, ctx, ch)) {
+      ctx = ch;
+      continue;
+    }
+    /* Escape, raw bytes until the first ASCII character */
+    if (!fsat_emit(t, ix, ctx, ESCAPE)) return -1;
+    put_bits((uint32_t)ch << 24, 8);
+    if (ch >= 128) {
+      ch = (uint8_t)*++s;
+      if (!ch) {
+        put_bits(0, 8);
+        return (enc_pos + 7) / 8;
+      }
+      if (ch >= 128) return -1;
+      put_bits((uint32_t)ch << 24, 8);
+    }
+    ctx = ch;
+  }
+  if (!fsat_emit(t, ix, ctx, STOP)) return -1;
+  return (enc_pos + 7) / 8;
+}
+
+/* ************************************************************************
+ * OpenTV
+ * ***********************************************************************/
+
+#define KEEP 512
+
+static int
+test_opentv ( const char *path )
+{
+  static const uint8_t masks[] = {
+    0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01, 0x30, 0x00, 0x20, 0x20
+  };
+  static uint8_t keep[KEEP][300];
+  static int keepl[KEEP];
+  htsmsg_t *m;
+  htsmsg_field_t *f;
+  huffman_node_t *tree;
+  const char **codes = NULL, *s;
+  char o1[1024], o2[1024];
+  uint8_t b[300], mask;
+  int i, it, len, pos, outl, ncodes = 0, bad = 0;
+  long bytes = 0;
+  double t0, t1, t2;
+  char *r1, *r2;
+
+  if (!(m = hts_settings_load(path)) || !(tree = huffman_tree_build(m))) {
+    printf("%s: failed to load\n", path);
+    return 1;
+  }
+  HTSMSG_FOREACH(f, m) {
+    htsmsg_t *e = htsmsg_field_get_map(f);
+    if (e && (s = htsmsg_get_str(e, "code"))) {
+      codes = realloc(codes, (ncodes + 1) * sizeof(char *));
+      codes[ncodes++] = s;
+    }
+  }
+
+  srand(1);
+  for (it = 0; it < 200000; it++) {
+    memset(b, 0, sizeof(b));
+    mask = masks[rand() % 12];
+    len  = 1 + rand() % 200;
+    if (rand() % 4 == 0) {
+      for (i = 0; i < len; i++)
+        b[i] = rand();
+    } else {
+      /* Valid codes, starting at the mask bit, optionally damaged */
+      pos = mask ? 7 - __builtin_ctz(mask) : 8;
+      if (mask & (mask - 1)) pos = 2;
+      while (pos < len * 8)
+        for (s = codes[rand() % ncodes]; *s && pos < len * 8; s++, pos++)
+          if (*s == '1')
+            b[pos >> 3] |= 0x80 >> (pos & 7);
+      if (rand() % 3 == 0)
+        b[rand() % len] ^= 1 << (rand() % 8);
+    }
+    outl = (rand() % 5 == 0) ? 1 + rand() % 20 : 2 * len;
+    memset(o1, 'x', sizeof(o1));
+    memset(o2, 'x', sizeof(o2));
+    r1 = huffman_decode(tree, b, len, mask, o1, outl);
+    r2 = ref_huffman_decode(tree, b, len, mask, o2, outl);
+    if ((r1 == NULL) != (r2 == NULL) || memcmp(o1, o2, sizeof(o1))) {
+      if (bad++ < 5)
+        printf("  len %d mask %02x outl %d\n    %s\n    %s\n",
+               len, mask, outl, o1, o2);
+    }
+    if (it < KEEP) {
+      memcpy(keep[it], b, sizeof(b));
+      keepl[it] = len;
+    }
+  }
+  printf("%s: %d cases, %d differ\n", path, it, bad);
+
+  t0 = now();
+  for (it = 0; it < 2000; it++)
+    for (i = 0; i < KEEP; i++) {
+      ref_huffman_decode(tree, keep[i], keepl[i], 0x20, o1, 2 * keepl[i]);
+      bytes += keepl[i];
+    }
+  t1 = now();
+  for (it = 0; it < 2000; it++)
+    for (i = 0; i < KEEP; i++)
+      huffman_decode(tree, keep[i], keepl[i], 0x20, o1, 2 * keepl[i]);
+  t2 = now();
+  printf("  reference %7.1f MB/s, table %7.1f MB/s\n",
+         bytes / (t1 - t0) / 1e6, bytes / (t2 - t1) / 1e6);
+
+  free(codes);
+  huffman_tree_destroy(tree);
+  htsmsg_destroy(m);
+  return bad != 0;
+}
+
+/* ************************************************************************
+ * Freesat
+ * ***********************************************************************/
+
+static int
+test_freesat ( void )
+{
+  static const char *common = "etaoin shrdluETAOINSHRDLU,.'";
+  static uint8_t keep[1024][600];
+  static int keepl[1024];
+  char s[300], o1[1100], o2[1100];
+  uint8_t b[600];
+  size_t dl, d1, d2, r1, r2;
+  int i, it, l, r, len, tab, nkeep = 0, nenc = 0, bad = 0;
+  long bytes = 0;
+  double t0, t1, t2;
+
+  srand(7);
+  for (it = 0; it < 300000; it++) {
+    tab = 1 + rand() % 2;
+    if (rand() % 5 == 0) {
+      len = 2 + rand() % 100;
+      for (i = 0; i < len; i++)
+        b[i] = rand();
+      b[0] = 0x1f;
+      if (rand() % 8) b[1] = tab;
+    } else {
+      l = rand() % 250;
+      for (i = 0; i < l; i++) {
+        r = rand() % 100;
+        s[i] = r < 70 ? common[rand() % 28] :
+               r < 95 ? 32 + rand() % 95 : 0x80 + rand() % 128;
+      }
+      s[l] = '\0';
+      if ((len = fsat_encode(tab, s)) < 0)
+        continue;
+      memcpy(b, enc_buf, len);
+      nenc++;
+      /* Truncate or damage some */
+      r = rand() % 10;
+      if (r == 0 && len > 3)
+        len = 2 + rand() % (len - 2);
+      else if (r == 1)
+        b[2 + rand() % (len > 2 ? len - 2 : 1)] ^= 1 << (rand() % 8);
+    }
+    dl = (rand() % 6 == 0) ? rand() % 30 : 1000;
+    d1 = d2 = dl;
+    memset(o1, 'x', sizeof(o1));
+    memset(o2, 'x', sizeof(o2));
+    r1 = freesat_huffman_decode(o1, &d1, b, len);
+    r2 = ref_freesat_decode(o2, &d2, b, len);
+    if (r1 != r2 || d1 != d2 || memcmp(o1, o2, sizeof(o1))) {
+      if (bad++ < 5)
+        printf("  len %d ret %zd/%zd dstlen %zu/%zu\n", len, r1, r2, d1, d2);
+    }
+    if (nkeep < 1024 && len > 20) {
+      memcpy(keep[nkeep], b, len);
+      keepl[nkeep++] = len;
+    }
+  }
+  printf("freesat: %d cases (%d encoded), %d differ\n", it, nenc, bad);
+
+  t0 = now();
+  for (it = 0; it < 200; it++)
+    for (i = 0; i < nkeep; i++) {
+      dl = 1000;
+      ref_freesat_decode(o1, &dl, keep[i], keepl[i]);
+      bytes += keepl[i];
+    }
+  t1 = now();
+  for (it = 0; it < 200; it++)
+    for (i = 0; i < nkeep; i++) {
+      dl = 1000;
+      freesat_huffman_decode(o1, &dl, keep[i], keepl[i]);
+    }
+  t2 = now();
+  printf("  reference %7.1f MB/s, table %7.1f MB/s\n",
+         bytes / (t1 - t0) / 1e6, bytes / (t2 - t1) / 1e6);
+
+  return bad != 0;
+}
+
+int
+main ( int argc, char **argv )
+{
+  static const char *dicts[] = {
+    "data/conf/epggrab/opentv/dict/skyeng",
+    "data/conf/epggrab/opentv/dict/skyit",
+  };
+  int i, bad = 0;
+
+  if (argc > 1) {
+    for (i = 1; i < argc; i++)
+      bad |= test_opentv(argv[i]);
+  } else {
+    for (i = 0; i < sizeof(dicts) / sizeof(dicts[0]); i++)
+      bad |= test_opentv(dicts[i]);
+  }
+  bad |= test_freesat();
+  return bad;
+}